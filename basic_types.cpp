@@ -52,7 +52,8 @@ std::vector<Instruction *> Instruction::pred() const {
 }
 
 uint32_t Instruction::blockId() const {
-    return list->block->blockId;
+    // Hoisted instructions aren't in any block.
+    return list == nullptr ? NO_BLOCK_ID : list->block->blockId;
 }
 
 std::string Instruction::pos() const {
@@ -111,17 +112,23 @@ void Instruction::dump(std::ostream &out) const {
     for (auto succ : succ()) {
         out << " " << succ->pos();
     }
-    out << ", livein";
-    for (auto &[label,liveinSet] : livein) {
-        out << " " << label << "(";
-        for (auto regId : liveinSet) {
+
+    // Liveness is only known once it's been computed for the function.
+    const Function *function = list == nullptr ? nullptr : list->block->function;
+    if (function != nullptr &&
+            function->blockLiveOut.find(list->block->blockId) != function->blockLiveOut.end()) {
+
+        BitVector liveIn;
+        BitVector liveOut;
+        function->instructionLiveness(this, liveIn, liveOut);
+        out << ", livein";
+        for (auto regId : function->liveRegisters(liveIn)) {
+            out << " " << regId;
+        }
+        out << ", liveout";
+        for (auto regId : function->liveRegisters(liveOut)) {
             out << " " << regId;
         }
-        out << ")";
-    }
-    out << ", liveout";
-    for (auto regId : liveout) {
-        out << " " << regId;
     }
 
     out << ")\n";
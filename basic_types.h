@@ -549,7 +549,7 @@ struct RiscVPhi;
 // Base class for individual instructions.
 struct Instruction {
     Instruction(const LineInfo& lineInfo)
-        : list(nullptr), lineInfo(lineInfo), needLiveness(false) {
+        : list(nullptr), lineInfo(lineInfo) {
 
         // Nothing.
     }
@@ -580,16 +580,6 @@ struct Instruction {
     // Label IDs we might branch to.
     std::set<uint32_t> targetLabelIds;
 
-    // Registers that are live going into this instruction. The key is
-    // the block it's coming from, or 0 to mean "any".
-    std::map<uint32_t,std::set<uint32_t>> livein;
-
-    // Registers that are live leaving this instruction.
-    std::set<uint32_t> liveout;
-
-    // Whether we need to recompute liveness for this instruction.
-    bool needLiveness;
-
     // Step the interpreter forward one instruction.
     virtual void step(Interpreter *interpreter) = 0;
 
@@ -602,6 +592,9 @@ struct Instruction {
     // The name of this instruction (e.g., "OpFMul").
     virtual std::string name() const = 0;
 
+    // Make a copy of this instruction that isn't in any list.
+    virtual std::shared_ptr<Instruction> clone() const = 0;
+
     // Whether this is a branch instruction (OpBranch, OpBranchConditional,
     // OpSwitch, OpReturn, or OpReturnValue).
     virtual bool isBranch() const { return false; }
@@ -610,7 +603,7 @@ struct Instruction {
     // OpUnreachable).
     virtual bool isTermination() const { return false; }
 
-    // Which block this instruction is in.
+    // Which block this instruction is in, or NO_BLOCK_ID if it isn't in one.
     uint32_t blockId() const;
 
     // Add a result to the instruction.
@@ -660,6 +653,17 @@ struct Instruction {
 
     // Dump a rough disassembly to stdout.
     void dump(std::ostream &out) const;
+
+protected:
+    // Implementation of clone() for subclass T.
+    template <class T>
+    std::shared_ptr<Instruction> cloneAs() const {
+        std::shared_ptr<T> copy = std::make_shared<T>(*dynamic_cast<const T *>(this));
+        copy->list = nullptr;
+        copy->next.reset();
+        copy->prev.reset();
+        return copy;
+    }
 };
 
 // A doubly-linked list of Instruction objects.
@@ -820,6 +824,13 @@ struct Block {
     // ID of label that points to first instruction.
     uint32_t blockId;
 
+    // Name of the block in a block profile. Unlike the block ID, it's the
+    // same from one compile of the shader to the next even when the profile
+    // changes what gets inlined or unrolled: it's the SPIR-V block that this
+    // was copied from, then a suffix for each copy. See Program::inlineCall()
+    // and Program::unrollLoop().
+    std::string profileKey;
+
     // Predecessor blocks. This is only empty for the first block in each function.
     std::set<uint32_t> pred;
 
@@ -0,0 +1,78 @@
+#ifndef BITVECTOR_H
+#define BITVECTOR_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Dense set of small non-negative integers, for dataflow analysis.
+class BitVector {
+    std::vector<uint64_t> m_words;
+
+public:
+    BitVector() {
+        // Nothing.
+    }
+
+    // Make an empty set that can hold values up to size - 1.
+    explicit BitVector(size_t size)
+        : m_words((size + 63)/64, 0) {
+
+        // Nothing.
+    }
+
+    void set(size_t i) {
+        m_words[i/64] |= uint64_t(1) << (i%64);
+    }
+
+    void reset(size_t i) {
+        m_words[i/64] &= ~(uint64_t(1) << (i%64));
+    }
+
+    bool test(size_t i) const {
+        return (m_words[i/64] & (uint64_t(1) << (i%64))) != 0;
+    }
+
+    // Add all elements of the other set. Returns whether we changed.
+    bool unionWith(const BitVector &other) {
+        bool changed = false;
+
+        for (size_t i = 0; i < m_words.size(); i++) {
+            uint64_t word = m_words[i] | other.m_words[i];
+            changed = changed || word != m_words[i];
+            m_words[i] = word;
+        }
+
+        return changed;
+    }
+
+    // Remove all elements of the other set.
+    void subtract(const BitVector &other) {
+        for (size_t i = 0; i < m_words.size(); i++) {
+            m_words[i] &= ~other.m_words[i];
+        }
+    }
+
+    bool operator==(const BitVector &other) const {
+        return m_words == other.m_words;
+    }
+
+    bool operator!=(const BitVector &other) const {
+        return m_words != other.m_words;
+    }
+
+    // Call the function with each element, in increasing order.
+    template <class F>
+    void forEach(F f) const {
+        for (size_t i = 0; i < m_words.size(); i++) {
+            uint64_t word = m_words[i];
+            while (word != 0) {
+                int bit = __builtin_ctzll(word);
+                f(i*64 + bit);
+                word &= word - 1;
+            }
+        }
+    }
+};
+
+#endif // BITVECTOR_H
@@ -1,12 +1,95 @@
 
+#include <functional>
 #include <iomanip>
 #include <sstream>
+#include <sys/stat.h>
 
 #include "compiler.h"
+#include "assembler.h"
 #include "risc-v.h"
 #include "pcopy.h"
 #include "function.h"
 
+// Whether the physical register is one of the argument registers (a0-a7 or
+// fa0-fa7) that library routines are allowed to clobber.
+static bool isArgumentRegister(uint32_t phy) {
+    return (phy >= 10 && phy <= 17) || (phy >= 32 + 10 && phy <= 32 + 17);
+}
+
+// We can't know how big the code between a forward branch and its target
+// will be until we emit it. This is more than any single instruction
+// expands to, not counting phi copies.
+static const int MAX_EMITTED_PER_INSTRUCTION = 16;
+
+// Float register that's never allocated, so that emitParallelCopy() can
+// swap two float registers through it.
+static const uint32_t FLOAT_SWAP_REGISTER = 31;
+
+// Class of the emitted instruction, for the compile report.
+static std::string instructionClass(const std::string &op) {
+    std::string mnemonic = op.substr(0, op.find(' '));
+
+    if (mnemonic == "lw" || mnemonic == "lh" || mnemonic == "lhu" ||
+            mnemonic == "lb" || mnemonic == "lbu" || mnemonic == "flw") {
+
+        return "load";
+    }
+    if (mnemonic == "sw" || mnemonic == "sh" || mnemonic == "sb" || mnemonic == "fsw") {
+        return "store";
+    }
+    if (mnemonic == "jal") {
+        return op.compare(0, 7, "jal ra,") == 0 ? "call" : "jump";
+    }
+    if (mnemonic == "jalr") {
+        return "jump";
+    }
+    if (mnemonic[0] == 'b') {
+        return "branch";
+    }
+    if (mnemonic[0] == 'f') {
+        return "float";
+    }
+    return "integer";
+}
+
+// Whether the output pathname is for an object file rather than assembly text.
+static bool isObjectPathname(const std::string &pathname) {
+    return pathname.size() >= 2 && pathname.compare(pathname.size() - 2, 2, ".o") == 0;
+}
+
+// Library routines that every shader is linked with. "as -r" assembles them
+// into the second file (see the Makefile) so they're not assembled per shader.
+static const char *LIBRARY_PATHNAME = "library.s";
+static const char *RELOCATABLE_LIBRARY_PATHNAME = "library.ro";
+
+// Get the library ready to link. Uses the assembled library if it's at
+// least as new as the source, otherwise assembles the source.
+static void loadLibrary(Assembler &library) {
+    struct stat sourceStat, relocatableStat;
+    if (stat(RELOCATABLE_LIBRARY_PATHNAME, &relocatableStat) == 0 &&
+            stat(LIBRARY_PATHNAME, &sourceStat) == 0 &&
+            relocatableStat.st_mtime >= sourceStat.st_mtime &&
+            library.loadRelocatable(RELOCATABLE_LIBRARY_PATHNAME)) {
+
+        return;
+    }
+
+    library = Assembler();
+    library.makeRelocatable();
+    library.load(LIBRARY_PATHNAME);
+    library.assemble();
+}
+
+// Write the whole string to the file, failing the program if we can't.
+static void writeTextFile(const std::string &pathname, const std::string &text) {
+    std::ofstream file(pathname, std::ios::out);
+    if (!file.good()) {
+        std::cerr << "Can't open file \"" << pathname << "\".\n";
+        exit(EXIT_FAILURE);
+    }
+    file << text;
+}
+
 void Compiler::compile() {
 #if 0
     // XXX disable this because the code is broken. This is done after liveness
@@ -28,8 +111,13 @@ void Compiler::compile() {
     // Perform physical register assignment.
     assignRegisters();
 
-    // Emit our header.
-    outFile << ".segment text\n";
+    // Find which constants can share a word in the constant pool.
+    computeConstantPool();
+
+    // Emit our header. The first label names the shader, so that a block
+    // profile of this code can be checked against it.
+    out << ".segment text\n";
+    emitLabel(pgm->profileShaderLabel());
     std::ostringstream ss;
 
     ss << "lui sp, %hi(" << RiscVInitialStackPointer << ")";
@@ -40,6 +128,19 @@ void Compiler::compile() {
         emit(ss.str(), "");
     }
 
+    if (pgm->uniformPrologueFunctionId != NO_FUNCTION) {
+        // The data segment persists across calls for the whole frame, so only
+        // compute the uniform expressions the first time through.
+        std::string doneLabel = makeLocalLabel();
+        emit("lw x5, .uniformPrologueDone(x0)", "");
+        emit("bne x5, x0, " + doneLabel, "already computed this frame");
+        emit("jal ra, " + pgm->functions.at(pgm->uniformPrologueFunctionId)->cleanName,
+                "compute uniform expressions");
+        emit("addi x5, x0, 1", "");
+        emit("sw x5, .uniformPrologueDone(x0)", "");
+        emitLabel(doneLabel);
+    }
+
     std::string mainName = pgm->functions.at(pgm->mainFunctionId)->cleanName;
     ss.str("");
     ss << "lui a0, %hi(" << mainName << ")";
@@ -55,9 +156,134 @@ void Compiler::compile() {
     emitInstructions();
     emitVariables();
     emitConstants();
-    emitLibrary();
 
-    outFile.close();
+    if (isObjectPathname(outputPathname)) {
+        // Assemble our code ourselves instead of writing text for "as" to
+        // parse, and link it with the already assembled library. Errors
+        // refer to lines of the listing.
+        Assembler library;
+        loadLibrary(library);
+        Assembler assembler;
+        assembler.loadText(out.str(), listingPathname.empty() ? "(compiler output)" : listingPathname);
+        assembler.link(library);
+        assembler.assemble();
+        assembler.save(outputPathname);
+
+        if (!listingPathname.empty()) {
+            writeTextFile(listingPathname, out.str());
+        }
+    } else {
+        emitLibrary();
+        writeTextFile(outputPathname, out.str());
+    }
+}
+
+void Compiler::printReport(double clockMhz, int coreCount, int width, int height) const {
+    bool haveProfile = pgm->maxBlockCount > 0;
+
+    // Each pixel runs the main function once.
+    const Function *mainFunction = pgm->functions.at(pgm->mainFunctionId).get();
+    uint64_t pixelCount = haveProfile ?
+        pgm->blockCount(mainFunction->blocks.at(mainFunction->startBlockId).get()) : 1;
+    if (pixelCount == 0) {
+        std::cerr << "Error: Profile never ran the main function.\n";
+        exit(EXIT_FAILURE);
+    }
+
+    double cyclesPerPixel = 0;
+    double cyclesPerFrame = 0;
+    std::cout << "Compile report:\n";
+    for (auto &[_, function] : pgm->functions) {
+        bool isPrologue = function->id == pgm->uniformPrologueFunctionId;
+        std::cout << "    Function " << function->cleanName
+            << (isPrologue ? " (once per frame)" : "") << ":\n";
+
+        BlockStats total;
+        double functionCycles = 0;
+        for (auto &[blockId, block] : function->blocks) {
+            auto itr = blockStats.find(blockId);
+            if (itr == blockStats.end()) {
+                continue;
+            }
+            const BlockStats &stats = itr->second;
+
+            // How many times the block runs per pixel, or per frame for the
+            // prologue.
+            double runs = haveProfile ?
+                double(pgm->blockCount(block.get()))/(isPrologue ? 1 : pixelCount) : 1;
+            functionCycles += runs*stats.cycles;
+
+            std::ostringstream ss;
+            int instructions = 0;
+            for (auto &[className, count] : stats.classCounts) {
+                instructions += count;
+                ss << " " << className << " " << count;
+                total.classCounts[className] += count;
+            }
+            std::cout << "        block" << blockId << ": " << instructions << " instructions";
+            if (instructions > 0) {
+                std::cout << " (" << ss.str().substr(1) << ")";
+            }
+            if (stats.spillCount > 0 || stats.reloadCount > 0) {
+                std::cout << ", " << stats.spillCount << " spills, "
+                    << stats.reloadCount << " reloads";
+            }
+            for (auto &[routine, count] : stats.callCounts) {
+                std::cout << ", " << count << " x " << routine;
+                total.callCounts[routine] += count;
+            }
+            std::cout << ", " << stats.cycles << " cycles";
+            if (haveProfile) {
+                std::cout << ", run " << runs << (isPrologue ? " times" : " times per pixel");
+            }
+            std::cout << "\n";
+
+            total.spillCount += stats.spillCount;
+            total.reloadCount += stats.reloadCount;
+        }
+
+        int instructions = 0;
+        int calls = 0;
+        std::cout << "        Total:";
+        for (auto &[className, count] : total.classCounts) {
+            instructions += count;
+            std::cout << " " << className << " " << count;
+        }
+        for (auto &[routine, count] : total.callCounts) {
+            calls += count;
+        }
+        std::cout << "\n        " << instructions << " instructions, "
+            << total.spillCount << " spills, " << total.reloadCount << " reloads, "
+            << calls << " library calls, " << functionCycles
+            << (isPrologue ? " cycles per frame" : " cycles per pixel") << ".\n";
+
+        if (isPrologue) {
+            cyclesPerFrame += functionCycles;
+        } else {
+            cyclesPerPixel += functionCycles;
+        }
+    }
+
+    std::cout << "    Coalesced " << coalescedCopyCount << " of " << copyCount
+        << " register copies.\n";
+    std::cout << "    Scheduling changed estimated cycles from " << pgm->unscheduledCycles
+        << " to " << pgm->scheduledCycles << ".\n";
+    std::cout << "    Built " << immediateConstantCount << " of " << constantLoadCount
+        << " constant loads from immediates, " << usedPoolIds.size()
+        << " constant pool words used.\n";
+    std::cout << "    Block layout removed " << removedJumpCount << " jumps.\n";
+    std::cout << "    Skipped " << pgm->skippedComponentCount
+        << " vector component" << (pgm->skippedComponentCount == 1 ? "" : "s")
+        << " that were never used.\n";
+
+    if (!haveProfile) {
+        std::cout << "No profile, so assuming every block runs once per pixel.\n";
+    }
+    cyclesPerFrame += cyclesPerPixel*width*height;
+    std::cout << cyclesPerPixel << " cycles per pixel estimated, "
+        << cyclesPerFrame << " cycles per " << width << "x" << height << " frame.\n";
+    std::cout << clockMhz*1000000*coreCount/cyclesPerFrame << " fps estimated at "
+        << clockMhz << " MHz on " << coreCount << (coreCount == 1 ? " core" : " cores") << ".\n";
 }
 
 void Compiler::emitInstructions() {
@@ -67,28 +293,48 @@ void Compiler::emitInstructions() {
 }
 
 void Compiler::emitInstructionsForFunction(Function *function) {
-    outFile << "; ---------------------------- function \"" << function->cleanName << "\"\n";
-    outFile << ".segment text\n";
+    out << "; ---------------------------- function \"" << function->cleanName << "\"\n";
+    out << ".segment text\n";
     emitLabel(function->cleanName);
 
-    // Emit instructions to fill constants.
-    for (auto regId : function->blocks.at(function->startBlockId)->instructions.head->livein.at(0)) {
-        auto r = registers.find(regId);
-        assert(r != registers.end());
-        assert(r->second.phy != NO_REGISTER);
-        std::ostringstream ss;
-        if (isRegFloat(regId)) {
-            ss << "flw f" << (r->second.phy - 32);
-        } else {
-            ss << "lw x" << r->second.phy;
+    // Count the function's entry code with its first block.
+    currentBlockStats = &blockStats[function->startBlockId];
+
+    // Library calls overwrite ra, so save it once for the whole function.
+    saveReturnAddress = false;
+    for (auto &[_, block] : function->blocks) {
+        for (auto inst = block->instructions.head; inst; inst = inst->next) {
+            if (isLibraryCall(inst->opcode())) {
+                saveReturnAddress = true;
+            }
         }
-        ss << ", .C" << regId << "(x0)";
+    }
+    if (saveReturnAddress) {
+        emit("addi sp, sp, -4", "Make room on stack");
+        emit("sw ra, 0(sp)", "Save return address");
+    }
 
+    // Emit instructions to fill constants. Nothing else is live yet, so
+    // any integer register the constants don't use is free for building
+    // float values.
+    std::set<uint32_t> constIds =
+        function->liveRegisters(function->blockLiveIn.at(function->startBlockId));
+    std::set<uint32_t> constPhys;
+    for (auto regId : constIds) {
+        constPhys.insert(physicalRegisterFor(regId, true));
+    }
+    uint32_t scratchPhy = NO_REGISTER;
+    for (uint32_t phy = 3; phy < 32 && scratchPhy == NO_REGISTER; phy++) {
+        if (constPhys.find(phy) == constPhys.end()) {
+            scratchPhy = phy;
+        }
+    }
+    for (auto regId : constIds) {
         // Build comment with constant value.
         std::ostringstream ssc;
         ssc << "Load constant (";
         Register const &pr = pgm->constants.at(regId);
-        uint32_t typeOp = pgm->getTypeOp(r->second.type);
+        uint32_t typeOp = pgm->getTypeOp(pr.type);
         switch (typeOp) {
             case SpvOpTypeInt:
                 ssc << *reinterpret_cast<uint32_t *>(pr.data);
@@ -108,27 +354,169 @@ void Compiler::emitInstructionsForFunction(Function *function) {
                 break;
 
             default:
-                ssc << "unknown type " << r->second.type << ", op " << typeOp;
+                ssc << "unknown type " << pr.type << ", op " << typeOp;
         }
         ssc << ")";
 
-        emit(ss.str(), ssc.str());
+        emitLoadConstant(physicalRegisterFor(regId, true), regId, scratchPhy, ssc.str());
     }
 
-    // Start with start block.
-    emitInstructionsForBlockTree(function->blocks.at(function->startBlockId).get());
+    // Emit the blocks in an order that lets branches fall through. Also
+    // estimate where each block starts, for the range of forward branches.
+    std::vector<Block *> layout = computeBlockLayout(function);
+    blockLayoutStarts.clear();
+    int estimate = 0;
+    for (Block *block : layout) {
+        blockLayoutStarts[block->blockId] = estimate;
+        for (auto inst = block->instructions.head; inst; inst = inst->next) {
+            estimate += MAX_EMITTED_PER_INSTRUCTION;
+            // Each phi copy is at worst a three-instruction swap.
+            for (uint32_t labelId : inst->targetLabelIds) {
+                Instruction *head = function->blocks.at(labelId)->instructions.head.get();
+                if (head->opcode() == RiscVOpPhi) {
+                    estimate += 3*head->resIdList.size();
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < layout.size(); i++) {
+        fallThroughBlockId = i + 1 < layout.size() ? layout[i + 1]->blockId : NO_BLOCK_ID;
+        emitInstructionsForBlock(layout[i]);
+    }
+    currentBlockStats = nullptr;
 }
 
-void Compiler::emitInstructionsForBlockTree(Block *block) {
-    // Do block.
-    emitInstructionsForBlock(block);
+std::vector<Block *> Compiler::computeBlockLayout(const Function *function) const {
+    Block *startBlock = function->blocks.at(function->startBlockId).get();
+
+    // Pre-order walk of the dominator tree, the order we used to emit in.
+    // We fall back to this when no successor is a good next block.
+    std::vector<Block *> treeOrder;
+    std::vector<Block *> stack {startBlock};
+    while (!stack.empty()) {
+        Block *block = stack.back();
+        stack.pop_back();
+        treeOrder.push_back(block);
+        for (auto itr = block->idomChildren.rbegin(); itr != block->idomChildren.rend(); ++itr) {
+            stack.push_back(itr->get());
+        }
+    }
 
-    // Descend down idom tree. We could be more clever about this, maybe looking for
-    // block that only have one successor, and trying to put those back-to-back
-    // to avoid needless jumps.
-    for (auto subBlock : block->idomChildren) {
-        emitInstructionsForBlockTree(subBlock.get());
+    // Successors in the order we'd like them, and predecessors.
+    std::map<uint32_t, std::vector<uint32_t>> succ;
+    std::map<uint32_t, std::vector<uint32_t>> pred;
+    for (Block *block : treeOrder) {
+        Instruction *tail = block->instructions.tail.get();
+        std::vector<uint32_t> &targets = succ[block->blockId];
+        InsnBranchConditional *branch = dynamic_cast<InsnBranchConditional *>(tail);
+        if (branch != nullptr) {
+            // Put the heavier side first if the source gave branch weights.
+            bool falseFirst = branch->branchweightsId.size() == 2 &&
+                branch->branchweightsId[1] > branch->branchweightsId[0];
+            targets.push_back(falseFirst ? branch->falseLabelId : branch->trueLabelId);
+            targets.push_back(falseFirst ? branch->trueLabelId : branch->falseLabelId);
+        } else {
+            targets.assign(tail->targetLabelIds.begin(), tail->targetLabelIds.end());
+        }
+        for (uint32_t targetId : targets) {
+            pred[targetId].push_back(block->blockId);
+        }
+    }
+
+    // Find the back edges with a depth-first search.
+    std::set<std::pair<uint32_t, uint32_t>> backEdges;
+    std::set<uint32_t> visited;
+    std::set<uint32_t> onStack;
+    std::function<void(uint32_t)> visit = [&](uint32_t blockId) {
+        visited.insert(blockId);
+        onStack.insert(blockId);
+        for (uint32_t targetId : succ[blockId]) {
+            if (onStack.find(targetId) != onStack.end()) {
+                backEdges.insert(std::make_pair(blockId, targetId));
+            } else if (visited.find(targetId) == visited.end()) {
+                visit(targetId);
+            }
+        }
+        onStack.erase(blockId);
+    };
+    visit(startBlock->blockId);
+
+    // Each loop is its header plus everything that gets to one of its back
+    // edges without going through the header. The loop depth of a block is
+    // the number of loops it's in.
+    std::map<uint32_t, std::set<uint32_t>> loops;
+    for (auto [sourceId, headerId] : backEdges) {
+        std::set<uint32_t> &loop = loops[headerId];
+        loop.insert(headerId);
+        std::vector<uint32_t> worklist {sourceId};
+        while (!worklist.empty()) {
+            uint32_t blockId = worklist.back();
+            worklist.pop_back();
+            if (loop.insert(blockId).second) {
+                worklist.insert(worklist.end(), pred[blockId].begin(), pred[blockId].end());
+            }
+        }
+    }
+    std::map<uint32_t, int> loopDepth;
+    for (auto &[_, loop] : loops) {
+        for (uint32_t blockId : loop) {
+            loopDepth[blockId]++;
+        }
     }
+
+    // Grow a chain from the start block, each time following the successor
+    // that ran most often or stays in the deepest loop, as long as all of
+    // its predecessors (other than through back edges) are already placed.
+    std::set<uint32_t> placed;
+    auto isReady = [&placed, &pred, &backEdges](uint32_t blockId) {
+        for (uint32_t predId : pred[blockId]) {
+            if (placed.find(predId) == placed.end() &&
+                    backEdges.find(std::make_pair(predId, blockId)) == backEdges.end()) {
+
+                return false;
+            }
+        }
+        return true;
+    };
+
+    std::vector<Block *> layout;
+    Block *block = startBlock;
+    while (block != nullptr) {
+        layout.push_back(block);
+        placed.insert(block->blockId);
+
+        // The profile, if we have one, knows best which way we usually go.
+        Block *next = nullptr;
+        std::pair<uint64_t, int> nextScore;
+        for (uint32_t targetId : succ[block->blockId]) {
+            std::pair<uint64_t, int> score(pgm->blockCount(function->blocks.at(targetId).get()),
+                    loopDepth[targetId]);
+            if (placed.find(targetId) == placed.end() && isReady(targetId) &&
+                    (next == nullptr || score > nextScore)) {
+
+                next = function->blocks.at(targetId).get();
+                nextScore = score;
+            }
+        }
+
+        // Otherwise start a new chain, preferring a block that's ready.
+        for (Block *treeBlock : treeOrder) {
+            if (next == nullptr && placed.find(treeBlock->blockId) == placed.end() &&
+                    isReady(treeBlock->blockId)) {
+
+                next = treeBlock;
+            }
+        }
+        for (Block *treeBlock : treeOrder) {
+            if (next == nullptr && placed.find(treeBlock->blockId) == placed.end()) {
+                next = treeBlock;
+            }
+        }
+
+        block = next;
+    }
+
+    return layout;
 }
 
 void Compiler::emitInstructionsForBlock(Block *block) {
@@ -136,15 +524,30 @@ void Compiler::emitInstructionsForBlock(Block *block) {
     std::ostringstream ss;
     ss << "block" << block->blockId;
     emitLabel(ss.str());
+    emitLabel(Program::profileLabel(block));
+    blockAddresses[block->blockId] = instructionCount;
+    currentBlockStats = &blockStats[block->blockId];
+    emitLiveOut = block->function->instructionLiveOut(block);
+    emitIndex = 0;
+
+    for (auto inst = block->instructions.head; inst; inst = inst->next, emitIndex++) {
+        // Count what the spiller added.
+        uint32_t opcode = inst->opcode();
+        bool isSpillSlot = !inst->argIdList.empty() &&
+            pgm->spillVariables.find(inst->argIdList[0]) != pgm->spillVariables.end();
+        if (opcode == RiscVOpLoadConst || (opcode == RiscVOpLoad && isSpillSlot)) {
+            currentBlockStats->reloadCount++;
+        } else if (opcode == RiscVOpStore && isSpillSlot) {
+            currentBlockStats->spillCount++;
+        }
 
-    for (auto inst = block->instructions.head; inst; inst = inst->next) {
         inst->emit(this);
     }
 }
 
 void Compiler::emitVariables() {
-    outFile << "; ---------------------------- variables\n";
-    outFile << ".segment data\n";
+    out << "; ---------------------------- variables\n";
+    out << ".segment data\n";
     for (auto &[id, var] : pgm->variables) {
         std::string name = getVariableName(id);
 
@@ -158,28 +561,32 @@ void Compiler::emitVariables() {
             emit(".byte 0", "");
         }
     }
+
+    if (pgm->uniformPrologueFunctionId != NO_FUNCTION) {
+        emitLabel(".uniformPrologueDone");
+        emit(".word 0", "non-zero once uniform prologue has run");
+    }
 }
 
 void Compiler::emitConstants() {
-    outFile << "; ---------------------------- constants\n";
-    outFile << ".segment data\n";
+    out << "; ---------------------------- constants\n";
+    out << ".segment data\n";
     for (auto &[id, reg] : pgm->constants) {
-        std::string name;
-        auto nameItr = pgm->names.find(id);
-        if (nameItr == pgm->names.end()) {
-            std::ostringstream ss;
-            ss << ".C" << id;
-            name = ss.str();
-        } else {
-            name = nameItr->second;
+        // Constants we built from immediates, and ones that share another's
+        // word, don't need their own.
+        if (usedPoolIds.find(id) == usedPoolIds.end()) {
+            continue;
         }
-        emitLabel(name);
+
+        std::ostringstream ss;
+        ss << ".C" << id;
+        emitLabel(ss.str());
         emitConstant(id, reg.type, reg.data);
     }
 }
 
 void Compiler::emitLibrary() {
-    outFile << readFileContents("library.s");
+    out << readFileContents(LIBRARY_PATHNAME);
 }
 
 std::string Compiler::getVariableName(uint32_t id) const {
@@ -256,6 +663,131 @@ bool Compiler::asIntegerConstant(uint32_t id, uint32_t &value) const {
     return false;
 }
 
+bool Compiler::asConstantWord(uint32_t id, uint32_t &word) const {
+    auto r = pgm->constants.find(id);
+    if (r == pgm->constants.end()) {
+        return false;
+    }
+
+    switch (pgm->types.at(r->second.type)->op()) {
+        case SpvOpTypeBool:
+            word = *reinterpret_cast<bool *>(r->second.data) ? 1 : 0;
+            return true;
+
+        case SpvOpTypeInt:
+        case SpvOpTypeFloat:
+            word = *reinterpret_cast<uint32_t *>(r->second.data);
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+void Compiler::computeConstantPool() {
+    // The pool is untyped, so an int and a float with the same bits can
+    // share a word too.
+    std::map<uint32_t, uint32_t> idForWord;
+    for (auto &[id, _] : pgm->constants) {
+        uint32_t word;
+        if (asConstantWord(id, word)) {
+            constantPoolIds[id] = idForWord.emplace(word, id).first->second;
+        }
+    }
+}
+
+void Compiler::emitLoadConstant(uint32_t phy, uint32_t constId, uint32_t scratchPhy,
+        const std::string &comment) {
+
+    constantLoadCount++;
+
+    uint32_t word;
+    if (asConstantWord(constId, word)) {
+        if (phy < 32) {
+            emitLoadImmediate(phy, word, comment);
+            immediateConstantCount++;
+            return;
+        }
+
+        // A float that's just an upper immediate (0.0, 0.5, 1.0, 2.0, ...)
+        // takes two ALU instructions instead of a data memory read.
+        if (word == 0 || ((word & 0xFFF) == 0 && scratchPhy != NO_REGISTER)) {
+            uint32_t srcPhy = 0;
+            if (word != 0) {
+                emitLoadImmediate(scratchPhy, word, comment);
+                srcPhy = scratchPhy;
+            }
+            std::ostringstream ss;
+            ss << "fmv.s.x f" << (phy - 32) << ", x" << srcPhy;
+            emit(ss.str(), word == 0 ? comment : "");
+            immediateConstantCount++;
+            return;
+        }
+    }
+
+    // Load it from the constant pool, using the word it shares with others.
+    uint32_t poolId = constId;
+    auto itr = constantPoolIds.find(constId);
+    if (itr != constantPoolIds.end()) {
+        poolId = itr->second;
+    }
+    usedPoolIds.insert(poolId);
+
+    std::ostringstream ss;
+    if (phy < 32) {
+        ss << "lw x" << phy;
+    } else {
+        ss << "flw f" << (phy - 32);
+    }
+    ss << ", .C" << poolId << "(x0)";
+    emit(ss.str(), comment);
+}
+
+void Compiler::emitLoadImmediate(uint32_t phy, uint32_t value, const std::string &comment) {
+    // Low 12 bits, sign-extended, and the upper 20 bits adjusted for that.
+    int32_t lo = int32_t(value << 20) >> 20;
+    uint32_t hi = ((value - lo) >> 12) & 0xFFFFF;
+
+    std::ostringstream ss;
+    if (hi == 0) {
+        ss << "addi x" << phy << ", x0, " << lo;
+        emit(ss.str(), comment);
+    } else {
+        ss << "lui x" << phy << ", " << hi;
+        emit(ss.str(), comment);
+        if (lo != 0) {
+            ss.str("");
+            ss << "addi x" << phy << ", x" << phy << ", " << lo;
+            emit(ss.str(), "");
+        }
+    }
+}
+
+uint32_t Compiler::findScratchRegister(const Instruction *instruction) const {
+    const Function *function = instruction->list->block->function;
+    assert(emitIndex < emitLiveOut.size());
+    const BitVector &liveOut = emitLiveOut[emitIndex];
+    BitVector liveIn = liveOut;
+    function->stepLivenessBackward(instruction, liveIn);
+
+    std::set<uint32_t> busy;
+    for (uint32_t regId : function->liveRegisters(liveIn)) {
+        busy.insert(physicalRegisterFor(regId));
+    }
+    for (uint32_t regId : function->liveRegisters(liveOut)) {
+        busy.insert(physicalRegisterFor(regId));
+    }
+
+    // x0 is zero, x1 is ra, and x2 is sp.
+    for (uint32_t phy = 3; phy < 32; phy++) {
+        if (busy.find(phy) == busy.end()) {
+            return phy;
+        }
+    }
+
+    return NO_REGISTER;
+}
+
 bool Compiler::isRegFloat(uint32_t id) const {
     auto r = registers.find(id);
     assert(r != registers.end());
@@ -306,27 +838,32 @@ void Compiler::transformInstructions(InstructionList &inList) {
 }
 
 void Compiler::translateOutOfSsa() {
-    // Compute the phi equivalent classes.
-    // Disable this. It's efficient because it maps registers together, but
-    // we need to make sure they don't interfere. See end of that function.
-    /// computePhiClassMap();
+    // Compute the phi equivalent classes. The register allocator uses them
+    // as a preference only, so it doesn't matter if members interfere.
+    computePhiClassMap();
 }
 
 void Compiler::computePhiClassMap() {
-#if 0 // Disabled until we need it.
     phiClassMap.clear();
 
     // Go through all instructions look for phi.
-    for (int pc = 0; pc < instructions.size(); pc++) {
-        Instruction *insn = instructions.at(pc).get();
-        // XXX This is still using the old phi instruction.
-        if (insn->opcode() == SpvOpPhi) {
-            std::shared_ptr<PhiClass> phiClass = std::make_shared<PhiClass>();
-            for (uint32_t regId : insn->resIdSet) {
-                processPhiRegister(regId, phiClass);
+    for (auto &[_, function] : pgm->functions) {
+        for (auto &[_, block] : function->blocks) {
+            Instruction *insn = block->instructions.head.get();
+            if (insn == nullptr || insn->opcode() != RiscVOpPhi) {
+                continue;
             }
-            for (uint32_t regId : insn->argIdSet) {
-                processPhiRegister(regId, phiClass);
+
+            // Each result makes its own class with its operands.
+            RiscVPhi *phi = dynamic_cast<RiscVPhi *>(insn);
+            for (size_t res = 0; res < phi->resultIds.size(); res++) {
+                std::shared_ptr<PhiClass> phiClass = std::make_shared<PhiClass>();
+                processPhiRegister(phi->resultIds[res], phiClass);
+                for (uint32_t regId : phi->operandIds[res]) {
+                    if (!pgm->isConstant(regId)) {
+                        processPhiRegister(regId, phiClass);
+                    }
+                }
             }
         }
     }
@@ -342,11 +879,6 @@ void Compiler::computePhiClassMap() {
         }
         std::cout << "-----------------------\n";
     }
-
-    // We've created all the phi classes. We must make sure that
-    // no pair of registers in a class is ever live at the same time.
-    // XXX to do!
-#endif
 }
 
 void Compiler::processPhiRegister(uint32_t regId, std::shared_ptr<PhiClass> &phiClass) {
@@ -383,10 +915,12 @@ void Compiler::assignRegisters() {
         PHY_INT_REGS.insert(i);
     }
 
-    // 32 float registers.
+    // 32 float registers, less the one for swapping.
     std::set<uint32_t> PHY_FLOAT_REGS;
     for (int i = 0; i < 32; i++) {
-        PHY_FLOAT_REGS.insert(i + 32);
+        if (i != FLOAT_SWAP_REGISTER) {
+            PHY_FLOAT_REGS.insert(i + 32);
+        }
     }
 
     for (auto& [id, function] : pgm->functions) {
@@ -407,10 +941,43 @@ void Compiler::assignRegistersForFunction(const Function *function,
         std::cout << "Assigning registers for function \"" << function->name << "\"\n";
     }
 
+    // Find the virtual registers that must survive a library call.
+    liveAcrossCall.clear();
+    for (auto &[_, b] : function->blocks) {
+        std::vector<BitVector> liveOut;
+        size_t pos = 0;
+        for (auto inst = b->instructions.head; inst; inst = inst->next, pos++) {
+            if (isLibraryCall(inst->opcode())) {
+                if (liveOut.empty()) {
+                    liveOut = function->instructionLiveOut(b.get());
+                }
+                for (uint32_t regId : function->liveRegisters(liveOut[pos])) {
+                    if (inst->resIdSet.find(regId) == inst->resIdSet.end()) {
+                        liveAcrossCall.insert(regId);
+                    }
+                }
+            }
+        }
+    }
+
+    computeRegisterHints(function);
+
+    // Lowest register in the set that can hold the virtual register.
+    auto pickConstantRegister = [this](uint32_t regId, const std::set<uint32_t> &regs) {
+        bool acrossCall = liveAcrossCall.find(regId) != liveAcrossCall.end();
+        for (uint32_t phy : regs) {
+            if (!acrossCall || !isArgumentRegister(phy)) {
+                return phy;
+            }
+        }
+        std::cerr << "Error: No physical register available for constant " << regId << ".\n";
+        exit(EXIT_FAILURE);
+    };
+
     // Assign registers for constants.
     std::set<uint32_t> constIntRegs = allIntPhy;
     std::set<uint32_t> constFloatRegs = allFloatPhy;
-    for (auto regId : block->instructions.head->livein.at(0)) {
+    for (auto regId : function->liveRegisters(function->blockLiveIn.at(block->blockId))) {
         if (registers.find(regId) != registers.end()) {
             std::cerr << "Error: Constant "
                 << regId << " already assigned a register at head of function.\n";
@@ -420,8 +987,7 @@ void Compiler::assignRegistersForFunction(const Function *function,
         auto r = CompilerRegister {c.type, 1}; // XXX get real count.
         uint32_t phy;
         if (pgm->isTypeFloat(c.type)) {
-            assert(!constFloatRegs.empty());
-            phy = *constFloatRegs.begin();
+            phy = pickConstantRegister(regId, constFloatRegs);
             constFloatRegs.erase(phy);
             if (false) {
                 // Print allocated constants.
@@ -429,8 +995,7 @@ void Compiler::assignRegistersForFunction(const Function *function,
                 std::cerr << "Allocating phy " << phy << " for value " << *f << "\n";
             }
         } else {
-            assert(!constIntRegs.empty());
-            phy = *constIntRegs.begin();
+            phy = pickConstantRegister(regId, constIntRegs);
             constIntRegs.erase(phy);
         }
         if (pgm->verbose) {
@@ -473,11 +1038,11 @@ void Compiler::assignRegistersForBlock(Block *block,
     std::set<uint32_t> assigned;
 
     // Registers that are live going into this block have already been
-    // assigned. Note that we use livein[0] here, because
-    // we want to ignore parameters to phi instructions. They're not
-    // considered live here, we'll add copy instructions on the edge
-    // between the block and here.
-    for (auto regId : block->instructions.head->livein.at(0)) {
+    // assigned. The block's live in doesn't include parameters to phi
+    // instructions. They're not considered live here, we'll add copy
+    // instructions on the edge between the block and here.
+    const Function *function = block->function;
+    for (auto regId : function->liveRegisters(function->blockLiveIn.at(block->blockId))) {
         auto r = registers.find(regId);
         if (r == registers.end()) {
             std::cerr << "Warning: Initial virtual register "
@@ -491,14 +1056,16 @@ void Compiler::assignRegistersForBlock(Block *block,
     }
 
     // Assign registers for each instruction in order.
-    for (auto inst = block->instructions.head; inst; inst = inst->next) {
+    std::vector<BitVector> liveOut = function->instructionLiveOut(block);
+    size_t pos = 0;
+    for (auto inst = block->instructions.head; inst; inst = inst->next, pos++) {
         Instruction *instruction = inst.get();
 
         // Free up now-unused physical registers.
         for (auto argId : instruction->argIdSet) {
             // If this virtual register doesn't survive past this line, then we
             // can use its physical register again.
-            if (instruction->liveout.find(argId) == instruction->liveout.end()) {
+            if (!function->isLive(liveOut[pos], argId)) {
                 auto r = registers.find(argId);
                 if (r != registers.end()) {
                     // Phi instruction's arg ID set includes parameters that aren't
@@ -512,7 +1079,10 @@ void Compiler::assignRegistersForBlock(Block *block,
             }
         }
 
-        // Assign result registers to physical registers.
+        // Assign result registers to physical registers. Results that aren't
+        // used still need a register distinct from the other results, since
+        // they're all written at once.
+        std::set<uint32_t> deadPhy;
         for (uint32_t resId : instruction->resIdSet) {
             auto r = registers.find(resId);
             if (r == registers.end()) {
@@ -528,25 +1098,130 @@ void Compiler::assignRegistersForBlock(Block *block,
             const std::set<uint32_t> &allPhy =
                 pgm->isTypeFloat(r->second.type) ? allFloatPhy : allIntPhy;
 
-            // Find an available physical register.
-            bool found = false;
-            for (uint32_t phy : allPhy) {
-                if (assigned.find(phy) == assigned.end()) {
-                    r->second.phy = phy;
-                    // If the result lives past this instruction, consider its
-                    // register assigned.
-                    if (instruction->liveout.find(resId) != instruction->liveout.end()) {
-                        assigned.insert(phy);
-                    }
-                    found = true;
+            // Library calls clobber the argument registers, so values that
+            // live across a call can't use them.
+            bool acrossCall = liveAcrossCall.find(resId) != liveAcrossCall.end();
+
+            // First try the registers that would make a copy go away.
+            uint32_t phy = NO_REGISTER;
+            for (uint32_t hint : preferredRegisters(resId)) {
+                if (allPhy.find(hint) != allPhy.end() &&
+                        assigned.find(hint) == assigned.end() &&
+                        !(acrossCall && isArgumentRegister(hint))) {
+
+                    phy = hint;
                     break;
                 }
             }
-            if (!found) {
+
+            // Otherwise find any available physical register. Values that
+            // don't live across calls try the argument registers first to
+            // leave the rest for values that do.
+            for (int pass = acrossCall ? 1 : 0; pass < 2 && phy == NO_REGISTER; pass++) {
+                for (uint32_t candidate : allPhy) {
+                    if (isArgumentRegister(candidate) == (pass == 0) &&
+                            assigned.find(candidate) == assigned.end()) {
+
+                        phy = candidate;
+                        break;
+                    }
+                }
+            }
+            if (phy == NO_REGISTER) {
                 std::cerr << "Error: No physical register available for " << resId << ".\n";
                 exit(EXIT_FAILURE);
             }
+
+            r->second.phy = phy;
+            // If the result doesn't live past this instruction, free
+            // its register once all results have been assigned.
+            if (!function->isLive(liveOut[pos], resId)) {
+                deadPhy.insert(phy);
+            }
+            assigned.insert(phy);
         }
+        for (uint32_t phy : deadPhy) {
+            assigned.erase(phy);
+        }
+    }
+}
+
+void Compiler::computeRegisterHints(const Function *function) {
+    registerHints.clear();
+    copySources.clear();
+
+    for (auto &[_, block] : function->blocks) {
+        for (auto inst = block->instructions.head; inst; inst = inst->next) {
+            Instruction *instruction = inst.get();
+
+            if (isLibraryCall(instruction->opcode())) {
+                // Parameters and results go through the argument registers,
+                // floats and ints counted separately. See emitCall().
+                uint32_t nextInt = 10;
+                uint32_t nextFloat = 32 + 10;
+                for (uint32_t argId : instruction->argIdList) {
+                    bool isFloat = pgm->isTypeFloat(pgm->typeIdOf(argId));
+                    registerHints[argId].push_back(isFloat ? nextFloat++ : nextInt++);
+                }
+                nextInt = 10;
+                nextFloat = 32 + 10;
+                for (uint32_t resId : instruction->resIdList) {
+                    bool isFloat = pgm->isTypeFloat(pgm->typeIdOf(resId));
+                    registerHints[resId].push_back(isFloat ? nextFloat++ : nextInt++);
+                }
+            } else if (instruction->opcode() == SpvOpCopyObject) {
+                InsnCopyObject *insn = dynamic_cast<InsnCopyObject *>(instruction);
+                copySources[insn->resultId()].push_back(insn->operandId());
+            } else if (instruction->opcode() == SpvOpSelect) {
+                InsnSelect *insn = dynamic_cast<InsnSelect *>(instruction);
+                copySources[insn->resultId()].push_back(insn->object1Id());
+                copySources[insn->resultId()].push_back(insn->object2Id());
+            }
+        }
+    }
+}
+
+std::vector<uint32_t> Compiler::preferredRegisters(uint32_t regId) const {
+    std::vector<uint32_t> phys;
+
+    // Add the physical register of the virtual register, if it has one.
+    auto addRegisterOf = [this, &phys](uint32_t otherId) {
+        auto r = registers.find(otherId);
+        if (r != registers.end() && r->second.phy != NO_REGISTER) {
+            phys.push_back(r->second.phy);
+        }
+    };
+
+    // Registers of the others in our phi class remove phi copies, which
+    // are on the edges of loops, so they're most important.
+    auto phiClass = phiClassMap.find(regId);
+    if (phiClass != phiClassMap.end()) {
+        for (uint32_t otherId : phiClass->second->registers) {
+            addRegisterOf(otherId);
+        }
+    }
+
+    // Then the registers of the values we're copied from.
+    auto sources = copySources.find(regId);
+    if (sources != copySources.end()) {
+        for (uint32_t sourceId : sources->second) {
+            addRegisterOf(sourceId);
+        }
+    }
+
+    // Then the argument registers of the calls we're passed to or returned from.
+    auto hints = registerHints.find(regId);
+    if (hints != registerHints.end()) {
+        phys.insert(phys.end(), hints->second.begin(), hints->second.end());
+    }
+
+    return phys;
+}
+
+void Compiler::recordCopy(uint32_t dst, uint32_t src) {
+    copyCount++;
+    if (dst == src) {
+        coalescedCopyCount++;
     }
 }
 
@@ -618,7 +1293,14 @@ void Compiler::emitCopyVariable(uint32_t dst, uint32_t src, const std::string &c
     std::ostringstream ssc;
     ssc << "r" << dst << " <- r" << src << comment;
 
-    emitCopyRegister(asRegister(dst)->phy, asRegister(src)->phy, ssc.str());
+    uint32_t dstPhy = asRegister(dst)->phy;
+    uint32_t srcPhy = asRegister(src)->phy;
+    recordCopy(dstPhy, srcPhy);
+    if (dstPhy == srcPhy) {
+        emit("", ssc.str());
+    } else {
+        emitCopyRegister(dstPhy, srcPhy, ssc.str());
+    }
 }
 
 void Compiler::emitCopyRegister(uint32_t dst, uint32_t src, const std::string &comment) {
@@ -663,14 +1345,14 @@ void Compiler::emitBinaryOp(const std::string &opName, int result, int op1, int
 
 void Compiler::emitBinaryImmOp(const std::string &opName, int result, int op, uint32_t imm) {
     std::ostringstream ss1;
-    ss1 << opName << " " << reg(result) << ", " << reg(op) << ", " << imm;
+    ss1 << opName << " " << reg(result) << ", " << reg(op) << ", " << int32_t(imm);
     std::ostringstream ss2;
-    ss2 << "r" << result << " = " << opName << " r" << op << " " << imm;
+    ss2 << "r" << result << " = " << opName << " r" << op << " " << int32_t(imm);
     emit(ss1.str(), ss2.str());
 }
 
 void Compiler::emitLabel(const std::string &label) {
-    outFile << notEmptyLabel(label) << ":\n";
+    out << notEmptyLabel(label) << ":\n";
 }
 
 std::string Compiler::notEmptyLabel(const std::string &label) const {
@@ -681,62 +1363,48 @@ void Compiler::emitCall(const std::string &functionName,
         const std::vector<uint32_t> resultIds,
         const std::vector<uint32_t> operandIds) {
 
-    // Push parameters.
-    {
-        std::ostringstream ss;
-        ss << "addi sp, sp, -" << 4*(operandIds.size() + 1);
-        emit(ss.str(), "Make room on stack");
-    }
-    {
-        std::ostringstream ss;
-        ss << "sw ra, " << 4*operandIds.size() << "(sp)";
-        emit(ss.str(), "Save return address");
-    }
-
-    for (int i = operandIds.size() - 1; i >= 0; i--) {
-        std::ostringstream ss;
-        uint32_t phy = asRegister(operandIds[i])->phy;
-        if (phy < 32) {
-            ss << "sw x" << phy << ", " << i*4 << "(sp)";
-        } else {
-            ss << "fsw f" << (phy - 32) << ", " << i*4 << "(sp)";
-        }
-        std::ostringstream ssc;
-        ssc << "Push parameter r" << operandIds[i];
-        emit(ss.str(), ssc.str());
+    // Move parameters into argument registers, floats and ints counted separately.
+    std::vector<PCopyPair> pairs;
+    uint32_t nextInt = 10;
+    uint32_t nextFloat = 32 + 10;
+    for (uint32_t operandId : operandIds) {
+        uint32_t phy = physicalRegisterFor(operandId, true);
+        uint32_t argPhy = phy < 32 ? nextInt++ : nextFloat++;
+        assert(argPhy <= 17 || (argPhy >= 32 && argPhy <= 32 + 17));
+        pairs.push_back({{phy}, {argPhy}});
     }
+    emitParallelCopy(pairs, "Parameter");
 
-    // Call routines.
+    // Call routine.
     {
         std::ostringstream ss;
         ss << "jal ra, " << functionName;
         emit(ss.str(), "Call routine");
     }
-
-    // Pop parameters.
-    for (size_t i = 0; i < resultIds.size(); i++) {
-        std::ostringstream ss;
-        uint32_t phy = asRegister(resultIds[i])->phy;
-        if (phy < 32) {
-            ss << "lw x" << phy << ", " << i*4 << "(sp)";
-        } else {
-            ss << "flw f" << (phy - 32) << ", " << i*4 << "(sp)";
-        }
-        std::ostringstream ssc;
-        ssc << "Pop result r" << resultIds[i];
-        emit(ss.str(), ssc.str());
+    if (currentBlockStats != nullptr) {
+        currentBlockStats->callCounts[functionName]++;
+        currentBlockStats->cycles += lookupCycles(cycleTable, functionName,
+                DEFAULT_LIBRARY_ROUTINE_CYCLES);
     }
 
-    {
-        std::ostringstream ss;
-        ss << "lw ra, " << 4*resultIds.size() << "(sp)";
-        emit(ss.str(), "Restore return address");
+    // Move results out of argument registers.
+    pairs.clear();
+    nextInt = 10;
+    nextFloat = 32 + 10;
+    for (uint32_t resultId : resultIds) {
+        uint32_t phy = physicalRegisterFor(resultId, true);
+        uint32_t argPhy = phy < 32 ? nextInt++ : nextFloat++;
+        pairs.push_back({{argPhy}, {phy}});
     }
-    {
-        std::ostringstream ss;
-        ss << "addi sp, sp, " << 4*(resultIds.size() + 1);
-        emit(ss.str(), "Restore stack");
+    emitParallelCopy(pairs, "Result");
+}
+
+void Compiler::emitReturn() {
+    if (saveReturnAddress) {
+        emit("lw ra, 0(sp)", "Restore return address");
+        emit("addi sp, sp, 4", "Restore stack");
     }
+    emit("jalr x0, ra, 0", "");
 }
 
 void Compiler::emitUniCall(const std::string &functionName, uint32_t resultId, uint32_t operandId) {
@@ -778,19 +1446,80 @@ void Compiler::emitTerCall(const std::string &functionName, uint32_t resultId,
 
 void Compiler::emit(const std::string &op, const std::string &comment) {
     std::ios oldState(nullptr);
-    oldState.copyfmt(outFile);
+    oldState.copyfmt(out);
 
-    outFile
+    out
         << "        "
         << std::left
         << std::setw(30) << op
         << std::setw(0);
     if(!comment.empty()) {
-        outFile << "; " << comment;
+        out << "; " << comment;
     }
-    outFile << "\n";
+    out << "\n";
+
+    out.copyfmt(oldState);
 
-    outFile.copyfmt(oldState);
+    // Directives don't count, they're only in the data segment.
+    if (!op.empty() && op[0] != '.') {
+        instructionCount++;
+
+        if (currentBlockStats != nullptr) {
+            currentBlockStats->classCounts[instructionClass(op)]++;
+            currentBlockStats->cycles += lookupCycles(cycleTable, op.substr(0, op.find(' ')));
+        }
+    }
+}
+
+void Compiler::emitJump(uint32_t blockId) {
+    std::ostringstream ss;
+    if (blockId == fallThroughBlockId) {
+        ss << "fall through to block" << blockId;
+        emit("", ss.str());
+        removedJumpCount++;
+    } else {
+        ss << "jal x0, block" << blockId;
+        emit(ss.str(), "");
+    }
+}
+
+bool Compiler::isBranchInRange(uint32_t fromBlockId, uint32_t toBlockId) const {
+    // Backward we know exactly.
+    auto itr = blockAddresses.find(toBlockId);
+    if (itr != blockAddresses.end()) {
+        return instructionCount - itr->second <= MAX_BRANCH_DISTANCE;
+    }
+
+    // Forward it's at most the estimated size of the blocks in between.
+    auto fromItr = blockLayoutStarts.find(fromBlockId);
+    auto toItr = blockLayoutStarts.find(toBlockId);
+    return fromItr != blockLayoutStarts.end() && toItr != blockLayoutStarts.end() &&
+        toItr->second - fromItr->second < MAX_BRANCH_DISTANCE;
+}
+
+bool Compiler::needsPhiCopy(Instruction *instruction, uint32_t blockId) const {
+    Function *function = instruction->list->block->function;
+    Instruction *firstInstruction = function->blocks.at(blockId)->instructions.head.get();
+    if (firstInstruction->opcode() != RiscVOpPhi) {
+        return false;
+    }
+    RiscVPhi *phi = dynamic_cast<RiscVPhi *>(firstInstruction);
+
+    // Let emitPhiCopy() report a missing source.
+    int labelIndex = phi->getLabelIndexForSource(instruction->blockId());
+    if (labelIndex == -1) {
+        return true;
+    }
+
+    for (size_t resultIndex = 0; resultIndex < phi->resultIds.size(); resultIndex++) {
+        uint32_t destId = phi->resultIds[resultIndex];
+        uint32_t sourceId = phi->operandIds[resultIndex][labelIndex];
+        if (!isSamePhysicalRegister(destId, sourceId)) {
+            return true;
+        }
+    }
+
+    return false;
 }
 
 void Compiler::emitPhiCopy(Instruction *instruction, uint32_t blockId) {
@@ -819,11 +1548,8 @@ void Compiler::emitPhiCopy(Instruction *instruction, uint32_t blockId) {
         exit(EXIT_FAILURE);
     }
 
-    // Compute parallel copy steps.
-    std::vector<PCopyPair> pairs;
-    std::vector<PCopyInstruction> instructions;
-
     // Set up our pairs.
+    std::vector<PCopyPair> pairs;
     for (size_t resultIndex = 0; resultIndex < phi->resultIds.size(); resultIndex++) {
         uint32_t destId = phi->resultIds[resultIndex];
         uint32_t sourceId = phi->operandIds[resultIndex][labelIndex];
@@ -833,6 +1559,16 @@ void Compiler::emitPhiCopy(Instruction *instruction, uint32_t blockId) {
         pairs.push_back({{sourceReg}, {destReg}});
     }
 
+    emitParallelCopy(pairs, "Phi elimination");
+}
+
+void Compiler::emitParallelCopy(const std::vector<PCopyPair> &pairs, const std::string &comment) {
+    std::vector<PCopyInstruction> instructions;
+
+    for (auto &pair : pairs) {
+        recordCopy(pair.mDestination.mRegister, pair.mSource.mRegister);
+    }
+
     // Compute necessary instructions.
     parallel_copy(pairs, instructions);
 
@@ -842,7 +1578,7 @@ void Compiler::emitPhiCopy(Instruction *instruction, uint32_t blockId) {
             case PCOPY_OP_MOVE: {
                 uint32_t sourceReg = instruction.mPair.mSource.mRegister;
                 uint32_t destReg = instruction.mPair.mDestination.mRegister;
-                emitCopyRegister(destReg, sourceReg, "Phi elimination (move)");
+                emitCopyRegister(destReg, sourceReg, comment + " (move)");
                 break;
             }
 
@@ -854,7 +1590,7 @@ void Compiler::emitPhiCopy(Instruction *instruction, uint32_t blockId) {
                     {
                         std::ostringstream ss;
                         ss << "xor x" << destReg << ", x" << sourceReg << ", x" << destReg;
-                        emit(ss.str(), "Phi elimination (swap)");
+                        emit(ss.str(), comment + " (swap)");
                     }
                     {
                         std::ostringstream ss;
@@ -870,13 +1606,13 @@ void Compiler::emitPhiCopy(Instruction *instruction, uint32_t blockId) {
                     destReg -= 32;
                     sourceReg -= 32;
                     // We don't have any easy way to swap two floating point registers.
-                    // The XOR trick won't work. XXX For now just assume that f31 is free
-                    // (which we can't even assert on!).
-                    uint32_t tmpReg = 31;
+                    // The XOR trick won't work, so go through the reserved register.
+                    uint32_t tmpReg = FLOAT_SWAP_REGISTER;
+                    assert(sourceReg != tmpReg && destReg != tmpReg);
                     {
                         std::ostringstream ss;
                         ss << "fsgnj.s f" << tmpReg << ", f" << sourceReg << ", f" << sourceReg;
-                        emit(ss.str(), "Phi elimination (swap)");
+                        emit(ss.str(), comment + " (swap)");
                     }
                     {
                         std::ostringstream ss;
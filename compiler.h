@@ -1,8 +1,14 @@
 #ifndef COMPILER_H
 #define COMPILER_H
 
-#include <fstream>
+#include <sstream>
 #include "program.h"
+#include "pcopy.h"
+#include "timing.h"
+#include "bitvector.h"
+
+// Conditional branches reach +/-4 kB, so this many instructions.
+static const int MAX_BRANCH_DISTANCE = 1024;
 
 // Virtual register used by the compiler.
 struct CompilerRegister {
@@ -40,6 +46,31 @@ struct PhiClass {
     }
 };
 
+// What we emitted for one block, for the compile report.
+struct BlockStats {
+    // Number of instructions of each class ("integer", "float", "load",
+    // and so on).
+    std::map<std::string, int> classCounts;
+
+    // Number of stores that spill a register, and of loads that reload one
+    // (including constants).
+    int spillCount;
+    int reloadCount;
+
+    // Number of calls to each library routine.
+    std::map<std::string, int> callCounts;
+
+    // Estimated cycles to run through the block once, including the library
+    // routines it calls.
+    uint64_t cycles;
+
+    BlockStats()
+        : spillCount(0), reloadCount(0), cycles(0)
+    {
+        // Nothing.
+    }
+};
+
 // Compiles a Program to our ISA.
 struct Compiler {
     Program *pgm;
@@ -51,24 +82,123 @@ struct Compiler {
     // entry here if the register participates in a phi instruction.
     std::map<uint32_t,std::shared_ptr<PhiClass>> phiClassMap;
 
-    std::ofstream outFile;
-
-    Compiler(Program *pgm, const std::string &outputAssemblyPathname)
+    // Virtual registers of the function being assigned that are live
+    // across a library call, and so can't be in argument registers.
+    std::set<uint32_t> liveAcrossCall;
+
+    // Physical registers that each virtual register would like to be in
+    // because it's passed to or returned from a library call there. Only
+    // valid while assigning registers for a function.
+    std::map<uint32_t, std::vector<uint32_t>> registerHints;
+
+    // Virtual registers that each virtual register is copied from, so
+    // sharing their physical register removes the copy. Only valid while
+    // assigning registers for a function.
+    std::map<uint32_t, std::vector<uint32_t>> copySources;
+
+    // Number of register copies we've emitted, and how many of those
+    // were between the same physical register and so cost nothing.
+    int copyCount;
+    int coalescedCopyCount;
+
+    // Number of constants we've put into registers, and how many of those
+    // we built from immediates instead of loading from the constant pool.
+    int constantLoadCount;
+    int immediateConstantCount;
+
+    // Map from each scalar constant to the constant whose pool entry it
+    // shares, which is the lowest-numbered one with the same bits.
+    std::map<uint32_t, uint32_t> constantPoolIds;
+
+    // Pool entries that we've loaded from, so only these need emitting.
+    std::set<uint32_t> usedPoolIds;
+
+    // Whether the function being emitted saved ra on the stack because
+    // it calls library routines.
+    bool saveReturnAddress;
+
+    // Block that will be emitted right after the one we're emitting, or
+    // NO_BLOCK_ID if it's the last one in the function.
+    uint32_t fallThroughBlockId;
+
+    // Upper bound on the instruction index of each block in the function
+    // being emitted, relative to the first block in the layout.
+    std::map<uint32_t, int> blockLayoutStarts;
+
+    // Number of instructions we've emitted so far, and the instruction index
+    // of each block label we've emitted.
+    int instructionCount;
+    std::map<uint32_t, int> blockAddresses;
+
+    // Number of jumps we didn't need because of the block layout.
+    int removedJumpCount;
+
+    // Estimated cycles of each mnemonic and library routine, for the
+    // compile report. It's the program's table, see timing.h.
+    std::map<std::string, int> cycleTable;
+
+    // What we emitted for each block, and the stats of the block we're
+    // emitting, or null if we're not in one.
+    std::map<uint32_t, BlockStats> blockStats;
+    BlockStats *currentBlockStats;
+
+    // Registers live out of each instruction of the block we're emitting,
+    // and the index of the instruction we're emitting in it. Computed once
+    // per block so that findScratchRegister() doesn't walk the block.
+    std::vector<BitVector> emitLiveOut;
+    size_t emitIndex;
+
+    // Assembly text we've generated so far.
+    std::ostringstream out;
+
+    // Where to write the output. If it ends in ".o" we write an object
+    // file, otherwise assembly text.
+    std::string outputPathname;
+
+    // Where to also write the assembly text when writing an object file,
+    // or empty for nowhere.
+    std::string listingPathname;
+
+    Compiler(Program *pgm, const std::string &outputPathname,
+            const std::string &listingPathname = "")
         : pgm(pgm),
           localLabelCounter(1),
-          outFile(outputAssemblyPathname, std::ios::out)
+          copyCount(0),
+          coalescedCopyCount(0),
+          constantLoadCount(0),
+          immediateConstantCount(0),
+          saveReturnAddress(false),
+          fallThroughBlockId(NO_BLOCK_ID),
+          instructionCount(0),
+          removedJumpCount(0),
+          cycleTable(pgm->cycleTable),
+          currentBlockStats(nullptr),
+          emitIndex(0),
+          outputPathname(outputPathname),
+          listingPathname(listingPathname)
     {
-        if (!outFile.good()) {
-            std::cerr << "Can't open file \"" << outputAssemblyPathname << "\".\n";
-            exit(EXIT_FAILURE);
-        }
+        // Nothing.
     }
 
     void compile();
+
+    // Print what we emitted for each function and block: instructions by
+    // class, spills and reloads, library calls, and estimated cycles. Then
+    // what the optimization passes did, and estimate the cycles per pixel
+    // and the frame rate of a width by height image on coreCount cores at
+    // clockMhz. Blocks are weighted by the profile if we have one,
+    // otherwise each is counted once per pixel.
+    void printReport(double clockMhz, int coreCount, int width, int height) const;
     void emitInstructions();
     void emitInstructionsForFunction(Function *function);
-    void emitInstructionsForBlockTree(Block *block);
     void emitInstructionsForBlock(Block *block);
+
+    // Order the function's blocks so that as many branches as possible go
+    // to the next block. Loop bodies are kept together, and at a two-way
+    // branch we favor the side the profile says is taken more, then staying
+    // in the loop, as long as the block's other predecessors have already
+    // been placed. The start block is first.
+    std::vector<Block *> computeBlockLayout(const Function *function) const;
     void emitVariables();
     void emitConstants();
     void emitLibrary();
@@ -81,6 +211,30 @@ struct Compiler {
     // untouched.
     bool asIntegerConstant(uint32_t id, uint32_t &value) const;
 
+    // If the virtual register "id" is a scalar constant, returns the 32-bit
+    // word it's stored as in "word" and returns true. Otherwise returns false.
+    bool asConstantWord(uint32_t id, uint32_t &word) const;
+
+    // Fill constantPoolIds so that constants with the same bits share a word.
+    void computeConstantPool();
+
+    // Emit instructions to put the constant into the physical register.
+    // Integers are built with addi and lui, and floats whose bits are all
+    // in the top 20 are built in the scratch integer register and moved
+    // over. Anything else is loaded from the constant pool. The scratch
+    // register may be NO_REGISTER if none is free.
+    void emitLoadConstant(uint32_t phy, uint32_t constId, uint32_t scratchPhy,
+            const std::string &comment);
+
+    // Emit instructions to put the 32-bit value into the integer physical
+    // register using only immediates.
+    void emitLoadImmediate(uint32_t phy, uint32_t value, const std::string &comment);
+
+    // Return an integer physical register that holds nothing live going into
+    // or out of the instruction, or NO_REGISTER if there isn't one. The
+    // instruction must be the one we're emitting.
+    uint32_t findScratchRegister(const Instruction *instruction) const;
+
     // Returns true if the register is a float, false if it's an integer,
     // otherwise asserts.
     bool isRegFloat(uint32_t id) const;
@@ -123,6 +277,17 @@ struct Compiler {
             const std::set<uint32_t> &allIntPhy,
             const std::set<uint32_t> &allFloatPhy);
 
+    // Compute registerHints and copySources for the function.
+    void computeRegisterHints(const Function *function);
+
+    // Physical registers the virtual register should be assigned to, in
+    // order of preference, to avoid copies. These may already be taken.
+    std::vector<uint32_t> preferredRegisters(uint32_t regId) const;
+
+    // Count a register copy for the statistics. Copies from a register to
+    // itself are emitted as nothing.
+    void recordCopy(uint32_t dst, uint32_t src);
+
     // Return the physical register for the virtual register, or NO_REGISTER
     // if it hasn't been assigned yet. If required, the program fails if
     // the ID has no physical register.
@@ -152,7 +317,9 @@ struct Compiler {
     // it returns an appropriate non-empty string.
     std::string notEmptyLabel(const std::string &label) const;
 
-    // Emit a call to a floating-point routine.
+    // Emit a call to a library routine. Float parameters are passed in
+    // fa0-fa7 and integer parameters in a0-a7, and results come back
+    // the same way. The routine may clobber those registers.
     void emitCall(const std::string &functionName,
             const std::vector<uint32_t> resultIds,
             const std::vector<uint32_t> operandIds);
@@ -168,12 +335,31 @@ struct Compiler {
     void emitTerCall(const std::string &functionName, uint32_t resultId,
             uint32_t operand1Id, uint32_t operand2Id, uint32_t operand3Id);
 
+    // Emit a return from the function, restoring ra if we saved it.
+    void emitReturn();
+
     void emit(const std::string &op, const std::string &comment);
 
+    // Jump to the block, or nothing if it's the next one emitted.
+    void emitJump(uint32_t blockId);
+
+    // Whether a conditional branch at the end of one block can reach the
+    // label of the other directly. B-type branches only reach 4 kB, so
+    // forward targets are estimated conservatively.
+    bool isBranchInRange(uint32_t fromBlockId, uint32_t toBlockId) const;
+
+    // Whether going from the instruction to the block needs any phi copies
+    // that aren't between the same physical register.
+    bool needsPhiCopy(Instruction *instruction, uint32_t blockId) const;
+
     // Just before a Branch or BranchConditional instruction, copy any
     // registers that a target OpPhi instruction might need. Instruction
     // is the branch; labelId is the target whose block has a phi.
     void emitPhiCopy(Instruction *instruction, uint32_t labelId);
+
+    // Copy each source register to its destination register as if all the
+    // copies happened at once.
+    void emitParallelCopy(const std::vector<PCopyPair> &pairs, const std::string &comment);
 };
 
 #endif // COMPILER_H
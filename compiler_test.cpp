@@ -0,0 +1,283 @@
+// Test for the compiler passes in compiler.cpp and program.cpp, on small
+// functions built by hand.
+
+#include <iostream>
+#include <sstream>
+#include "program.h"
+#include "function.h"
+#include "compiler.h"
+
+static int failureCount = 0;
+
+void verify(const std::string &name, bool ok) {
+    if (!ok) {
+        std::cout << name << ": failed\n";
+        failureCount++;
+    }
+}
+
+void verify_equal(const std::string &name, const std::string &expected, const std::string &actual) {
+    if (actual != expected) {
+        std::cout << name << ": expected \"" << expected << "\" but got \"" << actual << "\"\n";
+        failureCount++;
+    }
+}
+
+// Add an empty block to the function, as a dominator tree child of the
+// parent block if there is one.
+Block *add_block(Function *function, uint32_t blockId, Block *parent) {
+    auto block = std::make_shared<Block>(blockId, function);
+    function->blocks[blockId] = block;
+    if (parent == nullptr) {
+        function->startBlockId = blockId;
+    } else {
+        block->idom = parent->blockId;
+        parent->idomChildren.push_back(block);
+    }
+    return block.get();
+}
+
+void add_branch(Block *block, uint32_t targetId) {
+    block->instructions.push_back(std::make_shared<InsnBranch>(LineInfo(), targetId));
+}
+
+void add_branch_conditional(Block *block, uint32_t trueId, uint32_t falseId,
+        std::vector<uint32_t> weights = {}) {
+
+    block->instructions.push_back(std::make_shared<InsnBranchConditional>(LineInfo(),
+                100, trueId, falseId, weights));
+}
+
+void add_return(Block *block) {
+    block->instructions.push_back(std::make_shared<InsnReturn>(LineInfo()));
+}
+
+std::string layout_string(const std::vector<Block *> &layout) {
+    std::ostringstream ss;
+    for (Block *block : layout) {
+        ss << (ss.tellp() == 0 ? "" : " ") << block->blockId;
+    }
+    return ss.str();
+}
+
+void test_block_layout() {
+    Program pgm(false, false);
+    Compiler compiler(&pgm, "out.s");
+
+    // If-else where the branch weights say the false side is usual. It falls
+    // through from the branch, and the true side falls through to the join.
+    {
+        Function function(1, "diamond", 0, 0, 0, &pgm);
+        Block *b1 = add_block(&function, 1, nullptr);
+        Block *b2 = add_block(&function, 2, b1);
+        Block *b3 = add_block(&function, 3, b1);
+        Block *b4 = add_block(&function, 4, b1);
+        add_branch_conditional(b1, 2, 3, {1, 9});
+        add_branch(b2, 4);
+        add_branch(b3, 4);
+        add_return(b4);
+        verify_equal("layout weights", "1 3 2 4", layout_string(compiler.computeBlockLayout(&function)));
+
+        // Without weights, the profile decides.
+        b1->instructions.erase(b1->instructions.tail);
+        add_branch_conditional(b1, 3, 2);
+        b2->profileKey = "b2";
+        b3->profileKey = "b3";
+        pgm.blockCounts["b2"] = 100;
+        pgm.blockCounts["b3"] = 1;
+        verify_equal("layout profile", "1 2 3 4", layout_string(compiler.computeBlockLayout(&function)));
+        pgm.blockCounts.clear();
+    }
+
+    // Loop whose body is the false side of the header's branch. The body
+    // still follows the header, and the exit goes after the loop.
+    {
+        Function function(2, "loop", 0, 0, 0, &pgm);
+        Block *b1 = add_block(&function, 1, nullptr);
+        Block *b2 = add_block(&function, 2, b1);
+        Block *b4 = add_block(&function, 4, b2);
+        Block *b3 = add_block(&function, 3, b2);
+        add_branch(b1, 2);
+        add_branch_conditional(b2, 4, 3);
+        add_branch(b3, 2);
+        add_return(b4);
+        verify_equal("layout loop", "1 2 3 4", layout_string(compiler.computeBlockLayout(&function)));
+    }
+}
+
+void test_branch_range() {
+    Program pgm(false, false);
+    Compiler compiler(&pgm, "out.s");
+
+    // Backward branches use where the target was emitted.
+    compiler.instructionCount = MAX_BRANCH_DISTANCE + 10;
+    compiler.blockAddresses[1] = 10;
+    compiler.blockAddresses[2] = 9;
+    verify("backward at limit", compiler.isBranchInRange(3, 1));
+    verify("backward past limit", !compiler.isBranchInRange(3, 2));
+
+    // Forward branches use the estimated start of each block.
+    compiler.blockLayoutStarts[3] = 0;
+    compiler.blockLayoutStarts[4] = MAX_BRANCH_DISTANCE - 1;
+    compiler.blockLayoutStarts[5] = MAX_BRANCH_DISTANCE;
+    verify("forward at limit", compiler.isBranchInRange(3, 4));
+    verify("forward past limit", !compiler.isBranchInRange(3, 5));
+    verify("forward unknown", !compiler.isBranchInRange(3, 6));
+}
+
+// Schedule a block with and without latency in mind, and make sure that
+// nothing moved ahead of what it depends on.
+void test_schedule_block(bool forLatency) {
+    std::string name = forLatency ? "schedule for latency" : "schedule for pressure";
+    Program pgm(false, false);
+    pgm.scheduleForLatency = forLatency;
+    Function function(1, "schedule", 0, 0, 0, &pgm);
+    Block *block = add_block(&function, 1, nullptr);
+
+    // Pointers are 50 and 51, and 20 comes from another block.
+    auto add = [block](std::shared_ptr<Instruction> inst) { block->instructions.push_back(inst); };
+    add(std::make_shared<InsnLoad>(LineInfo(), 1, 10, 50, 0));
+    add(std::make_shared<InsnFMul>(LineInfo(), 1, 11, 10, 10));
+    add(std::make_shared<InsnStore>(LineInfo(), 51, 11, 0));
+    add(std::make_shared<InsnLoad>(LineInfo(), 1, 12, 51, 0));
+    add(std::make_shared<InsnFAdd>(LineInfo(), 1, 13, 12, 20));
+    add(std::make_shared<InsnFMul>(LineInfo(), 1, 14, 20, 20));
+    add(std::make_shared<InsnFMul>(LineInfo(), 1, 15, 14, 13));
+    add(std::make_shared<InsnStore>(LineInfo(), 50, 15, 0));
+    add_branch(block, 2);
+
+    std::vector<Instruction *> memoryBefore;
+    std::map<uint32_t,int> useCount;
+    for (auto inst = block->instructions.head; inst; inst = inst->next) {
+        uint32_t opcode = inst->opcode();
+        if (opcode == SpvOpLoad || opcode == SpvOpStore) {
+            memoryBefore.push_back(inst.get());
+        }
+        for (uint32_t argId : inst->argIdList) {
+            useCount[argId]++;
+        }
+    }
+    size_t sizeBefore = block->instructions.size();
+
+    int cyclesBefore = 0;
+    int cyclesAfter = 0;
+    pgm.scheduleBlock(block, useCount, cyclesBefore, cyclesAfter);
+
+    // Each result is defined before it's used, loads and stores are in
+    // their original order, and the branch is still last.
+    std::set<uint32_t> defined;
+    std::vector<Instruction *> memoryAfter;
+    for (auto inst = block->instructions.head; inst; inst = inst->next) {
+        for (uint32_t argId : inst->argIdList) {
+            verify(name + " uses r" + std::to_string(argId) + " after its definition",
+                    argId == 20 || argId == 50 || argId == 51 || defined.count(argId) != 0);
+        }
+        defined.insert(inst->resIdList.begin(), inst->resIdList.end());
+        uint32_t opcode = inst->opcode();
+        if (opcode == SpvOpLoad || opcode == SpvOpStore) {
+            memoryAfter.push_back(inst.get());
+        }
+    }
+    verify(name + " keeps every instruction", block->instructions.size() == sizeBefore);
+    verify(name + " keeps loads and stores in order", memoryAfter == memoryBefore);
+    verify(name + " keeps the branch last", block->instructions.tail->opcode() == SpvOpBranch);
+    verify(name + " isn't slower", cyclesAfter <= cyclesBefore);
+}
+
+// String of the components of the register that are used, like "xz".
+std::string demanded_string(const Program &pgm, uint32_t regId, int count) {
+    std::string s;
+    for (int i = 0; i < count; i++) {
+        if (pgm.isComponentDemanded(regId, i)) {
+            s += "xyzw"[i];
+        }
+    }
+    return s;
+}
+
+void test_demanded_components() {
+    Program pgm(false, false);
+    auto floatType = std::make_shared<TypeFloat>(32);
+    pgm.types[1] = floatType;
+    pgm.types[2] = std::make_shared<TypeVector>(floatType, 1, 4);
+    pgm.types[3] = std::make_shared<TypeVector>(floatType, 1, 2);
+    auto function = std::make_shared<Function>(1, "swizzle", 0, 0, 0, &pgm);
+    pgm.functions[1] = function;
+    Block *block = add_block(function.get(), 1, nullptr);
+
+    // r11 is the vector of (r8 + r9).z and r9.y, and only its .y is used.
+    // r13 is (r8 + r9).w.
+    auto add = [&pgm, block](std::shared_ptr<Instruction> inst, uint32_t type) {
+        block->instructions.push_back(inst);
+        for (uint32_t resId : inst->resIdList) {
+            pgm.resultTypes[resId] = type;
+        }
+    };
+    add(std::make_shared<InsnLoad>(LineInfo(), 2, 8, 50, 0), 2);
+    add(std::make_shared<InsnLoad>(LineInfo(), 2, 9, 51, 0), 2);
+    add(std::make_shared<InsnFAdd>(LineInfo(), 2, 10, 8, 9), 2);
+    add(std::make_shared<InsnVectorShuffle>(LineInfo(), 3, 11, 10, 9, std::vector<uint32_t>{2, 5}), 3);
+    add(std::make_shared<InsnCompositeExtract>(LineInfo(), 1, 12, 11, std::vector<uint32_t>{1}), 1);
+    add(std::make_shared<InsnStore>(LineInfo(), 52, 12, 0), 0);
+    add(std::make_shared<InsnCompositeExtract>(LineInfo(), 1, 13, 10, std::vector<uint32_t>{3}), 1);
+    add(std::make_shared<InsnStore>(LineInfo(), 53, 13, 0), 0);
+    add_return(block);
+
+    pgm.computeDemandedComponents();
+    verify_equal("demanded shuffle", "y", demanded_string(pgm, 11, 2));
+    verify_equal("demanded add", "w", demanded_string(pgm, 10, 4));
+    verify_equal("demanded first operand", "w", demanded_string(pgm, 8, 4));
+    verify_equal("demanded second operand", "yw", demanded_string(pgm, 9, 4));
+}
+
+std::string registers_string(const std::vector<uint32_t> &phys) {
+    std::ostringstream ss;
+    for (uint32_t phy : phys) {
+        ss << (ss.tellp() == 0 ? "" : " ") << phy;
+    }
+    return ss.str();
+}
+
+void test_preferred_registers() {
+    Program pgm(false, false);
+    Compiler compiler(&pgm, "out.s");
+    for (uint32_t id = 1; id <= 5; id++) {
+        compiler.registers[id] = CompilerRegister(1, 1);
+    }
+
+    // Register 1 is in a phi class with 2 (in f8) and 3 (not assigned yet),
+    // is copied from 4 (in f9) and 5 (not assigned yet), and is passed to
+    // calls in fa0 and fa1. Each of those would remove a different copy.
+    auto phiClass = std::make_shared<PhiClass>();
+    phiClass->registers = {1, 2, 3};
+    for (uint32_t id : phiClass->registers) {
+        compiler.phiClassMap[id] = phiClass;
+    }
+    compiler.registers[2].phy = 32 + 8;
+    compiler.registers[4].phy = 32 + 9;
+    compiler.copySources[1] = {5, 4};
+    compiler.registerHints[1] = {32 + 10, 32 + 11};
+
+    // Phi copies are on loop edges, so the phi class is first, then the
+    // copy sources, then the call registers.
+    verify_equal("preferred order", "40 41 42 43", registers_string(compiler.preferredRegisters(1)));
+    verify_equal("preferred none", "", registers_string(compiler.preferredRegisters(5)));
+
+    // Only copies between different registers cost anything.
+    compiler.recordCopy(32 + 8, 32 + 8);
+    compiler.recordCopy(32 + 9, 32 + 8);
+    compiler.recordCopy(10, 10);
+    verify("copy count", compiler.copyCount == 3);
+    verify("coalesced copy count", compiler.coalescedCopyCount == 2);
+}
+
+int main() {
+    test_block_layout();
+    test_branch_range();
+    test_schedule_block(false);
+    test_schedule_block(true);
+    test_demanded_components();
+    test_preferred_registers();
+
+    return failureCount == 0 ? 0 : 1;
+}
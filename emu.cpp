@@ -7,13 +7,20 @@
 #include <iomanip>
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cinttypes>
+#include <stdexcept>
+#include <type_traits>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <atomic>
 #include "risc-v.h"
 #include "emu.h"
 #include "timer.h"
 #include "disassemble.h"
+#include "heatmap.h"
 
 void dumpGPUCore(const GPUCore& core)
 {
@@ -150,6 +157,55 @@ struct ReadWriteMemory : public ReadOnlyMemory
     }
 };
 
+// Memory for running without tracing. Values are copied straight to and
+// from the buffer in host order, which is little-endian like the core,
+// after a single range check.
+struct FlatMemory
+{
+    std::vector<uint8_t> memorybytes;
+    std::string label;
+    FlatMemory(const std::vector<uint8_t>& memorybytes_, const std::string &label) :
+        memorybytes(memorybytes_),
+        label(label)
+    {}
+
+    template <class TYPE>
+    TYPE read(uint32_t addr)
+    {
+        TYPE v;
+        check(addr, sizeof(TYPE));
+        memcpy(&v, memorybytes.data() + addr, sizeof(TYPE));
+        return v;
+    }
+    template <class TYPE>
+    void write(uint32_t addr, TYPE v)
+    {
+        check(addr, sizeof(TYPE));
+        memcpy(memorybytes.data() + addr, &v, sizeof(TYPE));
+    }
+
+    uint8_t read8(uint32_t addr) { return read<uint8_t>(addr); }
+    uint16_t read16(uint32_t addr) { return read<uint16_t>(addr); }
+    uint32_t read32(uint32_t addr) { return read<uint32_t>(addr); }
+    float readf(uint32_t addr) { return read<float>(addr); }
+    void write8(uint32_t addr, uint32_t v) { write<uint8_t>(addr, v); }
+    void write16(uint32_t addr, uint32_t v) { write<uint16_t>(addr, v); }
+    void write32(uint32_t addr, uint32_t v) { write<uint32_t>(addr, v); }
+    void writef(uint32_t addr, float v) { write<float>(addr, v); }
+
+    void check(uint32_t addr, size_t size) const
+    {
+        if(size_t(addr) + size > memorybytes.size()) {
+            outOfRange(addr, size);
+        }
+    }
+    [[noreturn]] void outOfRange(uint32_t addr, size_t size) const
+    {
+        throw std::out_of_range(label + ": access of " + std::to_string(size) + " bytes at " +
+                to_hex(addr) + " is outside of " + to_hex(uint32_t(memorybytes.size())) + " bytes");
+    }
+};
+
 template <class MEMORY, class TYPE>
 void set(MEMORY& memory, uint32_t address, const TYPE& value)
 {
@@ -212,11 +268,26 @@ std::string base64Encode(const std::string &in) {
     return out;
 }
 
+// Whether the string is a non-negative decimal number.
+static bool isNumber(const char *s)
+{
+    return *s != '\0' && strspn(s, "0123456789") == strlen(s);
+}
+
+// Cores take tiles of the image from a shared queue as they become free,
+// so a few expensive tiles don't hold up the frame.
+static const int DEFAULT_TILE_WIDTH = 32;
+static const int DEFAULT_TILE_HEIGHT = 4;
+
+// Hardware the timing model's estimates are for.
+static const double DEFAULT_CLOCK_MHZ = 50;
+static const int DEFAULT_CORE_COUNT = 1;
+
 void usage(const char* progname)
 {
     printf("usage: %s [options] shader.blob\n", progname);
     printf("options:\n");
-    printf("\t-f N         Render frame N\n");
+    printf("\t-f N [M]     Render frame N, or frames N through M to emulated-NNN.ppm\n");
     printf("\t-v           Print memory access\n");
     printf("\t-S           Show the disassembly of the SPIR-V code\n");
     printf("\t--term       Draw output image on terminal (in addition to file)\n");
@@ -226,8 +297,23 @@ void usage(const char* progname)
     printf("\t-j N         Use N threads [%d]\n",
             int(std::thread::hardware_concurrency()));
     printf("\t--pixel X Y  Render only pixel X and Y\n");
+    printf("\t--tile W H   Hand out W by H pixel tiles to the cores [%d %d]\n",
+            DEFAULT_TILE_WIDTH, DEFAULT_TILE_HEIGHT);
     printf("\t--subst      Print which library functions were substituted\n");
     printf("\t--libhist    Print which library functions were called and how many times\n");
+    printf("\t--block-profile FILE\n");
+    printf("\t             Write how many times each text label was reached to FILE,\n");
+    printf("\t             for \"shade -p\"\n");
+    printf("\t--heatmap    Also write the estimated cycles of each pixel to emulated-heat.ppm\n");
+    printf("\t             and each row's total to emulated-heat.txt\n");
+    printf("\t--profile FILE\n");
+    printf("\t             Write the instructions and text labels that took the most\n");
+    printf("\t             cycles to FILE\n");
+    printf("\t--listing FILE\n");
+    printf("\t             Annotate this \"as -v\" listing of the program in the profile\n");
+    printf("\t--cycles FILE  Read \"mnemonic cycles\" lines for the timing model\n");
+    printf("\t--clock MHZ    Core clock for the estimates [%g]\n", DEFAULT_CLOCK_MHZ);
+    printf("\t--cores N      Number of hardware cores for the estimates [%d]\n", DEFAULT_CORE_COUNT);
 }
 
 struct CoreShared
@@ -237,21 +323,79 @@ struct CoreShared
     std::vector<uint8_t> sdram;
     std::mutex rendererMutex;
 
-    // Number of rows still left to shade (for progress report).
-    std::atomic_int rowsLeft;
+    // Number of tiles still left to shade (for progress report).
+    std::atomic_int tilesLeft;
+
+    // Next tile of the frame for a core to take.
+    std::atomic_int nextTile;
+
+    // Frames are shaded one at a time. Cores wait for startedFrame to
+    // reach their next frame, and the main thread waits for coresFinished
+    // to reach the number of cores. Both require rendererMutex.
+    std::condition_variable frameChanged;
+    int startedFrame;
+    int coresFinished = 0;
+
+    void startFrame(int frame, int tiles)
+    {
+        {
+            std::scoped_lock l(rendererMutex);
+            coresFinished = 0;
+            tilesLeft = tiles;
+            nextTile = 0;
+            startedFrame = frame;
+        }
+        frameChanged.notify_all();
+    }
+    void waitForFrame(int frame)
+    {
+        std::unique_lock l(rendererMutex);
+        frameChanged.wait(l, [&]{ return startedFrame >= frame; });
+    }
+    void finishFrame()
+    {
+        {
+            std::scoped_lock l(rendererMutex);
+            coresFinished++;
+        }
+        frameChanged.notify_all();
+    }
+    void waitForCores(int coreCount)
+    {
+        std::unique_lock l(rendererMutex);
+        frameChanged.wait(l, [&]{ return coresFinished == coreCount; });
+    }
+    // Index of a tile nobody else has taken this frame. It's past the
+    // last tile when the frame has been handed out.
+    int takeTile()
+    {
+        return nextTile++;
+    }
 
     // These require exclusion using rendererMutex
     std::set<std::string> substitutedFunctions;
     std::map<std::string, int> libraryFunctionHistogram;
     std::map<std::string, int> instructionHistogram;
     uint64_t dispatchedCount = 0;
+    uint64_t cycles = 0;
     uint32_t minSP = 0xFFFFFFFF;
+
+    // Number of times each instruction ran, and how many of those were
+    // stores to SDRAM, indexed by PC/4. Only filled if
+    // CoreParameters::countPCs is set.
+    std::vector<uint64_t> pcCounts;
+    std::vector<uint64_t> sdramStoreCounts;
+
+    // Cycles charged to each word of SDRAM by the core that stored it,
+    // indexed by address/4. Only filled if CoreParameters::heatmap is set.
+    std::vector<uint32_t> sdramWordCycles;
 };
 
 struct CoreParameters
 {
     std::vector<uint8_t> text_bytes;
     std::vector<uint8_t> data_bytes;
+    DecodedText decodedText;
     SymbolTable text_symbols;
     SymbolTable data_symbols;
 
@@ -263,15 +407,46 @@ struct CoreParameters
     uint32_t rowWidthAddress;
     uint32_t colBufAddrAddress;
 
+    // Where .mainLoop gets the rows of a tile, or 0xFFFFFFFF if the
+    // library only does one row per call.
+    uint32_t rowCountAddress;
+    uint32_t colBufRowStrideAddress;
+
     uint32_t initialPC;
 
+    // Whether to count how many times each instruction runs.
+    bool countPCs = false;
+
+    // Whether to count how many times each text symbol is reached.
+    bool countLibraryCalls = false;
+
+    // Estimates the hardware's cycles for the cores.
+    const TimingModel *timing = nullptr;
+
+    // Whether to charge cycles to the pixels for a heatmap.
+    bool heatmap = false;
+
+    // The uniform block of the preamble, or 0xFFFFFFFF if there isn't one.
+    uint32_t anonymousAddress;
+    uint32_t anonymousSize;
+
     int imageWidth;
     int imageHeight;
-    float frameTime;
+
+    // Range of frames to shade, inclusive. iTime is the frame over 60.
+    int firstFrame = 0;
+    int lastFrame = 0;
     int startX;
     int startY;
     int afterLastX;
     int afterLastY;
+
+    // The region above is cut into tiles, numbered left to right and
+    // then top to bottom. Tiles on the right and bottom may be smaller.
+    int tileWidth;
+    int tileHeight;
+    int tilesAcross;
+    int tileCount;
 };
 
 struct GPUEmuDebugOptions
@@ -284,24 +459,24 @@ struct GPUEmuDebugOptions
 // Thread to show progress to the user.
 void showProgress(const CoreParameters* tmpl, CoreShared* shared, std::chrono::time_point<std::chrono::steady_clock> startTime)
 {
-    int totalRows = tmpl->afterLastY - tmpl->startY;
+    int totalTiles = tmpl->tileCount;
 
     while(true) {
-        int left = shared->rowsLeft;
+        int left = shared->tilesLeft;
         if (left == 0) {
             break;
         }
 
-        std::cout << left << " rows left of " << totalRows;
+        std::cout << left << " tiles left of " << totalTiles;
 
         // Estimate time left.
-        if (left != totalRows) {
+        if (left != totalTiles) {
             auto now = std::chrono::steady_clock::now();
             auto elapsedTime = now - startTime;
             auto elapsedSeconds = double(elapsedTime.count())*
                 std::chrono::steady_clock::period::num/
                 std::chrono::steady_clock::period::den;
-            auto secondsLeft = elapsedSeconds*left/(totalRows - left);
+            auto secondsLeft = elapsedSeconds*left/(totalTiles - left);
 
             std::cout << " (" << int(secondsLeft) << " seconds left)   ";
         }
@@ -309,7 +484,7 @@ void showProgress(const CoreParameters* tmpl, CoreShared* shared, std::chrono::t
         std::cout.flush();
 
         // Wait one second while polling.
-        for (int i = 0; i < 100 && shared->rowsLeft > 0; i++) {
+        for (int i = 0; i < 100 && shared->tilesLeft > 0; i++) {
             std::this_thread::sleep_for(std::chrono::milliseconds(10));
         }
     }
@@ -318,115 +493,229 @@ void showProgress(const CoreParameters* tmpl, CoreShared* shared, std::chrono::t
     std::cout << "                                                             \r";
 }
 
-void render(const GPUEmuDebugOptions* debugOptions, const CoreParameters* tmpl, CoreShared* shared, int start_row, int skip_rows)
-{
-    uint64_t coreDispatchedCount = 0;
+// Offsets of the uniforms in the preamble's uniform block, which the
+// compiler lays out with std140 rules and labels ".anonymous".
+static const uint32_t IRESOLUTION_OFFSET = 0;
+static const uint32_t ITIME_OFFSET = 12;
+static const uint32_t ITIMEDELTA_OFFSET = 16;
+static const uint32_t IFRAME_OFFSET = 112;
 
-    ReadWriteMemory data_memory(tmpl->data_bytes, "data_memory");
-    ReadOnlyMemory text_memory(tmpl->text_bytes, "text_memory");
-    ReadWriteMemory sdram(shared->sdram, "sdram");
+// Set the uniforms for the frame, if the shader has them.
+template <class MEMORY>
+void setFrameUniforms(MEMORY& data_memory, const CoreParameters* tmpl, int frame)
+{
+    uint32_t address = tmpl->anonymousAddress;
 
-    GPUCore core(tmpl->text_symbols);
-    GPUCore::Status status;
+    if(address == 0xFFFFFFFF) {
+        return;
+    }
 
     const float fw = tmpl->imageWidth;
     const float fh = tmpl->imageHeight;
     const float one = 1.0;
 
-    if (tmpl->data_symbols.find(".anonymous") != tmpl->data_symbols.end()) {
-        set(data_memory, tmpl->data_symbols.find(".anonymous")->second, v3float{fw, fh, one});
-        set(data_memory, tmpl->data_symbols.find(".anonymous")->second + sizeof(v3float), tmpl->frameTime);
+    set(data_memory, address + IRESOLUTION_OFFSET, v3float{fw, fh, one});
+    set(data_memory, address + ITIME_OFFSET, frame / 60.0f);
+    if(tmpl->anonymousSize >= ITIMEDELTA_OFFSET + sizeof(float)) {
+        set(data_memory, address + ITIMEDELTA_OFFSET, 1 / 60.0f);
+    }
+    if(tmpl->anonymousSize >= IFRAME_OFFSET + sizeof(int32_t)) {
+        set(data_memory, address + IFRAME_OFFSET, int32_t(frame));
     }
+}
 
-    for(int j = start_row; j < tmpl->afterLastY; j += skip_rows) {
-        GPUCore::Registers oldRegs;
+// Shade tiles of every frame using memory of type RWM until the frame's
+// tiles run out. With FlatMemory the core runs a basic block at a time;
+// otherwise it's stepped so it can be traced. The core and its memory are
+// kept from frame to frame.
+template <class RWM>
+void renderTiles(const GPUEmuDebugOptions* debugOptions, const CoreParameters* tmpl, CoreShared* shared, int coreNumber)
+{
+    constexpr bool runBlocks = std::is_same_v<RWM, FlatMemory>;
+    std::vector<uint64_t> corePcCounts(tmpl->countPCs ? tmpl->text_bytes.size()/4 : 0);
+    std::vector<uint64_t> coreSdramStoreCounts(corePcCounts.size());
 
-        if(shared->coreHadAnException) {
-            return;
-        }
+    RWM data_memory(tmpl->data_bytes, "data_memory");
+    ReadOnlyMemory text_memory(tmpl->text_bytes, "text_memory");
+    RWM sdram(shared->sdram, "sdram");
 
-        if(tmpl->gl_FragCoordAddress != 0xFFFFFFFF) {
-            set(data_memory, tmpl->gl_FragCoordAddress, v4float{tmpl->startX + 0.5f, j + 0.5f, 0, 0});
-        }
-        if(tmpl->colorAddress != 0xFFFFFFFF) {
-            set(data_memory, tmpl->colorAddress, v4float{1, 1, 1, 1});
-        }
-        if(false) {
-            // XXX TODO: when iTime is exported by compilation
-            set(data_memory, tmpl->iTimeAddress, tmpl->frameTime);
-        }
-        uint32_t width = tmpl->afterLastX - tmpl->startX;
-        set(data_memory, tmpl->rowWidthAddress, width);
-        // Offset in pixels into the image.
-        uint32_t pixelOffset = (tmpl->imageHeight - 1 - j)*tmpl->imageWidth + tmpl->startX;
-        // Offset in bytes into the shared memory space.
-        uint32_t sdramAddr = pixelOffset*3*sizeof(float);
-        set(data_memory, tmpl->colBufAddrAddress, sdramAddr | 0x80000000);
+    GPUCore core(tmpl->text_symbols, tmpl->decodedText);
+    core.countLibraryCalls = tmpl->countLibraryCalls;
+    core.timing = tmpl->timing;
+    if(tmpl->countPCs) {
+        core.sdramStoreCounts = coreSdramStoreCounts.data();
+    }
+    if(tmpl->heatmap) {
+        core.sdramWordCycles = shared->sdramWordCycles.data();
+    }
+    GPUCore::Status status;
 
-        core.regs.x[1] = 0xfffffffe; // Set RA to unlikely value to catch ret with no caller
-        core.regs.pc = tmpl->initialPC;
+    TranslatedText<RWM> translatedText(tmpl->decodedText, tmpl->timing);
 
-        if(debugOptions->printDisassembly) {
-            std::cout << "; pixel " << tmpl->startX << ", " << j << '\n';
-        }
+    for(int frame = tmpl->firstFrame; frame <= tmpl->lastFrame && !shared->coreHadAnException; frame++) {
+        uint64_t coreDispatchedCount = 0;
 
-        try {
-            do {
-                if(debugOptions->printCoreDiff) {
-                    oldRegs = core.regs;
-                }
-                if(debugOptions->printDisassembly) {
-                    print_inst(core.regs.pc, text_memory.read32(core.regs.pc), tmpl->textAddressesToSymbols);
+        shared->waitForFrame(frame);
+
+        // Start over from the data segment, which resets the stack and
+        // makes the uniform prologue run again with this frame's uniforms.
+        data_memory.memorybytes = tmpl->data_bytes;
+        setFrameUniforms(data_memory, tmpl, frame);
+
+        for(int tile = shared->takeTile(); tile < tmpl->tileCount; tile = shared->takeTile()) {
+            GPUCore::Registers oldRegs;
+
+            if(shared->coreHadAnException) {
+                break;
+            }
+
+            int x = tmpl->startX + tile % tmpl->tilesAcross * tmpl->tileWidth;
+            int y = tmpl->startY + tile / tmpl->tilesAcross * tmpl->tileHeight;
+            int width = std::min(tmpl->tileWidth, tmpl->afterLastX - x);
+            int height = std::min(tmpl->tileHeight, tmpl->afterLastY - y);
+
+            if(tmpl->gl_FragCoordAddress != 0xFFFFFFFF) {
+                set(data_memory, tmpl->gl_FragCoordAddress, v4float{x + 0.5f, y + 0.5f, 0, 0});
+            }
+            if(tmpl->colorAddress != 0xFFFFFFFF) {
+                set(data_memory, tmpl->colorAddress, v4float{1, 1, 1, 1});
+            }
+            if(false) {
+                // XXX TODO: when iTime is exported by compilation
+                set(data_memory, tmpl->iTimeAddress, frame / 60.0f);
+            }
+            set(data_memory, tmpl->rowWidthAddress, uint32_t(width));
+            // Offset in pixels into the image. The image is stored bottom
+            // row first, so each row of the tile is a row earlier.
+            uint32_t pixelOffset = (tmpl->imageHeight - 1 - y)*tmpl->imageWidth + x;
+            // Offset in bytes into the shared memory space.
+            uint32_t sdramAddr = pixelOffset*3*sizeof(float);
+            set(data_memory, tmpl->colBufAddrAddress, sdramAddr | 0x80000000);
+            if(tmpl->rowCountAddress != 0xFFFFFFFF) {
+                set(data_memory, tmpl->rowCountAddress, uint32_t(height));
+                set(data_memory, tmpl->colBufRowStrideAddress, -int32_t(tmpl->imageWidth*3*sizeof(float)));
+            }
+
+            core.regs.x[1] = 0xfffffffe; // Set RA to unlikely value to catch ret with no caller
+            core.regs.pc = tmpl->initialPC;
+            core.lastSdramStoreCycles = core.cycles;
+
+            if(debugOptions->printDisassembly) {
+                std::cout << "; pixel " << x << ", " << y << '\n';
+            }
+
+            try {
+                if constexpr (runBlocks) {
+                    status = translatedText.run(core, data_memory, sdram, 0xfffffffe, coreDispatchedCount);
+                } else {
+                    do {
+                        if(debugOptions->printCoreDiff) {
+                            oldRegs = core.regs;
+                        }
+                        if(debugOptions->printDisassembly) {
+                            print_inst(core.regs.pc, text_memory.read32(core.regs.pc), tmpl->textAddressesToSymbols);
+                        }
+                        if(debugOptions->printMemoryAccess && !debugOptions->printDisassembly) {
+                            // The core runs pre-decoded instructions, so show the fetch here.
+                            text_memory.verbose = true;
+                            text_memory.read32(core.regs.pc);
+                            text_memory.verbose = false;
+                        }
+                        data_memory.verbose = debugOptions->printMemoryAccess;
+                        sdram.verbose = debugOptions->printMemoryAccess;
+                        if(tmpl->countPCs && core.regs.pc/4 < corePcCounts.size()) {
+                            corePcCounts[core.regs.pc/4]++;
+                        }
+                        status = core.step(data_memory, sdram);
+                        coreDispatchedCount ++;
+                        data_memory.verbose = false;
+                        sdram.verbose = false;
+                        if(debugOptions->printCoreDiff) {
+                            dumpRegsDiff(oldRegs, core.regs);
+                        }
+                    } while(core.regs.pc != 0xfffffffe && status == GPUCore::RUNNING);
                 }
-                data_memory.verbose = debugOptions->printMemoryAccess;
-                text_memory.verbose = debugOptions->printMemoryAccess && !debugOptions->printDisassembly;
-                sdram.verbose = debugOptions->printMemoryAccess;
-                status = core.step(text_memory, data_memory, sdram);
-                coreDispatchedCount ++;
-                data_memory.verbose = false;
-                text_memory.verbose = false;
-                sdram.verbose = false;
-                if(debugOptions->printCoreDiff) {
-                    dumpRegsDiff(oldRegs, core.regs);
+            } catch(const std::exception& e) {
+                std::cerr << "core " << coreNumber << ", " << e.what() << '\n';
+                dumpGPUCore(core);
+                shared->coreHadAnException = true;
+                break;
+            }
+
+            if(status != GPUCore::BREAK) {
+                std::cerr << "core " << coreNumber << ", " << "unexpected core step result " << status << '\n';
+                dumpGPUCore(core);
+                shared->coreHadAnException = true;
+                break;
+            }
+
+            // Convert to bytes.
+            for (int row = 0; row < height; row++) {
+                uint8_t *rgbByte = shared->img + pixelOffset*3;
+                uint32_t rowAddr = sdramAddr;
+                for (int i = 0; i < width; i++) {
+                    for (int c = 0; c < 3; c++) {
+                        rgbByte[c] = std::clamp(int(sdram.readf(rowAddr) * 255.99), 0, 255);
+                        rowAddr += sizeof(float);
+                    }
+                    rgbByte += 3;
                 }
-            } while(core.regs.pc != 0xfffffffe && status == GPUCore::RUNNING);
-        } catch(const std::exception& e) {
-            std::cerr << "core " << start_row << ", " << e.what() << '\n';
-            dumpGPUCore(core);
-            shared->coreHadAnException = true;
-            return;
-        }
-
-        if(status != GPUCore::BREAK) {
-            std::cerr << "core " << start_row << ", " << "unexpected core step result " << status << '\n';
-            dumpGPUCore(core);
-            shared->coreHadAnException = true;
-            return;
-        }
-
-        // Convert to bytes.
-        uint8_t *rgbByte = shared->img + pixelOffset*3;
-        for (int i = 0; i < width; i++) {
-            for (int c = 0; c < 3; c++) {
-                rgbByte[c] = std::clamp(int(sdram.readf(sdramAddr) * 255.99), 0, 255);
-                sdramAddr += sizeof(float);
+                pixelOffset -= tmpl->imageWidth;
+                sdramAddr -= tmpl->imageWidth*3*sizeof(float);
+            }
+
+            shared->tilesLeft --;
+        }
+        {
+            std::scoped_lock l(shared->rendererMutex);
+            shared->dispatchedCount += coreDispatchedCount;
+            shared->cycles += core.cycles;
+            for(auto [func, count] : core.libraryFunctionHistogram) {
+                shared->libraryFunctionHistogram[func] += count;
+            }
+            for(auto [func, count] : core.instructionHistogram) {
+                shared->instructionHistogram[func] += count;
             }
-            rgbByte += 3;
+            core.libraryFunctionHistogram.clear();
+            core.instructionHistogram.clear();
+            core.cycles = 0;
         }
+        shared->finishFrame();
+    }
 
-        shared->rowsLeft --;
+    if constexpr (runBlocks) {
+        if(tmpl->countPCs) {
+            translatedText.addPcCounts(corePcCounts);
+        }
     }
     {
         std::scoped_lock l(shared->rendererMutex);
-        shared->dispatchedCount += coreDispatchedCount;
-        shared->substitutedFunctions.insert(core.substitutedFunctions.begin(), core.substitutedFunctions.end());
-        for(auto [func, count] : core.libraryFunctionHistogram) {
-            shared->libraryFunctionHistogram[func] += count;
-        }
-        for(auto [func, count] : core.instructionHistogram) {
-            shared->instructionHistogram[func] += count;
+        for(auto& [name, subst]: GPUCore::substitutions()) {
+            if(core.substituted[subst]) {
+                shared->substitutedFunctions.insert(name);
+            }
         }
         shared->minSP = std::min(shared->minSP, core.minSP);
+        shared->pcCounts.resize(corePcCounts.size());
+        shared->sdramStoreCounts.resize(coreSdramStoreCounts.size());
+        for(size_t i = 0; i < corePcCounts.size(); i++) {
+            shared->pcCounts[i] += corePcCounts[i];
+            shared->sdramStoreCounts[i] += coreSdramStoreCounts[i];
+        }
+    }
+}
+
+void render(const GPUEmuDebugOptions* debugOptions, const CoreParameters* tmpl, CoreShared* shared, int coreNumber)
+{
+    // Only the slower memory can show accesses, and the core has to be
+    // stepped to trace each instruction.
+    bool tracing = debugOptions->printDisassembly || debugOptions->printMemoryAccess ||
+        debugOptions->printCoreDiff || makeInstructionHistogram || dump;
+
+    if(tracing) {
+        renderTiles<ReadWriteMemory>(debugOptions, tmpl, shared, coreNumber);
+    } else {
+        renderTiles<FlatMemory>(debugOptions, tmpl, shared, coreNumber);
     }
 }
 
@@ -458,17 +747,22 @@ static bool nearlyEqual(float a, float b, float epsilon) {
 
 /**
  * Run the specified math function. The parameters are in normal parameter order (i.e.,
- * in the order they'd be passed in C code).
+ * in the order they'd be passed in C code). If runBlocks is true, run it a basic
+ * block at a time like render() does, otherwise one step at a time, with
+ * GPUCore::referenceRounding set to referenceRounding.
  */
 static float runMathFunction(GPUEmuDebugOptions *debugOptions, CoreParameters *tmpl,
-        const std::string &funcName, const std::vector<float> &params) {
+        const std::string &funcName, const std::vector<float> &params, bool runBlocks,
+        bool referenceRounding = false) {
 
     ReadWriteMemory data_memory(tmpl->data_bytes, "data_memory", false);
     ReadOnlyMemory text_memory(tmpl->text_bytes, "text_memory", false);
     std::vector<uint8_t> sdram_buffer; // Empty, shouldn't be accessed.
     ReadWriteMemory sdram(sdram_buffer, "sdram", false);
 
-    GPUCore core(tmpl->text_symbols);
+    GPUCore core(tmpl->text_symbols, tmpl->decodedText);
+    core.countLibraryCalls = tmpl->countLibraryCalls;
+    core.referenceRounding = referenceRounding;
     GPUCore::Status status;
 
     // Find address of function.
@@ -482,13 +776,6 @@ static float runMathFunction(GPUEmuDebugOptions *debugOptions, CoreParameters *t
     // Set up the stack.
     core.regs.x[2] = RiscVInitialStackPointer;
 
-    // Push parameters in reverse order.
-    for (auto itr = params.rbegin(); itr != params.rend(); ++itr) {
-        float param = *itr;
-        core.regs.x[2] -= 4;
-        data_memory.writef(core.regs.x[2], param);
-    }
-
     // Set RA to catch final return.
     core.regs.x[1] = 0xfffffffe;
 
@@ -500,26 +787,45 @@ static float runMathFunction(GPUEmuDebugOptions *debugOptions, CoreParameters *t
         core.regs.f[i] = i*i*i + 123;
     }
 
+    // Parameters go in fa0 through fa7.
+    assert(params.size() <= 8);
+    for (size_t i = 0; i < params.size(); i++) {
+        core.regs.f[10 + i] = params[i];
+    }
+
     GPUCore::Registers oldRegs;
     try {
-        do {
-            if(debugOptions->printCoreDiff) {
-                oldRegs = core.regs;
-            }
-            if(debugOptions->printDisassembly) {
-                print_inst(core.regs.pc,
-                        text_memory.read32(core.regs.pc),
-                        tmpl->textAddressesToSymbols);
-            }
-            data_memory.verbose = debugOptions->printMemoryAccess;
-            text_memory.verbose = debugOptions->printMemoryAccess;
-            status = core.step(text_memory, data_memory, sdram);
-            data_memory.verbose = false;
-            text_memory.verbose = false;
-            if(debugOptions->printCoreDiff) {
-                dumpRegsDiff(oldRegs, core.regs);
-            }
-        } while(core.regs.pc != 0xfffffffe && status == GPUCore::RUNNING);
+        if(runBlocks) {
+            // Same as render() without tracing.
+            FlatMemory flat_data_memory(tmpl->data_bytes, "data_memory");
+            FlatMemory flat_sdram(sdram_buffer, "sdram");
+            TranslatedText<FlatMemory> translatedText(tmpl->decodedText);
+            uint64_t dispatchedCount = 0;
+            status = translatedText.run(core, flat_data_memory, flat_sdram, 0xfffffffe, dispatchedCount);
+        } else {
+            do {
+                if(debugOptions->printCoreDiff) {
+                    oldRegs = core.regs;
+                }
+                if(debugOptions->printDisassembly) {
+                    print_inst(core.regs.pc,
+                            text_memory.read32(core.regs.pc),
+                            tmpl->textAddressesToSymbols);
+                }
+                if(debugOptions->printMemoryAccess) {
+                    // The core runs pre-decoded instructions, so show the fetch here.
+                    text_memory.verbose = true;
+                    text_memory.read32(core.regs.pc);
+                    text_memory.verbose = false;
+                }
+                data_memory.verbose = debugOptions->printMemoryAccess;
+                status = core.step(data_memory, sdram);
+                data_memory.verbose = false;
+                if(debugOptions->printCoreDiff) {
+                    dumpRegsDiff(oldRegs, core.regs);
+                }
+            } while(core.regs.pc != 0xfffffffe && status == GPUCore::RUNNING);
+        }
     } catch(const std::exception& e) {
         std::cerr << "Exception running step: " << e.what() << '\n';
         dumpGPUCore(core);
@@ -532,20 +838,54 @@ static float runMathFunction(GPUEmuDebugOptions *debugOptions, CoreParameters *t
         exit(EXIT_FAILURE);
     }
 
-    // Check registers so we can see which ones aren't being saved.
+    // Check registers so we can see which ones aren't being saved. The
+    // argument registers a0-a7 and fa0-fa7 may be clobbered.
+    if (core.regs.x[2] != RiscVInitialStackPointer) {
+        std::cerr << "Error: Stack pointer isn't being restored in " << funcName << "\n";
+    }
     for (unsigned int i = 3; i < 32; i++) {
-        if (core.regs.x[i] != i*i*i) {
+        if ((i < 10 || i > 17) && core.regs.x[i] != i*i*i) {
             std::cerr << "Error: Register x" << i << " isn't being saved in " << funcName << "\n";
         }
     }
     for (unsigned int i = 0; i < 32; i++) {
-        if (core.regs.f[i] != i*i*i + 123) {
+        if ((i < 10 || i > 17) && core.regs.f[i] != i*i*i + 123) {
             std::cerr << "Error: Register f" << i << " isn't being saved in " << funcName << "\n";
         }
     }
 
-    // Pop result off the stack.
-    return data_memory.readf(core.regs.x[2]);
+    // Result is in fa0.
+    return core.regs.f[10];
+}
+
+/**
+ * Run the math function with the reference rounding of GPUCore::referenceRounding,
+ * which switches the host's rounding mode around every instruction like the
+ * emulator used to, then stepped and a basic block at a time, which take
+ * shortcuts. The results must be bit for bit the same as the reference.
+ * Returns the reference result.
+ */
+static float runMathFunctionAllWays(GPUEmuDebugOptions *debugOptions, CoreParameters *tmpl,
+        const std::string &funcName, const std::vector<float> &params, int &errors) {
+
+    // Only trace the reference run.
+    GPUEmuDebugOptions quiet;
+    float referenceValue = runMathFunction(debugOptions, tmpl, funcName, params, false, true);
+    float steppedValue = runMathFunction(&quiet, tmpl, funcName, params, false);
+    float blockValue = runMathFunction(debugOptions, tmpl, funcName, params, true);
+
+    if (floatToInt(steppedValue) != floatToInt(referenceValue)) {
+        std::cout << funcName << " gives " << to_hex(floatToInt(steppedValue))
+            << " stepped instead of " << to_hex(floatToInt(referenceValue)) << "\n";
+        errors++;
+    }
+    if (floatToInt(blockValue) != floatToInt(referenceValue)) {
+        std::cout << funcName << " gives " << to_hex(floatToInt(blockValue))
+            << " run by blocks instead of " << to_hex(floatToInt(referenceValue)) << "\n";
+        errors++;
+    }
+
+    return referenceValue;
 }
 
 /**
@@ -559,7 +899,7 @@ static void tryUnaryFunction(GPUEmuDebugOptions *debugOptions, CoreParameters *t
     params.push_back(param);
 
     float expectedValue = func(param);
-    float actualValue = runMathFunction(debugOptions, tmpl, funcName, params);
+    float actualValue = runMathFunctionAllWays(debugOptions, tmpl, funcName, params, errors);
 
     if (!nearlyEqual(expectedValue, actualValue, 0.000001)) {
         std::cout << funcName << "(" << param << ") = "
@@ -573,7 +913,7 @@ static void tryUnaryFunction(GPUEmuDebugOptions *debugOptions, CoreParameters *t
  */
 static void tryBinaryFunction(GPUEmuDebugOptions *debugOptions, CoreParameters *tmpl,
         const std::string &funcName, float (*func)(float,float),
-        float param1, float param2, int &errors) {
+        float param1, float param2, int &errors, float epsilon = 0.000001) {
 
     // Function parameters.
     std::vector<float> params;
@@ -581,9 +921,9 @@ static void tryBinaryFunction(GPUEmuDebugOptions *debugOptions, CoreParameters *
     params.push_back(param2);
 
     float expectedValue = func(param1, param2);
-    float actualValue = runMathFunction(debugOptions, tmpl, funcName, params);
+    float actualValue = runMathFunctionAllWays(debugOptions, tmpl, funcName, params, errors);
 
-    if (!nearlyEqual(expectedValue, actualValue, 0.000001)) {
+    if (!nearlyEqual(expectedValue, actualValue, epsilon)) {
         std::cout << funcName << "(" << param1 << ", " << param2 << ") = "
             << actualValue << " instead of " << expectedValue << "\n";
         errors++;
@@ -604,7 +944,7 @@ static void tryTernaryFunction(GPUEmuDebugOptions *debugOptions, CoreParameters
     params.push_back(param3);
 
     float expectedValue = func(param1, param2, param3);
-    float actualValue = runMathFunction(debugOptions, tmpl, funcName, params);
+    float actualValue = runMathFunctionAllWays(debugOptions, tmpl, funcName, params, errors);
 
     if (!nearlyEqual(expectedValue, actualValue, 0.000001)) {
         std::cout << funcName << "(" << param1 << ", " << param2 << ", " << param3 << ") = "
@@ -683,9 +1023,138 @@ static void runLibraryTest(GPUEmuDebugOptions *debugOptions, CoreParameters *tmp
     tryTernaryFunction(debugOptions, tmpl, ".smoothstep", smoothstep, 0.0, 0.0, 0.0, errors);
     tryTernaryFunction(debugOptions, tmpl, ".smoothstep", smoothstep, 0.0, 0.0, 1.0, errors);
 
+    // .floor
+    for (float x = -10.5; x < 10; x += 0.75) {
+        tryUnaryFunction(debugOptions, tmpl, ".floor", floorf, x, errors);
+    }
+
+    // .atan2. The library interpolates linearly between the 129 entries of
+    // atanTable_f32, which is off by up to (1/128)^2/8 times the largest
+    // second derivative of atan (0.65), about 5e-6.
+    const float atanEpsilon = 0.00001;
+    tryBinaryFunction(debugOptions, tmpl, ".atan2", atan2f, 1.5, 2.5, errors, atanEpsilon);
+    tryBinaryFunction(debugOptions, tmpl, ".atan2", atan2f, 1.5, -2.5, errors, atanEpsilon);
+    tryBinaryFunction(debugOptions, tmpl, ".atan2", atan2f, -1.5, -2.5, errors, atanEpsilon);
+    tryBinaryFunction(debugOptions, tmpl, ".atan2", atan2f, -1.5, 2.5, errors, atanEpsilon);
+
     std::cout << errors << " test errors.\n";
 }
 
+// Column text of an instruction's count, estimated cycles, and percent of
+// all cycles for the profile listing.
+std::string profileColumns(uint64_t count, uint64_t cycles, uint64_t totalCycles)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%12" PRIu64 " %14" PRIu64 " %6.2f%%  ",
+            count, cycles, totalCycles == 0 ? 0.0 : cycles*100.0/totalCycles);
+    return buf;
+}
+
+// Headings of the columns above.
+std::string profileHeadings()
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%12s %14s %7s  ", "count", "cycles", "percent");
+    return buf;
+}
+
+// Write where the cycles went: first the text labels by estimated cycles,
+// then each instruction with its count, cycles, and percent of the total.
+// An instruction's cycles are charged to the label before it. If
+// listingPathname isn't empty, its instruction lines are annotated, so the
+// instructions show up with their source; otherwise they're disassembled.
+void writeProfile(const std::string& pathname, const std::string& listingPathname,
+        const CoreParameters& tmpl, const CoreShared& shared)
+{
+    std::ofstream profileFile(pathname);
+    if(!profileFile.good()) {
+        std::cerr << "Error: Can't open profile " << pathname << " for writing.\n";
+        exit(EXIT_FAILURE);
+    }
+
+    size_t count = shared.pcCounts.size();
+    std::vector<uint64_t> pcCycles(count);
+    uint64_t totalCycles = 0;
+    uint64_t totalCount = 0;
+    std::map<std::string, std::pair<uint64_t, uint64_t>> labelCountsAndCycles;
+    std::string label = "(start)";
+    for(size_t i = 0; i < count; i++) {
+        auto itr = tmpl.textAddressesToSymbols.find(i*4);
+        if(itr != tmpl.textAddressesToSymbols.end()) {
+            label = itr->second;
+        }
+        pcCycles[i] = shared.pcCounts[i]*tmpl.timing->cyclesFor(tmpl.decodedText[i]) +
+            shared.sdramStoreCounts[i]*tmpl.timing->sdramStoreCycles;
+        totalCycles += pcCycles[i];
+        totalCount += shared.pcCounts[i];
+        if(shared.pcCounts[i] != 0) {
+            labelCountsAndCycles[label].first += shared.pcCounts[i];
+            labelCountsAndCycles[label].second += pcCycles[i];
+        }
+    }
+
+    std::vector<std::pair<std::string, std::pair<uint64_t, uint64_t>>> labels(
+            labelCountsAndCycles.begin(), labelCountsAndCycles.end());
+    std::stable_sort(labels.begin(), labels.end(), [](auto& a, auto& b) {
+        return a.second.second > b.second.second;
+    });
+
+    profileFile << "; " << totalCount << " instructions, " << totalCycles << " cycles estimated.\n";
+    profileFile << ";\n";
+    profileFile << "; " << profileHeadings() << "label\n";
+    for(auto& [name, countAndCycles]: labels) {
+        profileFile << "; " << profileColumns(countAndCycles.first, countAndCycles.second, totalCycles)
+            << name << "\n";
+    }
+    profileFile << "\n";
+    profileFile << profileHeadings() << "instruction\n";
+
+    std::string blank(profileColumns(0, 0, 0).size(), ' ');
+    if(listingPathname.empty()) {
+        for(size_t i = 0; i < count; i++) {
+            auto itr = tmpl.textAddressesToSymbols.find(i*4);
+            if(itr != tmpl.textAddressesToSymbols.end()) {
+                profileFile << blank << itr->second << ":\n";
+            }
+            char buf[80] = { 0 };
+            uint32_t insn;
+            memcpy(&insn, tmpl.text_bytes.data() + i*4, sizeof(insn));
+            disasm_inst(buf, sizeof(buf), rv32, i*4, insn);
+            profileFile << profileColumns(shared.pcCounts[i], pcCycles[i], totalCycles)
+                << to_hex(uint32_t(i*4)) << "  " << buf << "\n";
+        }
+        return;
+    }
+
+    std::ifstream listingFile(listingPathname);
+    if(!listingFile.good()) {
+        std::cerr << "Error: Can't open listing " << listingPathname << ".\n";
+        exit(EXIT_FAILURE);
+    }
+
+    // Instruction lines start with the address and the word in hex. The
+    // rest, including the disassembly of each instruction, is indented.
+    std::string line;
+    while(std::getline(listingFile, line)) {
+        unsigned int address, insn;
+        if(!line.empty() && isxdigit(line[0]) &&
+                sscanf(line.c_str(), "%x %x", &address, &insn) == 2 && address/4 < count) {
+
+            uint32_t textInsn;
+            memcpy(&textInsn, tmpl.text_bytes.data() + address/4*4, sizeof(textInsn));
+            if(textInsn != insn) {
+                std::cerr << "Error: Listing " << listingPathname << " has " << to_hex(insn)
+                    << " at " << to_hex(address) << " instead of " << to_hex(textInsn) << ".\n";
+                exit(EXIT_FAILURE);
+            }
+            profileFile << profileColumns(shared.pcCounts[address/4], pcCycles[address/4], totalCycles)
+                << line << "\n";
+        } else {
+            profileFile << blank << line << "\n";
+        }
+    }
+}
+
 int main(int argc, char **argv)
 {
     bool imageToTerminal = false;
@@ -697,6 +1166,15 @@ int main(int argc, char **argv)
     int specificPixelX = -1;
     int specificPixelY = -1;
     int threadCount = std::thread::hardware_concurrency();
+    int tileWidth = DEFAULT_TILE_WIDTH;
+    int tileHeight = DEFAULT_TILE_HEIGHT;
+    bool frameRange = false;
+    std::string blockProfilePathname;
+    std::string cycleTablePathname;
+    std::string profilePathname;
+    std::string listingPathname;
+    double clockMhz = DEFAULT_CLOCK_MHZ;
+    int coreCount = DEFAULT_CORE_COUNT;
 
     GPUEmuDebugOptions debugOptions;
     CoreParameters tmpl;
@@ -722,6 +1200,17 @@ int main(int argc, char **argv)
             specificPixelY = atoi(argv[2]);
             argv+=3; argc-=3;
 
+        } else if(strcmp(argv[0], "--tile") == 0) {
+
+            if(argc < 3 || atoi(argv[1]) < 1 || atoi(argv[2]) < 1) {
+                std::cerr << "Expected tile width and height for \"--tile\"\n";
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            tileWidth = atoi(argv[1]);
+            tileHeight = atoi(argv[2]);
+            argv+=3; argc-=3;
+
         } else if(strcmp(argv[0], "--header") == 0) {
 
             printHeaderInfo = true;
@@ -758,9 +1247,22 @@ int main(int argc, char **argv)
                 usage(progname);
                 exit(EXIT_FAILURE);
             }
-            tmpl.frameTime = atoi(argv[1]) / 60.0f;
+            tmpl.firstFrame = tmpl.lastFrame = atoi(argv[1]);
             argv+=2; argc-=2;
 
+            // The last frame of a range is optional, so it's only there
+            // if it's a number and isn't the binary.
+            if(argc > 1 && isNumber(argv[0])) {
+                tmpl.lastFrame = atoi(argv[0]);
+                argv++; argc--;
+                frameRange = true;
+                if(tmpl.lastFrame < tmpl.firstFrame) {
+                    std::cerr << "Last frame for \"-f\" is before the first\n";
+                    usage(progname);
+                    exit(EXIT_FAILURE);
+                }
+            }
+
         } else if(strcmp(argv[0], "-d") == 0) {
 
             printSymbols = true;
@@ -769,6 +1271,12 @@ int main(int argc, char **argv)
         } else if(strcmp(argv[0], "--libhist") == 0) {
 
             printLibraryHistogram = true;
+            tmpl.countLibraryCalls = true;
+            argv++; argc--;
+
+        } else if(strcmp(argv[0], "--heatmap") == 0) {
+
+            tmpl.heatmap = true;
             argv++; argc--;
 
         } else if(strcmp(argv[0], "--subst") == 0) {
@@ -776,6 +1284,68 @@ int main(int argc, char **argv)
             printSubstitutions = true;
             argv++; argc--;
 
+        } else if(strcmp(argv[0], "--block-profile") == 0) {
+
+            if(argc < 2) {
+                std::cerr << "Expected pathname for \"--block-profile\"\n";
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            blockProfilePathname = argv[1];
+            tmpl.countPCs = true;
+            argv+=2; argc-=2;
+
+        } else if(strcmp(argv[0], "--profile") == 0) {
+
+            if(argc < 2) {
+                std::cerr << "Expected pathname for \"--profile\"\n";
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            profilePathname = argv[1];
+            tmpl.countPCs = true;
+            argv+=2; argc-=2;
+
+        } else if(strcmp(argv[0], "--listing") == 0) {
+
+            if(argc < 2) {
+                std::cerr << "Expected pathname for \"--listing\"\n";
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            listingPathname = argv[1];
+            argv+=2; argc-=2;
+
+        } else if(strcmp(argv[0], "--cycles") == 0) {
+
+            if(argc < 2) {
+                std::cerr << "Expected pathname for \"--cycles\"\n";
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            cycleTablePathname = argv[1];
+            argv+=2; argc-=2;
+
+        } else if(strcmp(argv[0], "--clock") == 0) {
+
+            if(argc < 2) {
+                std::cerr << "Expected megahertz for \"--clock\"\n";
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            clockMhz = atof(argv[1]);
+            argv+=2; argc-=2;
+
+        } else if(strcmp(argv[0], "--cores") == 0) {
+
+            if(argc < 2) {
+                std::cerr << "Expected core count for \"--cores\"\n";
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            coreCount = atoi(argv[1]);
+            argv+=2; argc-=2;
+
         } else if(strcmp(argv[0], "--test") == 0) {
 
             runTest = true;
@@ -826,11 +1396,35 @@ int main(int argc, char **argv)
     }
 
     tmpl.initialPC = header.initialPC;
+    tmpl.decodedText = decodeText(tmpl.text_bytes, tmpl.text_symbols);
 
     binaryFile.close();
 
-    for(auto& [symbol, address]: tmpl.text_symbols)
-        tmpl.textAddressesToSymbols[address] = symbol;
+    // The compiler's "profile." labels are only for the block profile, so
+    // prefer any other label at the same address.
+    for(auto& [symbol, address]: tmpl.text_symbols) {
+        if(symbol.compare(0, 8, "profile.") == 0) {
+            tmpl.textAddressesToSymbols.emplace(address, symbol);
+        } else {
+            tmpl.textAddressesToSymbols[address] = symbol;
+        }
+    }
+
+    auto anonymous = tmpl.data_symbols.find(".anonymous");
+    if(anonymous != tmpl.data_symbols.end()) {
+        // The block goes up to the next symbol or the end of the segment.
+        tmpl.anonymousAddress = anonymous->second;
+        uint32_t end = tmpl.data_bytes.size();
+        for(auto& [symbol, address]: tmpl.data_symbols) {
+            if(address > tmpl.anonymousAddress && address < end) {
+                end = address;
+            }
+        }
+        tmpl.anonymousSize = end - tmpl.anonymousAddress;
+    } else {
+        tmpl.anonymousAddress = 0xFFFFFFFF;
+        tmpl.anonymousSize = 0;
+    }
 
     assert(tmpl.data_bytes.size() < RiscVInitialStackPointer);
     if(tmpl.data_bytes.size() > RiscVInitialStackPointer - 1024) {
@@ -878,6 +1472,15 @@ int main(int argc, char **argv)
     }
     tmpl.rowWidthAddress = tmpl.data_symbols[".rowWidth"];
     tmpl.colBufAddrAddress = tmpl.data_symbols[".colBufAddr"];
+    if(tmpl.data_symbols.find(".rowCount") != tmpl.data_symbols.end()) {
+        tmpl.rowCountAddress = tmpl.data_symbols[".rowCount"];
+        tmpl.colBufRowStrideAddress = tmpl.data_symbols[".colBufRowStride"];
+    } else {
+        // Older library, .mainLoop shades a row at a time.
+        tmpl.rowCountAddress = 0xFFFFFFFF;
+        tmpl.colBufRowStrideAddress = 0xFFFFFFFF;
+        tileHeight = 1;
+    }
 
     tmpl.startX = 0;
     tmpl.afterLastX = tmpl.imageWidth;
@@ -891,19 +1494,92 @@ int main(int argc, char **argv)
         tmpl.afterLastY = specificPixelY + 1;
     }
 
+    tmpl.tileWidth = tileWidth;
+    tmpl.tileHeight = tileHeight;
+    tmpl.tilesAcross = (tmpl.afterLastX - tmpl.startX + tileWidth - 1) / tileWidth;
+    int tilesDown = (tmpl.afterLastY - tmpl.startY + tileHeight - 1) / tileHeight;
+    tmpl.tileCount = tmpl.tilesAcross * tilesDown;
+
+    std::map<std::string, int> cycleTable = defaultCycleTable();
+    if(!cycleTablePathname.empty()) {
+        loadCycleTable(cycleTablePathname, cycleTable);
+    }
+    TimingModel timing(cycleTable);
+    tmpl.timing = &timing;
+
     std::cout << "Using " << threadCount << " threads.\n";
 
+    // The cores stay around for all the frames.
     std::vector<std::thread *> thread;
 
-    shared.rowsLeft = tmpl.afterLastY - tmpl.startY;
+    if(tmpl.heatmap) {
+        shared.sdramWordCycles.resize(shared.sdram.size()/4);
+    }
 
+    shared.startedFrame = tmpl.firstFrame - 1;
     for (int t = 0; t < threadCount; t++) {
-        thread.push_back(new std::thread(render, &debugOptions, &tmpl, &shared, tmpl.startY + t, threadCount));
+        thread.push_back(new std::thread(render, &debugOptions, &tmpl, &shared, t));
     }
 
-    // Progress information.
-    Timer frameElapsed;
-    thread.push_back(new std::thread(showProgress, &tmpl, &shared, frameElapsed.startTime()));
+    Timer shadingElapsed;
+    for(int frame = tmpl.firstFrame; frame <= tmpl.lastFrame; frame++) {
+        Timer frameElapsed;
+
+        std::fill(shared.sdramWordCycles.begin(), shared.sdramWordCycles.end(), 0);
+        shared.startFrame(frame, tmpl.tileCount);
+
+        // Progress information.
+        std::thread progress(showProgress, &tmpl, &shared, frameElapsed.startTime());
+
+        shared.waitForCores(threadCount);
+
+        if(shared.coreHadAnException) {
+            // Let the progress thread finish.
+            shared.tilesLeft = 0;
+            progress.join();
+            exit(EXIT_FAILURE);
+        }
+        progress.join();
+
+        std::string imagePathname = "emulated.ppm";
+        std::string heatmapPathname = "emulated-heat";
+        if(frameRange) {
+            char name[32];
+            snprintf(name, sizeof(name), "emulated-%03d.ppm", frame);
+            imagePathname = name;
+            snprintf(name, sizeof(name), "emulated-heat-%03d", frame);
+            heatmapPathname = name;
+            std::cout << "frame " << frame << " took " << frameElapsed.elapsed() << " seconds.\n";
+        }
+
+        if(tmpl.heatmap) {
+            // Each pixel is three floats of SDRAM.
+            std::vector<uint64_t> pixelCycles(tmpl.imageWidth * tmpl.imageHeight);
+            for(size_t i = 0; i < pixelCycles.size(); i++) {
+                for(int c = 0; c < 3; c++) {
+                    pixelCycles[i] += shared.sdramWordCycles[i*3 + c];
+                }
+            }
+            writeHeatmap(pixelCycles, tmpl.imageWidth, tmpl.imageHeight, "cycles",
+                    heatmapPathname + ".ppm", heatmapPathname + ".txt");
+        }
+
+        FILE *fp = fopen(imagePathname.c_str(), "wb");
+        fprintf(fp, "P6 %d %d 255\n", tmpl.imageWidth, tmpl.imageHeight);
+        fwrite(shared.img, 1, tmpl.imageWidth * tmpl.imageHeight * 3, fp);
+        fclose(fp);
+
+        if (imageToTerminal) {
+            // https://www.iterm2.com/documentation-images.html
+            std::ostringstream ss;
+            ss << "P6 " << tmpl.imageWidth << " " << tmpl.imageHeight << " 255\n";
+            ss.write(reinterpret_cast<char *>(shared.img), 3*tmpl.imageWidth*tmpl.imageHeight);
+            std::cout << "\033]1337;File=width="
+                << tmpl.imageWidth << "px;height="
+                << tmpl.imageHeight << "px;inline=1:"
+                << base64Encode(ss.str()) << "\007\n";
+        }
+    }
 
     // Wait for worker threads to quit.
     while(!thread.empty()) {
@@ -912,10 +1588,6 @@ int main(int argc, char **argv)
         td->join();
     }
 
-    if(shared.coreHadAnException) {
-        exit(EXIT_FAILURE);
-    }
-
     if(printSubstitutions) {
         for(auto& subst: shared.substitutedFunctions) {
             std::cout << "substituted for " << subst << '\n';
@@ -931,28 +1603,38 @@ int main(int argc, char **argv)
         std::cout << insn.first << " : " << insn.second << "\n";
     }
 
-    std::cout << "shading took " << frameElapsed.elapsed() << " seconds.\n";
+    int frameCount = tmpl.lastFrame - tmpl.firstFrame + 1;
+    uint64_t pixelCount = uint64_t(tmpl.afterLastX - tmpl.startX)*(tmpl.afterLastY - tmpl.startY)*frameCount;
+    std::cout << "shading took " << shadingElapsed.elapsed() << " seconds.\n";
     std::cout << shared.dispatchedCount << " instructions executed.\n";
-    float fps = 50000000.0f / shared.dispatchedCount;
-    std::cout << fps << " fps estimated at 50 MHz.\n";
-    float wvgaFps = fps * tmpl.imageWidth / 800 * tmpl.imageHeight / 480;
-    std::cout << "at least " << (int)ceilf(5.0 / wvgaFps) << " cores required at 50 MHz for 5 fps at 800x480.\n";
+    std::cout << shared.cycles << " cycles estimated, "
+        << double(shared.cycles) / pixelCount << " cycles per pixel.\n";
+    // Assumes the work is spread evenly over the cores.
+    double coreFps = clockMhz * 1000000 * frameCount / shared.cycles;
+    std::cout << coreFps * coreCount << " fps estimated at " << clockMhz << " MHz on "
+        << coreCount << (coreCount == 1 ? " core" : " cores") << ".\n";
+    double wvgaFps = coreFps * tmpl.imageWidth / 800 * tmpl.imageHeight / 480;
+    std::cout << "at least " << (int)ceil(5.0 / wvgaFps) << " cores required at "
+        << clockMhz << " MHz for 5 fps at 800x480.\n";
 
     std::cout << "minimum stack pointer was " << to_hex(shared.minSP) << ".\n";
 
-    FILE *fp = fopen("emulated.ppm", "wb");
-    fprintf(fp, "P6 %d %d 255\n", tmpl.imageWidth, tmpl.imageHeight);
-    fwrite(shared.img, 1, tmpl.imageWidth * tmpl.imageHeight * 3, fp);
-    fclose(fp);
-
-    if (imageToTerminal) {
-        // https://www.iterm2.com/documentation-images.html
-        std::ostringstream ss;
-        ss << "P6 " << tmpl.imageWidth << " " << tmpl.imageHeight << " 255\n";
-        ss.write(reinterpret_cast<char *>(shared.img), 3*tmpl.imageWidth*tmpl.imageHeight);
-        std::cout << "\033]1337;File=width="
-            << tmpl.imageWidth << "px;height="
-            << tmpl.imageHeight << "px;inline=1:"
-            << base64Encode(ss.str()) << "\007\n";
+    if(!blockProfilePathname.empty()) {
+        // One line per text label, with the number of times the
+        // instruction at the label ran. The compiler's labels for this
+        // start with "profile.", see Program::profileLabel().
+        std::ofstream profileFile(blockProfilePathname);
+        if(!profileFile.good()) {
+            std::cerr << "Can't open block profile " << blockProfilePathname << " for writing\n";
+            exit(EXIT_FAILURE);
+        }
+        for(auto& [symbol, address]: tmpl.text_symbols) {
+            uint64_t count = address/4 < shared.pcCounts.size() ? shared.pcCounts[address/4] : 0;
+            profileFile << symbol << " " << count << "\n";
+        }
+    }
+
+    if(!profilePathname.empty()) {
+        writeProfile(profilePathname, listingPathname, tmpl, shared);
     }
 }
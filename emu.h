@@ -1,4 +1,6 @@
 #include <algorithm>
+#include <array>
+#include <utility>
 #include <cstdint>
 #include <math.h>
 #include <cmath>
@@ -10,12 +12,7 @@
 
 #include "util.h"
 #include "objectfile.h"
-
-const int RM_RNE = 0b000;
-const int RM_RTZ = 0b001;
-const int RM_RDN = 0b010;
-const int RM_RUP = 0b011;
-const int RM_TONEAREST_MAX = 0b100;
+#include "timing.h"
 
 // --- Copied from interpreter.cpp. Didn't bother putting in shared file ---
 // --- because these will be deleted when we move them to library.s      ---
@@ -47,6 +44,105 @@ static inline float fmix(float x, float y, float a)
 
 // -------------------------------------------------------------------------
 
+// Round to an integral value with a RISC-V rounding mode, for fcvt.w.s and
+// fcvt.wu.s. This doesn't use rint() and the host rounding mode, because
+// without -frounding-math the compiler may inline rint() as round to nearest.
+static inline float roundWithMode(float f, uint32_t rm)
+{
+    switch(rm) {
+        case RM_RTZ: return truncf(f);
+        case RM_RDN: return floorf(f);
+        case RM_RUP: return ceilf(f);
+        case RM_TONEAREST_MAX: return roundf(f);
+
+        default: {
+            // Nearest, ties to even.
+            float r = roundf(f);
+            return fabsf(r - f) == 0.5f ? 2.0f*roundf(f*0.5f) : r;
+        }
+    }
+}
+
+// Operations that instructions decode to. Each is a single instruction, so
+// step() doesn't need to look at any other fields to know what to do.
+enum DecodedOp {
+    INSN_UNIMPLEMENTED,
+    INSN_NOP,
+    INSN_SUBST,             // "addi x0, x0, 0" starting a substituted library routine.
+    INSN_EBREAK,
+
+    INSN_LUI,
+    INSN_JAL,
+    INSN_JALR,
+    INSN_BEQ, INSN_BNE, INSN_BLT, INSN_BGE, INSN_BLTU, INSN_BGEU,
+    INSN_LB, INSN_LH, INSN_LW, INSN_LBU, INSN_LHU,
+    INSN_SB, INSN_SH, INSN_SW,
+    INSN_ADDI, INSN_SLTI, INSN_SLTIU, INSN_XORI, INSN_ORI, INSN_ANDI,
+    INSN_SLLI, INSN_SRLI, INSN_SRAI,
+    INSN_ADD, INSN_SUB, INSN_SLL, INSN_SLT, INSN_SLTU, INSN_XOR,
+    INSN_SRL, INSN_SRA, INSN_OR, INSN_AND,
+
+    INSN_FLW,
+    INSN_FSW,
+    INSN_FMADD_S,
+    INSN_FADD_S, INSN_FSUB_S, INSN_FMUL_S, INSN_FDIV_S, INSN_FSQRT_S,
+    INSN_FMIN_S, INSN_FMAX_S,
+    INSN_FLE_S, INSN_FLT_S, INSN_FEQ_S,
+    INSN_FCVT_W_S, INSN_FCVT_WU_S, INSN_FCVT_S_W, INSN_FCVT_S_WU,
+    INSN_FMV_W_X, INSN_FMV_X_W,
+    INSN_FCLASS_S,
+    INSN_FSGNJ_S, INSN_FSGNJN_S, INSN_FSGNJX_S,
+
+    INSN_COUNT
+};
+
+// Names of the operations above, for the instruction histogram.
+static const char *decodedOpNames[INSN_COUNT] = {
+    "unimplemented", "nop", "nop", "ebreak",
+    "lui", "jal", "jalr",
+    "beq", "bne", "blt", "bge", "bltu", "bgeu",
+    "lb", "lh", "lw", "lbu", "lhu",
+    "sb", "sh", "sw",
+    "addi", "slti", "sltiu", "xori", "ori", "andi",
+    "slli", "srli", "srai",
+    "add", "sub", "sll", "slt", "sltu", "xor",
+    "srl", "sra", "or", "and",
+    "flw", "fsw", "fmadd.s",
+    "fadd.s", "fsub.s", "fmul.s", "fdiv.s", "fsqrt.s",
+    "fmin.s", "fmax.s",
+    "fle.s", "flt.s", "feq.s",
+    "fcvt.w.s", "fcvt.wu.s", "fcvt.s.w", "fcvt.s.wu",
+    "fmv.w.x", "fmv.x.w",
+    "fclass.s",
+    "fsgnj.s", "fsgnjn.s", "fsgnjx.s",
+};
+
+// An instruction of the text segment with its fields pulled out.
+struct DecodedInstruction {
+    uint8_t op;             // DecodedOp
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    uint8_t rs3;
+    uint8_t rm;             // Rounding mode of float instructions.
+    uint8_t flags;          // DECODED_* bits.
+    uint32_t imm;           // Immediate for the format, sign-extended, or SubstituteFunction.
+    uint32_t insn;          // Original word, for reporting.
+};
+
+// A text symbol is at this instruction, so the library histogram counts it.
+static const uint8_t DECODED_SYMBOL = 0x01;
+
+// The whole text segment decoded, indexed by PC/4. The text segment
+// never changes, so this is done once and shared by all cores. Symbols
+// and library substitutions are looked up here too, so step() never has
+// to search for the PC in a map.
+typedef std::vector<DecodedInstruction> DecodedText;
+
+DecodedText decodeText(const std::vector<uint8_t>& text_bytes, const SymbolTable& text_symbols);
+
+struct TimingModel;
+
 struct GPUCore
 {
     // Loosely modeled on RISC-V RVI, RVA, RVM, RVF
@@ -120,89 +216,50 @@ struct GPUCore
         SUBST_ALL2,
         SUBST_ALL3,
         SUBST_ALL4,
+
+        SUBST_COUNT
     };
-    std::map<uint32_t, SubstituteFunction> substFunctions;
-    std::map<uint32_t, std::string> substFunctionNames;
-    std::set<std::string> substitutedFunctions;
+
+    // Library routines that can be run in C++, by the name of their symbol.
+    static const std::vector<std::pair<std::string, SubstituteFunction> >& substitutions();
+
+    // Which substitutions this core has run.
+    bool substituted[SUBST_COUNT] = {};
+
+    // Whether to count each time a text symbol is reached in
+    // libraryFunctionHistogram.
+    bool countLibraryCalls = false;
     AddressToSymbolTable libraryFunctions;
     std::map<std::string, int> libraryFunctionHistogram;
     std::map<std::string, int> instructionHistogram;
 
     uint32_t minSP = 0xFFFFFFFF;
 
-    GPUCore(const SymbolTable& librarySymbols)
+    // Estimated cycles the hardware core would have taken for the
+    // instructions run so far, if there's a timing model.
+    const TimingModel *timing = nullptr;
+    uint64_t cycles = 0;
+
+    // If not null, counts each instruction's stores to SDRAM, indexed by
+    // PC/4, so a profile can charge them their extra cycles.
+    uint64_t *sdramStoreCounts = nullptr;
+
+    // If not null, each store to SDRAM adds the cycles since the core's
+    // previous one to the word stored, indexed by SDRAM address/4. The
+    // shader's colors are its only stores to SDRAM, so this is about what
+    // each pixel cost.
+    uint32_t *sdramWordCycles = nullptr;
+    uint64_t lastSdramStoreCycles = 0;
+
+    const DecodedText& decodedText;
+
+    GPUCore(const SymbolTable& librarySymbols, const DecodedText& decodedText) :
+        decodedText(decodedText)
     {
         std::fill(regs.x, regs.x + 32, 0);
         std::fill(regs.f, regs.f + 32, 0.0f);
         regs.pc = 0;
 
-        std::vector<std::pair<std::string, SubstituteFunction> > substitutions = {
-            { ".sin", SUBST_SIN },
-            { ".atan", SUBST_ATAN },
-            { ".reflect1", SUBST_REFLECT1 },
-            { ".reflect2", SUBST_REFLECT2 },
-            { ".reflect3", SUBST_REFLECT3 },
-            { ".reflect4", SUBST_REFLECT4 },
-            { ".pow", SUBST_POW },
-            { ".clamp", SUBST_CLAMP },
-            { ".mix", SUBST_MIX },
-            { ".smoothstep", SUBST_SMOOTHSTEP },
-            { ".normalize1", SUBST_NORMALIZE1 },
-            { ".normalize2", SUBST_NORMALIZE2 },
-            { ".normalize3", SUBST_NORMALIZE3 },
-            { ".normalize4", SUBST_NORMALIZE4 },
-            { ".cos", SUBST_COS },
-            { ".log2", SUBST_LOG2 },
-            { ".exp", SUBST_EXP },
-            { ".mod", SUBST_MOD },
-            { ".inversesqrt", SUBST_INVERSESQRT },
-            { ".asin", SUBST_ASIN },
-            { ".length1", SUBST_LENGTH1 },
-            { ".length2", SUBST_LENGTH2 },
-            { ".length3", SUBST_LENGTH3 },
-            { ".length4", SUBST_LENGTH4 },
-            { ".cross", SUBST_CROSS },
-            { ".log", SUBST_LOG },
-            { ".faceforward1", SUBST_FACEFORWARD1 },
-            { ".faceforward2", SUBST_FACEFORWARD2 },
-            { ".faceforward3", SUBST_FACEFORWARD3 },
-            { ".faceforward4", SUBST_FACEFORWARD4 },
-            { ".acos", SUBST_ACOS },
-            { ".radians", SUBST_RADIANS },
-            { ".degrees", SUBST_DEGREES },
-            { ".exp2", SUBST_EXP2 },
-            { ".tan", SUBST_TAN },
-            { ".atan2", SUBST_ATAN2 },
-            { ".refract1", SUBST_REFRACT1 },
-            { ".refract2", SUBST_REFRACT2 },
-            { ".refract3", SUBST_REFRACT3 },
-            { ".refract4", SUBST_REFRACT4 },
-            { ".distance1", SUBST_DISTANCE1 },
-            { ".distance2", SUBST_DISTANCE2 },
-            { ".distance3", SUBST_DISTANCE3 },
-            { ".distance4", SUBST_DISTANCE4 },
-            { ".fract", SUBST_FRACT },
-            { ".floor", SUBST_FLOOR },
-            { ".step", SUBST_STEP },
-            { ".dot1", SUBST_DOT1 },
-            { ".dot2", SUBST_DOT2 },
-            { ".dot3", SUBST_DOT3 },
-            { ".dot4", SUBST_DOT4 },
-            { ".any1", SUBST_ANY1 },
-            { ".any2", SUBST_ANY2 },
-            { ".any3", SUBST_ANY3 },
-            { ".any4", SUBST_ANY4 },
-            { ".all1", SUBST_ALL1 },
-            { ".all2", SUBST_ALL2 },
-            { ".all3", SUBST_ALL3 },
-            { ".all4", SUBST_ALL4 },
-        };
-        for(auto& [name, subst]: substitutions) {
-            if(librarySymbols.find(name) != librarySymbols.end()) {
-                substFunctions[librarySymbols.at(name)] = subst;
-                substFunctionNames[librarySymbols.at(name)] = name;
-            }
-        }
         for(auto& [name, address]: librarySymbols) {
             libraryFunctions[address] = name;
         }
@@ -218,31 +275,23 @@ struct GPUCore
     // void write16(uint32_t addr, uint16_t v);
     // void write32(uint32_t addr, uint32_t v);
 
-    template <class RWM>
-    float pop32(RWM& data_memory)
+    // Library routines take float parameters in fa0-fa7 and integer
+    // parameters in a0-a7, and return their results starting at fa0 or a0.
+    float argf(int i)
     {
-        float v = data_memory.read32(regs.x[2]);
-        regs.x[2] += 4;
-        return v;
+        return regs.f[10 + i];
     };
-    template <class RWM>
-    void push32(RWM& data_memory, uint32_t f)
+    void resultf(int i, float f)
     {
-        regs.x[2] -= 4;
-        data_memory.write32(regs.x[2], f);
+        regs.f[10 + i] = f;
     };
-    template <class RWM>
-    float popf(RWM& data_memory)
+    uint32_t arg32(int i)
     {
-        float v = data_memory.readf(regs.x[2]);
-        regs.x[2] += 4;
-        return v;
+        return regs.x[10 + i];
     };
-    template <class RWM>
-    void pushf(RWM& data_memory, float f)
+    void result32(int i, uint32_t v)
     {
-        regs.x[2] -= 4;
-        data_memory.writef(regs.x[2], f);
+        regs.x[10 + i] = v;
     };
     
     void unimpl(uint32_t insn, Status& status)
@@ -253,16 +302,27 @@ struct GPUCore
         status = UNIMPLEMENTED_OPCODE;
     };
 
-    void unimpl_subst(Status& status)
+    void unimpl_subst(SubstituteFunction subst, Status& status)
     {
-        std::cerr << "unimplemented substitution " << substFunctions[regs.pc] << "\n";
+        std::cerr << "unimplemented substitution " << subst << "\n";
         status = UNIMPLEMENTED_OPCODE;
     };
 
-    int previous_rounding_mode;
+    // Rounding mode the host is in. Switching is slow, so instructions
+    // leave it set, and it's only switched when an instruction wants a
+    // different mode. Code outside the core expects round to nearest.
+    uint32_t roundingMode = RM_RNE;
+
+    // Whether step() ignores the above and switches the host's rounding
+    // mode for every instruction that rounds, then puts it back, the way
+    // the emulator always used to. It's the reference for --test.
+    bool referenceRounding = false;
+
     void setrm(uint32_t rm)
     {
-        previous_rounding_mode = fegetround();
+        if(rm == roundingMode) {
+            return;
+        }
         switch(rm) {
             case RM_RDN: fesetround(FE_DOWNWARD); break;
             case RM_RNE: fesetround(FE_TONEAREST); break;
@@ -270,26 +330,137 @@ struct GPUCore
             case RM_RUP: fesetround(FE_UPWARD); break;
             default:
                 std::cerr << "unimplemented rounding mode " << rm << " (ignored)\n";
-                break;
+                setrm(RM_RNE);
+                return;
         }
+        roundingMode = rm;
     };
     void restorerm(void)
     {
-        fesetround(previous_rounding_mode);
+        setrm(RM_RNE);
     };
 
-    template <class ROM, class RWM>
-    Status step(ROM& text_memory, RWM& data_memory, RWM& sdram);
+    // Run the library routine in C++ instead of emulating it.
+    void substitute(SubstituteFunction subst, Status& status);
+
+    // Run one instruction of operation OP and advance the PC. If DEFAULT_RM
+    // is true, float instructions are known to round to nearest, so their
+    // rounding mode field isn't looked at.
+    template <int OP, bool DEFAULT_RM, class RWM>
+    static Status execute(GPUCore& core, const DecodedInstruction& d, RWM& data_memory, RWM& sdram);
 
-    template <class ROM, class RWM>
-    Status stepUntilException(ROM& text_memory, RWM& data_memory, RWM& sdram)
+    template <class RWM>
+    Status step(RWM& data_memory, RWM& sdram);
+
+    template <class RWM>
+    Status stepUntilException(RWM& data_memory, RWM& sdram)
     {
         Status status;
-        while((status = step(text_memory, data_memory, sdram)) == RUNNING);
+        while((status = step(data_memory, sdram)) == RUNNING);
         return status;
     }
 };
 
+// Estimated cycles the shader core in gpu/shadercore/ShaderCore.v takes for
+// each decoded instruction, looked up once in a cycle table (see timing.h).
+struct TimingModel
+{
+    uint32_t opCycles[INSN_COUNT];
+
+    // Substituted routines are stubs in library.s, so charge what a real
+    // one would take.
+    uint32_t substCycles[GPUCore::SUBST_COUNT];
+
+    // Extra cycles of a store that goes to SDRAM.
+    uint32_t sdramStoreCycles;
+
+    TimingModel(const std::map<std::string, int>& table);
+
+    uint32_t cyclesFor(const DecodedInstruction& d) const
+    {
+        return d.op == INSN_SUBST ? substCycles[d.imm] : opCycles[d.op];
+    }
+};
+
+const std::vector<std::pair<std::string, GPUCore::SubstituteFunction> >& GPUCore::substitutions()
+{
+    static const std::vector<std::pair<std::string, SubstituteFunction> > table = {
+        { ".sin", SUBST_SIN },
+        { ".atan", SUBST_ATAN },
+        { ".reflect1", SUBST_REFLECT1 },
+        { ".reflect2", SUBST_REFLECT2 },
+        { ".reflect3", SUBST_REFLECT3 },
+        { ".reflect4", SUBST_REFLECT4 },
+        { ".pow", SUBST_POW },
+        { ".clamp", SUBST_CLAMP },
+        { ".mix", SUBST_MIX },
+        { ".smoothstep", SUBST_SMOOTHSTEP },
+        { ".normalize1", SUBST_NORMALIZE1 },
+        { ".normalize2", SUBST_NORMALIZE2 },
+        { ".normalize3", SUBST_NORMALIZE3 },
+        { ".normalize4", SUBST_NORMALIZE4 },
+        { ".cos", SUBST_COS },
+        { ".log2", SUBST_LOG2 },
+        { ".exp", SUBST_EXP },
+        { ".mod", SUBST_MOD },
+        { ".inversesqrt", SUBST_INVERSESQRT },
+        { ".asin", SUBST_ASIN },
+        { ".length1", SUBST_LENGTH1 },
+        { ".length2", SUBST_LENGTH2 },
+        { ".length3", SUBST_LENGTH3 },
+        { ".length4", SUBST_LENGTH4 },
+        { ".cross", SUBST_CROSS },
+        { ".log", SUBST_LOG },
+        { ".faceforward1", SUBST_FACEFORWARD1 },
+        { ".faceforward2", SUBST_FACEFORWARD2 },
+        { ".faceforward3", SUBST_FACEFORWARD3 },
+        { ".faceforward4", SUBST_FACEFORWARD4 },
+        { ".acos", SUBST_ACOS },
+        { ".radians", SUBST_RADIANS },
+        { ".degrees", SUBST_DEGREES },
+        { ".exp2", SUBST_EXP2 },
+        { ".tan", SUBST_TAN },
+        { ".atan2", SUBST_ATAN2 },
+        { ".refract1", SUBST_REFRACT1 },
+        { ".refract2", SUBST_REFRACT2 },
+        { ".refract3", SUBST_REFRACT3 },
+        { ".refract4", SUBST_REFRACT4 },
+        { ".distance1", SUBST_DISTANCE1 },
+        { ".distance2", SUBST_DISTANCE2 },
+        { ".distance3", SUBST_DISTANCE3 },
+        { ".distance4", SUBST_DISTANCE4 },
+        { ".fract", SUBST_FRACT },
+        { ".floor", SUBST_FLOOR },
+        { ".step", SUBST_STEP },
+        { ".dot1", SUBST_DOT1 },
+        { ".dot2", SUBST_DOT2 },
+        { ".dot3", SUBST_DOT3 },
+        { ".dot4", SUBST_DOT4 },
+        { ".any1", SUBST_ANY1 },
+        { ".any2", SUBST_ANY2 },
+        { ".any3", SUBST_ANY3 },
+        { ".any4", SUBST_ANY4 },
+        { ".all1", SUBST_ALL1 },
+        { ".all2", SUBST_ALL2 },
+        { ".all3", SUBST_ALL3 },
+        { ".all4", SUBST_ALL4 },
+    };
+
+    return table;
+}
+
+TimingModel::TimingModel(const std::map<std::string, int>& table)
+{
+    for(int op = 0; op < INSN_COUNT; op++) {
+        opCycles[op] = lookupCycles(table, decodedOpNames[op]);
+    }
+    std::fill(substCycles, substCycles + GPUCore::SUBST_COUNT, DEFAULT_LIBRARY_ROUTINE_CYCLES);
+    for(auto& [name, subst]: GPUCore::substitutions()) {
+        substCycles[subst] = lookupCycles(table, name, DEFAULT_LIBRARY_ROUTINE_CYCLES);
+    }
+    sdramStoreCycles = lookupCycles(table, "sdram", SDRAM_STORE_EXTRA_CYCLES);
+}
+
 uint32_t extendSign(uint32_t v, int width)
 {
     uint32_t sign = v & (1 << (width - 1));
@@ -320,27 +491,18 @@ const bool makeInstructionHistogram = false;
         case makeOpcode(6, (a), (b)): \
         case makeOpcode(7, (a), (b)):
 
-template <class ROM, class RWM>
-GPUCore::Status GPUCore::step(ROM& text_memory, RWM& data_memory, RWM& sdram)
+// Decode the instruction word once, so that step() only has to switch on
+// the operation. Encodings we don't implement decode to INSN_UNIMPLEMENTED,
+// and reported only if they run. Integer results going to x0 decode to
+// INSN_NOP, except for loads. Library substitutions are found later by decodeText().
+DecodedInstruction decodeInstruction(uint32_t insn)
 {
-    uint32_t insn = text_memory.read32(regs.pc);
-
-    auto lib = libraryFunctions.find(regs.pc);
-    if(lib != libraryFunctions.end()) {
-        libraryFunctionHistogram[lib->second]++;
-    }
-
-    Status status = RUNNING;
+    DecodedInstruction d;
 
     uint32_t fmt = getBits(insn, 26, 25);
-    uint32_t rd = getBits(insn, 11, 7);
     uint32_t funct3 = getBits(insn, 14, 12);
     uint32_t funct7 = getBits(insn, 31, 25);
     uint32_t ffunct = getBits(insn, 31, 27);
-    uint32_t rs1 = getBits(insn, 19, 15);
-    uint32_t rs2 = getBits(insn, 24, 20);
-    uint32_t rs3 = getBits(insn, 31, 27);
-    uint32_t rm = getBits(insn, 14, 12);
     uint32_t immI = extendSign(getBits(insn, 31, 20), 12);
     uint32_t shamt = getBits(insn, 24, 20);
     uint32_t immS = extendSign(
@@ -359,368 +521,421 @@ GPUCore::Status GPUCore::step(ROM& text_memory, RWM& data_memory, RWM& sdram)
         (getBits(insn, 30, 21) << 1),
         21);
 
+    d.op = INSN_UNIMPLEMENTED;
+    d.flags = 0;
+    d.rd = getBits(insn, 11, 7);
+    d.rs1 = getBits(insn, 19, 15);
+    d.rs2 = getBits(insn, 24, 20);
+    d.rs3 = getBits(insn, 31, 27);
+    d.rm = getBits(insn, 14, 12);
+    d.imm = 0;
+    d.insn = insn;
+
+    // Operation for integer results, or INSN_NOP if they're thrown away.
+    auto intOp = [&d](DecodedOp op) {
+        return d.rd == 0 ? INSN_NOP : op;
+    };
+
     switch(insn & 0x707F) {
         // flw       rd rs1 imm12 14..12=2 6..2=0x01 1..0=3
-        case makeOpcode(2, 0x01, 3): {
-            if(makeInstructionHistogram) { instructionHistogram["flw"]++; }
-            if(dump) std::cout << "flw\n";
-            regs.f[rd] = data_memory.readf(regs.x[rs1] + immI);
-            regs.pc += 4;
+        case makeOpcode(2, 0x01, 3):
+            d.op = INSN_FLW;
+            d.imm = immI;
             break;
-        }
 
         // fsw       imm12hi rs1 rs2 imm12lo 14..12=2 6..2=0x09 1..0=3
-        case makeOpcode(2, 0x09, 3): {
-            if(makeInstructionHistogram) { instructionHistogram["fsw"]++; }
-            if(dump) std::cout << "fsw\n";
-            uint32_t addr = regs.x[rs1] + immS;
-            float data = regs.f[rs2];
-            RWM *rwm;
-            if ((addr & 0x80000000) != 0) {
-                // SDRAM write.
-                addr &= 0x7FFFFFFF;
-                rwm = &sdram;
-            } else {
-                // Data memory write.
-                rwm = &data_memory;
-            }
-            rwm->writef(addr, data);
-            regs.pc += 4;
+        case makeOpcode(2, 0x09, 3):
+            d.op = INSN_FSW;
+            d.imm = immS;
             break;
-        }
 
         CASE_MAKE_OPCODE_ALL_FUNCT3(0x10, 3)
-        {
-            if(dump) std::cout << "fmadd\n";
-            if(makeInstructionHistogram) { instructionHistogram["fmadd"]++; }
             if(fmt == 0x0) { // size = .s
-                setrm(rm);
-                regs.f[rd] = regs.f[rs1] * regs.f[rs2] + regs.f[rs3];
-                restorerm();
-            } else {
-                unimpl(insn, status);
+                d.op = INSN_FMADD_S;
             }
-            regs.pc += 4;
             break;
-        }
-
-        // fadd.s    rd rs1 rs2      31..27=0x00 rm       26..25=0 6..2=0x14 1..0=3
-        // fmul.s    rd rs1 rs2      31..27=0x02 rm       26..25=0 6..2=0x14 1..0=3
-        // fsub.s    rd rs1 rs2      31..27=0x01 rm       26..25=0 6..2=0x14 1..0=3
-        // fdiv.s    rd rs1 rs2      31..27=0x03 rm       26..25=0 6..2=0x14 1..0=3
-        // fmin.s    rd rs1 rs2      31..27=0x05 14..12=0 26..25=0 6..2=0x14 1..0=3
-        // fmax.s    rd rs1 rs2      31..27=0x05 14..12=1 26..25=0 6..2=0x14 1..0=3
-        // fsqrt.s   rd rs1 24..20=0 31..27=0x0B rm       26..25=0 6..2=0x14 1..0=3
-        // fle.s     rd rs1 rs2      31..27=0x14 14..12=0 26..25=0 6..2=0x14 1..0=3
-        // flt.s     rd rs1 rs2      31..27=0x14 14..12=1 26..25=0 6..2=0x14 1..0=3
-        // feq.s     rd rs1 rs2      31..27=0x14 14..12=2 26..25=0 6..2=0x14 1..0=3
-
-        // fcvt.w.s  rd rs1 24..20=0 31..27=0x18 rm       26..25=0 6..2=0x14 1..0=3
-        // fcvt.wu.s rd rs1 24..20=1 31..27=0x18 rm       26..25=0 6..2=0x14 1..0=3
 
         // XXX haven't implemented anything but "S" (single) size
         CASE_MAKE_OPCODE_ALL_FUNCT3(0x14, 3)
-        {
-            if(dump) std::cout << "fadd etc\n";
-            if(fmt == 0x0) { // size = .s
-                switch(ffunct) {
-                    case 0x00: /* fadd */ setrm(rm); regs.f[rd] = regs.f[rs1] + regs.f[rs2]; restorerm(); if(makeInstructionHistogram) { instructionHistogram["fadd"]++; } break;
-                    case 0x01: /* fsub */ setrm(rm); regs.f[rd] = regs.f[rs1] - regs.f[rs2]; restorerm(); if(makeInstructionHistogram) { instructionHistogram["fsub"]++; } break;
-                    case 0x02: /* fmul */ setrm(rm); regs.f[rd] = regs.f[rs1] * regs.f[rs2]; restorerm(); if(makeInstructionHistogram) { instructionHistogram["fmul"]++; } break;
-                    case 0x03: /* fdiv */ setrm(rm); regs.f[rd] = regs.f[rs1] / regs.f[rs2]; restorerm(); if(makeInstructionHistogram) { instructionHistogram["fdiv"]++; } break;
-                    case 0x05: /* fmin or fmax */ regs.f[rd] = (funct3 == 0) ? fminf(regs.f[rs1], regs.f[rs2]) : fmaxf(regs.f[rs1], regs.f[rs2]); if(makeInstructionHistogram) { instructionHistogram["fmin,fmax"]++; } break;
-                    case 0x0B: /* fsqrt */ setrm(rm); regs.f[rd] = sqrtf(regs.f[rs1]); restorerm(); if(makeInstructionHistogram) { instructionHistogram["fsqrt"]++; } break;
-                    case 0x14:  { // fp comparison
-                        if(rd > 0) {
-                            if(funct3 == 0x0) { // fle 
-                                regs.x[rd] = (regs.f[rs1] <= regs.f[rs2]) ? 1 : 0;
-                            } else if(funct3 == 0x1) { // flt
-                                regs.x[rd] = (regs.f[rs1] < regs.f[rs2]) ? 1 : 0;
-                            } else { // feq
-                                regs.x[rd] = (regs.f[rs1] == regs.f[rs2]) ? 1 : 0;
-                            }
-                        }
-                        if(makeInstructionHistogram) { instructionHistogram["fcmp"]++; } 
-                        break;
+            if(fmt != 0x0) {
+                break;
+            }
+            switch(ffunct) {
+                case 0x00: d.op = INSN_FADD_S; break;
+                case 0x01: d.op = INSN_FSUB_S; break;
+                case 0x02: d.op = INSN_FMUL_S; break;
+                case 0x03: d.op = INSN_FDIV_S; break;
+                case 0x05: d.op = (funct3 == 0) ? INSN_FMIN_S : INSN_FMAX_S; break;
+                case 0x0B: d.op = INSN_FSQRT_S; break;
+                case 0x14: // fp comparison
+                    d.op = intOp(funct3 == 0x0 ? INSN_FLE_S :
+                            funct3 == 0x1 ? INSN_FLT_S : INSN_FEQ_S);
+                    break;
+                case 0x18:
+                    // ignoring setting valid flags
+                    d.op = d.rs2 == 0 ? intOp(INSN_FCVT_W_S) :
+                        d.rs2 == 1 ? intOp(INSN_FCVT_WU_S) : INSN_NOP;
+                    break;
+                case 0x1E: // fmv.w.x
+                    if(funct3 == 0) {
+                        d.op = INSN_FMV_W_X;
                     }
-                    case 0x18: {
-                        if(rd > 0) {
-                            // ignoring setting valid flags
-                            if(rs2 == 0) {      // fcvt.w.s
-                                setrm(rm);
-                                regs.x[rd] = std::rint(std::clamp(regs.f[rs1], -2147483648.0f, 2147483647.0f));
-                                restorerm();
-                            } else if(rs2 == 1) {       // fcvt.wu.s
-                                setrm(rm);
-                                regs.x[rd] = std::rint(std::clamp(regs.f[rs1], 0.0f, 4294967295.0f));
-                                restorerm();
-                            }
-                            if(makeInstructionHistogram) { instructionHistogram["fcvt"]++; } 
-                        }
-                        break;
+                    break;
+                case 0x1C:
+                    if(funct3 == 0) {
+                        d.op = intOp(INSN_FMV_X_W);
+                    } else if(funct3 == 1) {
+                        d.op = intOp(INSN_FCLASS_S);
                     }
-
-                    // fmv.w.x   rd rs1 24..20=0 31..27=0x1E 14..12=0 26..25=0 6..2=0x14 1..0=3
-                    case 0x1E: {
-                        if(funct3 == 0) {
-                            if(fmt == 0) {
-                                regs.f[rd] = intToFloat(regs.x[rs1]);
-                            } else {
-                                unimpl(insn, status);
-                            }
-                        } else {
-                            unimpl(insn, status);
-                        }
-                        if(makeInstructionHistogram) { instructionHistogram["fmv.w.x"]++; } 
-                        break;
+                    break;
+                case 0x1A:
+                    if(d.rs2 == 0) {
+                        d.op = INSN_FCVT_S_W;
+                    } else if(d.rs2 == 1) {
+                        d.op = INSN_FCVT_S_WU;
                     }
-
-                    case 0x1C: {
-                        if(funct3 == 0) {
-                            // fmv.x.w   rd rs1 24..20=0 31..27=0x1C 14..12=0 26..25=0 6..2=0x14 1..0=3
-                            if(fmt == 0) {
-                                regs.x[rd] = floatToInt(regs.f[rs1]);
-                            } else {
-                                unimpl(insn, status);
-                            }
-                            if(makeInstructionHistogram) { instructionHistogram["fmv.x.w"]++; } 
-                        } else if(funct3 == 1) {
-                            // fclass.s  rd rs1 24..20=0 31..27=0x1C 14..12=1 26..25=0 6..2=0x14 1..0=3
-                            if(fmt == 0) {
-                                float f = regs.f[rs1];
-                                uint32_t bits = floatToInt(f);
-
-                                int is_negative = bits & 0x80000000;
-                                int is_positive = !(bits & 0x80000000);
-
-                                // emulate our Verilog FPU:
-                                // assign qnan_a =  fracta[22];
-                                // assign snan_a = !fracta[22] & |fracta[21:0];
-                                int qnan_bits = (bits & (1 << 22));
-                                int snan_bits = (bits & ((1 << 22) - 1));
-
-                                int is_neg_inf = isinf(f) && is_negative;
-                                int is_neg_normal = isfinite(f) && isnormal(f) && is_negative;
-                                int is_neg_subnormal = isfinite(f) && (f != 0.0f) && (!isnormal(f)) && is_negative;
-                                int is_neg_zero = (f == 0.0f) && is_negative;
-                                int is_pos_zero = (f == 0.0f) && is_positive;
-                                int is_pos_subnormal = isfinite(f) && (f != 0.0f) && (!isnormal(f)) && is_positive;
-                                int is_pos_normal = isfinite(f) && isnormal(f) && is_positive;
-                                int is_pos_inf = isinf(f) && is_positive;
-
-                                int is_qnan = isnan(f) && qnan_bits && (!snan_bits);
-                                int is_snan = isnan(f) && (!qnan_bits) && snan_bits;
-
-                                regs.x[rd] =
-                                        (is_neg_inf << 0) |
-                                        (is_neg_normal << 1) |
-                                        (is_neg_subnormal << 2) |
-                                        (is_neg_zero << 3) |
-                                        (is_pos_zero << 4) |
-                                        (is_pos_subnormal << 5) |
-                                        (is_pos_normal << 6) |
-                                        (is_pos_inf << 7) |
-                                        (is_qnan << 8) |
-                                        (is_snan << 9);
-                            } else {
-                                unimpl(insn, status);
-                            }
-                            if(makeInstructionHistogram) { instructionHistogram["fclass"]++; } 
-                        } else {
-                            unimpl(insn, status);
-                        }
-                        break;
+                    break;
+                case 0x04:
+                    if(funct3 == 0) {
+                        d.op = INSN_FSGNJ_S;
+                    } else if(funct3 == 1) {
+                        d.op = INSN_FSGNJN_S;
+                    } else if(funct3 == 2) {
+                        d.op = INSN_FSGNJX_S;
                     }
+                    break;
+            }
+            break;
 
-                    case 0x1A: {
-                        if(rs2 == 0) {          // fcvt.s.w
-                            if(fmt == 0) {
-                                setrm(rm);
-                                regs.f[rd] = *reinterpret_cast<int32_t*>(&regs.x[rs1]);
-                                restorerm();
-                            } else {
-                                printf("fmt = %d\n", fmt);
-                                unimpl(insn, status);
-                            }
-                        } else if(rs2 == 1) {   // fcvt.s.wu
-                            if(fmt == 0) {
-                                setrm(rm);
-                                regs.f[rd] = regs.x[rs1];
-                                restorerm();
-                            } else {
-                                printf("fmt = %d\n", fmt);
-                                unimpl(insn, status);
-                            }
-                        } else {
-                            printf("rs2 = %d\n", rs2);
-                            unimpl(insn, status);
-                        }
-                        if(makeInstructionHistogram) { instructionHistogram["fcvt.sw"]++; } 
-                        break;
-                    }
+        case makeOpcode(0, 0x1C, 3): // ebreak
+            if(insn == 0x00100073) {
+                d.op = INSN_EBREAK;
+            }
+            break;
 
-                    // fsgnj.s   rd rs1 rs2      31..27=0x04 14..12=0 26..25=0 6..2=0x14 1..0=3
-                    // fsgnjn.s  rd rs1 rs2      31..27=0x04 14..12=1 26..25=0 6..2=0x14 1..0=3
-                    // fsgnjx.s  rd rs1 rs2      31..27=0x04 14..12=2 26..25=0 6..2=0x14 1..0=3
-                    case 0x04: {
-                        uint32_t fs1 = floatToInt(regs.f[rs1]);
-                        uint32_t fs2 = floatToInt(regs.f[rs2]);
-                        uint32_t fd;
-                        if(funct3 == 0) {
-                            fd = (fs1 & 0x7FFFFFFF) | (fs2 & 0x80000000);
-                        } else if(funct3 == 1) {
-                            fd = (fs1 & 0x7FFFFFFF) | ((fs2 & 0x80000000) ^ 0x80000000);
-                        } else if(funct3 == 2) {
-                            fd = (fs1 & 0x7FFFFFFF) | ((fs2 & 0x80000000) ^ (fs1 & 0x80000000));
-                        } else {
-                            fd = 0;
-                            unimpl(insn, status);
-                        }
-                        if(makeInstructionHistogram) { instructionHistogram["fsgnj"]++; } 
-                        regs.f[rd] = intToFloat(fd);
-                        break;
-                    }
-                    default: unimpl(insn, status); break;
-                }
-            } else {
-                unimpl(insn, status);
+        case makeOpcode(0, 0x08, 3): d.op = INSN_SB; d.imm = immS; break;
+        case makeOpcode(1, 0x08, 3): d.op = INSN_SH; d.imm = immS; break;
+        case makeOpcode(2, 0x08, 3): d.op = INSN_SW; d.imm = immS; break;
+
+        CASE_MAKE_OPCODE_ALL_FUNCT3(0x00, 3)
+            // lb, lh, lw, lbu, lhw
+            // Even to x0, since the access can fault and takes time.
+            d.imm = immI;
+            switch(funct3) {
+                case 0: d.op = INSN_LB; break;
+                case 1: d.op = INSN_LH; break;
+                case 2: d.op = INSN_LW; break;
+                case 4: d.op = INSN_LBU; break;
+                case 5: d.op = INSN_LHU; break;
             }
-            regs.pc += 4;
             break;
-        }
 
-        // fmv.x.s
+        CASE_MAKE_OPCODE_ALL_FUNCT3(0x0D, 3)
+            d.op = intOp(INSN_LUI);
+            d.imm = immU;
+            break;
 
-        case makeOpcode(0, 0x1C, 3): { // ebreak
-            if(dump) std::cout << "ebreak\n";
-            if(insn == 0x00100073) {
-                status = BREAK;
-            } else {
-                unimpl(insn, status);
+        CASE_MAKE_OPCODE_ALL_FUNCT3(0x18, 3)
+            // beq, bne, blt, bge, bltu, bgeu etc
+            d.imm = immSB;
+            switch(funct3) {
+                case 0: d.op = INSN_BEQ; break;
+                case 1: d.op = INSN_BNE; break;
+                case 4: d.op = INSN_BLT; break;
+                case 5: d.op = INSN_BGE; break;
+                case 6: d.op = INSN_BLTU; break;
+                case 7: d.op = INSN_BGEU; break;
             }
-            if(makeInstructionHistogram) { instructionHistogram["ebreak"]++; } 
             break;
+
+        CASE_MAKE_OPCODE_ALL_FUNCT3(0x0C, 3)
+            switch(funct3) {
+                case 0:
+                    d.op = funct7 == 0 ? INSN_ADD : funct7 == 32 ? INSN_SUB : INSN_UNIMPLEMENTED;
+                    break;
+                case 1: d.op = INSN_SLL; break;
+                case 5:
+                    d.op = funct7 == 0 ? INSN_SRL : funct7 == 32 ? INSN_SRA : INSN_UNIMPLEMENTED;
+                    break;
+                case 2: d.op = INSN_SLT; break;
+                case 3: d.op = INSN_SLTU; break;
+                case 4: d.op = INSN_XOR; break;
+                case 6: d.op = INSN_OR; break;
+                case 7: d.op = INSN_AND; break;
+            }
+            d.op = intOp(DecodedOp(d.op));
+            break;
+
+        case makeOpcode(0, 0x19, 3): // jalr
+            d.op = INSN_JALR;
+            d.imm = immI;
+            break;
+
+        CASE_MAKE_OPCODE_ALL_FUNCT3(0x1b, 3) // jal
+            d.op = INSN_JAL;
+            d.imm = immUJ;
+            break;
+
+        CASE_MAKE_OPCODE_ALL_FUNCT3(0x04, 3)
+            // addi etc
+            d.imm = immI;
+            switch(funct3) {
+                case 0: d.op = INSN_ADDI; break;
+                case 1: d.op = INSN_SLLI; d.imm = shamt; break;
+                case 2: d.op = INSN_SLTI; break;
+                case 3: d.op = INSN_SLTIU; break;
+                case 4: d.op = INSN_XORI; break;
+                case 5:
+                    d.op = funct7 == 0 ? INSN_SRLI : funct7 == 32 ? INSN_SRAI : INSN_UNIMPLEMENTED;
+                    d.imm = shamt;
+                    break;
+                case 6: d.op = INSN_ORI; break;
+                case 7: d.op = INSN_ANDI; break;
+            }
+            if(d.rd == 0) {
+                d.op = INSN_NOP;
+            }
+            break;
+    }
+
+    return d;
+}
+
+DecodedText decodeText(const std::vector<uint8_t>& text_bytes, const SymbolTable& text_symbols)
+{
+    DecodedText decoded(text_bytes.size()/4);
+
+    for(size_t i = 0; i < decoded.size(); i++) {
+        const uint8_t *p = text_bytes.data() + i*4;
+        uint32_t insn = p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24);
+        decoded[i] = decodeInstruction(insn);
+    }
+
+    for(auto& [name, address]: text_symbols) {
+        if(address/4 < decoded.size()) {
+            decoded[address/4].flags |= DECODED_SYMBOL;
         }
+    }
+
+    // A library routine is substituted if it starts with "addi x0, x0, 0".
+    for(auto& [name, subst]: GPUCore::substitutions()) {
+        auto symbol = text_symbols.find(name);
+        if(symbol != text_symbols.end() && symbol->second/4 < decoded.size()) {
+            DecodedInstruction& d = decoded[symbol->second/4];
+            if(d.insn == 0x00000013) {
+                d.op = INSN_SUBST;
+                d.imm = subst;
+            }
+        }
+    }
+
+    return decoded;
+}
+
+// Runs one decoded instruction on the core. See GPUCore::execute().
+template <class RWM>
+using InstructionHandler = GPUCore::Status (*)(GPUCore& core, const DecodedInstruction& d,
+        RWM& data_memory, RWM& sdram);
+
+template <int OP, bool DEFAULT_RM, class RWM>
+GPUCore::Status GPUCore::execute(GPUCore& core, const DecodedInstruction& d, RWM& data_memory, RWM& sdram)
+{
+    Registers& regs = core.regs;
+    Status status = RUNNING;
+
+    uint32_t rd = d.rd;
+    uint32_t rs1 = d.rs1;
+    uint32_t rs2 = d.rs2;
+    uint32_t rs3 = d.rs3;
+    uint32_t imm = d.imm;
+    uint32_t rm = DEFAULT_RM ? RM_RNE : d.rm;
+
+    switch(OP) {
+        case INSN_FLW:
+            regs.f[rd] = data_memory.readf(regs.x[rs1] + imm);
+            regs.pc += 4;
+            break;
 
-        case makeOpcode(0, 0x08, 3):
-        case makeOpcode(1, 0x08, 3):
-        case makeOpcode(2, 0x08, 3):
-        { // sb, sh, sw
-            if(dump) std::cout << "sw\n";
-            uint32_t addr = regs.x[rs1] + immS;
-            uint32_t data = regs.x[rs2];
+        case INSN_FSW:
+        case INSN_SB:
+        case INSN_SH:
+        case INSN_SW: {
+            uint32_t addr = regs.x[rs1] + imm;
             RWM *rwm;
             if ((addr & 0x80000000) != 0) {
                 // SDRAM write.
                 addr &= 0x7FFFFFFF;
                 rwm = &sdram;
+                if(core.timing != nullptr) {
+                    core.cycles += core.timing->sdramStoreCycles;
+                }
+                if(core.sdramStoreCounts != nullptr) {
+                    core.sdramStoreCounts[regs.pc/4]++;
+                }
             } else {
                 // Data memory write.
                 rwm = &data_memory;
             }
-            switch(funct3) {
-                case 0: rwm->write8(addr, data & 0xFF); break;
-                case 1: rwm->write16(addr, data & 0xFFFF); break;
-                case 2: rwm->write32(addr, data); break;
+            switch(OP) {
+                case INSN_FSW: rwm->writef(addr, regs.f[rs2]); break;
+                case INSN_SB: rwm->write8(addr, regs.x[rs2] & 0xFF); break;
+                case INSN_SH: rwm->write16(addr, regs.x[rs2] & 0xFFFF); break;
+                default: rwm->write32(addr, regs.x[rs2]); break;
+            }
+            if(rwm == &sdram && core.sdramWordCycles != nullptr) {
+                core.sdramWordCycles[addr/4] += core.cycles - core.lastSdramStoreCycles;
+                core.lastSdramStoreCycles = core.cycles;
             }
             regs.pc += 4;
-            if(makeInstructionHistogram) { instructionHistogram["store"]++; } 
             break;
         }
 
-        CASE_MAKE_OPCODE_ALL_FUNCT3(0x00, 3)
-        { // lb, lh, lw, lbu, lhw
-            if(dump) std::cout << "load\n";
-            if(rd != 0) {
-                switch(funct3) {
-                    case 0: regs.x[rd] = extendSign(data_memory.read8(regs.x[rs1] + immI), 8); break;
-                    case 1: regs.x[rd] = extendSign(data_memory.read16(regs.x[rs1] + immI), 16); break;
-                    case 2: regs.x[rd] = data_memory.read32(regs.x[rs1] + immI); break;
-                    case 4: regs.x[rd] = data_memory.read8(regs.x[rs1] + immI); break;
-                    case 5: regs.x[rd] = data_memory.read16(regs.x[rs1] + immI); break;
-                    default: unimpl(insn, status); break;
-                }
-            }
+        case INSN_FMADD_S:
+            core.setrm(rm);
+            regs.f[rd] = regs.f[rs1] * regs.f[rs2] + regs.f[rs3];
             regs.pc += 4;
-            if(makeInstructionHistogram) { instructionHistogram["load"]++; } 
             break;
-        }
 
-        CASE_MAKE_OPCODE_ALL_FUNCT3(0x0D, 3)
-        { // lui
-            if(dump) std::cout << "lui\n";
-            if(rd > 0) {
-                regs.x[rd] = immU;
-            }
+        case INSN_FADD_S: core.setrm(rm); regs.f[rd] = regs.f[rs1] + regs.f[rs2]; regs.pc += 4; break;
+        case INSN_FSUB_S: core.setrm(rm); regs.f[rd] = regs.f[rs1] - regs.f[rs2]; regs.pc += 4; break;
+        case INSN_FMUL_S: core.setrm(rm); regs.f[rd] = regs.f[rs1] * regs.f[rs2]; regs.pc += 4; break;
+        case INSN_FDIV_S: core.setrm(rm); regs.f[rd] = regs.f[rs1] / regs.f[rs2]; regs.pc += 4; break;
+        case INSN_FMIN_S: regs.f[rd] = fminf(regs.f[rs1], regs.f[rs2]); regs.pc += 4; break;
+        case INSN_FMAX_S: regs.f[rd] = fmaxf(regs.f[rs1], regs.f[rs2]); regs.pc += 4; break;
+        case INSN_FSQRT_S: core.setrm(rm); regs.f[rd] = sqrtf(regs.f[rs1]); regs.pc += 4; break;
+        case INSN_FLE_S: regs.x[rd] = (regs.f[rs1] <= regs.f[rs2]) ? 1 : 0; regs.pc += 4; break;
+        case INSN_FLT_S: regs.x[rd] = (regs.f[rs1] < regs.f[rs2]) ? 1 : 0; regs.pc += 4; break;
+        case INSN_FEQ_S: regs.x[rd] = (regs.f[rs1] == regs.f[rs2]) ? 1 : 0; regs.pc += 4; break;
+
+        case INSN_FCVT_W_S:
+            regs.x[rd] = roundWithMode(std::clamp(regs.f[rs1], -2147483648.0f, 2147483647.0f), rm);
             regs.pc += 4;
-            if(makeInstructionHistogram) { instructionHistogram["lui"]++; } 
             break;
-        }
- 
-        CASE_MAKE_OPCODE_ALL_FUNCT3(0x18, 3)
-        { // beq, bne, blt, bge, bltu, bgeu etc
-            if(dump) std::cout << "bge\n";
-            switch(funct3) {
-                case 0: regs.pc += (regs.x[rs1] == regs.x[rs2]) ? immSB : 4; break;
-                case 1: regs.pc += (regs.x[rs1] != regs.x[rs2]) ? immSB : 4; break;
-                case 4: regs.pc += (static_cast<int32_t>(regs.x[rs1]) < static_cast<int32_t>(regs.x[rs2])) ? immSB : 4; break;
-                case 5: regs.pc += (static_cast<int32_t>(regs.x[rs1]) >= static_cast<int32_t>(regs.x[rs2])) ? immSB : 4; break;
-                case 6: regs.pc += (regs.x[rs1] < regs.x[rs2]) ? immSB : 4; break;
-                case 7: regs.pc += (regs.x[rs1] >= regs.x[rs2]) ? immSB : 4; break;
-                default: unimpl(insn, status); break;
-            }
-            if(makeInstructionHistogram) { instructionHistogram["branch"]++; }
+
+        case INSN_FCVT_WU_S:
+            regs.x[rd] = roundWithMode(std::clamp(regs.f[rs1], 0.0f, 4294967295.0f), rm);
+            regs.pc += 4;
+            break;
+
+        case INSN_FMV_W_X:
+            regs.f[rd] = intToFloat(regs.x[rs1]);
+            regs.pc += 4;
+            break;
+
+        case INSN_FMV_X_W:
+            regs.x[rd] = floatToInt(regs.f[rs1]);
+            regs.pc += 4;
+            break;
+
+        case INSN_FCLASS_S: {
+            float f = regs.f[rs1];
+            uint32_t bits = floatToInt(f);
+
+            int is_negative = bits & 0x80000000;
+            int is_positive = !(bits & 0x80000000);
+
+            // emulate our Verilog FPU:
+            // assign qnan_a =  fracta[22];
+            // assign snan_a = !fracta[22] & |fracta[21:0];
+            int qnan_bits = (bits & (1 << 22));
+            int snan_bits = (bits & ((1 << 22) - 1));
+
+            int is_neg_inf = isinf(f) && is_negative;
+            int is_neg_normal = isfinite(f) && isnormal(f) && is_negative;
+            int is_neg_subnormal = isfinite(f) && (f != 0.0f) && (!isnormal(f)) && is_negative;
+            int is_neg_zero = (f == 0.0f) && is_negative;
+            int is_pos_zero = (f == 0.0f) && is_positive;
+            int is_pos_subnormal = isfinite(f) && (f != 0.0f) && (!isnormal(f)) && is_positive;
+            int is_pos_normal = isfinite(f) && isnormal(f) && is_positive;
+            int is_pos_inf = isinf(f) && is_positive;
+
+            int is_qnan = isnan(f) && qnan_bits && (!snan_bits);
+            int is_snan = isnan(f) && (!qnan_bits) && snan_bits;
+
+            regs.x[rd] =
+                    (is_neg_inf << 0) |
+                    (is_neg_normal << 1) |
+                    (is_neg_subnormal << 2) |
+                    (is_neg_zero << 3) |
+                    (is_pos_zero << 4) |
+                    (is_pos_subnormal << 5) |
+                    (is_pos_normal << 6) |
+                    (is_pos_inf << 7) |
+                    (is_qnan << 8) |
+                    (is_snan << 9);
+            regs.pc += 4;
             break;
         }
 
-        CASE_MAKE_OPCODE_ALL_FUNCT3(0x0C, 3)
-        {
-            if(dump) std::cout << "add etc\n";
-            if(makeInstructionHistogram) { instructionHistogram["add etc"]++; }
-            if(rd > 0) {
-                switch(funct3) {
-                    case 0: {
-                        if(funct7 == 0) {
-                            regs.x[rd] = regs.x[rs1] + regs.x[rs2]; // add
-                        } else if(funct7 == 32) {
-                            regs.x[rd] = regs.x[rs1] - regs.x[rs2]; // sub
-                        } else {
-                            unimpl(insn, status);
-                        }
-                        break;
-                    }
-                    case 1: regs.x[rd] = regs.x[rs1] << (regs.x[rs2] & 0x1F); break;        // sll
-                    case 5: {
-                        if(funct7 == 0) {
-                            regs.x[rd] = regs.x[rs1] >> (regs.x[rs2] & 0x1F); break;        // srl
-                        } else if(funct7 == 32) {
-                            // whether right-shifting a negative signed
-                            // int extends the sign bit is implementation
-                            // defined in C but I'll risk it.
-                            regs.x[rd] = ((int32_t)regs.x[rs1]) >> (regs.x[rs2] & 0x1F); break;     // sra
-                        } else {
-                            unimpl(insn, status);
-                        }
-                        break;
-                    }
-                    case 2: regs.x[rd] = ((int32_t)regs.x[rs1] < (int32_t)regs.x[rs2]); break;      // slt
-                    case 3: regs.x[rd] = (regs.x[rs1] < regs.x[rs2]); break;        // sltu
-                    case 4: regs.x[rd] = regs.x[rs1] ^ regs.x[rs2]; break;  // xor
-                    case 6: regs.x[rd] = regs.x[rs1] | regs.x[rs2]; break;  // or
-                    case 7: regs.x[rd] = regs.x[rs1] & regs.x[rs2]; break;  // and
-                    default: {
-                        unimpl(insn, status);
-                    }
-                }
+        case INSN_FCVT_S_W:
+            core.setrm(rm);
+            regs.f[rd] = int32_t(regs.x[rs1]);
+            regs.pc += 4;
+            break;
+
+        case INSN_FCVT_S_WU:
+            core.setrm(rm);
+            regs.f[rd] = regs.x[rs1];
+            regs.pc += 4;
+            break;
+
+        // fsgnj.s   rd rs1 rs2      31..27=0x04 14..12=0 26..25=0 6..2=0x14 1..0=3
+        // fsgnjn.s  rd rs1 rs2      31..27=0x04 14..12=1 26..25=0 6..2=0x14 1..0=3
+        // fsgnjx.s  rd rs1 rs2      31..27=0x04 14..12=2 26..25=0 6..2=0x14 1..0=3
+        case INSN_FSGNJ_S:
+        case INSN_FSGNJN_S:
+        case INSN_FSGNJX_S: {
+            uint32_t fs1 = floatToInt(regs.f[rs1]);
+            uint32_t fs2 = floatToInt(regs.f[rs2]);
+            uint32_t fd;
+            if(OP == INSN_FSGNJ_S) {
+                fd = (fs1 & 0x7FFFFFFF) | (fs2 & 0x80000000);
+            } else if(OP == INSN_FSGNJN_S) {
+                fd = (fs1 & 0x7FFFFFFF) | ((fs2 & 0x80000000) ^ 0x80000000);
+            } else {
+                fd = (fs1 & 0x7FFFFFFF) | ((fs2 & 0x80000000) ^ (fs1 & 0x80000000));
             }
+            regs.f[rd] = intToFloat(fd);
             regs.pc += 4;
             break;
         }
 
-        case makeOpcode(0, 0x19, 3): { // jalr
-            if(dump) std::cout << "jalr\n";
-            if(makeInstructionHistogram) { instructionHistogram["jalr"]++; } 
-            uint32_t ra = (regs.x[rs1] + immI) & ~0x00000001; // spec says set least significant bit to zero
+        case INSN_EBREAK:
+            status = BREAK;
+            break;
+
+        // Loads are the only integer results that can go to x0, so they
+        // put its zero back.
+        case INSN_LB: regs.x[rd] = extendSign(data_memory.read8(regs.x[rs1] + imm), 8); regs.x[0] = 0; regs.pc += 4; break;
+        case INSN_LH: regs.x[rd] = extendSign(data_memory.read16(regs.x[rs1] + imm), 16); regs.x[0] = 0; regs.pc += 4; break;
+        case INSN_LW: regs.x[rd] = data_memory.read32(regs.x[rs1] + imm); regs.x[0] = 0; regs.pc += 4; break;
+        case INSN_LBU: regs.x[rd] = data_memory.read8(regs.x[rs1] + imm); regs.x[0] = 0; regs.pc += 4; break;
+        case INSN_LHU: regs.x[rd] = data_memory.read16(regs.x[rs1] + imm); regs.x[0] = 0; regs.pc += 4; break;
+
+        case INSN_LUI: regs.x[rd] = imm; regs.pc += 4; break;
+
+        case INSN_BEQ: regs.pc += (regs.x[rs1] == regs.x[rs2]) ? imm : 4; break;
+        case INSN_BNE: regs.pc += (regs.x[rs1] != regs.x[rs2]) ? imm : 4; break;
+        case INSN_BLT: regs.pc += (static_cast<int32_t>(regs.x[rs1]) < static_cast<int32_t>(regs.x[rs2])) ? imm : 4; break;
+        case INSN_BGE: regs.pc += (static_cast<int32_t>(regs.x[rs1]) >= static_cast<int32_t>(regs.x[rs2])) ? imm : 4; break;
+        case INSN_BLTU: regs.pc += (regs.x[rs1] < regs.x[rs2]) ? imm : 4; break;
+        case INSN_BGEU: regs.pc += (regs.x[rs1] >= regs.x[rs2]) ? imm : 4; break;
+
+        case INSN_ADD: regs.x[rd] = regs.x[rs1] + regs.x[rs2]; regs.pc += 4; break;
+        case INSN_SUB: regs.x[rd] = regs.x[rs1] - regs.x[rs2]; regs.pc += 4; break;
+        case INSN_SLL: regs.x[rd] = regs.x[rs1] << (regs.x[rs2] & 0x1F); regs.pc += 4; break;
+        case INSN_SRL: regs.x[rd] = regs.x[rs1] >> (regs.x[rs2] & 0x1F); regs.pc += 4; break;
+        // whether right-shifting a negative signed int extends the sign
+        // bit is implementation defined in C but I'll risk it.
+        case INSN_SRA: regs.x[rd] = ((int32_t)regs.x[rs1]) >> (regs.x[rs2] & 0x1F); regs.pc += 4; break;
+        case INSN_SLT: regs.x[rd] = ((int32_t)regs.x[rs1] < (int32_t)regs.x[rs2]); regs.pc += 4; break;
+        case INSN_SLTU: regs.x[rd] = (regs.x[rs1] < regs.x[rs2]); regs.pc += 4; break;
+        case INSN_XOR: regs.x[rd] = regs.x[rs1] ^ regs.x[rs2]; regs.pc += 4; break;
+        case INSN_OR: regs.x[rd] = regs.x[rs1] | regs.x[rs2]; regs.pc += 4; break;
+        case INSN_AND: regs.x[rd] = regs.x[rs1] & regs.x[rs2]; regs.pc += 4; break;
+
+        case INSN_JALR: {
+            uint32_t ra = (regs.x[rs1] + imm) & ~0x00000001; // spec says set least significant bit to zero
             if(rd > 0) {
                 regs.x[rd] = regs.pc + 4;
             }
@@ -728,435 +943,754 @@ GPUCore::Status GPUCore::step(ROM& text_memory, RWM& data_memory, RWM& sdram)
             break;
         }
 
-        CASE_MAKE_OPCODE_ALL_FUNCT3(0x1b, 3)
-        { // jal
-            if(dump) std::cout << "jal\n";
-            if(makeInstructionHistogram) { instructionHistogram["jal"]++; } 
+        case INSN_JAL:
             if(rd > 0) {
                 regs.x[rd] = regs.pc + 4;
             }
-            regs.pc += immUJ;
+            regs.pc += imm;
             break;
-        }
 
-        CASE_MAKE_OPCODE_ALL_FUNCT3(0x04, 3)
-        { // addi
-            if(dump) std::cout << "addi etc\n";
-            if(makeInstructionHistogram) { instructionHistogram["addi etc"]++; } 
-            if(rd > 0) {
-                switch(funct3) {
-                    case 0: regs.x[rd] = regs.x[rs1] + immI; break;     // addi
-                    case 1: regs.x[rd] = regs.x[rs1] << shamt; break;   // slli
-                    case 2: regs.x[rd] = int32_t(regs.x[rs1]) < int32_t(immI); break; // slti
-                    case 3: regs.x[rd] = regs.x[rs1] < immI; break;     // sltiu
-                    case 4: regs.x[rd] = regs.x[rs1] ^ immI; break;     // xori
-                    case 5:
-                        // regs.x[rd] = regs.x[rs1] >> shamt; break;   // srli, srai
-                        if(funct7 == 0) {
-                            regs.x[rd] = regs.x[rs1] >> (shamt); break;        // srli
-                        } else if(funct7 == 32) {
-                            // whether right-shifting a negative signed
-                            // int extends the sign bit is implementation
-                            // defined in C but I'll risk it.
-                            regs.x[rd] = ((int32_t)regs.x[rs1]) >> (shamt); break;     // srai
-                        } else {
-                            unimpl(insn, status);
-                        }
-                    case 6: regs.x[rd] = regs.x[rs1] | immI; break;     // ori
-                    case 7: regs.x[rd] = regs.x[rs1] & immI; break;     // andi
-                    default: unimpl(insn, status); break;
-                }
-            } else {
-                if(makeInstructionHistogram) { instructionHistogram["nop"]++; } 
-                if((funct3 == 0) && (rs1 == 0) && (immI == 0)) {
-                    if(substFunctions.find(regs.pc) != substFunctions.end()) {
-                        substitutedFunctions.insert(substFunctionNames[regs.pc]);
-                        switch(substFunctions[regs.pc]) {
-                            case SUBST_SIN: {
-                                pushf(data_memory, sinf(popf(data_memory)));
-                                break;
-                            }
-                            case SUBST_ATAN: {
-                                pushf(data_memory, atanf(popf(data_memory)));
-                                break;
-                            }
-                            case SUBST_POW: {
-                                float x = popf(data_memory);
-                                float y = popf(data_memory);
-                                pushf(data_memory, powf(x, y));
-                                break;
-                            }
-                            case SUBST_CLAMP: {
-                                float x = popf(data_memory);
-                                float minVal = popf(data_memory);
-                                float maxVal = popf(data_memory);
-                                pushf(data_memory, fclamp(x, minVal, maxVal));
-                                break;
-                            }
-                            case SUBST_MIX: {
-                                float x = popf(data_memory);
-                                float y = popf(data_memory);
-                                float a = popf(data_memory);
-                                pushf(data_memory, fmix(x, y, a));
-                                break;
-                            }
-                            case SUBST_SMOOTHSTEP: {
-                                float edge0 = popf(data_memory);
-                                float edge1 = popf(data_memory);
-                                float x = popf(data_memory);
-                                pushf(data_memory, smoothstep(edge0, edge1, x));
-                                break;
-                            }
-                            case SUBST_COS: {
-                                pushf(data_memory, cosf(popf(data_memory)));
-                                break;
-                            }
-                            case SUBST_LOG2: {
-                                pushf(data_memory, log2f(popf(data_memory)));
-                                break;
-                            }
-                            case SUBST_EXP: {
-                                pushf(data_memory, expf(popf(data_memory)));
-                                break;
-                            }
-                            case SUBST_MOD: {
-                                float x = popf(data_memory);
-                                float y = popf(data_memory);
-                                // fmodf() isn't right for us, it's the remainder after
-                                // rounding toward zero, but we need to floor.
-                                float q = floorf(x/y);
-                                pushf(data_memory, x - q*y);
-                                break;
-                            }
-                            case SUBST_INVERSESQRT: {
-                                pushf(data_memory, 1.0 / sqrtf(popf(data_memory)));
-                                break;
-                            }
-                            case SUBST_ASIN: {
-                                pushf(data_memory, asinf(popf(data_memory)));
-                                break;
-                            }
-                            case SUBST_LOG: {
-                                pushf(data_memory, logf(popf(data_memory)));
-                                break;
-                            }
-                            case SUBST_ACOS: {
-                                pushf(data_memory, acosf(popf(data_memory)));
-                                break;
-                            }
-                            case SUBST_RADIANS: {
-                                pushf(data_memory, popf(data_memory) / 180.0 * M_PI);
-                                break;
-                            }
-                            case SUBST_DEGREES: {
-                                pushf(data_memory, popf(data_memory) * 180.0 / M_PI);
-                                break;
-                            }
-                            case SUBST_EXP2: {
-                                pushf(data_memory, exp2f(popf(data_memory)));
-                                break;
-                            }
-                            case SUBST_TAN: {
-                                pushf(data_memory, tanf(popf(data_memory)));
-                                break;
-                            }
-                            case SUBST_ATAN2: {
-                                float y = popf(data_memory);
-                                float x = popf(data_memory);
-                                pushf(data_memory, atan2f(y, x));
-                                break;
-                            }
-                            case SUBST_CROSS: {
-                                float v1[3], v2[3], cross[3];
-                                v1[0] = popf(data_memory);
-                                v1[1] = popf(data_memory);
-                                v1[2] = popf(data_memory);
-                                v2[0] = popf(data_memory);
-                                v2[1] = popf(data_memory);
-                                v2[2] = popf(data_memory);
-                                cross[0] = v1[1] * v2[2] - v2[1] * v1[2];
-                                cross[1] = v1[2] * v2[0] - v2[2] * v1[0];
-                                cross[2] = v1[0] * v2[1] - v2[0] * v1[1];
-                                pushf(data_memory, cross[2]);
-                                pushf(data_memory, cross[1]);
-                                pushf(data_memory, cross[0]);
-                                break;
-                            }
-                            case SUBST_NORMALIZE1: {
-                                float x = popf(data_memory);
-                                pushf(data_memory, x < 0.0 ? -1.0f : 1.0f);
-                                break;
-                            }
-                            case SUBST_NORMALIZE2: {
-                                float x = popf(data_memory);
-                                float y = popf(data_memory);
-                                float d = 1.0f / sqrtf(x * x + y * y);
-                                pushf(data_memory, y * d);
-                                pushf(data_memory, x * d);
-                                break;
-                            }
-                            case SUBST_NORMALIZE3: {
-                                float x = popf(data_memory);
-                                float y = popf(data_memory);
-                                float z = popf(data_memory);
-                                float d = 1.0f / sqrtf(x * x + y * y + z * z);
-                                pushf(data_memory, z * d);
-                                pushf(data_memory, y * d);
-                                pushf(data_memory, x * d);
-                                break;
-                            }
-                            case SUBST_NORMALIZE4: {
-                                float x = popf(data_memory);
-                                float y = popf(data_memory);
-                                float z = popf(data_memory);
-                                float w = popf(data_memory);
-                                float d = 1.0f / sqrtf(x * x + y * y + z * z + w * w);
-                                pushf(data_memory, w * d);
-                                pushf(data_memory, z * d);
-                                pushf(data_memory, y * d);
-                                pushf(data_memory, x * d);
-                                break;
-                            }
-                            case SUBST_FLOOR: {
-                                float f = popf(data_memory);
-                                pushf(data_memory, floorf(f));
-                                break;
-                            }
-                            case SUBST_DOT1: {
-                                float x1 = popf(data_memory);
-                                float x2 = popf(data_memory);
-                                float v = x1 * x2;
-                                pushf(data_memory, v);
-                                break;
-                            }
-                            case SUBST_DOT2: {
-                                float x1 = popf(data_memory);
-                                float y1 = popf(data_memory);
-                                float x2 = popf(data_memory);
-                                float y2 = popf(data_memory);
-                                float v = x1 * x2 + y1 * y2;
-                                pushf(data_memory, v);
-                                break;
-                            }
-                            case SUBST_DOT3: {
-                                float x1 = popf(data_memory);
-                                float y1 = popf(data_memory);
-                                float z1 = popf(data_memory);
-                                float x2 = popf(data_memory);
-                                float y2 = popf(data_memory);
-                                float z2 = popf(data_memory);
-                                float v = x1 * x2 + y1 * y2 + z1 * z2;
-                                pushf(data_memory, v);
-                                break;
-                            }
-                            case SUBST_DOT4: {
-                                float x1 = popf(data_memory);
-                                float y1 = popf(data_memory);
-                                float z1 = popf(data_memory);
-                                float w1 = popf(data_memory);
-                                float x2 = popf(data_memory);
-                                float y2 = popf(data_memory);
-                                float z2 = popf(data_memory);
-                                float w2 = popf(data_memory);
-                                float v = x1 * x2 + y1 * y2 + z1 * z2 + w1 * w2;
-                                pushf(data_memory, v);
-                                break;
-                            }
-                            case SUBST_ALL1: {
-                                uint32_t x = pop32(data_memory);
-                                push32(data_memory, x);
-                                break;
-                            }
-                            case SUBST_ALL2: {
-                                uint32_t x = pop32(data_memory);
-                                uint32_t y = pop32(data_memory);
-                                push32(data_memory, x && y);
-                                break;
-                            }
-                            case SUBST_ALL3: {
-                                uint32_t x = pop32(data_memory);
-                                uint32_t y = pop32(data_memory);
-                                uint32_t z = pop32(data_memory);
-                                push32(data_memory, x && y && z);
-                                break;
-                            }
-                            case SUBST_ALL4: {
-                                uint32_t x = pop32(data_memory);
-                                uint32_t y = pop32(data_memory);
-                                uint32_t z = pop32(data_memory);
-                                uint32_t w = pop32(data_memory);
-                                push32(data_memory, x && y && z && w);
-                                break;
-                            }
-                            case SUBST_ANY1: {
-                                uint32_t x = pop32(data_memory);
-                                push32(data_memory, x);
-                                break;
-                            }
-                            case SUBST_ANY2: {
-                                uint32_t x = pop32(data_memory);
-                                uint32_t y = pop32(data_memory);
-                                push32(data_memory, x || y);
-                                break;
-                            }
-                            case SUBST_ANY3: {
-                                uint32_t x = pop32(data_memory);
-                                uint32_t y = pop32(data_memory);
-                                uint32_t z = pop32(data_memory);
-                                push32(data_memory, x || y || z);
-                                break;
-                            }
-                            case SUBST_ANY4: {
-                                uint32_t x = pop32(data_memory);
-                                uint32_t y = pop32(data_memory);
-                                uint32_t z = pop32(data_memory);
-                                uint32_t w = pop32(data_memory);
-                                push32(data_memory, x || y || z || w);
-                                break;
-                            }
-                            case SUBST_STEP: {
-                                float edge = popf(data_memory);
-                                float x = popf(data_memory);
-                                float y = (x < edge) ? 0.0f : 1.0f;
-                                pushf(data_memory, y);
-                                break;
-                            }
-                            case SUBST_FRACT: {
-                                float f = popf(data_memory);
-                                pushf(data_memory, f - floorf(f));
-                                break;
-                            }
-                            case SUBST_REFRACT1: {
-                                unimpl_subst(status);
-                                break;
-                            }
-                            case SUBST_REFRACT2: {
-                                unimpl_subst(status);
-                                break;
-                            }
-                            case SUBST_REFRACT3: {
-                                unimpl_subst(status);
-                                break;
-                            }
-                            case SUBST_REFRACT4: {
-                                unimpl_subst(status);
-                                break;
-                            }
-                            case SUBST_DISTANCE1: {
-                                unimpl_subst(status);
-                                break;
-                            }
-                            case SUBST_DISTANCE2: {
-                                unimpl_subst(status);
-                                break;
-                            }
-                            case SUBST_DISTANCE3: {
-                                float x1 = popf(data_memory);
-                                float y1 = popf(data_memory);
-                                float z1 = popf(data_memory);
-                                float x2 = popf(data_memory);
-                                float y2 = popf(data_memory);
-                                float z2 = popf(data_memory);
-                                float dx = x2 - x1;
-                                float dy = y2 - y1;
-                                float dz = z2 - z1;
-                                pushf(data_memory, sqrtf(dx*dx + dy*dy + dz*dz));
-                                break;
-                            }
-                            case SUBST_DISTANCE4: {
-                                unimpl_subst(status);
-                                break;
-                            }
-                            case SUBST_REFLECT1: {
-                                unimpl_subst(status);
-                                break;
-                            }
-                            case SUBST_REFLECT2: {
-                                unimpl_subst(status);
-                                break;
-                            }
-                            case SUBST_REFLECT3: {
-                                float ix = popf(data_memory);
-                                float iy = popf(data_memory);
-                                float iz = popf(data_memory);
-                                float nx = popf(data_memory);
-                                float ny = popf(data_memory);
-                                float nz = popf(data_memory);
-                                float dot = ix*nx + iy*ny + iz*nz;
-                                float rx = ix - 2*dot*nx;
-                                float ry = iy - 2*dot*ny;
-                                float rz = iz - 2*dot*nz;
-                                pushf(data_memory, rx);
-                                pushf(data_memory, ry);
-                                pushf(data_memory, rz);
-                                break;
-                            }
-                            case SUBST_REFLECT4: {
-                                unimpl_subst(status);
-                                break;
-                            }
-                            case SUBST_FACEFORWARD1: {
-                                unimpl_subst(status);
-                                break;
-                            }
-                            case SUBST_FACEFORWARD2: {
-                                unimpl_subst(status);
-                                break;
-                            }
-                            case SUBST_FACEFORWARD3: {
-                                unimpl_subst(status);
-                                break;
-                            }
-                            case SUBST_FACEFORWARD4: {
-                                unimpl_subst(status);
-                                break;
-                            }
-                            case SUBST_LENGTH1: {
-                                float x = popf(data_memory);
-                                pushf(data_memory, fabsf(x));
-                                break;
-                            }
-                            case SUBST_LENGTH2: {
-                                float x = popf(data_memory);
-                                float y = popf(data_memory);
-                                float d = sqrtf(x * x + y * y);
-                                pushf(data_memory, d);
-                                break;
-                            }
-                            case SUBST_LENGTH3: {
-                                float x = popf(data_memory);
-                                float y = popf(data_memory);
-                                float z = popf(data_memory);
-                                float d = sqrtf(x * x + y * y + z * z);
-                                pushf(data_memory, d);
-                                break;
-                            }
-                            case SUBST_LENGTH4: {
-                                float x = popf(data_memory);
-                                float y = popf(data_memory);
-                                float z = popf(data_memory);
-                                float w = popf(data_memory);
-                                float d = sqrtf(x * x + y * y + z * z + w * w);
-                                pushf(data_memory, d);
-                                break;
-                            }
-                        }
-                        regs.pc += 4;
-                        return RUNNING;
-                    }
-                }
-            }
+        case INSN_ADDI: regs.x[rd] = regs.x[rs1] + imm; regs.pc += 4; break;
+        case INSN_SLLI: regs.x[rd] = regs.x[rs1] << imm; regs.pc += 4; break;
+        case INSN_SLTI: regs.x[rd] = int32_t(regs.x[rs1]) < int32_t(imm); regs.pc += 4; break;
+        case INSN_SLTIU: regs.x[rd] = regs.x[rs1] < imm; regs.pc += 4; break;
+        case INSN_XORI: regs.x[rd] = regs.x[rs1] ^ imm; regs.pc += 4; break;
+        case INSN_SRLI: regs.x[rd] = regs.x[rs1] >> imm; regs.pc += 4; break;
+        case INSN_SRAI: regs.x[rd] = ((int32_t)regs.x[rs1]) >> imm; regs.pc += 4; break;
+        case INSN_ORI: regs.x[rd] = regs.x[rs1] | imm; regs.pc += 4; break;
+        case INSN_ANDI: regs.x[rd] = regs.x[rs1] & imm; regs.pc += 4; break;
 
+        case INSN_SUBST: {
+            SubstituteFunction subst = SubstituteFunction(imm);
+            core.substituted[subst] = true;
+            core.restorerm();
+            core.substitute(subst, status);
             regs.pc += 4;
-            break;
+            // Substitutions don't stop the core.
+            return RUNNING;
         }
 
-        default: {
-            unimpl(insn, status);
-        }
+        case INSN_NOP:
+            regs.pc += 4;
+            break;
+
+        case INSN_UNIMPLEMENTED:
+            core.unimpl(d.insn, status);
+            break;
+    }
+
+    return status;
+}
+
+// Makes the table of execute() instantiations for every operation.
+template <class RWM, bool DEFAULT_RM, size_t... OPS>
+constexpr std::array<InstructionHandler<RWM>, INSN_COUNT> makeHandlerTable(std::index_sequence<OPS...>)
+{
+    return {{ &GPUCore::execute<OPS, DEFAULT_RM, RWM>... }};
+}
+
+template <class RWM>
+constexpr std::array<InstructionHandler<RWM>, INSN_COUNT> instructionHandlers =
+    makeHandlerTable<RWM, false>(std::make_index_sequence<INSN_COUNT>());
+
+template <class RWM>
+constexpr std::array<InstructionHandler<RWM>, INSN_COUNT> defaultRoundingHandlers =
+    makeHandlerTable<RWM, true>(std::make_index_sequence<INSN_COUNT>());
+
+// The handler for the instruction. Float instructions that round to
+// nearest, the host's mode, don't need to switch the rounding mode.
+template <class RWM>
+InstructionHandler<RWM> handlerFor(const DecodedInstruction& d)
+{
+    return d.rm == RM_RNE ? defaultRoundingHandlers<RWM>[d.op] : instructionHandlers<RWM>[d.op];
+}
+
+template <class RWM>
+GPUCore::Status GPUCore::step(RWM& data_memory, RWM& sdram)
+{
+    if(regs.pc/4 >= decodedText.size() || (regs.pc & 3) != 0) {
+        std::cerr << "pc " << to_hex(regs.pc) << " is outside the text segment\n";
+        return UNIMPLEMENTED_OPCODE;
+    }
+    const DecodedInstruction& d = decodedText[regs.pc/4];
+
+    if(countLibraryCalls && (d.flags & DECODED_SYMBOL) != 0) {
+        libraryFunctionHistogram[libraryFunctions.at(regs.pc)]++;
     }
+
+    if(makeInstructionHistogram) { instructionHistogram[decodedOpNames[d.op]]++; }
+    if(dump) std::cout << decodedOpNames[d.op] << "\n";
+
+    if(timing != nullptr) {
+        cycles += timing->cyclesFor(d);
+    }
+
+    Status status;
+    if(referenceRounding) {
+        // Forget the host's mode so setrm() always switches, and look
+        // at the rounding mode field even when it's round to nearest.
+        roundingMode = ~0u;
+        status = instructionHandlers<RWM>[d.op](*this, d, data_memory, sdram);
+        fesetround(FE_TONEAREST);
+        roundingMode = RM_RNE;
+    } else {
+        status = handlerFor<RWM>(d)(*this, d, data_memory, sdram);
+
+        // Callers may do their own float math between steps.
+        restorerm();
+    }
+
     if(regs.x[2] > 0) {
         minSP = std::min(regs.x[2], minSP);
     }
     return status;
 }
+
+void GPUCore::substitute(SubstituteFunction subst, Status& status)
+{
+    switch(subst) {
+        case SUBST_SIN: {
+            resultf(0, sinf(argf(0)));
+            break;
+        }
+        case SUBST_ATAN: {
+            resultf(0, atanf(argf(0)));
+            break;
+        }
+        case SUBST_POW: {
+            float x = argf(0);
+            float y = argf(1);
+            resultf(0, powf(x, y));
+            break;
+        }
+        case SUBST_CLAMP: {
+            float x = argf(0);
+            float minVal = argf(1);
+            float maxVal = argf(2);
+            resultf(0, fclamp(x, minVal, maxVal));
+            break;
+        }
+        case SUBST_MIX: {
+            float x = argf(0);
+            float y = argf(1);
+            float a = argf(2);
+            resultf(0, fmix(x, y, a));
+            break;
+        }
+        case SUBST_SMOOTHSTEP: {
+            float edge0 = argf(0);
+            float edge1 = argf(1);
+            float x = argf(2);
+            resultf(0, smoothstep(edge0, edge1, x));
+            break;
+        }
+        case SUBST_COS: {
+            resultf(0, cosf(argf(0)));
+            break;
+        }
+        case SUBST_LOG2: {
+            resultf(0, log2f(argf(0)));
+            break;
+        }
+        case SUBST_EXP: {
+            resultf(0, expf(argf(0)));
+            break;
+        }
+        case SUBST_MOD: {
+            float x = argf(0);
+            float y = argf(1);
+            // fmodf() isn't right for us, it's the remainder after
+            // rounding toward zero, but we need to floor.
+            float q = floorf(x/y);
+            resultf(0, x - q*y);
+            break;
+        }
+        case SUBST_INVERSESQRT: {
+            resultf(0, 1.0 / sqrtf(argf(0)));
+            break;
+        }
+        case SUBST_ASIN: {
+            resultf(0, asinf(argf(0)));
+            break;
+        }
+        case SUBST_LOG: {
+            resultf(0, logf(argf(0)));
+            break;
+        }
+        case SUBST_ACOS: {
+            resultf(0, acosf(argf(0)));
+            break;
+        }
+        case SUBST_RADIANS: {
+            resultf(0, argf(0) / 180.0 * M_PI);
+            break;
+        }
+        case SUBST_DEGREES: {
+            resultf(0, argf(0) * 180.0 / M_PI);
+            break;
+        }
+        case SUBST_EXP2: {
+            resultf(0, exp2f(argf(0)));
+            break;
+        }
+        case SUBST_TAN: {
+            resultf(0, tanf(argf(0)));
+            break;
+        }
+        case SUBST_ATAN2: {
+            float y = argf(0);
+            float x = argf(1);
+            resultf(0, atan2f(y, x));
+            break;
+        }
+        case SUBST_CROSS: {
+            float v1[3], v2[3], cross[3];
+            v1[0] = argf(0);
+            v1[1] = argf(1);
+            v1[2] = argf(2);
+            v2[0] = argf(3);
+            v2[1] = argf(4);
+            v2[2] = argf(5);
+            cross[0] = v1[1] * v2[2] - v2[1] * v1[2];
+            cross[1] = v1[2] * v2[0] - v2[2] * v1[0];
+            cross[2] = v1[0] * v2[1] - v2[0] * v1[1];
+            resultf(0, cross[0]);
+            resultf(1, cross[1]);
+            resultf(2, cross[2]);
+            break;
+        }
+        case SUBST_NORMALIZE1: {
+            float x = argf(0);
+            resultf(0, x < 0.0 ? -1.0f : 1.0f);
+            break;
+        }
+        case SUBST_NORMALIZE2: {
+            float x = argf(0);
+            float y = argf(1);
+            float d = 1.0f / sqrtf(x * x + y * y);
+            resultf(0, x * d);
+            resultf(1, y * d);
+            break;
+        }
+        case SUBST_NORMALIZE3: {
+            float x = argf(0);
+            float y = argf(1);
+            float z = argf(2);
+            float d = 1.0f / sqrtf(x * x + y * y + z * z);
+            resultf(0, x * d);
+            resultf(1, y * d);
+            resultf(2, z * d);
+            break;
+        }
+        case SUBST_NORMALIZE4: {
+            float x = argf(0);
+            float y = argf(1);
+            float z = argf(2);
+            float w = argf(3);
+            float d = 1.0f / sqrtf(x * x + y * y + z * z + w * w);
+            resultf(0, x * d);
+            resultf(1, y * d);
+            resultf(2, z * d);
+            resultf(3, w * d);
+            break;
+        }
+        case SUBST_FLOOR: {
+            float f = argf(0);
+            resultf(0, floorf(f));
+            break;
+        }
+        case SUBST_DOT1: {
+            float x1 = argf(0);
+            float x2 = argf(1);
+            float v = x1 * x2;
+            resultf(0, v);
+            break;
+        }
+        case SUBST_DOT2: {
+            float x1 = argf(0);
+            float y1 = argf(1);
+            float x2 = argf(2);
+            float y2 = argf(3);
+            float v = x1 * x2 + y1 * y2;
+            resultf(0, v);
+            break;
+        }
+        case SUBST_DOT3: {
+            float x1 = argf(0);
+            float y1 = argf(1);
+            float z1 = argf(2);
+            float x2 = argf(3);
+            float y2 = argf(4);
+            float z2 = argf(5);
+            float v = x1 * x2 + y1 * y2 + z1 * z2;
+            resultf(0, v);
+            break;
+        }
+        case SUBST_DOT4: {
+            float x1 = argf(0);
+            float y1 = argf(1);
+            float z1 = argf(2);
+            float w1 = argf(3);
+            float x2 = argf(4);
+            float y2 = argf(5);
+            float z2 = argf(6);
+            float w2 = argf(7);
+            float v = x1 * x2 + y1 * y2 + z1 * z2 + w1 * w2;
+            resultf(0, v);
+            break;
+        }
+        case SUBST_ALL1: {
+            uint32_t x = arg32(0);
+            result32(0, x);
+            break;
+        }
+        case SUBST_ALL2: {
+            uint32_t x = arg32(0);
+            uint32_t y = arg32(1);
+            result32(0, x && y);
+            break;
+        }
+        case SUBST_ALL3: {
+            uint32_t x = arg32(0);
+            uint32_t y = arg32(1);
+            uint32_t z = arg32(2);
+            result32(0, x && y && z);
+            break;
+        }
+        case SUBST_ALL4: {
+            uint32_t x = arg32(0);
+            uint32_t y = arg32(1);
+            uint32_t z = arg32(2);
+            uint32_t w = arg32(3);
+            result32(0, x && y && z && w);
+            break;
+        }
+        case SUBST_ANY1: {
+            uint32_t x = arg32(0);
+            result32(0, x);
+            break;
+        }
+        case SUBST_ANY2: {
+            uint32_t x = arg32(0);
+            uint32_t y = arg32(1);
+            result32(0, x || y);
+            break;
+        }
+        case SUBST_ANY3: {
+            uint32_t x = arg32(0);
+            uint32_t y = arg32(1);
+            uint32_t z = arg32(2);
+            result32(0, x || y || z);
+            break;
+        }
+        case SUBST_ANY4: {
+            uint32_t x = arg32(0);
+            uint32_t y = arg32(1);
+            uint32_t z = arg32(2);
+            uint32_t w = arg32(3);
+            result32(0, x || y || z || w);
+            break;
+        }
+        case SUBST_STEP: {
+            float edge = argf(0);
+            float x = argf(1);
+            float y = (x < edge) ? 0.0f : 1.0f;
+            resultf(0, y);
+            break;
+        }
+        case SUBST_FRACT: {
+            float f = argf(0);
+            resultf(0, f - floorf(f));
+            break;
+        }
+        case SUBST_REFRACT1: {
+            unimpl_subst(subst, status);
+            break;
+        }
+        case SUBST_REFRACT2: {
+            unimpl_subst(subst, status);
+            break;
+        }
+        case SUBST_REFRACT3: {
+            unimpl_subst(subst, status);
+            break;
+        }
+        case SUBST_REFRACT4: {
+            unimpl_subst(subst, status);
+            break;
+        }
+        case SUBST_DISTANCE1: {
+            unimpl_subst(subst, status);
+            break;
+        }
+        case SUBST_DISTANCE2: {
+            unimpl_subst(subst, status);
+            break;
+        }
+        case SUBST_DISTANCE3: {
+            float x1 = argf(0);
+            float y1 = argf(1);
+            float z1 = argf(2);
+            float x2 = argf(3);
+            float y2 = argf(4);
+            float z2 = argf(5);
+            float dx = x2 - x1;
+            float dy = y2 - y1;
+            float dz = z2 - z1;
+            resultf(0, sqrtf(dx*dx + dy*dy + dz*dz));
+            break;
+        }
+        case SUBST_DISTANCE4: {
+            unimpl_subst(subst, status);
+            break;
+        }
+        case SUBST_REFLECT1: {
+            unimpl_subst(subst, status);
+            break;
+        }
+        case SUBST_REFLECT2: {
+            unimpl_subst(subst, status);
+            break;
+        }
+        case SUBST_REFLECT3: {
+            float ix = argf(0);
+            float iy = argf(1);
+            float iz = argf(2);
+            float nx = argf(3);
+            float ny = argf(4);
+            float nz = argf(5);
+            float dot = ix*nx + iy*ny + iz*nz;
+            float rx = ix - 2*dot*nx;
+            float ry = iy - 2*dot*ny;
+            float rz = iz - 2*dot*nz;
+            resultf(0, rx);
+            resultf(1, ry);
+            resultf(2, rz);
+            break;
+        }
+        case SUBST_REFLECT4: {
+            unimpl_subst(subst, status);
+            break;
+        }
+        case SUBST_FACEFORWARD1: {
+            unimpl_subst(subst, status);
+            break;
+        }
+        case SUBST_FACEFORWARD2: {
+            unimpl_subst(subst, status);
+            break;
+        }
+        case SUBST_FACEFORWARD3: {
+            unimpl_subst(subst, status);
+            break;
+        }
+        case SUBST_FACEFORWARD4: {
+            unimpl_subst(subst, status);
+            break;
+        }
+        case SUBST_LENGTH1: {
+            float x = argf(0);
+            resultf(0, fabsf(x));
+            break;
+        }
+        case SUBST_LENGTH2: {
+            float x = argf(0);
+            float y = argf(1);
+            float d = sqrtf(x * x + y * y);
+            resultf(0, d);
+            break;
+        }
+        case SUBST_LENGTH3: {
+            float x = argf(0);
+            float y = argf(1);
+            float z = argf(2);
+            float d = sqrtf(x * x + y * y + z * z);
+            resultf(0, d);
+            break;
+        }
+        case SUBST_LENGTH4: {
+            float x = argf(0);
+            float y = argf(1);
+            float z = argf(2);
+            float w = argf(3);
+            float d = sqrtf(x * x + y * y + z * z + w * w);
+            resultf(0, d);
+            break;
+        }
+        case SUBST_COUNT: {
+            unimpl_subst(subst, status);
+            break;
+        }
+    }
+}
+
+// Whether the operation can change the flow of control or stop the core,
+// so that it has to end a basic block.
+static bool endsBlock(uint8_t op)
+{
+    switch(op) {
+        case INSN_BEQ: case INSN_BNE: case INSN_BLT:
+        case INSN_BGE: case INSN_BLTU: case INSN_BGEU:
+        case INSN_JAL:
+        case INSN_JALR:
+        case INSN_EBREAK:
+        case INSN_UNIMPLEMENTED:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+// Whether the operation jumps to a PC-relative target known when decoding.
+static bool hasStaticTarget(uint8_t op)
+{
+    switch(op) {
+        case INSN_BEQ: case INSN_BNE: case INSN_BLT:
+        case INSN_BGE: case INSN_BLTU: case INSN_BGEU:
+        case INSN_JAL:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+// A basic block of the decoded text. Only its last instruction can change
+// the flow of control, so the block runs without going back to the
+// dispatcher between instructions.
+template <class RWM>
+struct TranslatedBlock
+{
+    // Range of instructions in the decoded text.
+    uint32_t first;
+    uint32_t count;
+
+    // A text symbol is at the first instruction.
+    bool isSymbol;
+
+    // Some instruction may write the stack pointer, so the block has to
+    // keep GPUCore::minSP up to date.
+    bool writesSP;
+
+    // Blocks after the last instruction and at its branch or jump target,
+    // or nullptr if there isn't one. These chain the blocks without
+    // looking up the next PC.
+    uint32_t fallThroughPC;
+    TranslatedBlock *fallThrough;
+    uint32_t takenPC;
+    TranslatedBlock *taken;
+
+    // Estimated cycles of the block's instructions, not counting the
+    // extra for SDRAM stores, or 0 if there's no timing model.
+    uint32_t cycles;
+
+    // Number of times the block has run.
+    uint64_t runCount;
+};
+
+// The decoded text divided into basic blocks, with the handler of each
+// instruction looked up ahead of time. This is the fast way to run a core;
+// GPUCore::step() is still used when every instruction has to be traced.
+// Each core has its own, because it keeps counts.
+template <class RWM>
+class TranslatedText
+{
+    const DecodedText& decodedText;
+
+    // Handler for each instruction of the decoded text.
+    std::vector<InstructionHandler<RWM>> handlers;
+
+    std::vector<TranslatedBlock<RWM>> blocks;
+
+    // Block starting at each instruction, or nullptr if none does.
+    std::vector<TranslatedBlock<RWM>*> blockStarts;
+
+    // Estimated cycles of each instruction, or empty if there's no timing
+    // model. Used instead of the block total when SDRAM stores are charged
+    // to words, so a store sees the same cycle count as under step().
+    std::vector<uint32_t> instructionCycles;
+
+    // Number of times each instruction was stepped because the core
+    // jumped into the middle of a block.
+    std::vector<uint64_t> stepCounts;
+
+public:
+    TranslatedText(const DecodedText& decodedText, const TimingModel *timing = nullptr);
+
+    // Run the core from its PC until it reaches stopPC or an instruction
+    // returns something other than RUNNING. Adds the number of
+    // instructions run to dispatchedCount.
+    GPUCore::Status run(GPUCore& core, RWM& data_memory, RWM& sdram, uint32_t stopPC,
+            uint64_t& dispatchedCount);
+
+    // Add the number of times each instruction ran, indexed by PC/4.
+    void addPcCounts(std::vector<uint64_t>& pcCounts) const;
+
+private:
+    TranslatedBlock<RWM>* blockAt(uint32_t pc) const
+    {
+        return (pc & 3) == 0 && pc/4 < blockStarts.size() ? blockStarts[pc/4] : nullptr;
+    }
+
+    GPUCore::Status runBlock(TranslatedBlock<RWM>& block, GPUCore& core, RWM& data_memory, RWM& sdram);
+};
+
+template <class RWM>
+TranslatedText<RWM>::TranslatedText(const DecodedText& decodedText, const TimingModel *timing) :
+    decodedText(decodedText),
+    handlers(decodedText.size()),
+    blockStarts(decodedText.size(), nullptr),
+    stepCounts(decodedText.size(), 0)
+{
+    // Find the first instruction of each block: the start of the text,
+    // every symbol, every static branch target, and every instruction
+    // after one that ends a block.
+    std::vector<bool> isLeader(decodedText.size(), false);
+    if(!decodedText.empty()) {
+        isLeader[0] = true;
+    }
+    for(uint32_t i = 0; i < decodedText.size(); i++) {
+        const DecodedInstruction& d = decodedText[i];
+
+        handlers[i] = handlerFor<RWM>(d);
+        if((d.flags & DECODED_SYMBOL) != 0) {
+            isLeader[i] = true;
+        }
+        if(endsBlock(d.op) && i + 1 < decodedText.size()) {
+            isLeader[i + 1] = true;
+        }
+        if(hasStaticTarget(d.op)) {
+            uint32_t target = i*4 + d.imm;
+            if((target & 3) == 0 && target/4 < decodedText.size()) {
+                isLeader[target/4] = true;
+            }
+        }
+    }
+
+    for(uint32_t i = 0; i < decodedText.size(); i++) {
+        if(isLeader[i]) {
+            blocks.push_back(TranslatedBlock<RWM>{i, 0, (decodedText[i].flags & DECODED_SYMBOL) != 0, false,
+                    0, nullptr, 0, nullptr, 0, 0});
+        }
+        TranslatedBlock<RWM>& block = blocks.back();
+        block.count++;
+        if(timing != nullptr) {
+            instructionCycles.push_back(timing->cyclesFor(decodedText[i]));
+            block.cycles += instructionCycles.back();
+        }
+        if(decodedText[i].rd == 2) {
+            // Conservative; float registers have the same field.
+            block.writesSP = true;
+        }
+    }
+
+    // The vector won't move anymore, so link the blocks.
+    for(auto& block: blocks) {
+        blockStarts[block.first] = &block;
+    }
+    for(auto& block: blocks) {
+        uint32_t last = block.first + block.count - 1;
+        const DecodedInstruction& d = decodedText[last];
+
+        block.fallThroughPC = (last + 1)*4;
+        block.fallThrough = blockAt(block.fallThroughPC);
+        if(hasStaticTarget(d.op)) {
+            block.takenPC = last*4 + d.imm;
+            block.taken = blockAt(block.takenPC);
+        }
+    }
+}
+
+template <class RWM>
+GPUCore::Status TranslatedText<RWM>::runBlock(TranslatedBlock<RWM>& block, GPUCore& core,
+        RWM& data_memory, RWM& sdram)
+{
+    uint32_t last = block.first + block.count - 1;
+
+    block.runCount++;
+    if(core.countLibraryCalls && block.isSymbol) {
+        core.libraryFunctionHistogram[core.libraryFunctions.at(core.regs.pc)]++;
+    }
+
+    if(core.sdramWordCycles != nullptr && !instructionCycles.empty()) {
+        // Charge cycles as each instruction runs, like step() does.
+        GPUCore::Status status = GPUCore::RUNNING;
+        for(uint32_t i = block.first; i <= last; i++) {
+            core.cycles += instructionCycles[i];
+            status = handlers[i](core, decodedText[i], data_memory, sdram);
+            if(core.regs.x[2] > 0) {
+                core.minSP = std::min(core.regs.x[2], core.minSP);
+            }
+        }
+        return status;
+    }
+
+    core.cycles += block.cycles;
+    if(block.writesSP) {
+        GPUCore::Status status = GPUCore::RUNNING;
+        for(uint32_t i = block.first; i <= last; i++) {
+            status = handlers[i](core, decodedText[i], data_memory, sdram);
+            if(core.regs.x[2] > 0) {
+                core.minSP = std::min(core.regs.x[2], core.minSP);
+            }
+        }
+        return status;
+    }
+
+    // Only the last instruction can stop the core.
+    for(uint32_t i = block.first; i < last; i++) {
+        handlers[i](core, decodedText[i], data_memory, sdram);
+    }
+    return handlers[last](core, decodedText[last], data_memory, sdram);
+}
+
+template <class RWM>
+GPUCore::Status TranslatedText<RWM>::run(GPUCore& core, RWM& data_memory, RWM& sdram, uint32_t stopPC,
+        uint64_t& dispatchedCount)
+{
+    TranslatedBlock<RWM> *block = blockAt(core.regs.pc);
+    GPUCore::Status status;
+
+    do {
+        if(block != nullptr) {
+            status = runBlock(*block, core, data_memory, sdram);
+            dispatchedCount += block->count;
+        } else {
+            // Jumped into the middle of a block or out of the text. Step
+            // until we get to the start of a block.
+            if((core.regs.pc & 3) == 0 && core.regs.pc/4 < stepCounts.size()) {
+                stepCounts[core.regs.pc/4]++;
+            }
+            status = core.step(data_memory, sdram);
+            dispatchedCount++;
+        }
+
+        uint32_t pc = core.regs.pc;
+        if(block != nullptr && block->fallThrough != nullptr && pc == block->fallThroughPC) {
+            block = block->fallThrough;
+        } else if(block != nullptr && block->taken != nullptr && pc == block->takenPC) {
+            block = block->taken;
+        } else {
+            block = blockAt(pc);
+        }
+    } while(core.regs.pc != stopPC && status == GPUCore::RUNNING);
+
+    core.restorerm();
+
+    return status;
+}
+
+template <class RWM>
+void TranslatedText<RWM>::addPcCounts(std::vector<uint64_t>& pcCounts) const
+{
+    pcCounts.resize(decodedText.size());
+    for(auto& block: blocks) {
+        for(uint32_t i = block.first; i < block.first + block.count; i++) {
+            pcCounts[i] += block.runCount;
+        }
+    }
+    for(size_t i = 0; i < stepCounts.size(); i++) {
+        pcCounts[i] += stepCounts[i];
+    }
+}
@@ -1,8 +1,12 @@
 
+#include <algorithm>
+#include <functional>
 #include <iomanip>
 
 #include "function.h"
 #include "program.h"
+#include "risc-v.h"
+#include "bitvector.h"
 
 std::string Function::cleanUpName(std::string name) {
     // Replace "mainImage(vf4;vf2;" with "mainImage$v4f$vf2$"
@@ -20,6 +24,21 @@ std::string Function::cleanUpName(std::string name) {
     return name;
 }
 
+void Function::computeSuccPred() {
+    for (auto& [_, block] : blocks) {
+        block->pred.clear();
+    }
+
+    for (auto& [_, block] : blocks) {
+        Instruction *instruction = block->instructions.tail.get();
+        assert(instruction->isTermination());
+        block->succ = instruction->targetLabelIds;
+        for (uint32_t blockId : block->succ) {
+            blocks.at(blockId)->pred.insert(block->blockId);
+        }
+    }
+}
+
 void Function::computeDomTree(bool verbose) {
     std::vector<uint32_t> worklist; // block IDs.
 
@@ -33,6 +52,7 @@ void Function::computeDomTree(bool verbose) {
     // Prepare every block.
     for (auto& [_, block] : blocks) {
         block->dom = allBlockIds;
+        block->idomChildren.clear();
     }
 
     // Insert start block.
@@ -238,171 +258,408 @@ void Function::phiLiftingForBlock(Block *block, RiscVPhi *phi) {
 }
 
 void Function::ensureMaxRegisters() {
-    // Set of registers that have already been spilled, so we don't spill them
-    // again.
-    std::set<uint32_t> alreadySpilled;
-    uint32_t spilledRegId = NO_REGISTER;
-
-    do {
-        computeLiveness(spilledRegId);
-        // dumpInstructions("After liveness");
-        spilledRegId = spillIfNecessary(alreadySpilled);
-        if (spilledRegId != NO_REGISTER) {
-            alreadySpilled.insert(spilledRegId);
+    // Registers that we can't spill: ones already spilled and the
+    // short-lived registers that reload them.
+    std::set<uint32_t> unspillable;
+
+    computeLiveness();
+    while (true) {
+        std::set<uint32_t> spills = chooseSpills(unspillable);
+        if (spills.empty()) {
+            break;
+        }
+
+        for (uint32_t regId : spills) {
+            spillRegister(regId, unspillable);
+            unspillable.insert(regId);
         }
-        // Keep going as long as we're spilling.
-    } while (spilledRegId != NO_REGISTER);
+
+        // One liveness pass for the whole batch. We only go around again if
+        // the reloads themselves pushed us over.
+        computeLiveness();
+    }
 }
 
-int ___count = 0; // XXX
+// Liveness info for a block, indexed by dense register index.
+struct BlockLiveness {
+    // Registers used in the block before being defined, not counting phis.
+    BitVector use;
+
+    // Registers defined in the block, including phi results.
+    BitVector def;
+
+    // Registers live into and out of the block.
+    BitVector in;
+    BitVector out;
 
-void Function::computeLiveness(uint32_t spilledRegId) {
+    // Phi operands, by the predecessor block they come from.
+    std::map<uint32_t, BitVector> phiUse;
+};
+
+void Function::computeLiveness() {
     Timer timer;
-    std::set<Instruction *> inst_worklist; // Instructions left to work on.
 
-    // Insert all instructions of all blocks.
+    // Give each register a dense index. Variables are never in registers.
+    regIndex.clear();
+    indexReg.clear();
+    auto addRegister = [this](uint32_t regId) {
+        if (program->variables.find(regId) == program->variables.end() &&
+                regIndex.find(regId) == regIndex.end()) {
+
+            regIndex[regId] = indexReg.size();
+            indexReg.push_back(regId);
+        }
+    };
     for (auto &[_, block] : blocks) {
         for (auto inst = block->instructions.head; inst; inst = inst->next) {
-            if (spilledRegId == NO_REGISTER) {
-                // Clear all info for initial liveness analysis.
-                inst->livein.clear();
-                inst->liveout.clear();
-                inst_worklist.insert(inst.get());
+            for (uint32_t resId : inst->resIdList) {
+                addRegister(resId);
+            }
+            for (uint32_t argId : inst->argIdList) {
+                addRegister(argId);
+            }
+        }
+    }
+    size_t count = indexReg.size();
+
+    // Compute each block's uses and definitions, and its predecessors.
+    std::map<uint32_t, BlockLiveness> liveness;
+    std::map<uint32_t, std::vector<uint32_t>> predBlockIds;
+    for (auto &[blockId, block] : blocks) {
+        BlockLiveness &bl = liveness[blockId];
+        bl.use = BitVector(count);
+        bl.def = BitVector(count);
+        bl.in = BitVector(count);
+        bl.out = BitVector(count);
+
+        for (auto inst = block->instructions.tail; inst; inst = inst->prev) {
+            for (uint32_t resId : inst->resIdList) {
+                size_t index = regIndex.at(resId);
+                bl.use.reset(index);
+                bl.def.set(index);
+            }
+
+            assert(inst->opcode() != SpvOpPhi); // Should have been replaced.
+            if (inst->opcode() == RiscVOpPhi) {
+                // Phi operands are only live coming from their own block.
+                RiscVPhi *phi = dynamic_cast<RiscVPhi *>(inst.get());
+                assert(phi->operandIds.size() == phi->resultIds.size());
+                for (const std::vector<uint32_t> &operandIds : phi->operandIds) {
+                    assert(phi->labelIds.size() == operandIds.size());
+                    for (size_t j = 0; j < operandIds.size(); j++) {
+                        auto itr = regIndex.find(operandIds[j]);
+                        if (itr != regIndex.end()) {
+                            bl.phiUse.emplace(phi->labelIds[j], BitVector(count))
+                                .first->second.set(itr->second);
+                        }
+                    }
+                }
             } else {
-                // We just spilled one register. No need to clear all, just do
-                // the one we spilled.
-                for (auto &[_, livein] : inst->livein) {
-                    livein.erase(spilledRegId);
+                for (uint32_t argId : inst->argIdSet) {
+                    auto itr = regIndex.find(argId);
+                    if (itr != regIndex.end()) {
+                        bl.use.set(itr->second);
+                    }
                 }
-                inst->liveout.erase(spilledRegId);
+            }
+        }
 
-                if (inst->needLiveness) {
-                    inst_worklist.insert(inst.get());
-                    inst->needLiveness = false;
+        for (uint32_t succId : block->instructions.tail->targetLabelIds) {
+            predBlockIds[succId].push_back(blockId);
+        }
+    }
+
+    // Iterate to a fixed point. Live out is the union of the successors'
+    // live in, plus the phi operands that come from us. Live in is what
+    // we use plus what's live out that we don't define.
+    std::vector<uint32_t> worklist;
+    std::set<uint32_t> inWorklist;
+    for (auto &[blockId, _] : blocks) {
+        worklist.push_back(blockId);
+        inWorklist.insert(blockId);
+    }
+    while (!worklist.empty()) {
+        uint32_t blockId = worklist.back();
+        worklist.pop_back();
+        inWorklist.erase(blockId);
+
+        BlockLiveness &bl = liveness.at(blockId);
+        BitVector out(count);
+        for (uint32_t succId : blocks.at(blockId)->instructions.tail->targetLabelIds) {
+            const BlockLiveness &succ = liveness.at(succId);
+            out.unionWith(succ.in);
+            auto itr = succ.phiUse.find(blockId);
+            if (itr != succ.phiUse.end()) {
+                out.unionWith(itr->second);
+            }
+        }
+        bl.out = out;
+
+        BitVector in = out;
+        in.subtract(bl.def);
+        in.unionWith(bl.use);
+        if (in != bl.in) {
+            bl.in = in;
+
+            // Our predecessors depend on us.
+            for (uint32_t predBlockId : predBlockIds[blockId]) {
+                if (inWorklist.insert(predBlockId).second) {
+                    worklist.push_back(predBlockId);
                 }
             }
         }
     }
 
-    while (!inst_worklist.empty()) {
-        // Pick any PC to start with.
-        Instruction *instruction = *inst_worklist.begin();
-        inst_worklist.erase(instruction);
+    blockLiveIn.clear();
+    blockLiveOut.clear();
+    for (auto &[blockId, bl] : liveness) {
+        blockLiveIn[blockId] = std::move(bl.in);
+        blockLiveOut[blockId] = std::move(bl.out);
+    }
 
-        // Keep track of old livein/liveout for comparison.
-        std::map<uint32_t,std::set<uint32_t>> oldLivein = instruction->livein;
-        std::set<uint32_t> oldLiveout = instruction->liveout;
+    if (PRINT_TIMER_RESULTS) {
+        std::cerr << "Livein and liveout took " << timer.elapsed() << " seconds.\n";
+    }
+}
 
-        // Compute liveout as union of next instructions' liveins.
-        instruction->liveout.clear();
-        for (Instruction *succInstruction : instruction->succ()) {
-            // Add livein from any branch (0).
-            instruction->liveout.insert(
-                    succInstruction->livein[0].begin(),
-                    succInstruction->livein[0].end());
+void Function::stepLivenessBackward(const Instruction *instruction, BitVector &live) const {
+    for (uint32_t resId : instruction->resIdList) {
+        live.reset(regIndex.at(resId));
+    }
 
-            // Add livein specifically from this branch (if phi).
-            auto itr = succInstruction->livein.find(instruction->blockId());
-            if (itr != succInstruction->livein.end()) {
-                instruction->liveout.insert(itr->second.begin(), itr->second.end());
+    if (instruction->opcode() != RiscVOpPhi) {
+        for (uint32_t argId : instruction->argIdSet) {
+            auto itr = regIndex.find(argId);
+            if (itr != regIndex.end()) {
+                live.set(itr->second);
             }
         }
+    }
+}
 
-        // Livein is liveout minus what we generate ...
-        instruction->livein[0] = instruction->liveout;
-        for (uint32_t resId : instruction->resIdSet) {
-            instruction->livein[0].erase(resId);
+std::vector<BitVector> Function::instructionLiveOut(const Block *block) const {
+    size_t size = 0;
+    for (auto inst = block->instructions.head; inst; inst = inst->next) {
+        size++;
+    }
+
+    std::vector<BitVector> liveOut(size);
+    BitVector live = blockLiveOut.at(block->blockId);
+    for (auto inst = block->instructions.tail; inst; inst = inst->prev) {
+        liveOut[--size] = live;
+        stepLivenessBackward(inst.get(), live);
+    }
+
+    return liveOut;
+}
+
+void Function::instructionLiveness(const Instruction *instruction,
+        BitVector &liveIn, BitVector &liveOut) const {
+
+    const Block *block = instruction->list->block;
+    BitVector live = blockLiveOut.at(block->blockId);
+    for (auto inst = block->instructions.tail; inst; inst = inst->prev) {
+        if (inst.get() == instruction) {
+            liveOut = live;
+            stepLivenessBackward(instruction, live);
+            liveIn = live;
+            return;
         }
-        // ... plus what we need.
-        assert(instruction->opcode() != SpvOpPhi); // Should have been replaced.
-        if (instruction->opcode() == RiscVOpPhi) {
-            // Special handling of Phi instruction, because we must specify
-            // which branch our livein is from. Otherwise all branches will
-            // think they need all inputs, which is incorrect.
-            RiscVPhi *phi = dynamic_cast<RiscVPhi *>(instruction);
-            assert(phi->operandIds.size() == phi->resultIds.size());
-            for (size_t i = 0; i < phi->operandIds.size(); i++) {
-                // Operands for a specific result.
-                const std::vector<uint32_t> &operandIds = phi->operandIds[i];
-                assert(phi->labelIds.size() == operandIds.size());
-
-                for (size_t j = 0; j < operandIds.size(); j++) {
-                    instruction->livein[phi->labelIds[j]].insert(operandIds[j]);
+        stepLivenessBackward(inst.get(), live);
+    }
+
+    std::cerr << "Error: Instruction isn't in its block when computing liveness.\n";
+    exit(EXIT_FAILURE);
+}
+
+bool Function::isLive(const BitVector &live, uint32_t regId) const {
+    auto itr = regIndex.find(regId);
+    return itr != regIndex.end() && live.test(itr->second);
+}
+
+std::set<uint32_t> Function::liveRegisters(const BitVector &live) const {
+    std::set<uint32_t> regIds;
+    live.forEach([this, &regIds](size_t index) {
+        regIds.insert(regIds.end(), indexReg[index]);
+    });
+    return regIds;
+}
+
+// f31 is never allocated, the compiler swaps float registers through it.
+static const size_t MAX_LIVE_FLOATS = 31;
+
+// Library calls clobber fa0-fa7, so fewer floats can survive them.
+static const size_t MAX_LIVE_FLOATS_ACROSS_CALL = MAX_LIVE_FLOATS - 8;
+
+// Added to the next-use distance of registers that are live out of the block
+// but not used again in it.
+static const size_t LIVE_OUT_DISTANCE = 1000;
+
+// Added to the next-use distance of constants that the compiler rebuilds from
+// immediates, so they're spilled first. Their reloads don't read memory and
+// they need no store.
+static const size_t REMATERIALIZE_DISTANCE = 2*LIVE_OUT_DISTANCE;
+
+// Whether the register is a float constant that the compiler can build with
+// lui and fmv.s.x, which is when its low 12 bits are zero.
+static bool isRematerializable(const Program *program, uint32_t regId) {
+    auto itr = program->constants.find(regId);
+    return itr != program->constants.end() &&
+        program->isTypeFloat(itr->second.type) &&
+        (*reinterpret_cast<const uint32_t *>(itr->second.data) & 0xFFF) == 0;
+}
+
+std::set<uint32_t> Function::chooseSpills(const std::set<uint32_t> &unspillable) {
+    Timer timer;
+    std::set<uint32_t> spills;
+    size_t maxFloatLiveness = 0;
+    bool stuck = false;
+
+    // With a profile, the cost of spilling a register is how many times its
+    // reloads and store would run. We spill the cheapest first, and among
+    // equal costs (always, without a profile) the one used furthest away.
+    std::map<uint32_t, uint64_t> spillCost;
+    if (!program->blockCounts.empty()) {
+        for (auto &[blockId, block] : blocks) {
+            uint64_t count = program->blockCount(block.get());
+            for (auto inst = block->instructions.head; inst; inst = inst->next) {
+                for (uint32_t argId : inst->argIdSet) {
+                    spillCost[argId] += count;
                 }
-            }
-        } else {
-            // Non-phi instruction, all parameters are livein.
-            for (uint32_t argId : instruction->argIdSet) {
-                // Don't consider /*constants or*/ variables, they're never in registers.
-                if (/*constants.find(argId) == constants.end() &&*/
-                        program->variables.find(argId) == program->variables.end()) {
-
-                    instruction->livein[0].insert(argId);
+                for (uint32_t resId : inst->resIdList) {
+                    spillCost[resId] += count;
                 }
             }
         }
+    }
+    auto spillOrder = [&spillCost](const std::pair<size_t, uint32_t> &a,
+            const std::pair<size_t, uint32_t> &b) {
 
-        // If we changed, then our predecessors need to update since they
-        // depend on us.
-        if (oldLivein != instruction->livein || oldLiveout != instruction->liveout) {
-            // Our predecessors depend on us.
-            for (Instruction *predInstruction : instruction->pred()) {
-                inst_worklist.insert(predInstruction);
+        uint64_t costA = spillCost[a.second];
+        uint64_t costB = spillCost[b.second];
+        return costA != costB ? costA < costB : a > b;
+    };
+
+    for (auto &[blockId, block] : blocks) {
+        std::vector<BitVector> liveOut = instructionLiveOut(block.get());
+
+        // Instructions in order, and the positions where each register is used.
+        std::vector<Instruction *> instructions;
+        std::map<uint32_t, std::vector<size_t>> usePositions;
+        for (auto inst = block->instructions.head; inst; inst = inst->next) {
+            for (uint32_t argId : inst->argIdSet) {
+                usePositions[argId].push_back(instructions.size());
             }
+            instructions.push_back(inst.get());
         }
-    }
-    if (PRINT_TIMER_RESULTS || true) {
-        std::cout << "Livein and liveout took " << timer.elapsed() << " seconds.\n";
-    }
-}
 
-uint32_t Function::spillIfNecessary(const std::set<uint32_t> &alreadySpilled) {
-    Timer timer;
-    int maxFloatLiveness = 0;
-    Instruction *heaviestInstruction = nullptr;
+        // Number of instructions until the register is next used.
+        auto nextUse = [&instructions, &usePositions](uint32_t regId, size_t pos) {
+            auto itr = usePositions.find(regId);
+            if (itr != usePositions.end()) {
+                auto posItr = std::lower_bound(itr->second.begin(), itr->second.end(), pos);
+                if (posItr != itr->second.end()) {
+                    return *posItr - pos;
+                }
+            }
 
-    for (auto &[_, block] : blocks) {
-        for (auto inst = block->instructions.head; inst; inst = inst->next) {
+            return instructions.size() - pos + LIVE_OUT_DISTANCE;
+        };
+
+        for (size_t pos = 0; pos < instructions.size(); pos++) {
             std::set<uint32_t> liveInts;
             std::set<uint32_t> liveFloats;
-            computeLiveSets(inst.get(), liveInts, liveFloats);
-            int floatLiveness = liveFloats.size();
-            if (floatLiveness > maxFloatLiveness) {
-                maxFloatLiveness = floatLiveness;
-                heaviestInstruction = inst.get();
-            }
+            computeLiveSets(pos == 0 ? blockLiveIn.at(blockId) : liveOut[pos - 1],
+                    liveInts, liveFloats);
+            maxFloatLiveness = std::max(maxFloatLiveness, liveFloats.size());
             // We don't currently have a problem with too many ints, so ignore
             // them for now.
+
+            // Count what's still in registers here, and find what we could
+            // spill. Spilling a register used by this instruction doesn't
+            // help, its reload would be live here instead.
+            size_t live = 0;
+            std::vector<std::pair<size_t, uint32_t>> candidates; // Distance and register.
+            for (uint32_t regId : liveFloats) {
+                if (spills.find(regId) != spills.end()) {
+                    continue;
+                }
+                live++;
+
+                size_t distance = nextUse(regId, pos);
+                if (distance > 0 && unspillable.find(regId) == unspillable.end()) {
+                    if (isRematerializable(program, regId)) {
+                        distance += REMATERIALIZE_DISTANCE;
+                    }
+                    candidates.push_back(std::make_pair(distance, regId));
+                }
+            }
+
+            // Spill the ones used furthest in the future.
+            std::sort(candidates.begin(), candidates.end(), spillOrder);
+            for (size_t i = 0; i < candidates.size() && live > MAX_LIVE_FLOATS; i++) {
+                spills.insert(candidates[i].second);
+                live--;
+            }
+            if (live > MAX_LIVE_FLOATS) {
+                stuck = true;
+            }
+
+            // Same thing for the floats that must survive a library call.
+            Instruction *instruction = instructions[pos];
+            if (isLibraryCall(instruction->opcode())) {
+                size_t across = 0;
+                candidates.clear();
+                for (uint32_t regId : liveRegisters(liveOut[pos])) {
+                    if (spills.find(regId) != spills.end() ||
+                            instruction->resIdSet.find(regId) != instruction->resIdSet.end() ||
+                            !program->isTypeFloat(program->typeIdOf(regId))) {
+
+                        continue;
+                    }
+                    across++;
+
+                    if (unspillable.find(regId) == unspillable.end()) {
+                        size_t distance = nextUse(regId, pos + 1);
+                        if (isRematerializable(program, regId)) {
+                            distance += REMATERIALIZE_DISTANCE;
+                        }
+                        candidates.push_back(std::make_pair(distance, regId));
+                    }
+                }
+
+                std::sort(candidates.begin(), candidates.end(), spillOrder);
+                for (size_t i = 0; i < candidates.size() && across > MAX_LIVE_FLOATS_ACROSS_CALL; i++) {
+                    spills.insert(candidates[i].second);
+                    across--;
+                }
+                if (across > MAX_LIVE_FLOATS_ACROSS_CALL) {
+                    stuck = true;
+                }
+            }
         }
     }
 
-    std::cout << "Max float liveness is " << maxFloatLiveness << "\n";
+    std::cout << "Max float liveness is " << maxFloatLiveness
+        << ", spilling " << spills.size() << " registers.\n";
 
-    uint32_t spilledRegId = NO_REGISTER;
-    if (heaviestInstruction != nullptr) {
-        // Recompute these.
-        std::set<uint32_t> liveInts;
-        std::set<uint32_t> liveFloats;
-        computeLiveSets(heaviestInstruction, liveInts, liveFloats);
-        ___count++; // XXX remove.
-        // XXX this is 31 because my swap routine assumes f31 is free.
-        if (liveFloats.size() > 31 && ___count < 200) {
-            spilledRegId = spillVariable(heaviestInstruction, liveFloats, alreadySpilled);
-        }
+    if (spills.empty() && stuck) {
+        std::cerr << "Error: Can't spill enough float registers.\n";
+        exit(EXIT_FAILURE);
     }
 
     if (PRINT_TIMER_RESULTS) {
-        std::cerr << "Spilling took " << timer.elapsed() << " seconds.\n";
+        std::cerr << "Choosing spills took " << timer.elapsed() << " seconds.\n";
     }
 
-    return spilledRegId;
+    return spills;
 }
 
-void Function::computeLiveSets(Instruction *instruction,
+void Function::computeLiveSets(const BitVector &live,
         std::set<uint32_t> &liveInts,
         std::set<uint32_t> &liveFloats) {
 
-    for (uint32_t regId : instruction->livein.at(0)) {
+    for (uint32_t regId : liveRegisters(live)) {
         uint32_t typeId = program->typeIdOf(regId);
         if (typeId == 0) {
             std::cerr << "Error: Can't find type ID of virtual register " << regId << ".\n";
@@ -429,33 +686,7 @@ void Function::computeLiveSets(Instruction *instruction,
     }
 }
 
-uint32_t Function::spillVariable(Instruction *instruction, const std::set<uint32_t> &liveFloats,
-        const std::set<uint32_t> &alreadySpilled) {
-
-    // Pick one randomly. Can later use ComputeWeight or similar to pick a good one.
-    uint32_t regId = NO_REGISTER;
-    for (uint32_t liveRegId : liveFloats) {
-        if (alreadySpilled.find(liveRegId) == alreadySpilled.end()
-                && (regId == NO_REGISTER || liveRegId < regId)) {
-
-            regId = liveRegId;
-        }
-    }
-    if (regId == NO_REGISTER) {
-        std::cerr << "Have already spilled everything.\n";
-        std::cerr << "Live registers:";
-        for (uint32_t regId : liveFloats) {
-            std::cerr << " " << regId;
-        }
-        std::cerr << "\n";
-        std::cerr << "Already spilled registers:";
-        for (uint32_t regId : alreadySpilled) {
-            std::cerr << " " << regId;
-        }
-        std::cerr << "\n";
-        instruction->dump(std::cerr);
-    }
-    assert(regId != NO_REGISTER);
+void Function::spillRegister(uint32_t regId, std::set<uint32_t> &reloadIds) {
     uint32_t typeId = program->typeIdOf(regId);
     bool isConstant = program->isConstant(regId);
     std::cout << "Spilling " << (isConstant ? "constant" : "variable")
@@ -476,6 +707,7 @@ uint32_t Function::spillVariable(Instruction *instruction, const std::set<uint32
         varId = program->nextReg++;
         program->variables[varId] = {pointerTypeId, SpvStorageClassFunction,
             NO_INITIALIZER, 0xFFFFFFFF};
+        program->spillVariables.insert(varId);
     }
 
     // Find every use.
@@ -488,6 +720,7 @@ uint32_t Function::spillVariable(Instruction *instruction, const std::set<uint32
                 // Find a new register name for the use.
                 uint32_t newRegId = program->nextReg++;
                 program->resultTypes[newRegId] = typeId;
+                reloadIds.insert(newRegId);
 
                 // Add a load instruction before the use.
                 LineInfo lineInfo;
@@ -507,9 +740,6 @@ uint32_t Function::spillVariable(Instruction *instruction, const std::set<uint32
                 // Rename the use.
                 inst->changeArg(regId, newRegId);
                 // XXX do we need to call recomputeArgs() if this is a RiscVPhi?
-
-                // Mark it as needing new liveness info.
-                inst->needLiveness = true;
             }
         }
     }
@@ -521,9 +751,6 @@ uint32_t Function::spillVariable(Instruction *instruction, const std::set<uint32
         std::shared_ptr<Instruction> saveInstruction = std::make_shared<RiscVStore>(
                 lineInfo, varId, regId, NO_MEMORY_ACCESS_SEMANTIC, 0);
 
-        // Mark it as needing new liveness info.
-        saveInstruction->needLiveness = true;
-
         // Find the definition.
         found = false;
         for (auto &[_, block] : blocks) {
@@ -543,6 +770,4 @@ uint32_t Function::spillVariable(Instruction *instruction, const std::set<uint32
         }
         assert(found);
     }
-
-    return regId;
 }
@@ -4,8 +4,10 @@
 #include <string>
 #include <map>
 #include <set>
+#include <vector>
 
 #include "risc-v.h"
+#include "bitvector.h"
 
 struct Program;
 struct Block;
@@ -41,6 +43,9 @@ struct Function {
         // Nothing.
     }
 
+    // Compute successor and predecessor blocks from the branch instructions.
+    void computeSuccPred();
+
     // Compute the dominance graph and immediate dominance tree.
     void computeDomTree(bool verbose);
 
@@ -51,26 +56,59 @@ struct Function {
     // Make sure that we don't use more registers than we have in hardware.
     void ensureMaxRegisters();
 
-    // Compute live in and live out registers for each instruction.
-    void computeLiveness(uint32_t spilledRegId);
+    // Dense index of each register in the liveness bit vectors, and back.
+    // Variables are never in registers, so they have no index.
+    std::map<uint32_t, size_t> regIndex;
+    std::vector<uint32_t> indexReg;
+
+    // Registers live into and out of each block. Phi operands aren't live
+    // into the phi's block, only out of the predecessor they come from.
+    std::map<uint32_t, BitVector> blockLiveIn;
+    std::map<uint32_t, BitVector> blockLiveOut;
+
+    // Compute live in and live out registers for each block, with dataflow
+    // over bit vectors. The per-instruction sets are only made on demand
+    // by walking a block backward, see instructionLiveOut().
+    void computeLiveness();
+
+    // Registers live out of each instruction of the block, in order. The
+    // live in of an instruction is the live out of the one before it, or
+    // the block's live in for the first.
+    std::vector<BitVector> instructionLiveOut(const Block *block) const;
 
-    // Spill registers if they won't fit in our hardware registers. Returns
-    // the ID of the spilled register, or NO_REGISTER if nothing was spilled.
-    uint32_t spillIfNecessary(const std::set<uint32_t> &alreadySpilled);
+    // Registers live into and out of a single instruction.
+    void instructionLiveness(const Instruction *instruction,
+            BitVector &liveIn, BitVector &liveOut) const;
 
-    // Compute set of live ints and floats at this instruction.
-    void computeLiveSets(Instruction *instruction,
+    // Whether the register is in the liveness set.
+    bool isLive(const BitVector &live, uint32_t regId) const;
+
+    // The registers in the liveness set.
+    std::set<uint32_t> liveRegisters(const BitVector &live) const;
+
+    // Pick the registers to spill so that no instruction has more float
+    // registers live than we have. At each instruction that's over, spills
+    // the live registers whose next use is furthest away. Returns an empty
+    // set if nothing needs to be spilled.
+    std::set<uint32_t> chooseSpills(const std::set<uint32_t> &unspillable);
+
+    // Split the liveness set into ints and floats.
+    void computeLiveSets(const BitVector &live,
             std::set<uint32_t> &liveInts,
             std::set<uint32_t> &liveFloats);
 
-    // Spill one of the variables in the set of live floats at this instruction.
-    // Returns the ID of the spilled variable.
-    uint32_t spillVariable(Instruction *instruction, const std::set<uint32_t> &liveFloats,
-            const std::set<uint32_t> &alreadySpilled);
+    // Spill the register to memory, storing it after its definition and
+    // loading it into a new register before each use. The new registers
+    // are added to reloadIds.
+    void spillRegister(uint32_t regId, std::set<uint32_t> &reloadIds);
 
     // Take "mainImage(vf4;vf2;" and return "mainImage$v4f$vf2".
     static std::string cleanUpName(std::string name);
 
+    // Update the live set from after the instruction to before it. Phi
+    // operands aren't added, see blockLiveIn.
+    void stepLivenessBackward(const Instruction *instruction, BitVector &live) const;
+
     // Debug dump.
     void dumpBlockInfo() const;
     void dumpGraph(const std::set<uint32_t> &unreached) const;
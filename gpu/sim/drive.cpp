@@ -26,6 +26,10 @@ constexpr bool dumpCoreStatus = false; // true;
 
 constexpr std::chrono::microseconds h2f_timeout(h2f_timeout_micros);
 
+// Rows a core shades per run of the program, if the library can do more
+// than one. Cores take spans from the work pool as they become idle.
+constexpr int ROWS_PER_SPAN = 4;
+
 typedef std::unique_ptr<Hal> HalPtr;
 
 class scoped_lock {
@@ -46,9 +50,9 @@ public:
         mItems.push_back(item);
     }
 
-    // Add all in a range.
-    void addRange(int begin, int end) {
-        for (int item = begin; item < end; item++) {
+    // Add all in a range, optionally only every step-th one.
+    void addRange(int begin, int end, int step = 1) {
+        for (int item = begin; item < end; item += step) {
             add(item);
         }
     }
@@ -368,6 +372,14 @@ struct CoreParameters
     uint32_t rowWidthAddress;
     uint32_t colBufAddrAddress;
 
+    // Where .mainLoop gets the rows of a span, or 0xFFFFFFFF if the
+    // library only does one row per call.
+    uint32_t rowCountAddress;
+    uint32_t colBufRowStrideAddress;
+
+    // Number of rows a core shades before it's given more work.
+    int rowsPerSpan;
+
     uint32_t initialPC;
 
     int imageWidth;
@@ -458,9 +470,10 @@ bool isCoreHalted(Hal *hal, int coreNumber) {
 }
 
 /**
- * Configure the core to prepare to do this row. Does not start the program.
+ * Configure the core to prepare to do the span of rows starting at this row.
+ * Does not start the program. Returns the number of rows in the span.
  */
-void configureCoreForRow(const SimDebugOptions *debugOptions, const CoreParameters *params,
+int configureCoreForRows(const SimDebugOptions *debugOptions, const CoreParameters *params,
         Hal *hal, int row, int coreNumber)
 {
     // Set up parameters.
@@ -477,10 +490,19 @@ void configureCoreForRow(const SimDebugOptions *debugOptions, const CoreParamete
     // Offset in bytes into the shared memory space.
     uint32_t sdramAddr = pixelOffset*3*sizeof(float);
     set(hal, params->colBufAddrAddress, sdramAddr | 0x80000000, coreNumber);
+    uint32_t rowCount = std::min(params->rowsPerSpan, params->afterLastY - row);
+    if(params->rowCountAddress != 0xFFFFFFFF) {
+        set(hal, params->rowCountAddress, rowCount, coreNumber);
+        // Rows are stored bottom up, so the next row is earlier in memory.
+        uint32_t rowStride = -params->imageWidth*3*sizeof(float);
+        set(hal, params->colBufRowStrideAddress, rowStride, coreNumber);
+    }
 
     if(debugOptions->printDisassembly) {
         std::cout << "; pixel " << params->startX << ", " << row << '\n';
     }
+
+    return rowCount;
 }
 
 /**
@@ -573,8 +595,9 @@ void render(const SimDebugOptions* debugOptions, const CoreParameters* params, C
         }
     }
 
-    // Keep track of which core is busy.
+    // Keep track of which core is busy and how many rows it's doing.
     bool coreIsWorking[hal->getCoreCount()];
+    int coreRowCount[hal->getCoreCount()];
     steady_clock::time_point coreStartTime[hal->getCoreCount()];
     for (int coreNumber: coresToUse) {
         coreIsWorking[coreNumber] = false;
@@ -604,7 +627,7 @@ void render(const SimDebugOptions* debugOptions, const CoreParameters* params, C
             if (!coreIsWorking[coreNumber]) {
                 int row = workPool->get();
 
-                // We have an idle core. Dispatch a row if we have one.
+                // We have an idle core. Dispatch a span of rows if we have one.
                 if (row == -1) {
                     // No rows left.
                     idleCoreCount++;
@@ -612,7 +635,7 @@ void render(const SimDebugOptions* debugOptions, const CoreParameters* params, C
                     if(dumpCoreStatus) printf("Core %d is idle, doing row %d.\n", coreNumber, row);
 
                     resetCore(hal.get(), coreNumber);
-                    configureCoreForRow(debugOptions, params, hal.get(), row, coreNumber);
+                    coreRowCount[coreNumber] = configureCoreForRows(debugOptions, params, hal.get(), row, coreNumber);
                     startProgram(hal.get(), coreNumber);
                     coreIsWorking[coreNumber] = true;
                     coreStartTime[coreNumber] = steady_clock::now();
@@ -703,7 +726,7 @@ void render(const SimDebugOptions* debugOptions, const CoreParameters* params, C
                 uint32_t width = params->afterLastX - params->startX;
 		{
 		    scoped_lock s(shared->rendererMutex);
-		    shared->pixelsLeft -= width;
+		    shared->pixelsLeft -= width*coreRowCount[coreNumber];
 		}
 
                 /* return to STATE_INIT so we can drive ext memory access */
@@ -902,10 +925,16 @@ int main(int argc, char **argv)
 
     binaryFile.close();
 
+    // The compiler's "profile." labels are only for the block profile, so
+    // prefer any other label at the same address.
     for(auto& it: params.text_symbols) {
         auto symbol = it.first;
         auto address = it.second;
-        params.textAddressesToSymbols[address] = symbol;
+        if(symbol.compare(0, 8, "profile.") == 0) {
+            params.textAddressesToSymbols.emplace(address, symbol);
+        } else {
+            params.textAddressesToSymbols[address] = symbol;
+        }
     }
 
     assert(params.data_bytes.size() < RiscVInitialStackPointer);
@@ -948,6 +977,16 @@ int main(int argc, char **argv)
     }
     params.rowWidthAddress = params.data_symbols[".rowWidth"];
     params.colBufAddrAddress = params.data_symbols[".colBufAddr"];
+    if(params.data_symbols.find(".rowCount") != params.data_symbols.end()) {
+        params.rowCountAddress = params.data_symbols[".rowCount"];
+        params.colBufRowStrideAddress = params.data_symbols[".colBufRowStride"];
+        params.rowsPerSpan = ROWS_PER_SPAN;
+    } else {
+        // Older library, .mainLoop shades a row at a time.
+        params.rowCountAddress = 0xFFFFFFFF;
+        params.colBufRowStrideAddress = 0xFFFFFFFF;
+        params.rowsPerSpan = 1;
+    }
 
     params.startX = 0;
     params.afterLastX = params.imageWidth;
@@ -970,7 +1009,7 @@ int main(int argc, char **argv)
 
     // Set up our work pool.
     WorkPool workPool;
-    workPool.addRange(params.startY, params.afterLastY);
+    workPool.addRange(params.startY, params.afterLastY, params.rowsPerSpan);
 
     // Start the threads.
     if(!HalCanCreateMultipleInstances) {
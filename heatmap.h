@@ -0,0 +1,66 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Color of a cost that's the fraction t of the most expensive pixel's, going
+// from black through red and yellow to white.
+inline void heatmapColor(double t, uint8_t rgb[3]) {
+    for (int c = 0; c < 3; c++) {
+        rgb[c] = uint8_t(std::clamp(3*t - c, 0.0, 1.0)*255.99);
+    }
+}
+
+// Write a heatmap of what each pixel cost to imagePathname as a PPM, and the
+// total of each row to rowsPathname as "y cost" lines, y being the row of
+// gl_FragCoord. Print the minimum, median, 99th percentile, and maximum cost
+// of a pixel. The costs are in the order of the image file, top row first.
+// Fails the program if a file can't be written.
+inline void writeHeatmap(const std::vector<uint64_t> &costs, int width, int height,
+        const std::string &unit, const std::string &imagePathname,
+        const std::string &rowsPathname) {
+
+    std::vector<uint64_t> sorted(costs);
+    std::sort(sorted.begin(), sorted.end());
+    uint64_t maxCost = sorted.back();
+
+    std::cout << unit << " per pixel: min " << sorted.front()
+        << ", median " << sorted[sorted.size()/2]
+        << ", 99th percentile " << sorted[sorted.size()*99/100]
+        << ", max " << maxCost << ".\n";
+
+    FILE *fp = fopen(imagePathname.c_str(), "wb");
+    if (fp == nullptr) {
+        std::cerr << "Error: Can't open heatmap \"" << imagePathname << "\" for writing.\n";
+        exit(EXIT_FAILURE);
+    }
+    fprintf(fp, "P6 %d %d 255\n", width, height);
+    for (uint64_t cost : costs) {
+        uint8_t rgb[3];
+        heatmapColor(maxCost == 0 ? 0.0 : double(cost)/maxCost, rgb);
+        fwrite(rgb, 1, 3, fp);
+    }
+    fclose(fp);
+
+    std::ofstream rowsFile(rowsPathname);
+    if (!rowsFile.good()) {
+        std::cerr << "Error: Can't open \"" << rowsPathname << "\" for writing.\n";
+        exit(EXIT_FAILURE);
+    }
+    for (int y = 0; y < height; y++) {
+        uint64_t total = 0;
+        for (int x = 0; x < width; x++) {
+            total += costs[(height - 1 - y)*width + x];
+        }
+        rowsFile << y << " " << total << "\n";
+    }
+}
+
+#endif // HEATMAP_H
@@ -16,7 +16,7 @@ struct UninitializedMemoryReadException : std::runtime_error
 };
 
 Interpreter::Interpreter(const Program *pgm)
-    : instruction(nullptr), pgm(pgm)
+    : instruction(nullptr), pgm(pgm), instructionCount(0)
 {
     memory = new unsigned char[pgm->memorySize];
     memoryInitialized = new bool[pgm->memorySize];
@@ -1741,13 +1741,11 @@ void Interpreter::step()
     }
 
     thisInstruction->step(this);
+    instructionCount++;
 }
 
-void Interpreter::run()
+void Interpreter::prepareRegisters()
 {
-    currentBlockId = NO_BLOCK_ID;
-    previousBlockId = NO_BLOCK_ID;
-
     // Copy constants to memory. They're treated like variables.
     for(auto& [id, constant]: pgm->constants) {
         registers[id] = constant;
@@ -1761,6 +1759,38 @@ void Interpreter::run()
             assert(var.initializer == NO_INITIALIZER); // XXX will do initializers later
         }
     }
+}
+
+void Interpreter::runUniformPrologue()
+{
+    prepareRegisters();
+
+    // These aren't in any block, and none of them branch, so step
+    // them directly.
+    for(auto& inst: pgm->uniformPrologue) {
+        inst->step(this);
+    }
+}
+
+void Interpreter::copyUniformResults(const Interpreter &other)
+{
+    for(uint32_t id: pgm->uniformResultIds) {
+        // Access chains produce pointers, everything else a register.
+        auto p = other.pointers.find(id);
+        if(p != other.pointers.end()) {
+            pointers[id] = p->second;
+        } else {
+            registers[id] = other.registers.at(id);
+        }
+    }
+}
+
+void Interpreter::run()
+{
+    currentBlockId = NO_BLOCK_ID;
+    previousBlockId = NO_BLOCK_ID;
+
+    prepareRegisters();
 
     parameterStack.clear();
     returnStack.clear();
@@ -28,6 +28,9 @@ struct Interpreter
 
     const Program *pgm;
 
+    // Number of instructions stepped so far.
+    uint64_t instructionCount;
+
     Interpreter(const Program *pgm);
 
     virtual ~Interpreter()
@@ -70,6 +73,17 @@ struct Interpreter
     void jumpToBlock(const Instruction *thisInstruction, uint32_t blockId);
     void jumpToFunction(const Function *function);
 
+    // Copy constants into registers and point at all variables.
+    void prepareRegisters();
+
+    // Evaluate the program's uniform prologue. The uniforms must
+    // already have been set.
+    void runUniformPrologue();
+
+    // Copy the results of the other interpreter's uniform prologue
+    // into our registers.
+    void copyUniformResults(const Interpreter &other);
+
     void step();
     void run();
 
@@ -3,18 +3,36 @@
 ; library.s
 ;
 ; library of math functions
+;
+; Calling convention: float parameters are passed in fa0-fa7 and integer
+; (bool) parameters in a0-a7, in order. Results are returned starting at
+; fa0 (or a0). Routines may clobber a0-a7 and fa0-fa7 but must preserve all
+; other registers. Routines that call other routines save ra (and anything
+; else they need across the call) on the stack.
 
 .segment data
 
 ; for communication with the driving code.
 .rowWidth:                      ; in pixels
         .word   0
+.rowCount:                      ; number of rows to shade, starting at gl_FragCoord
+        .word   1
 .colBufAddr:                    ; in byte offset to shared SDRAM area, must have high bit set
         .word   0
+.colBufRowStride:               ; in bytes from one row's colBufAddr to the next's
+        .word   0
 .mailLoopX:
         .word   0
 .mailLoopY:
         .word   0
+.mainLoopStartX:
+        .word   0
+.mainLoopWidth:
+        .word   0
+.mainLoopRowsLeft:
+        .word   0
+.mainLoopRowAddr:
+        .word   0
 
 ; some useful constants
 .NaN:
@@ -211,49 +229,34 @@
 .sin:
         ; XXX this is different enough from emulation that it causes substantial visual differences between wetrock and flirt 
 
-        ; save registers
-        sw      a0,-4(sp)
-        sw      a1,-8(sp)
-        sw      a2,-12(sp)
-        sw      a3,-16(sp)
-        sw      a4,-20(sp)
-        sw      a5,-24(sp)
-        fsw     ft0,-28(sp)
-        fsw     ft1,-32(sp)
-        fsw     ft2,-36(sp)
-        fsw     ft3,-40(sp)
-        fsw     ft4,-44(sp)
-        fsw     ft5,-48(sp)
-        fsw     ft6,-52(sp)
-
-        flw     ft0, 0(sp)       ; load first parameter ("x"), doesn't have to be into ft0
+        ; x is already in fa0.
 
         ; .oneOverTwoPi is 1/(2pi)
         ; .sinTableSize is 512.0
         ; .one is 1.0
         ; sinTable_f32 is 513 long
 
-        ; ft2<u> = ft0<x> * ft1<1 / (2 * pi)>
+        ; fa2<u> = fa0<x> * fa1<1 / (2 * pi)>
 	lui	a5,%hi(.oneOverTwoPi)
-	flw	ft1,%lo(.oneOverTwoPi)(a5)
-	fmul.s	ft2,ft0,ft1
+	flw	fa1,%lo(.oneOverTwoPi)(a5)
+	fmul.s	fa2,fa0,fa1
 
-        ; ft3<indexf> = ft2<u> * ft1<tablesize>
+        ; fa3<indexf> = fa2<u> * fa1<tablesize>
 	lui	a5,%hi(.sinTableSize)
-	flw	ft1,%lo(.sinTableSize)(a5)
-	fmul.s	ft3,ft2,ft1
+	flw	fa1,%lo(.sinTableSize)(a5)
+	fmul.s	fa3,fa2,fa1
 
-        ; a1<index> = ifloorf(ft3<indexf>)
-	fcvt.w.s a1,ft3,rdn
+        ; a1<index> = ifloorf(fa3<indexf>)
+	fcvt.w.s a1,fa3,rdn
 
-        ; ft6<beta> = ft3<indexf> - ft4<float(index)>
-        fcvt.s.w ft4,a1,rtz
-	fsub.s	ft6,ft3,ft4
+        ; fa6<beta> = fa3<indexf> - fa4<float(index)>
+        fcvt.s.w fa4,a1,rtz
+	fsub.s	fa6,fa3,fa4
 
-        ; ft4<alpha> = ft5<1.0f> - ft6<beta>
+        ; fa4<alpha> = fa5<1.0f> - fa6<beta>
 	lui	a5,%hi(.one)
-	flw	ft5,%lo(.one)(a5)
-        fsub.s ft4,ft5,ft6
+	flw	fa5,%lo(.one)(a5)
+        fsub.s fa4,fa5,fa6
 
         ; a2<lower> = a1<index> & imm<tablemask>
 	andi	a2,a1,511
@@ -261,7 +264,7 @@
         ; a3<upper> = a2<lower> + imm<1>
         addi     a3,a2,1
 
-        ; ; ft0<result> = table[a2<lower>] * ft4<alpha> + table[a3<upper>] * ft6<beta>
+        ; ; fa0<result> = table[a2<lower>] * fa4<alpha> + table[a3<upper>] * fa6<beta>
         ; a1 = table + a2 * 4
         lui     a5,%hi(sinTable_f32)
         addi    a5,a5,%lo(sinTable_f32)
@@ -269,41 +272,26 @@
         slli    a4,a2,2
         add    a1,a5,a4
 
-        ; ft1 = *a1
-        flw     ft1,0(a1)
+        ; fa1 = *a1
+        flw     fa1,0(a1)
 
-        ; ft2 = *(a1 + 4)
-        flw     ft2,4(a1)
+        ; fa2 = *(a1 + 4)
+        flw     fa2,4(a1)
 
-        ; ft3 = ft2 * ft6
-        fmul.s    ft3,ft2,ft6
+        ; fa3 = fa2 * fa6
+        fmul.s    fa3,fa2,fa6
 
-        ; ft0 = ft1 * ft4 + ft0
-        ; for the following, would prefer: fmadd.s   ft0,ft1,ft4,ft3
-        fmul.s  ft2,ft1, ft4
-        fadd.s  ft0, ft2, ft3
+        ; fa0 = fa1 * fa4 + fa0
+        ; for the following, would prefer: fmadd.s   fa0,fa1,fa4,fa3
+        fmul.s  fa2,fa1, fa4
+        fadd.s  fa0, fa2, fa3
 
         ; XXX debugging - multiply by .5
 	; lui	a5,%hi(.point5)
-	; flw	ft1,%lo(.point5)(a5)
-        ; fmul.s    ft0,ft0,ft1
-
-        fsw     ft0, 0(sp)      ; store return value
-        ; restore registers
-        lw      a0,-4(sp)
-        lw      a1,-8(sp)
-        lw      a2,-12(sp)
-        lw      a3,-16(sp)
-        lw      a4,-20(sp)
-        lw      a5,-24(sp)
-        flw     ft0,-28(sp)
-        flw     ft1,-32(sp)
-        flw     ft2,-36(sp)
-        flw     ft3,-40(sp)
-        flw     ft4,-44(sp)
-        flw     ft5,-48(sp)
-        flw     ft6,-52(sp)
+	; flw	fa1,%lo(.point5)(a5)
+        ; fmul.s    fa0,fa0,fa1
 
+        ; return value is in fa0
         jalr x0, ra, 0                
 
 .segment data
@@ -960,35 +948,24 @@ atanTable_f32:
 
 .segment text
 .atan_0_1:
-
-        fsw     ft0, -4(sp)
-        fsw     ft1, -8(sp)
-        fsw     ft2, -12(sp)
-        fsw     ft3, -16(sp)
-        fsw     ft4, -20(sp)
-        fsw     ft5, -24(sp)
-        sw     a0, -28(sp)
-        sw     a1, -32(sp)
-        sw     a2, -36(sp)
-
         ; atan_0_1(float z) { }
-        flw     ft0, 0(sp)              ; ft0 = z
+        ; fa0 = z
 
         ; int i = z * TABLE_POW2;
 	lui	a1,%hi(.atanTableSize)  ; a1 = hi part of address of TABLE_POW2
-	flw	ft1,%lo(.atanTableSize)(a1)      ; ft1 = TABLE_POW2
+	flw	fa1,%lo(.atanTableSize)(a1)      ; fa1 = TABLE_POW2
         ; a1 is available after this line
-        fmul.s    ft2, ft0, ft1         ; ft2 = z * TABLE_POW2
-	fcvt.w.s        a0,ft2,rdn      ; a0 = ifloor(z * TABLE_POW2)
-        ; ft1 is available after this line
-        ; ft0 is available after this line
+        fmul.s    fa2, fa0, fa1         ; fa2 = z * TABLE_POW2
+	fcvt.w.s        a0,fa2,rdn      ; a0 = ifloor(z * TABLE_POW2)
+        ; fa1 is available after this line
+        ; fa0 is available after this line
 
         ; float a = z * TABLE_POW2 - i;
-        ; ft3 = a
-        fcvt.s.w ft0,a0,rne             ; ft0 = float(a0)
-        fsub.s ft3,ft2,ft0            ; ft3 = z * TABLE_POW2 - float(floori(z * TABLE_POW2))
-        ; ft0 is available after this line
-        ; ft2 is available after this line
+        ; fa3 = a
+        fcvt.s.w fa0,a0,rne             ; fa0 = float(a0)
+        fsub.s fa3,fa2,fa0            ; fa3 = z * TABLE_POW2 - float(floori(z * TABLE_POW2))
+        ; fa0 is available after this line
+        ; fa2 is available after this line
 
         ; float lower = atanTable[i];
         lui     a1,%hi(atanTable_f32)   ; a1 = hi part of address of atanTable
@@ -999,139 +976,89 @@ atanTable_f32:
         ; a0 is available after this line
         add     a0, a1, a2              ; a0 = ifloor(z * TABLE_POW2) * 4 + atanTable
         ; a1 is available after this line
-        flw     ft4, 0(a0)              ; ft4 = lower = atanTable[z * TABLE_POW2]
+        flw     fa4, 0(a0)              ; fa4 = lower = atanTable[z * TABLE_POW2]
         ; float higher = atanTable[i + 1];
-        flw     ft5, 4(a0)              ; ft5 = higher = atanTable[z * TABLE_POW2 + 1]
+        flw     fa5, 4(a0)              ; fa5 = higher = atanTable[z * TABLE_POW2 + 1]
         ; a0 is available after this line
 
         ; float f = lower * (1 - a) + higher * a;
 	lui	a0,%hi(.one)            ; a0 = hi part of .one
-	flw	ft0,%lo(.one)(a0)       ; ft0 = 1.0
-        fsub.s  ft1,ft0,ft3             ; ft1 = 1.0 - a
-        fmul.s  ft0,ft4,ft1             ; ft0 = lower * (1.0 - a)
-
-        ; for the following, would prefer: fmadd.s ft1,ft5,ft3,ft0
-        fmul.s  ft2, ft5, ft3 ; ft1 = higher * a + lower * (1.0 - a)
-        fadd.s  ft1, ft2, ft0
-
-        ; return f;
-        fsw     ft1, 0(sp)
-
-        ; restore registers
-        flw     ft0, -4(sp)
-        flw     ft1, -8(sp)
-        flw     ft2, -12(sp)
-        flw     ft3, -16(sp)
-        flw     ft4, -20(sp)
-        flw     ft5, -24(sp)
-        lw     a0, -28(sp)
-        lw     a1, -32(sp)
-        lw     a2, -36(sp)
+	flw	fa0,%lo(.one)(a0)       ; fa0 = 1.0
+        fsub.s  fa1,fa0,fa3             ; fa1 = 1.0 - a
+        fmul.s  fa0,fa4,fa1             ; fa0 = lower * (1.0 - a)
 
+        ; for the following, would prefer: fmadd.s fa0,fa5,fa3,fa0
+        fmul.s  fa2, fa5, fa3 ; fa0 = higher * a + lower * (1.0 - a)
+        fadd.s  fa0, fa2, fa0
+
+        ; return f in fa0;
         jalr x0, ra, 0
 
 .atan:
-        ; save registers
-        sw      a0, -4(sp)
-        sw      a1, -8(sp)
-        fsw     ft0, -12(sp)
-        fsw     ft1, -16(sp)
-        fsw     ft2, -20(sp)
-        fsw     ft3, -24(sp)
-        fsw     ft4, -28(sp)
-        fsw     ft5, -32(sp)
-        fsw     ft6, -36(sp)
-
-        ; load parameter
-        ; begin using ft0
-        flw     ft0, 0(sp)      ; float atan(float y_x) {}
-
-        addi    sp,sp,-36        ; push saved registers
-
-        ; begin using ft2
-        fsgnjx.s ft2, ft0, ft0     ; float ft2 = fabs_y_x = fabs(y_x)
+        ; float atan(float y_x) {}
+        ; fa0 = y_x
+
+        ; Keep y_x and our return address on the stack across the call to .atan_0_1.
+        addi    sp, sp, -8
+        sw      ra, 4(sp)
+        fsw     fa0, 0(sp)
+
+        ; begin using fa2
+        fsgnjx.s fa2, fa0, fa0     ; float fa2 = fabs_y_x = fabs(y_x)
 
         ; if(fabsf(y_x) > 1.0) {
 	lui	a0,%hi(.one)
-	flw	ft1,%lo(.one)(a0)       ; ft1 = 1.0
+	flw	fa1,%lo(.one)(a0)       ; fa1 = 1.0
         ; begin using a1
-        fle.s   a1,ft2,ft1              ; a1 = (fabs_y_x <= 1.0)
+        fle.s   a1,fa2,fa1              ; a1 = (fabs_y_x <= 1.0)
         bne     a1,zero,.atan_small_y_x ; if(fabs_y_x <= 1.0) goto atan_small_y_x
         ; a1 is available after this line
 
         ;     return copysign(M_PI / 2.0, y_x) + -copysign(brad_atan_0_1(1.0 / fabs(y_x)), y_x);
-        ; begin using ft3
-        fdiv.s  ft3, ft1, ft2
+        fdiv.s  fa0, fa1, fa2
 
-        addi    sp, sp, -8      ; Make room on stack
-        sw      ra, 4(sp)       ; Save return address
-        fsw     ft3, 0(sp)      ; Store parameter
-        ; ft3 is available after this line
+        jal     ra, .atan_0_1           ; fa3 = brad_atan_0_1(1.0 / fabs(y_x))
+        fsgnj.s fa3, fa0, fa0
 
-        jal     ra, .atan_0_1   
-
-        ; begin using ft3
-        flw     ft3, 0(sp)      ; Pop result
-        lw      ra, 4(sp)       ; Restore return address
-        addi    sp, sp, 8       ; Restore stack
+        flw     fa0, 0(sp)              ; fa0 = y_x
 
 	lui	a0,%hi(.halfPi)
-        ; begin using ft4
-	flw	ft4,%lo(.halfPi)(a0)
-        ; begin using ft5
-        fsgnj.s   ft5, ft4, ft0
-        ; ft4 is available after this line
+        ; begin using fa4
+	flw	fa4,%lo(.halfPi)(a0)
+        ; begin using fa5
+        fsgnj.s   fa5, fa4, fa0
+        ; fa4 is available after this line
 
-        ; begin using ft6
-        fsgnjn.s ft6, ft3, ft0
-        ; ft3 is available after this line
+        ; begin using fa6
+        fsgnjn.s fa6, fa3, fa0
+        ; fa3 is available after this line
 
-        ; begin using ft4
-        fadd.s  ft4, ft5, ft6
-        ; ft6 is available after this line
-        ; ft5 is available after this line
+        fadd.s  fa0, fa5, fa6
+        ; fa6 is available after this line
+        ; fa5 is available after this line
 
         jal zero, .atan_finish   ; goto .atan_finish
 
 .atan_small_y_x: ; } else {
 
-        addi    sp, sp, -8      ; Make room on stack
-        sw      ra, 4(sp)       ; Save return address
-        fsw     ft2, 0(sp)      ; Store parameter
-        ; ft2 is available after this line
+        fsgnj.s fa0, fa2, fa2           ; Parameter fabs_y_x
+        ; fa2 is available after this line
 
         jal     ra, .atan_0_1   
 
-        ; begin using ft2
-        flw     ft2, 0(sp)      ; Pop result
-        lw      ra, 4(sp)       ; Restore return address
-        addi    sp, sp, 8       ; Restore stack
+        ; begin using fa1
+        flw     fa1, 0(sp)              ; fa1 = y_x
 
-        ; begin using ft4
-        fsgnj.s   ft4, ft2, ft0
-        ; ft2 is available after this line
-        ; ft0 is available after this line
+        fsgnj.s   fa0, fa0, fa1
+        ; fa1 is available after this line
         
 .atan_finish:
 
-        addi    sp,sp,36        ; pop saved registers
-
-        ; store return value
-        fsw     ft4, 0(sp)
-        ; ft4 is available after this line
-
-        ; restore registers
-        lw      a0, -4(sp)
-        lw      a1, -8(sp)
-        flw     ft0, -12(sp)
-        flw     ft1, -16(sp)
-        flw     ft2, -20(sp)
-        flw     ft3, -24(sp)
-        flw     ft4, -28(sp)
-        flw     ft5, -32(sp)
-        flw     ft6, -36(sp)
+        ; Restore return address and stack.
+        lw      ra, 4(sp)
+        addi    sp, sp, 8
 
-        ; return
+        ; return value is in fa0
         jalr x0, ra, 0
 
 .reflect1:
@@ -1143,58 +1070,33 @@ atanTable_f32:
         jalr x0, ra, 0
 
 .reflect3:
-        ; Save registers.
-        fsw     ft0, -4(sp)
-        fsw     ft1, -8(sp)
-        fsw     ft2, -12(sp)
-        fsw     ft3, -16(sp)
-        fsw     ft4, -20(sp)
-        fsw     ft5, -24(sp)
-        fsw     ft6, -28(sp)
-        fsw     ft7, -32(sp)
-
-        ; Parameters.
-        flw     ft0, 0(sp)                  ; ix
-        flw     ft1, 4(sp)                  ; iy
-        flw     ft2, 8(sp)                  ; iz
-        flw     ft3, 12(sp)                 ; nx
-        flw     ft4, 16(sp)                 ; ny
-        flw     ft5, 20(sp)                 ; nz
+        ; Parameters:
+        ; fa0 = ix
+        ; fa1 = iy
+        ; fa2 = iz
+        ; fa3 = nx
+        ; fa4 = ny
+        ; fa5 = nz
 
         ; Dot product of i and n.
-        fmul.s  ft6, ft0, ft3               ; ix*nx
-        fmul.s  ft7, ft1, ft4               ; iy*ny
-        fadd.s  ft6, ft6, ft7               ; ix*nx + iy*ny
-        fmul.s  ft7, ft2, ft5               ; iz*nz
-        fadd.s  ft6, ft6, ft7               ; ix*nx + iy*ny + iz*nz
+        fmul.s  fa6, fa0, fa3               ; ix*nx
+        fmul.s  fa7, fa1, fa4               ; iy*ny
+        fadd.s  fa6, fa6, fa7               ; ix*nx + iy*ny
+        fmul.s  fa7, fa2, fa5               ; iz*nz
+        fadd.s  fa6, fa6, fa7               ; ix*nx + iy*ny + iz*nz
 
         ; Double dot product.
-        fadd.s  ft6, ft6, ft6
-
-        fmul.s  ft7, ft6, ft3               ; 2*dot*nx
-        fsub.s  ft0, ft0, ft7               ; ix - 2*dot*nx
-        fsw     ft0, 12(sp)
-
-        fmul.s  ft7, ft6, ft4               ; 2*dot*ny
-        fsub.s  ft1, ft1, ft7               ; iy - 2*dot*ny
-        fsw     ft1, 16(sp)
+        fadd.s  fa6, fa6, fa6
 
-        fmul.s  ft7, ft6, ft5               ; 2*dot*nz
-        fsub.s  ft2, ft2, ft7               ; iz - 2*dot*nz
-        fsw     ft2, 20(sp)
+        ; Return values in fa0, fa1, and fa2.
+        fmul.s  fa7, fa6, fa3               ; 2*dot*nx
+        fsub.s  fa0, fa0, fa7               ; ix - 2*dot*nx
 
-        ; Restore registers.
-        flw     ft0, -4(sp)
-        flw     ft1, -8(sp)
-        flw     ft2, -12(sp)
-        flw     ft3, -16(sp)
-        flw     ft4, -20(sp)
-        flw     ft5, -24(sp)
-        flw     ft6, -28(sp)
-        flw     ft7, -32(sp)
+        fmul.s  fa7, fa6, fa4               ; 2*dot*ny
+        fsub.s  fa1, fa1, fa7               ; iy - 2*dot*ny
 
-        ; We took six parameters and return three, so fix up stack.
-        addi    sp, sp, 12
+        fmul.s  fa7, fa6, fa5               ; 2*dot*nz
+        fsub.s  fa2, fa2, fa7               ; iz - 2*dot*nz
 
         ; Return.
         jalr    x0, ra, 0
@@ -1215,155 +1117,80 @@ atanTable_f32:
         ; to detect integer b when a < 0. See "man powf" for a full
         ; list of the special cases.
 
-        ; Save registers.
-        sw      ra, -4(sp)
-        fsw     ft0, -8(sp)
-        fsw     ft1, -12(sp)
-
-        flw     ft0, 0(sp)                  ; Parameter a.
-        flw     ft1, 4(sp)                  ; Parameter b.
+        ; Parameter a is in fa0, parameter b is in fa1. Keep b and our
+        ; return address on the stack across the call to .log2.
+        addi    sp, sp, -8
+        sw      ra, 4(sp)
+        fsw     fa1, 0(sp)
 
         ; Compute log2(a).
-        addi    sp, sp, -16                 ; Make room on stack.
-        fsw     ft0, 0(sp)                  ; Store parameter.
         jal     ra, .log2                   ; Call our log2 function.
-        flw     ft0, 0(sp)                  ; Pop result.
 
         ; Multiply by parameter b.
-        fmul.s  ft1, ft1, ft0
+        flw     fa1, 0(sp)
+        fmul.s  fa0, fa1, fa0
 
-        ; Compute exp2(b*log2(a)).
-        fsw     ft1, 0(sp)                  ; Store parameter.
-        jal     ra, .exp2                   ; Call our exp2 function.
-        flw     ft1, 0(sp)                  ; Pop result.
-        addi    sp, sp, 16                  ; Restore stack.
-
-        ; Return value.
-        fsw     ft1, 4(sp)
-
-        ; Restore registers.
-        lw      ra, -4(sp)
-        flw     ft0, -8(sp)
-        flw     ft1, -12(sp)
-
-        ; We took two parameters and return one, so fix up stack.
-        addi    sp, sp, 4
+        ; Restore return address and stack.
+        lw      ra, 4(sp)
+        addi    sp, sp, 8
 
-        ; Return.
-        jalr x0, ra, 0
+        ; Compute exp2(b*log2(a)). It returns directly to our caller.
+        jal     x0, .exp2
 
 .clamp:
-        ; Save registers.
-        fsw     ft0, -4(sp)
-        fsw     ft1, -8(sp)
-
-        flw     ft0, 0(sp)                  ; Parameter x.
-        flw     ft1, 4(sp)                  ; Parameter minVal.
-        fmax.s  ft0, ft0, ft1               ; max(x, minVal).
-        flw     ft1, 8(sp)                  ; Parameter maxVal.
-        fmin.s  ft0, ft0, ft1               ; min(max(x, minVal), maxVal).
-
-        ; Return value.
-        fsw     ft0, 8(sp)
-
-        ; Restore registers.
-        flw     ft0, -4(sp)
-        flw     ft1, -8(sp)
-
-        ; We took three parameters and return one, so fix up stack.
-        addi    sp, sp, 8
+        ; fa0 = x, fa1 = minVal, fa2 = maxVal.
+        fmax.s  fa0, fa0, fa1               ; max(x, minVal).
+        fmin.s  fa0, fa0, fa2               ; min(max(x, minVal), maxVal).
 
         ; Return.
         jalr    x0, ra, 0
 
 .mix:
         ; Mixes between x and y according to a: x*(1.0 - a) + y*a
+        ; fa0 = x, fa1 = y, fa2 = a.
 
-        ; Save registers.
-        fsw     ft0, -4(sp)
-        fsw     ft1, -8(sp)
-        fsw     ft2, -16(sp)
-
-        flw     ft1, 4(sp)                  ; Parameter y.
-        flw     ft2, 8(sp)                  ; Parameter a.
-        fmul.s  ft1, ft1, ft2               ; y*a
-        flw     ft0, .one(zero)             ; 1.0
-        fsub.s  ft2, ft0, ft2               ; 1.0 - a
-        flw     ft0, 0(sp)                  ; Parameter x.
-        fmul.s  ft0, ft0, ft2               ; x*(1.0 - a)
-        fadd.s  ft0, ft0, ft1               ; x*(1.0 - a) + y*a
-
-        ; Return value.
-        fsw     ft0, 8(sp)
-
-        ; Restore registers.
-        flw     ft0, -4(sp)
-        flw     ft1, -8(sp)
-        flw     ft2, -16(sp)
-
-        ; We took three parameters and return one, so fix up stack.
-        addi    sp, sp, 8
+        fmul.s  fa1, fa1, fa2               ; y*a
+        flw     fa3, .one(zero)             ; 1.0
+        fsub.s  fa2, fa3, fa2               ; 1.0 - a
+        fmul.s  fa0, fa0, fa2               ; x*(1.0 - a)
+        fadd.s  fa0, fa0, fa1               ; x*(1.0 - a) + y*a
 
         ; Return.
         jalr x0, ra, 0
 
 .smoothstep:
-        ; Save registers.
-        fsw     ft0, -4(sp)
-        fsw     ft1, -8(sp)
-        fsw     ft2, -12(sp)
-        fsw     ft3, -16(sp)
-        fsw     ft4, -20(sp)
-        sw      a0, -24(sp)
-
-        flw     ft0, 0(sp)                  ; Parameter edge0.
-        flw     ft1, 4(sp)                  ; Parameter edge1.
-        flw     ft2, 8(sp)                  ; Parameter x.
-
-        fsub.s  ft3, ft1, ft0               ; edge1 - edge0
+        ; fa0 = edge0, fa1 = edge1, fa2 = x.
+
+        fsub.s  fa3, fa1, fa0               ; edge1 - edge0
         ; XXX use fclass.s
-        fmv.s.x ft4, zero                   ; 0.0
-        feq.s   a0, ft3, ft4                ; edge1 - edge0 == 0.0?
+        fmv.s.x fa4, zero                   ; 0.0
+        feq.s   a0, fa3, fa4                ; edge1 - edge0 == 0.0?
         beq     a0, zero, .smoothstep_not_equal
 
         ; Answer is undefined when edge0 and edge1 are equal.
-        fmv.s.x ft0, zero                   ; 0.0
+        fmv.s.x fa0, zero                   ; 0.0
         jal     x0, .smoothstep_return
 
 .smoothstep_not_equal:
         ; Compute position of x between edge0 and edge1 in range [0.0,1.0] (unclamped).
-        fsub.s  ft4, ft2, ft0               ; x - edge0
-        fdiv.s  ft4, ft4, ft3               ; t = (x - edge0)/(edge1 - edge0)
+        fsub.s  fa4, fa2, fa0               ; x - edge0
+        fdiv.s  fa4, fa4, fa3               ; t = (x - edge0)/(edge1 - edge0)
 
         ; Clamped to [0.0,1.0].
-        fmv.s.x ft0, zero                   ; 0.0
-        fmax.s  ft4, ft4, ft0               ; Clamp to 0.0
-        flw     ft0, .one(zero)             ; 1.0
-        fmin.s  ft4, ft4, ft0               ; Clamp to 1.0
+        fmv.s.x fa0, zero                   ; 0.0
+        fmax.s  fa4, fa4, fa0               ; Clamp to 0.0
+        flw     fa0, .one(zero)             ; 1.0
+        fmin.s  fa4, fa4, fa0               ; Clamp to 1.0
 
         ; Compute spline.
-        fadd.s  ft0, ft4, ft4               ; 2*t
-        flw     ft1, .three(zero)           ; 3
-        fsub.s  ft0, ft1, ft0               ; 3 - 2*t
-        fmul.s  ft0, ft0, ft4               ; t*(3 - 2*t)
-        fmul.s  ft0, ft0, ft4               ; t*t*(3 - 2*t)
+        fadd.s  fa0, fa4, fa4               ; 2*t
+        flw     fa1, .three(zero)           ; 3
+        fsub.s  fa0, fa1, fa0               ; 3 - 2*t
+        fmul.s  fa0, fa0, fa4               ; t*(3 - 2*t)
+        fmul.s  fa0, fa0, fa4               ; t*t*(3 - 2*t)
 
 .smoothstep_return:
-        ; Return value.
-        fsw     ft0, 8(sp)
-
-        ; Restore registers.
-        flw     ft0, -4(sp)
-        flw     ft1, -8(sp)
-        flw     ft2, -12(sp)
-        flw     ft3, -16(sp)
-        flw     ft4, -20(sp)
-        lw      a0, -24(sp)
-
-        ; We took three parameters and return one, so fix up stack.
-        addi    sp, sp, 8
-
-        ; Return.
+        ; Return value is in fa0.
         jalr    x0, ra, 0
 
 .normalize1:
@@ -1375,48 +1202,27 @@ atanTable_f32:
         jalr x0, ra, 0
 
 .normalize3:
-        ; Save registers.
-        fsw     ft0, -4(sp)
-        fsw     ft1, -8(sp)
-        fsw     ft2, -12(sp)
-        fsw     ft3, -16(sp)
-        fsw     ft4, -20(sp)
-        sw      ra, -24(sp)
-
-        ; Parameters.
-        flw     ft0, 0(sp)                  ; x
-        flw     ft1, 4(sp)                  ; y
-        flw     ft2, 8(sp)                  ; z
-
-        fmul.s  ft3, ft0, ft0               ; x^2
-        fmul.s  ft4, ft1, ft1               ; y^2
-        fadd.s  ft3, ft3, ft4               ; x^2 + y^2
-        fmul.s  ft4, ft2, ft2               ; z^2
-        fadd.s  ft3, ft3, ft4               ; x^2 + y^2 + z^2
-
-        fsqrt.s ft3, ft3
+        ; Parameters:
+        ; fa0 = x
+        ; fa1 = y
+        ; fa2 = z
+
+        fmul.s  fa3, fa0, fa0               ; x^2
+        fmul.s  fa4, fa1, fa1               ; y^2
+        fadd.s  fa3, fa3, fa4               ; x^2 + y^2
+        fmul.s  fa4, fa2, fa2               ; z^2
+        fadd.s  fa3, fa3, fa4               ; x^2 + y^2 + z^2
+
+        fsqrt.s fa3, fa3
 
         ; Compute sqrt() reciprocal.
-        flw     ft4, .one(zero)             ; 1.0
-        fdiv.s  ft3, ft4, ft3               ; 1.0/sqrt()
-
-        ; Divide vector by length.
-        fmul.s  ft0, ft0, ft3               ; x /= sqrt()
-        fmul.s  ft1, ft1, ft3               ; y /= sqrt()
-        fmul.s  ft2, ft2, ft3               ; z /= sqrt()
-
-        ; Return values.
-        fsw     ft0, 0(sp)
-        fsw     ft1, 4(sp)
-        fsw     ft2, 8(sp)
-
-        ; Restore registers.
-        flw     ft0, -4(sp)
-        flw     ft1, -8(sp)
-        flw     ft2, -12(sp)
-        flw     ft3, -16(sp)
-        flw     ft4, -20(sp)
-        lw      ra, -24(sp)
+        flw     fa4, .one(zero)             ; 1.0
+        fdiv.s  fa3, fa4, fa3               ; 1.0/sqrt()
+
+        ; Divide vector by length. Return values in fa0, fa1, and fa2.
+        fmul.s  fa0, fa0, fa3               ; x /= sqrt()
+        fmul.s  fa1, fa1, fa3               ; y /= sqrt()
+        fmul.s  fa2, fa2, fa3               ; z /= sqrt()
 
         ; Return.
         jalr    x0, ra, 0
@@ -1434,21 +1240,7 @@ atanTable_f32:
         ; to the library, so make a judgement call that adding 46 more words but only making
         ; .cos 3.6% slower and completely removing the cosine table is a good tradeoff.
 
-        sw      a0,-4(sp)
-        sw      a1,-8(sp)
-        sw      a2,-12(sp)
-        sw      a3,-16(sp)
-        sw      a4,-20(sp)
-        sw      a5,-24(sp)
-        fsw     ft0,-28(sp)
-        fsw     ft1,-32(sp)
-        fsw     ft2,-36(sp)
-        fsw     ft3,-40(sp)
-        fsw     ft4,-44(sp)
-        fsw     ft5,-48(sp)
-        fsw     ft6,-52(sp)
-
-        flw     ft0, 0(sp)       ; load first parameter ("x"), doesn't have to be into ft0
+        ; x is already in fa0.
 
         ; .oneOverTwoPi is 1/(2pi)
         ; .sinTableSize is 512.0
@@ -1457,32 +1249,32 @@ atanTable_f32:
 
         ; accomplish adding pi / 2 by adding 1/4 to the normalized angle in the fmadd below
 	lui	a5,%hi(.point25)
-	flw	ft3,%lo(.point25)(a5)
+	flw	fa3,%lo(.point25)(a5)
 
-        ; ft2<u> = ft0<x> * ft1<1 / (2 * pi)> + ft3(1/4)
+        ; fa2<u> = fa0<x> * fa1<1 / (2 * pi)> + fa3(1/4)
 	lui	a5,%hi(.oneOverTwoPi)
-	flw	ft1,%lo(.oneOverTwoPi)(a5)
+	flw	fa1,%lo(.oneOverTwoPi)(a5)
 
-        ; for the following, would prefer: fmadd.s   ft2,ft0,ft1,ft3
-        fmul.s  ft4, ft0, ft1
-        fadd.s  ft2, ft4, ft3
+        ; for the following, would prefer: fmadd.s   fa2,fa0,fa1,fa3
+        fmul.s  fa4, fa0, fa1
+        fadd.s  fa2, fa4, fa3
 
-        ; ft3<indexf> = ft2<u> * ft1<tablesize>
+        ; fa3<indexf> = fa2<u> * fa1<tablesize>
 	lui	a5,%hi(.sinTableSize)
-	flw	ft1,%lo(.sinTableSize)(a5)
-	fmul.s	ft3,ft2,ft1
+	flw	fa1,%lo(.sinTableSize)(a5)
+	fmul.s	fa3,fa2,fa1
 
-        ; a1<index> = ifloorf(ft3<indexf>)
-	fcvt.w.s a1,ft3,rdn
+        ; a1<index> = ifloorf(fa3<indexf>)
+	fcvt.w.s a1,fa3,rdn
 
-        ; ft6<beta> = ft3<indexf> - ft4<float(index)>
-        fcvt.s.w ft4,a1,rtz
-	fsub.s	ft6,ft3,ft4
+        ; fa6<beta> = fa3<indexf> - fa4<float(index)>
+        fcvt.s.w fa4,a1,rtz
+	fsub.s	fa6,fa3,fa4
 
-        ; ft4<alpha> = ft5<1.0f> - ft6<beta>
+        ; fa4<alpha> = fa5<1.0f> - fa6<beta>
 	lui	a5,%hi(.one)
-	flw	ft5,%lo(.one)(a5)
-        fsub.s ft4,ft5,ft6
+	flw	fa5,%lo(.one)(a5)
+        fsub.s fa4,fa5,fa6
 
         ; a2<lower> = a1<index> & imm<tablemask>
 	andi	a2,a1,511
@@ -1490,7 +1282,7 @@ atanTable_f32:
         ; a3<upper> = a2<lower> + imm<1>
         addi     a3,a2,1
 
-        ; ft0<result> = table[a2<lower>] * ft4<alpha> + table[a3<upper>] * ft6<beta>
+        ; fa0<result> = table[a2<lower>] * fa4<alpha> + table[a3<upper>] * fa6<beta>
         ; a1 = table + a2 * 4
         lui     a5,%hi(sinTable_f32)
         addi    a5,a5,%lo(sinTable_f32)
@@ -1498,8 +1290,8 @@ atanTable_f32:
         slli    a4,a2,2
         add    a1,a5,a4
 
-        ; ft1 = *a1
-        flw     ft1,0(a1)
+        ; fa1 = *a1
+        flw     fa1,0(a1)
 
         ; a4 = table + a3 * 4
         lui     a5,%hi(sinTable_f32)
@@ -1507,71 +1299,44 @@ atanTable_f32:
         slli    a1,a3,2
         add    a4,a5,a1
 
-        ; ft2 = *a4
-        flw     ft2,0(a4)
+        ; fa2 = *a4
+        flw     fa2,0(a4)
 
-        ; ft3 = ft2 * ft6
-        fmul.s    ft3,ft2,ft6
+        ; fa3 = fa2 * fa6
+        fmul.s    fa3,fa2,fa6
 
-        ; ft0 = ft1 * ft4 + ft0
-        ; for the following, would prefer: fmadd.s   ft0,ft1,ft4,ft3
-        fmul.s  ft2, ft1, ft4
-        fadd.s  ft0, ft2, ft3
+        ; fa0 = fa1 * fa4 + fa0
+        ; for the following, would prefer: fmadd.s   fa0,fa1,fa4,fa3
+        fmul.s  fa2, fa1, fa4
+        fadd.s  fa0, fa2, fa3
 
         ; XXX debugging - multiply by .5
 	; lui	a5,%hi(.point5)
-	; flw	ft1,%lo(.point5)(a5)
-        ; fmul.s    ft0,ft0,ft1
-
-        fsw     ft0, 0(sp)      ; store return value
-        ; restore registers
-        lw      a0,-4(sp)
-        lw      a1,-8(sp)
-        lw      a2,-12(sp)
-        lw      a3,-16(sp)
-        lw      a4,-20(sp)
-        lw      a5,-24(sp)
-        flw     ft0,-28(sp)
-        flw     ft1,-32(sp)
-        flw     ft2,-36(sp)
-        flw     ft3,-40(sp)
-        flw     ft4,-44(sp)
-        flw     ft5,-48(sp)
-        flw     ft6,-52(sp)
+	; flw	fa1,%lo(.point5)(a5)
+        ; fmul.s    fa0,fa0,fa1
 
+        ; return value is in fa0
         jalr x0, ra, 0                
 
 .log2:
-        ; Save registers.
-        sw      a0, -4(sp)
-        sw      a1, -8(sp)
-        sw      a2, -12(sp)
-        fsw     ft0, -16(sp)
-        fsw     ft1, -20(sp)
-        fsw     ft2, -24(sp)
-        fsw     ft3, -28(sp)
-        fsw     ft4, -32(sp)
-        fsw     ft5, -36(sp)
-
-        ; Fetch parameter.
-        flw     ft0, 0(sp)
+        ; Parameter is already in fa0.
 
         ; Check for negative. Log of any negative value is undefined.
         ; XXX Should use fclass.s here.
-        fmv.s.x ft1, zero
-        flt.s   a0, ft0, ft1
+        fmv.s.x fa1, zero
+        flt.s   a0, fa0, fa1
         beq     a0, zero, .log2_not_negative
-        flw     ft0, .NaN(x0)
+        flw     fa0, .NaN(x0)
         jal     x0, .log2_ret
 
 .log2_not_negative:
         ; Check for positive and negative zero. We return negative infinity
         ; to match the behavior of the standard math library.
         ; XXX Should use fclass.s here.
-        fmv.x.s a0, ft0
+        fmv.x.s a0, fa0
         slli    a0, a0, 1                   ; Lose sign bit.
         bne     a0, zero, .log2_not_zero
-        flw     ft0, .negInf(x0)
+        flw     fa0, .negInf(x0)
         jal     x0, .log2_ret
 
 .log2_not_zero:
@@ -1596,13 +1361,13 @@ atanTable_f32:
         ; We'll extract the exponent and use it directly,
         ; and add to that the log2 of the significand.
 
-        fmv.x.s a0, ft0                     ; Convert to bits.
+        fmv.x.s a0, fa0                     ; Convert to bits.
 
         ; Compute integer part of result. We can get this right from
         ; the floating point exponent.
         srli    a1, a0, 23                  ; Lose significand (keep exponent).
         addi    a1, a1, -127                ; Remove offset. We're now signed.
-        fcvt.s.w ft0, a1, rne               ; Convert to float.
+        fcvt.s.w fa0, a1, rne               ; Convert to float.
 
         ; We now want to extract the significand so we can compute its
         ; log2. We do this by stripping out the existing exponent and replacing
@@ -1612,7 +1377,7 @@ atanTable_f32:
         srli    a0, a0, 9                   ; Move back into position.
         lui     a1, 0x3f800                 ; Exponent for 2^0.
         or      a2, a0, a1                  ; Original value but with 2^0 exponent.
-        fmv.s.x ft1, a2                     ; Convert to float in range [1.0, 2.0).
+        fmv.s.x fa1, a2                     ; Convert to float in range [1.0, 2.0).
 
         ; We now have the value that we want to take the log2 of. We'll do this
         ; with two table lookups, one linear step for the rough answer and one
@@ -1630,217 +1395,140 @@ atanTable_f32:
         ; put it in the range [0.0, 1.0).
         slli    a2, a0, 17                  ; Convert back to significand.
         or      a2, a2, a1                  ; Exponent for 2^0.
-        fmv.s.x ft2, a2                     ; Convert to float in range [1.0, 2.0).
-        fsub.s  ft1, ft1, ft2               ; Error between original significand and clipped-off.
-        flw     ft2, .log2dinv(x0)          ; 64 = 2^6, since 6 bits are the table index.
-        fmul.s  ft2, ft1, ft2               ; Multiply by 64 to get [0.0, 1.0) value = b.
+        fmv.s.x fa2, a2                     ; Convert to float in range [1.0, 2.0).
+        fsub.s  fa1, fa1, fa2               ; Error between original significand and clipped-off.
+        flw     fa2, .log2dinv(x0)          ; 64 = 2^6, since 6 bits are the table index.
+        fmul.s  fa2, fa1, fa2               ; Multiply by 64 to get [0.0, 1.0) value = b.
 
         ; The value b is what we'll use to interpolate between the two table
         ; entries. Also compute a = 1.0 - b for the linear interpolation.
-        flw     ft1, .one(x0)
-        fsub.s  ft1, ft1, ft2               ; a = 1.0 - b
+        flw     fa1, .one(x0)
+        fsub.s  fa1, fa1, fa2               ; a = 1.0 - b
 
         ; Compute the rough value with linear interpolation using the first table.
         slli    a0, a0, 2                   ; Byte offset into table.
-        flw     ft3, .log2TableQ1(a0)       ; Table value.
-        fmul.s  ft3, ft3, ft1               ; a*table[a0]
-        flw     ft4, .log2TableQ1 + 4(a0)   ; Next table value (table has 65 entries).
-        fmul.s  ft4, ft4, ft2               ; b*table[a0 + 1]
-        fadd.s  ft5, ft3, ft4               ; a*table[a0] + b*table[a0 + 1]
+        flw     fa3, .log2TableQ1(a0)       ; Table value.
+        fmul.s  fa3, fa3, fa1               ; a*table[a0]
+        flw     fa4, .log2TableQ1 + 4(a0)   ; Next table value (table has 65 entries).
+        fmul.s  fa4, fa4, fa2               ; b*table[a0 + 1]
+        fadd.s  fa5, fa3, fa4               ; a*table[a0] + b*table[a0 + 1]
 
         ; Now refine the rough value with a spline-interpolated secondary table.
-        fmul.s  ft4, ft1, ft1               ; a*a
-        fmul.s  ft4, ft4, ft1               ; a*a*a
-        fsub.s  ft1, ft4, ft1               ; a*a*a - a
-        flw     ft3, .log2TableQ2(a0)       ; Table value.
-        fmul.s  ft3, ft3, ft1               ; (a*a*a - a)*table[a0]
-        fmul.s  ft4, ft2, ft2               ; b*b
-        fmul.s  ft4, ft4, ft2               ; b*b*b
-        fsub.s  ft2, ft4, ft2               ; b*b*b - b
-        flw     ft4, .log2TableQ2 + 4(a0)   ; Next table value (table has 65 entries).
-        fmul.s  ft4, ft4, ft2               ; (b*b*b - b)*table[a0 + 1]
-        fadd.s  ft3, ft3, ft4               ; (a*a*a - a)*table[a0] + (b*b*b - b)*table[a0 + 1]
+        fmul.s  fa4, fa1, fa1               ; a*a
+        fmul.s  fa4, fa4, fa1               ; a*a*a
+        fsub.s  fa1, fa4, fa1               ; a*a*a - a
+        flw     fa3, .log2TableQ2(a0)       ; Table value.
+        fmul.s  fa3, fa3, fa1               ; (a*a*a - a)*table[a0]
+        fmul.s  fa4, fa2, fa2               ; b*b
+        fmul.s  fa4, fa4, fa2               ; b*b*b
+        fsub.s  fa2, fa4, fa2               ; b*b*b - b
+        flw     fa4, .log2TableQ2 + 4(a0)   ; Next table value (table has 65 entries).
+        fmul.s  fa4, fa4, fa2               ; (b*b*b - b)*table[a0 + 1]
+        fadd.s  fa3, fa3, fa4               ; (a*a*a - a)*table[a0] + (b*b*b - b)*table[a0 + 1]
 
         ; Divide the fine adjustment down.
-        flw     ft4, .log2dsq6(zero)
-        fmul.s  ft3, ft3, ft4
+        flw     fa4, .log2dsq6(zero)
+        fmul.s  fa3, fa3, fa4
 
         ; Add to rough estimate.
-        fadd.s  ft3, ft5, ft3
+        fadd.s  fa3, fa5, fa3
 
         ; Our table actually has the natural log, so convert it to log2 with
         ; a multiplication.
-        flw     ft1, .log2_of_e(zero)
-        fmul.s  ft1, ft3, ft1
+        flw     fa1, .log2_of_e(zero)
+        fmul.s  fa1, fa3, fa1
 
         ; Add it to the original integer part.
-        fadd.s  ft0, ft0, ft1
+        fadd.s  fa0, fa0, fa1
 
 .log2_ret:
-        ; Return value.
-        fsw     ft0, 0(sp)
-
-        ; Restore registers.
-        lw      a0, -4(sp)
-        lw      a1, -8(sp)
-        lw      a2, -12(sp)
-        flw     ft0, -16(sp)
-        flw     ft1, -20(sp)
-        flw     ft2, -24(sp)
-        flw     ft3, -28(sp)
-        flw     ft4, -32(sp)
-        flw     ft5, -36(sp)
-
-        ; Return.
+        ; Return value is in fa0.
         jalr x0, ra, 0
 
 .exp2:
-        ; Save registers.
-        sw      a0, -4(sp)
-        sw      a1, -8(sp)
-        fsw     ft0, -12(sp)
-        fsw     ft1, -16(sp)
-        fsw     ft2, -20(sp)
-
-        ; Fetch parameter.
-        flw     ft0, 0(sp)
+        ; Parameter is already in fa0.
 
         ; Round to nearest.
         ; XXX rne isn't yet implemented in Verilog. See issue #6.
-        ;; fcvt.w.s a0, ft0, rne
-        flw     ft1, .point5(x0)
-        fadd.s  ft2, ft0, ft1
-        fcvt.w.s a0, ft2, rdn
+        ;; fcvt.w.s a0, fa0, rne
+        flw     fa1, .point5(x0)
+        fadd.s  fa2, fa0, fa1
+        fcvt.w.s a0, fa2, rdn
 
         ; Check for overflow (exponent > 128).
         addi    a1, x0, 128
         bge     a1, a0, .exp2_not_overflow
-        flw     ft0, .posInf(x0)
+        flw     fa0, .posInf(x0)
         jal     x0, .exp2_ret
 
 .exp2_not_overflow:
         ; Check for underflow (exponent < -127).
         addi    a1, x0, -127
         bge     a0, a1, .exp2_not_underflow
-        fmv.s.x ft0, x0
+        fmv.s.x fa0, x0
         jal     x0, .exp2_ret
 
 .exp2_not_underflow:
         ; Convert back to float so we can compute fractional part.
-        fcvt.s.w ft1, a0, rtz
-        fsub.s  ft0, ft0, ft1
+        fcvt.s.w fa1, a0, rtz
+        fsub.s  fa0, fa0, fa1
 
         ; Shift integer part into the exponent.
         addi    a0, a0, 127
         slli    a0, a0, 23
 
         ; Evaluate polynomial for fractional part.
-        flw     ft2, .exp2_0(x0)
+        flw     fa2, .exp2_0(x0)
 
-        fmul.s  ft2, ft2, ft0
-        flw     ft1, .exp2_1(x0)
-        fadd.s  ft2, ft2, ft1
+        fmul.s  fa2, fa2, fa0
+        flw     fa1, .exp2_1(x0)
+        fadd.s  fa2, fa2, fa1
 
-        fmul.s  ft2, ft2, ft0
-        flw     ft1, .exp2_2(x0)
-        fadd.s  ft2, ft2, ft1
+        fmul.s  fa2, fa2, fa0
+        flw     fa1, .exp2_2(x0)
+        fadd.s  fa2, fa2, fa1
 
-        fmul.s  ft2, ft2, ft0
-        flw     ft1, .exp2_3(x0)
-        fadd.s  ft2, ft2, ft1
+        fmul.s  fa2, fa2, fa0
+        flw     fa1, .exp2_3(x0)
+        fadd.s  fa2, fa2, fa1
 
-        fmul.s  ft2, ft2, ft0
-        flw     ft1, .exp2_4(x0)
-        fadd.s  ft2, ft2, ft1
+        fmul.s  fa2, fa2, fa0
+        flw     fa1, .exp2_4(x0)
+        fadd.s  fa2, fa2, fa1
 
-        fmul.s  ft2, ft2, ft0
-        flw     ft1, .exp2_5(x0)
-        fadd.s  ft2, ft2, ft1
+        fmul.s  fa2, fa2, fa0
+        flw     fa1, .exp2_5(x0)
+        fadd.s  fa2, fa2, fa1
 
-        fmul.s  ft2, ft2, ft0
-        flw     ft1, .exp2_6(x0)
-        fadd.s  ft2, ft2, ft1
+        fmul.s  fa2, fa2, fa0
+        flw     fa1, .exp2_6(x0)
+        fadd.s  fa2, fa2, fa1
 
         ; Multiply integer part (already in exponent) and fraction.
-        fmv.s.x ft0, a0
-        fmul.s  ft0, ft0, ft2
+        fmv.s.x fa0, a0
+        fmul.s  fa0, fa0, fa2
 
 .exp2_ret:
-        ; Return value.
-        fsw     ft0, 0(sp)
-
-        ; Restore registers.
-        lw      a0, -4(sp)
-        lw      a1, -8(sp)
-        flw     ft0, -12(sp)
-        flw     ft1, -16(sp)
-        flw     ft2, -20(sp)
-
-        ; Return.
+        ; Return value is in fa0.
         jalr x0, ra, 0
 
 .exp:
-        ; Save registers.
-        sw      ra, -4(sp)
-        fsw     ft0, -8(sp)
-        fsw     ft1, -12(sp)
-
-        ; Fetch parameter.
-        flw     ft0, 0(sp)
+        ; Parameter is in fa0.
 
         ; exp(x) = exp2(x*log2(e))
-        flw     ft1, .log2_of_e(x0)
-        fmul.s  ft0, ft0, ft1
-
-        addi    sp, sp, -16     ; Make room on stack
-        fsw     ft0, 0(sp)      ; Store parameter
-
-        ; Call our exp2 function.
-        jal     ra, .exp2
-
-        flw     ft0, 0(sp)      ; Pop result
-        addi    sp, sp, 16      ; Restore stack
-
-        ; Return value.
-        fsw     ft0, 0(sp)
-
-        ; Restore registers.
-        lw      ra, -4(sp)
-        flw     ft0, -8(sp)
-        flw     ft1, -12(sp)
+        flw     fa1, .log2_of_e(x0)
+        fmul.s  fa0, fa0, fa1
 
-        ; Return.
-        jalr    x0, ra, 0
+        ; Our exp2 function returns directly to our caller.
+        jal     x0, .exp2
 
 .mod:
-        ; save registers
-        fsw     ft0,-4(sp)
-        fsw     ft1,-8(sp)
-        fsw     ft2,-12(sp)
-        fsw     ft3,-16(sp)
-        fsw     ft4,-20(sp)
-        sw     a0,-24(sp)
-
-        flw     ft0, 0(sp)              ; ft0 = x = popf()
-        flw     ft1, 4(sp)              ; ft1 = y = popf()
-        fdiv.s  ft2, ft0, ft1, rdn      ; ft2 = t1 = x/y;
-	fcvt.w.s a0,ft2,rdn             ; a0 = i = floori(t1)
-        fcvt.s.w ft4,a0,rne             ; ft4 = q = floorf(i)
-        fmul.s  ft3, ft4, ft1           ; ft3 = t2 = q*y
-        fsub.s  ft1, ft0, ft3           ; ft1 = r = x - t2 = x - q*y
-
-        fsw     ft1, 4(sp)             ; pushf(r)
-
-        ; restore registers
-        flw     ft0,-4(sp)
-        flw     ft1,-8(sp)
-        flw     ft2,-12(sp)
-        flw     ft3,-16(sp)
-        flw     ft4,-20(sp)
-        lw     a0,-24(sp)
-
-        ; set stack pointer as if pops and pushes had occured
-        addi    sp, sp, 4
+        ; fa0 = x, fa1 = y.
+        fdiv.s  fa2, fa0, fa1, rdn      ; fa2 = t1 = x/y;
+	fcvt.w.s a0,fa2,rdn             ; a0 = i = floori(t1)
+        fcvt.s.w fa4,a0,rne             ; fa4 = q = floorf(i)
+        fmul.s  fa3, fa4, fa1           ; fa3 = t2 = q*y
+        fsub.s  fa0, fa0, fa3           ; fa0 = r = x - t2 = x - q*y
 
         jalr x0, ra, 0
 
@@ -1857,185 +1545,91 @@ atanTable_f32:
         jalr x0, ra, 0
 
 .length2:
-        ; save registers
-        fsw     ft0,-4(sp)
-        fsw     ft1,-8(sp)
-        fsw     ft2,-12(sp)
-        fsw     ft3,-16(sp)
-
-        flw     ft0, 0(sp)              ; ft0 = x = popf()
-        fmul.s  ft1, ft0, ft0           ; ft1 = x * x
-        flw     ft3, 4(sp)              ; ft3 = y = popf()
-
-        ; for the following, would prefer: fmadd.s ft2, ft3, ft3, ft1
-        fmul.s  ft0, ft3, ft3; ; ft2 = x * x + y * y
-        fadd.s  ft2, ft0, ft1
-
-        fsqrt.s ft0, ft2                ; ft0 = d = sqrtf(x * x + y * y)
+        ; fa0 = x, fa1 = y.
+        fmul.s  fa2, fa0, fa0           ; fa2 = x * x
 
-        fsw     ft0, 4(sp)             ; pushf(d) 
+        ; for the following, would prefer: fmadd.s fa2, fa1, fa1, fa2
+        fmul.s  fa3, fa1, fa1           ; fa2 = x * x + y * y
+        fadd.s  fa2, fa3, fa2
 
-        ; restore registers
-        flw     ft0,-4(sp)
-        flw     ft1,-8(sp)
-        flw     ft2,-12(sp)
-        flw     ft3,-16(sp)
-
-        ; set stack pointer as if pops and pushes had occured
-        addi    sp, sp, 4
+        fsqrt.s fa0, fa2                ; fa0 = d = sqrtf(x * x + y * y)
 
         jalr x0, ra, 0
 
 .length3:
-        ; save registers
-        fsw     ft0,-4(sp)
-        fsw     ft1,-8(sp)
-        fsw     ft2,-12(sp)
-        fsw     ft3,-16(sp)
-
-        flw     ft0, 0(sp)              ; ft0 = x = popf()
-        fmul.s  ft1, ft0, ft0           ; ft1 = x * x
-        flw     ft3, 4(sp)              ; ft3 = y = popf()
-
-        ; for the following, would prefer: fmadd.s ft2, ft3, ft3, ft1
-        fmul.s  ft0, ft3, ft3 ; ft2 = x * x + y * y
-        fadd.s  ft2, ft0, ft1
-
-        flw     ft0, 8(sp)              ; ft0 = z = popf()
-
-        ; for the following, would prefer: fmadd.s ft1, ft0, ft0, ft2
-        fmul.s  ft3, ft0, ft0 ; ft1 = x * x + y * y + z * z
-        fadd.s  ft1, ft3, ft2
+        ; fa0 = x, fa1 = y, fa2 = z.
+        fmul.s  fa3, fa0, fa0           ; fa3 = x * x
 
-        fsqrt.s ft3, ft1                ; ft0 = d = sqrtf(x * x + y * y + z * z)
+        ; for the following, would prefer: fmadd.s fa3, fa1, fa1, fa3
+        fmul.s  fa4, fa1, fa1           ; fa3 = x * x + y * y
+        fadd.s  fa3, fa4, fa3
 
-        fsw     ft3, 8(sp)             ; pushf(d) 
+        ; for the following, would prefer: fmadd.s fa3, fa2, fa2, fa3
+        fmul.s  fa4, fa2, fa2           ; fa3 = x * x + y * y + z * z
+        fadd.s  fa3, fa4, fa3
 
-        ; restore registers
-        flw     ft0,-4(sp)
-        flw     ft1,-8(sp)
-        flw     ft2,-12(sp)
-        flw     ft3,-16(sp)
-
-        ; set stack pointer as if pops and pushes had occured
-        addi    sp, sp, 8
+        fsqrt.s fa0, fa3                ; fa0 = d = sqrtf(x * x + y * y + z * z)
 
         jalr x0, ra, 0
 
 .length4:
-        ; save registers
-        fsw     ft0,-4(sp)
-        fsw     ft1,-8(sp)
-        fsw     ft2,-12(sp)
-        fsw     ft3,-16(sp)
-
-        flw     ft0, 0(sp)              ; ft0 = x = popf()
-        fmul.s  ft1, ft0, ft0           ; ft1 = x * x
-        flw     ft3, 4(sp)              ; ft3 = y = popf()
-
-        ; for the following, would prefer: fmadd.s ft2, ft3, ft3, ft1
-        fmul.s  ft0, ft3, ft3 ; ft2 = x * x + y * y
-        fadd.s  ft2, ft0, ft1
-
-        flw     ft0, 8(sp)              ; ft0 = z = popf()
+        ; fa0 = x, fa1 = y, fa2 = z, fa3 = w.
+        fmul.s  fa4, fa0, fa0           ; fa4 = x * x
 
-        ; for the following, would prefer: fmadd.s ft1, ft0, ft0, ft2
-        fmul.s  ft3, ft0, ft0 ; ft1 = x * x + y * y + z * z
-        fadd.s  ft1, ft3, ft2
+        ; for the following, would prefer: fmadd.s fa4, fa1, fa1, fa4
+        fmul.s  fa5, fa1, fa1           ; fa4 = x * x + y * y
+        fadd.s  fa4, fa5, fa4
 
-        flw     ft3, 12(sp)             ; ft3 = w = popf()
+        ; for the following, would prefer: fmadd.s fa4, fa2, fa2, fa4
+        fmul.s  fa5, fa2, fa2           ; fa4 = x * x + y * y + z * z
+        fadd.s  fa4, fa5, fa4
 
-        ; for the following, would prefer: fmadd.s ft2, ft3, ft3, ft1
-        fmul.s  ft0, ft3, ft3 ; ft2 = x * x + y * y + z * z + w * w
-        fadd.s  ft2, ft0, ft1
+        ; for the following, would prefer: fmadd.s fa4, fa3, fa3, fa4
+        fmul.s  fa5, fa3, fa3           ; fa4 = x * x + y * y + z * z + w * w
+        fadd.s  fa4, fa5, fa4
 
-        fsqrt.s ft0, ft2                ; ft0 = d = sqrtf(x * x + y * y + z * z + w * w)
-
-        fsw     ft0, 12(sp)             ; pushf(d) 
-
-        ; restore registers
-        flw     ft0,-4(sp)
-        flw     ft1,-8(sp)
-        flw     ft2,-12(sp)
-        flw     ft3,-16(sp)
-
-        ; set stack pointer as if pops and pushes had occured
-        addi    sp, sp, 12
+        fsqrt.s fa0, fa4                ; fa0 = d = sqrtf(x * x + y * y + z * z + w * w)
 
         jalr    x0, ra, 0                  ; return;
 
 .fract:
-        ; save registers
-        sw      a0, -4(sp)
-        fsw     ft0, -8(sp)
-        fsw     ft1, -12(sp)
-        fsw     ft2, -16(sp)
-
-        flw      ft0, 0(sp)      ; a0 = x
-
-        ; a0<wholei> = ifloorf(ft0<x>)
-	fcvt.w.s a0,ft0,rdn
+        ; fa0 = x
 
-        ; ft1<fract> = ft0<x> - ft1<float(wholei)>
-        fcvt.s.w ft1,a0,rtz
-	fsub.s	ft2,ft0,ft1
+        ; a0<wholei> = ifloorf(fa0<x>)
+	fcvt.w.s a0,fa0,rdn
 
-        fsw      ft2, 0(sp)     ; return(x)
-
-        ; restore registers
-        lw      a0, -4(sp)
-        flw     ft0, -8(sp)
-        flw     ft1, -12(sp)
-        flw     ft2, -16(sp)
+        ; fa0<fract> = fa0<x> - fa1<float(wholei)>
+        fcvt.s.w fa1,a0,rtz
+	fsub.s	fa0,fa0,fa1
 
         jalr x0, ra, 0
 
 .cross:
-        ; Save registers.
-        fsw     ft0, -4(sp)
-        fsw     ft1, -8(sp)
-        fsw     ft2, -12(sp)
-        fsw     ft3, -16(sp)
-        fsw     ft4, -20(sp)
-        fsw     ft5, -24(sp)
-        fsw     ft6, -28(sp)
-        fsw     ft7, -32(sp)
-
-        ; Parameters.
-        flw     ft0, 0(sp)                  ; v1[0]
-        flw     ft1, 4(sp)                  ; v1[1]
-        flw     ft2, 8(sp)                  ; v1[2]
-        flw     ft3, 12(sp)                 ; v2[0]
-        flw     ft4, 16(sp)                 ; v2[1]
-        flw     ft5, 20(sp)                 ; v2[2]
-
-        fmul.s  ft6, ft1, ft5               ; v1[1]*v2[2]
-        fmul.s  ft7, ft4, ft2               ; v2[1]*v1[2]
-        fsub.s  ft6, ft6, ft7               ; v1[1]*v2[2] - v2[1]*v1[2]
-        fsw     ft6, 12(sp)                 ; Store cross[0]
-
-        fmul.s  ft6, ft2, ft3               ; v1[2]*v2[0]
-        fmul.s  ft7, ft5, ft0               ; v2[2]*v1[0]
-        fsub.s  ft6, ft6, ft7               ; v1[2]*v2[0] - v2[2]*v1[0]
-        fsw     ft6, 16(sp)                 ; Store cross[1]
-
-        fmul.s  ft6, ft0, ft4               ; v1[0]*v2[1]
-        fmul.s  ft7, ft3, ft1               ; v2[0]*v1[1]
-        fsub.s  ft6, ft6, ft7               ; v1[0]*v2[1] - v2[0]*v1[1]
-        fsw     ft6, 20(sp)                 ; Store cross[2]
-
-        ; Restore registers.
-        flw     ft0, -4(sp)
-        flw     ft1, -8(sp)
-        flw     ft2, -12(sp)
-        flw     ft3, -16(sp)
-        flw     ft4, -20(sp)
-        flw     ft5, -24(sp)
-        flw     ft6, -28(sp)
-        flw     ft7, -32(sp)
-
-        ; We took six parameters and return three, so fix up stack.
-        addi    sp, sp, 12
+        ; Parameters:
+        ; fa0 = v1[0]
+        ; fa1 = v1[1]
+        ; fa2 = v1[2]
+        ; fa3 = v2[0]
+        ; fa4 = v2[1]
+        ; fa5 = v2[2]
+
+        ; We need all six parameters for all three results, so compute
+        ; cross[0] and cross[1] into temporaries first.
+        fmul.s  fa6, fa1, fa5               ; v1[1]*v2[2]
+        fmul.s  fa7, fa4, fa2               ; v2[1]*v1[2]
+        fsub.s  fa6, fa6, fa7               ; cross[0] = v1[1]*v2[2] - v2[1]*v1[2]
+
+        fmul.s  fa7, fa2, fa3               ; v1[2]*v2[0]
+        fmul.s  fa2, fa5, fa0               ; v2[2]*v1[0]
+        fsub.s  fa7, fa7, fa2               ; cross[1] = v1[2]*v2[0] - v2[2]*v1[0]
+
+        fmul.s  fa2, fa0, fa4               ; v1[0]*v2[1]
+        fmul.s  fa5, fa3, fa1               ; v2[0]*v1[1]
+        fsub.s  fa2, fa2, fa5               ; cross[2] = v1[0]*v2[1] - v2[0]*v1[1]
+
+        ; Return values in fa0, fa1, and fa2.
+        fsgnj.s fa0, fa6, fa6
+        fsgnj.s fa1, fa7, fa7
 
         ; Return.
         jalr    x0, ra, 0
@@ -2077,77 +1671,40 @@ atanTable_f32:
         jalr x0, ra, 0
 
 .atan2:
-        ; save registers
-        fsw     ft0, -4(sp)
-        fsw     ft1, -8(sp)
-        fsw     ft2, -12(sp)
-        fsw     ft3, -16(sp)
-        fsw     ft4, -20(sp)
-        fsw     ft5, -24(sp)
-        sw      a0, -28(sp)
-        sw      a1, -32(sp)
-
-        flw     ft1, 0(sp)      ; ft1 = y
-        flw     ft0, 4(sp)      ; ft0 = x
-        addi    sp,sp,-32        ; push saved registers
-
-        fdiv.s          ft3, ft1, ft0   ; z = y / x
-
-        fcvt.s.w        ft2,zero,rtz    ; ft2 = 0.0
-        flt.s           a1,ft0,ft2      ; a1 = (x < 0)
-        bne             a1,zero,.atan2_neg_x     ; if(x < 0) goto .atan2_neg_x;
-
-        addi    sp, sp, -8      ; Make room on stack
-        sw      ra, 4(sp)       ; Save return address
-        fsw     ft3, 0(sp)      ; Store parameter
+        ; fa0 = y, fa1 = x.
 
-        jal     ra, .atan       ; ft0 = a = atan(z)     ; XXX OPT could restore regs and jump to .atan
+        fdiv.s          fa3, fa0, fa1   ; z = y / x
 
-        flw     ft0, 0(sp)      ; Pop result
-        lw      ra, 4(sp)       ; Restore return address
-        addi    sp, sp, 8       ; Restore stack
+        fcvt.s.w        fa2,zero,rtz    ; fa2 = 0.0
+        flt.s           a1,fa1,fa2      ; a1 = (x < 0)
+        bne             a1,zero,.atan2_neg_x     ; if(x < 0) goto .atan2_neg_x;
 
-        jal zero, .atan2_finish   ; goto .atan2_finish
+        fsgnj.s         fa0, fa3, fa3   ; a = atan(z); .atan returns directly to our caller.
+        jal             zero, .atan
 
 .atan2_neg_x:
         ; x < 0
 
-        fsgnjn.s ft4, ft3, ft1  ; float z2 = copysign(z, -y);
+        ; Keep y and our return address on the stack across the call to .atan.
+        addi    sp, sp, -8
+        sw      ra, 4(sp)
+        fsw     fa0, 0(sp)
 
-        addi    sp, sp, -8      ; Make room on stack
-        sw      ra, 4(sp)       ; Save return address
-        fsw     ft4, 0(sp)      ; Store parameter
+        fsgnjn.s fa0, fa3, fa0  ; float z2 = copysign(z, -y);
 
-        jal     ra, .atan       ; ft0 = a = atan(z2)
+        jal     ra, .atan       ; fa0 = atan(z2)
 
-        flw     ft4, 0(sp)      ; Pop result
+        flw     fa1, 0(sp)      ; fa1 = y
         lw      ra, 4(sp)       ; Restore return address
         addi    sp, sp, 8       ; Restore stack
 
-        fsgnjn.s ft2, ft4, ft1  ; float a = copysign(brad_atan(z2), -y);
+        fsgnjn.s fa2, fa0, fa1  ; float a = copysign(brad_atan(z2), -y);
 
 	lui	a0,%hi(.pi)
-	flw	ft5,%lo(.pi)(a0)        ; float pi = 3.14159
-
-        fsgnj.s ft3, ft5, ft1   ; sign_y_pi = copysign(pi, y)
-        fadd.s  ft0, ft3, ft2   ; v = copysign(M_PI, y) + a;
-
-.atan2_finish:
-
-        addi    sp,sp,32        ; pop saved registers
-        fsw     ft0, 4(sp)      ; store return value
+	flw	fa5,%lo(.pi)(a0)        ; float pi = 3.14159
 
-        ; restore registers
-        flw     ft0, -4(sp)
-        flw     ft1, -8(sp)
-        flw     ft2, -12(sp)
-        flw     ft3, -16(sp)
-        flw     ft4, -20(sp)
-        flw     ft5, -24(sp)
-        lw      a0, -28(sp)
-        lw      a1, -32(sp)
-
-        addi    sp, sp, 4       ; We took two parameters and return one, so fix up stack
+        fsgnj.s fa3, fa5, fa1   ; sign_y_pi = copysign(pi, y)
+        fadd.s  fa0, fa3, fa2   ; v = copysign(M_PI, y) + a;
 
         jalr x0, ra, 0
 
@@ -2176,54 +1733,27 @@ atanTable_f32:
         jalr x0, ra, 0
 
 .distance3:
-        ; Save registers.
-        fsw     ft0, -4(sp)
-        fsw     ft1, -8(sp)
-        fsw     ft2, -12(sp)
-        fsw     ft3, -16(sp)
-        fsw     ft4, -20(sp)
-        fsw     ft5, -24(sp)
-        fsw     ft6, -28(sp)
-        fsw     ft7, -32(sp)
-        sw      ra, -36(sp)
-
-        ; Parameters.
-        flw     ft0, 0(sp)                  ; x1
-        flw     ft1, 4(sp)                  ; y1
-        flw     ft2, 8(sp)                  ; z1
-        flw     ft3, 12(sp)                 ; x2
-        flw     ft4, 16(sp)                 ; y2
-        flw     ft5, 20(sp)                 ; z2
-
-        fsub.s  ft6, ft0, ft3               ; x2 - x1
-        fmul.s  ft7, ft6, ft6               ; (x2 - x1)^2
-
-        fsub.s  ft6, ft1, ft4               ; y2 - y1
-        fmul.s  ft6, ft6, ft6               ; (y2 - y1)^2
-        fadd.s  ft7, ft7, ft6               ; (x2 - x1)^2 + (y2 - y1)^2
-
-        fsub.s  ft6, ft2, ft5               ; z2 - z1
-        fmul.s  ft6, ft6, ft6               ; (z2 - z1)^2
-        fadd.s  ft7, ft7, ft6               ; (x2 - x1)^2 + (y2 - y1)^2 + (z2 - z1)^2
-
-        fsqrt.s ft0, ft7
+        ; Parameters:
+        ; fa0 = x1
+        ; fa1 = y1
+        ; fa2 = z1
+        ; fa3 = x2
+        ; fa4 = y2
+        ; fa5 = z2
+
+        fsub.s  fa6, fa0, fa3               ; x2 - x1
+        fmul.s  fa7, fa6, fa6               ; (x2 - x1)^2
+
+        fsub.s  fa6, fa1, fa4               ; y2 - y1
+        fmul.s  fa6, fa6, fa6               ; (y2 - y1)^2
+        fadd.s  fa7, fa7, fa6               ; (x2 - x1)^2 + (y2 - y1)^2
+
+        fsub.s  fa6, fa2, fa5               ; z2 - z1
+        fmul.s  fa6, fa6, fa6               ; (z2 - z1)^2
+        fadd.s  fa7, fa7, fa6               ; (x2 - x1)^2 + (y2 - y1)^2 + (z2 - z1)^2
 
         ; Return value.
-        fsw     ft0, 20(sp)
-
-        ; Restore registers.
-        flw     ft0, -4(sp)
-        flw     ft1, -8(sp)
-        flw     ft2, -12(sp)
-        flw     ft3, -16(sp)
-        flw     ft4, -20(sp)
-        flw     ft5, -24(sp)
-        flw     ft6, -28(sp)
-        flw     ft7, -32(sp)
-        lw      ra, -36(sp)
-
-        ; We took six parameters and return one, so fix up stack.
-        addi    sp, sp, 20
+        fsqrt.s fa0, fa7
 
         ; Return.
         jalr    x0, ra, 0
@@ -2233,163 +1763,60 @@ atanTable_f32:
         jalr x0, ra, 0
 
 .floor:
-        ; save registers
-        sw      a0, -4(sp)
-        fsw     ft0, -8(sp)
-        fsw     ft1, -12(sp)
-
-        flw      ft0, 0(sp)      ; a0 = x
+        ; fa0 = x
 
-        ; a0<wholei> = ifloorf(ft0<x>)
-	fcvt.w.s a0,ft0,rdn
+        ; a0<wholei> = ifloorf(fa0<x>)
+	fcvt.w.s a0,fa0,rdn
 
         ; convert back to float.
-        fcvt.s.w ft1,a0,rtz
-
-        fsw      ft1, 0(sp)     ; return(fract)
-
-        ; restore registers
-        lw      a0, -4(sp)
-        flw     ft0, -8(sp)
-        flw     ft1, -12(sp)
+        fcvt.s.w fa0,a0,rtz
 
         jalr x0, ra, 0
 
 .step:
-        sw      a0, -4(sp)
-        fsw     ft0, -8(sp)
-        fsw     ft1, -12(sp)
-        fsw     ft2, -16(sp)
-
-        ; float edge = popf();
-        flw      ft0, 0(sp)      ; ft0 = edge = pop()
-
-        ; float x = popf();
-        flw      ft1, 4(sp)      ; ft1 = x = pop()
+        ; fa0 = edge, fa1 = x.
 
         ; float y = (x < edge) ? 0.0f : 1.0f;
-        fle.s     a0, ft0, ft1
-
-        fcvt.s.w ft2,a0,rtz
+        fle.s     a0, fa0, fa1
 
-        ; pushf(y);
-        fsw     ft2, 4(sp)
-
-        lw      a0, -4(sp)
-        flw     ft0, -8(sp)
-        flw     ft1, -12(sp)
-        flw     ft2, -16(sp)
-
-        addi    sp, sp, 4       ; We took two parameters and return one, so fix up stack
+        fcvt.s.w fa0,a0,rtz
 
         jalr x0, ra, 0
 
 .dot1:
-        ; save registers
-        fsw     ft0, -4(sp)
-        fsw     ft1, -8(sp)
-
-        flw     ft0, 0(sp)      ; x1
-        flw     ft1, 8(sp)      ; x2
-        fmul.s  ft0, ft0, ft1   ; x1*x2
-
-        fsw     ft0, 8(sp)      ; return value
-
-        ; restore registers
-        flw     ft0, -4(sp)
-        flw     ft1, -8(sp)
+        ; fa0 = x1, fa1 = x2.
+        fmul.s  fa0, fa0, fa1   ; x1*x2
 
-        addi    sp, sp, 4       ; we took two parameters and return one, so fix up stack
         jalr    x0, ra, 0       ; return
 
 .dot2:
-        ; save registers
-        fsw     ft0, -4(sp)
-        fsw     ft1, -8(sp)
-        fsw     ft2, -12(sp)
+        ; fa0 = x1, fa1 = y1, fa2 = x2, fa3 = y2.
+        fmul.s  fa0, fa0, fa2   ; x1*x2
+        fmul.s  fa1, fa1, fa3   ; y1*y2
+        fadd.s  fa0, fa1, fa0   ; x1*x2 + y1*y2
 
-        flw     ft0, 0(sp)      ; x1
-        flw     ft1, 8(sp)      ; x2
-        fmul.s  ft2, ft0, ft1   ; x1*x2
-
-        flw     ft0, 4(sp)      ; y1
-        flw     ft1, 12(sp)     ; y2
-        fmul.s  ft0, ft0, ft1   ; y1*y2
-
-        fadd.s  ft2, ft0, ft2   ; x1*x2 + y1*y2
-        fsw     ft2, 12(sp)     ; return value
-
-        ; restore registers
-        flw     ft0, -4(sp)
-        flw     ft1, -8(sp)
-        flw     ft2, -12(sp)
-
-        addi    sp, sp, 12      ; we took four parameters and return one, so fix up stack
         jalr    x0, ra, 0       ; return
 
 .dot3:
-        ; save registers
-        fsw     ft0, -4(sp)
-        fsw     ft1, -8(sp)
-        fsw     ft2, -12(sp)
-
-        flw     ft0, 0(sp)      ; x1
-        flw     ft1, 12(sp)     ; x2
-        fmul.s  ft2, ft0, ft1   ; x1*x2
+        ; fa0 = x1, fa1 = y1, fa2 = z1, fa3 = x2, fa4 = y2, fa5 = z2.
+        fmul.s  fa0, fa0, fa3   ; x1*x2
+        fmul.s  fa1, fa1, fa4   ; y1*y2
+        fadd.s  fa0, fa1, fa0   ; x1*x2 + y1*y2
+        fmul.s  fa2, fa2, fa5   ; z1*z2
+        fadd.s  fa0, fa2, fa0   ; x1*x2 + y1*y2 + z1*z2
 
-        flw     ft0, 4(sp)      ; y1
-        flw     ft1, 16(sp)     ; y2
-        fmul.s  ft0, ft0, ft1   ; y1*y2
-        fadd.s  ft2, ft0, ft2   ; x1*x2 + y1*y2
-
-        flw     ft0, 8(sp)      ; z1
-        flw     ft1, 20(sp)     ; z2
-        fmul.s  ft0, ft0, ft1   ; z1*z2
-        fadd.s  ft2, ft0, ft2   ; x1*x2 + y1*y2 + z1*z2
-
-        fsw     ft2, 20(sp)     ; return value
-
-        ; restore registers
-        flw     ft0, -4(sp)
-        flw     ft1, -8(sp)
-        flw     ft2, -12(sp)
-
-        addi    sp, sp, 20      ; we took six parameters and return one, so fix up stack
         jalr    x0, ra, 0       ; return
 
 .dot4:
-        ; save registers
-        fsw     ft0, -4(sp)
-        fsw     ft1, -8(sp)
-        fsw     ft2, -12(sp)
-
-        flw     ft0, 0(sp)      ; x1
-        flw     ft1, 16(sp)     ; x2
-        fmul.s  ft2, ft0, ft1   ; x1*x2
-
-        flw     ft0, 4(sp)      ; y1
-        flw     ft1, 20(sp)     ; y2
-        fmul.s  ft0, ft0, ft1   ; y1*y2
-        fadd.s  ft2, ft0, ft2   ; x1*x2 + y1*y2
-
-        flw     ft0, 8(sp)      ; z1
-        flw     ft1, 24(sp)     ; z2
-        fmul.s  ft0, ft0, ft1   ; z1*z2
-        fadd.s  ft2, ft0, ft2   ; x1*x2 + y1*y2 + z1*z2
-
-        flw     ft0, 12(sp)     ; w1
-        flw     ft1, 28(sp)     ; w2
-        fmul.s  ft0, ft0, ft1   ; w1*w2
-        fadd.s  ft2, ft0, ft2   ; x1*x2 + y1*y2 + z1*z2 + w1*w2
-
-        fsw     ft2, 28(sp)     ; return value
-
-        ; restore registers
-        flw     ft0, -4(sp)
-        flw     ft1, -8(sp)
-        flw     ft2, -12(sp)
-
-        addi    sp, sp, 28      ; we took eight parameters and return one, so fix up stack
+        ; fa0 = x1, fa1 = y1, fa2 = z1, fa3 = w1, fa4 = x2, fa5 = y2, fa6 = z2, fa7 = w2.
+        fmul.s  fa0, fa0, fa4   ; x1*x2
+        fmul.s  fa1, fa1, fa5   ; y1*y2
+        fadd.s  fa0, fa1, fa0   ; x1*x2 + y1*y2
+        fmul.s  fa2, fa2, fa6   ; z1*z2
+        fadd.s  fa0, fa2, fa0   ; x1*x2 + y1*y2 + z1*z2
+        fmul.s  fa3, fa3, fa7   ; w1*w2
+        fadd.s  fa0, fa3, fa0   ; x1*x2 + y1*y2 + z1*z2 + w1*w2
+
         jalr    x0, ra, 0       ; return
 
 .any1:
@@ -2398,75 +1825,21 @@ atanTable_f32:
         jalr x0, ra, 0
 
 .any2:
-        sw      a0, -4(sp)
-        sw      a1, -8(sp)
-        sw      a2, -12(sp)
-
-        lw a0, 0(sp)    ; a
-        lw a1, 4(sp)    ; b
-        or a2, a0, a1  ; c = a || b
-        sw a2, 4(sp)    ; return(c)
-
-        ; restore registers
-        lw      a0, -4(sp)
-        lw      a1, -8(sp)
-        lw      a2, -12(sp)
-
-        addi    sp, sp, 4       ; We took two parameters and return one, so fix up stack
+        ; a0 = a, a1 = b.
+        or a0, a0, a1  ; c = a || b
         jalr x0, ra, 0
 
 .any3:
-        ; save registers
-        sw      a0, -4(sp)
-        sw      a1, -8(sp)
-        sw      a2, -12(sp)
-        sw      a3, -16(sp)
-        sw      a4, -20(sp)
-
-        lw a0, 0(sp)    ; a
-        lw a1, 4(sp)    ; b
-        lw a2, 8(sp)    ; c
+        ; a0 = a, a1 = b, a2 = c.
         or a4, a0, a1  ; e = a || b
         or a0, a2, a4  ; f = c || e
-        sw a0, 8(sp)    ; return(f)
-
-        ; restore registers
-        lw      a0, -4(sp)
-        lw      a1, -8(sp)
-        lw      a2, -12(sp)
-        lw      a3, -16(sp)
-        lw      a4, -20(sp)
-
-        addi    sp, sp, 8       ; We took three parameters and return one, so fix up stack
         jalr x0, ra, 0
 
 .any4:
-        ; save registers
-        sw      a0, -4(sp)
-        sw      a1, -8(sp)
-        sw      a2, -12(sp)
-        sw      a3, -16(sp)
-        sw      a4, -20(sp)
-        sw      a5, -24(sp)
-
-        lw a0, 0(sp)    ; a
-        lw a1, 4(sp)    ; b
-        lw a2, 8(sp)    ; c
-        lw a3, 12(sp)   ; d
+        ; a0 = a, a1 = b, a2 = c, a3 = d.
         or a4, a0, a1  ; e = a || b
         or a5, a2, a3  ; f = c || d
         or a0, a4, a5  ; g = e || f
-        sw a0, 12(sp)   ; return(g)
-
-        ; restore registers
-        lw      a0, -4(sp)
-        lw      a1, -8(sp)
-        lw      a2, -12(sp)
-        lw      a3, -16(sp)
-        lw      a4, -20(sp)
-        lw      a5, -24(sp)
-
-        addi    sp, sp, 12      ; We took four parameters and return one, so fix up stack
         jalr x0, ra, 0
 
 .all1:
@@ -2475,78 +1848,28 @@ atanTable_f32:
         jalr x0, ra, 0
 
 .all2:
-        sw      a0, -4(sp)
-        sw      a1, -8(sp)
-        sw      a2, -12(sp)
-
-        lw a0, 0(sp)    ; a
-        lw a1, 4(sp)    ; b
-        and a2, a0, a1  ; c = a && b
-        sw a2, 4(sp)    ; return(c)
-
-        ; restore registers
-        lw      a0, -4(sp)
-        lw      a1, -8(sp)
-        lw      a2, -12(sp)
-
-        addi    sp, sp, 4       ; We took two parameters and return one, so fix up stack
+        ; a0 = a, a1 = b.
+        and a0, a0, a1  ; c = a && b
         jalr x0, ra, 0
 
 .all3:
-        ; save registers
-        sw      a0, -4(sp)
-        sw      a1, -8(sp)
-        sw      a2, -12(sp)
-        sw      a3, -16(sp)
-        sw      a4, -20(sp)
-
-        lw a0, 0(sp)    ; a
-        lw a1, 4(sp)    ; b
-        lw a2, 8(sp)    ; c
+        ; a0 = a, a1 = b, a2 = c.
         and a4, a0, a1  ; e = a && b
         and a0, a2, a4  ; f = c && e
-        sw a0, 8(sp)    ; return(f)
-
-        ; restore registers
-        lw      a0, -4(sp)
-        lw      a1, -8(sp)
-        lw      a2, -12(sp)
-        lw      a3, -16(sp)
-        lw      a4, -20(sp)
-
-        addi    sp, sp, 8       ; We took three parameters and return one, so fix up stack
         jalr x0, ra, 0
 
 .all4:
-        ; save registers
-        sw      a0, -4(sp)
-        sw      a1, -8(sp)
-        sw      a2, -12(sp)
-        sw      a3, -16(sp)
-        sw      a4, -20(sp)
-        sw      a5, -24(sp)
-
-        lw a0, 0(sp)    ; a
-        lw a1, 4(sp)    ; b
-        lw a2, 8(sp)    ; c
-        lw a3, 12(sp)   ; d
+        ; a0 = a, a1 = b, a2 = c, a3 = d.
         and a4, a0, a1  ; e = a && b
         and a5, a2, a3  ; f = c && d
         and a0, a4, a5  ; g = e && f
-        sw a0, 12(sp)   ; return(g)
-
-        ; restore registers
-        lw      a0, -4(sp)
-        lw      a1, -8(sp)
-        lw      a2, -12(sp)
-        lw      a3, -16(sp)
-        lw      a4, -20(sp)
-        lw      a5, -24(sp)
-
-        addi    sp, sp, 12      ; We took four parameters and return one, so fix up stack
         jalr x0, ra, 0
 
 .mainLoop:
+        ; a0 = pixel shader. Shades a rectangle of .rowWidth by .rowCount
+        ; pixels whose first pixel is at gl_FragCoord. Each row's colors go
+        ; to .colBufAddr, which moves by .colBufRowStride between rows.
+
         ; Save return address and pixel shader address.
         addi    sp, sp, -8
         sw      a0, 4(sp)
@@ -2555,13 +1878,33 @@ atanTable_f32:
         ; Save X and Y in case the shader damages them.
         flw     ft0, gl_FragCoord(zero)
         fsw     ft0, .mailLoopX(zero)
+        fsw     ft0, .mainLoopStartX(zero)
         flw     ft0, gl_FragCoord + 4(zero)
         fsw     ft0, .mailLoopY(zero)
 
+        ; Save the rectangle, since we count .rowWidth down for each row.
+        lw      t0, .rowWidth(zero)
+        sw      t0, .mainLoopWidth(zero)
+        lw      t0, .rowCount(zero)
+        sw      t0, .mainLoopRowsLeft(zero)
+        lw      t0, .colBufAddr(zero)
+        sw      t0, .mainLoopRowAddr(zero)
+
+.mainLoopRow:
+        ; See if we're done with the rectangle.
+        lw      t0, .mainLoopRowsLeft(zero)
+        beq     t0, zero, .mainLoopDone
+
+        ; Decrement the rows left and start a row.
+        addi    t0, t0, -1
+        sw      t0, .mainLoopRowsLeft(zero)
+        lw      t0, .mainLoopWidth(zero)
+        sw      t0, .rowWidth(zero)
+
 .mainLoopLoop:
         ; See if we're done with the row.
         lw      t0, .rowWidth(zero)
-        beq     t0, zero, .mainLoopDone
+        beq     t0, zero, .mainLoopRowDone
 
         ; Decrement the width.
         addi    t0, t0, -1
@@ -2594,6 +1937,27 @@ atanTable_f32:
         ; Next pixel.
         jal     zero, .mainLoopLoop
 
+.mainLoopRowDone:
+        ; Move the color buffer address to the start of the next row.
+        lw      t0, .mainLoopRowAddr(zero)
+        lw      t1, .colBufRowStride(zero)
+        add     t0, t0, t1
+        sw      t0, .mainLoopRowAddr(zero)
+        sw      t0, .colBufAddr(zero)
+
+        ; Go back to the first X coordinate, incrementing Y.
+        flw     ft0, .mainLoopStartX(zero)
+        fsw     ft0, gl_FragCoord(zero)
+        fsw     ft0, .mailLoopX(zero)
+        flw     ft0, .mailLoopY(zero)
+        flw     ft1, .one(zero)
+        fadd.s  ft0, ft0, ft1
+        fsw     ft0, gl_FragCoord + 4(zero)
+        fsw     ft0, .mailLoopY(zero)
+
+        ; Next row.
+        jal     zero, .mainLoopRow
+
 .mainLoopDone:
         lw      a0, 4(sp)
         lw      ra, 0(sp)
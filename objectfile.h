@@ -42,6 +42,27 @@ struct RunHeader2
     // Data bytes follow. Bytes are loaded at 0 in data memory.
 };
 
+const uint32_t RelocatableHeaderMagicExpected = 0x31354c52;
+struct RelocatableHeader
+{
+    // All words are little-endian.
+    uint32_t magic = RelocatableHeaderMagicExpected; // 'AL5R', relocatable Alice 5 code
+    uint32_t symbolCount;                           // Number of symbols, laid out as in RunHeader2.
+    uint32_t textByteCount;                         // Number of bytes of text (code).
+    uint32_t dataByteCount;                         // Number of bytes of data.
+    uint32_t relocationCount;                       // Number of relocations (see below).
+    // Symbols follow, with addresses relative to the start of their segment.
+    // Program bytes follow, then data bytes, as if both were loaded at 0.
+    // relocationCount relocations follow that are of the following layout:
+    //       uint32_t byte offset in text of the instruction to patch
+    //       uint32_t inDataSegment: segment whose start to add, if no symbol
+    //       uint32_t function: 'h' for %hi(), 'l' for %lo(), or 0
+    //       int32_t value: of the expression, as if the segments were at 0
+    //       uint32_t stringLength: including nul, 1 for no symbol.
+    //       stringLength bytes for the name of a symbol defined elsewhere
+    //       whose address to add, including nul
+};
+
 bool ReadBinary(std::ifstream& binaryFile, RunHeader2& header, SymbolTable& text_symbols, SymbolTable& data_symbols, std::vector<uint8_t>& text_bytes, std::vector<uint8_t>& data_bytes)
 {
     // TODO: dangerous because of struct packing?
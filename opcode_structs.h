@@ -12,6 +12,7 @@ struct InsnNop : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepNop(*this); }
     virtual uint32_t opcode() const { return SpvOpNop; }
     virtual std::string name() const { return "OpNop"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnNop>(); }
 };
 
 // OpFunctionParameter instruction (code 55).
@@ -24,6 +25,7 @@ struct InsnFunctionParameter : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepFunctionParameter(*this); }
     virtual uint32_t opcode() const { return SpvOpFunctionParameter; }
     virtual std::string name() const { return "OpFunctionParameter"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnFunctionParameter>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -43,6 +45,7 @@ struct InsnFunctionCall : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepFunctionCall(*this); }
     virtual uint32_t opcode() const { return SpvOpFunctionCall; }
     virtual std::string name() const { return "OpFunctionCall"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnFunctionCall>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -59,6 +62,7 @@ struct InsnLoad : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepLoad(*this); }
     virtual uint32_t opcode() const { return SpvOpLoad; }
     virtual std::string name() const { return "OpLoad"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnLoad>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -74,6 +78,7 @@ struct InsnStore : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepStore(*this); }
     virtual uint32_t opcode() const { return SpvOpStore; }
     virtual std::string name() const { return "OpStore"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnStore>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -94,6 +99,7 @@ struct InsnAccessChain : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepAccessChain(*this); }
     virtual uint32_t opcode() const { return SpvOpAccessChain; }
     virtual std::string name() const { return "OpAccessChain"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnAccessChain>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -112,6 +118,7 @@ struct InsnVectorShuffle : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepVectorShuffle(*this); }
     virtual uint32_t opcode() const { return SpvOpVectorShuffle; }
     virtual std::string name() const { return "OpVectorShuffle"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnVectorShuffle>(); }
 };
 
 // OpCompositeConstruct instruction (code 80).
@@ -129,6 +136,7 @@ struct InsnCompositeConstruct : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepCompositeConstruct(*this); }
     virtual uint32_t opcode() const { return SpvOpCompositeConstruct; }
     virtual std::string name() const { return "OpCompositeConstruct"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnCompositeConstruct>(); }
 };
 
 // OpCompositeExtract instruction (code 81).
@@ -144,6 +152,7 @@ struct InsnCompositeExtract : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepCompositeExtract(*this); }
     virtual uint32_t opcode() const { return SpvOpCompositeExtract; }
     virtual std::string name() const { return "OpCompositeExtract"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnCompositeExtract>(); }
 };
 
 // OpCompositeInsert instruction (code 82).
@@ -161,6 +170,7 @@ struct InsnCompositeInsert : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepCompositeInsert(*this); }
     virtual uint32_t opcode() const { return SpvOpCompositeInsert; }
     virtual std::string name() const { return "OpCompositeInsert"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnCompositeInsert>(); }
 };
 
 // OpCopyObject instruction (code 83).
@@ -175,6 +185,7 @@ struct InsnCopyObject : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepCopyObject(*this); }
     virtual uint32_t opcode() const { return SpvOpCopyObject; }
     virtual std::string name() const { return "OpCopyObject"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnCopyObject>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -193,6 +204,7 @@ struct InsnImageSampleImplicitLod : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepImageSampleImplicitLod(*this); }
     virtual uint32_t opcode() const { return SpvOpImageSampleImplicitLod; }
     virtual std::string name() const { return "OpImageSampleImplicitLod"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnImageSampleImplicitLod>(); }
 };
 
 // OpImageSampleExplicitLod instruction (code 88).
@@ -210,6 +222,7 @@ struct InsnImageSampleExplicitLod : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepImageSampleExplicitLod(*this); }
     virtual uint32_t opcode() const { return SpvOpImageSampleExplicitLod; }
     virtual std::string name() const { return "OpImageSampleExplicitLod"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnImageSampleExplicitLod>(); }
 };
 
 // OpConvertFToS instruction (code 110).
@@ -224,6 +237,7 @@ struct InsnConvertFToS : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepConvertFToS(*this); }
     virtual uint32_t opcode() const { return SpvOpConvertFToS; }
     virtual std::string name() const { return "OpConvertFToS"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnConvertFToS>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -239,6 +253,7 @@ struct InsnConvertSToF : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepConvertSToF(*this); }
     virtual uint32_t opcode() const { return SpvOpConvertSToF; }
     virtual std::string name() const { return "OpConvertSToF"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnConvertSToF>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -254,6 +269,7 @@ struct InsnFNegate : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepFNegate(*this); }
     virtual uint32_t opcode() const { return SpvOpFNegate; }
     virtual std::string name() const { return "OpFNegate"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnFNegate>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -271,6 +287,7 @@ struct InsnIAdd : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepIAdd(*this); }
     virtual uint32_t opcode() const { return SpvOpIAdd; }
     virtual std::string name() const { return "OpIAdd"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnIAdd>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -288,6 +305,7 @@ struct InsnFAdd : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepFAdd(*this); }
     virtual uint32_t opcode() const { return SpvOpFAdd; }
     virtual std::string name() const { return "OpFAdd"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnFAdd>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -305,6 +323,7 @@ struct InsnISub : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepISub(*this); }
     virtual uint32_t opcode() const { return SpvOpISub; }
     virtual std::string name() const { return "OpISub"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnISub>(); }
 };
 
 // OpFSub instruction (code 131).
@@ -321,6 +340,7 @@ struct InsnFSub : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepFSub(*this); }
     virtual uint32_t opcode() const { return SpvOpFSub; }
     virtual std::string name() const { return "OpFSub"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnFSub>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -338,6 +358,7 @@ struct InsnFMul : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepFMul(*this); }
     virtual uint32_t opcode() const { return SpvOpFMul; }
     virtual std::string name() const { return "OpFMul"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnFMul>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -355,6 +376,7 @@ struct InsnSDiv : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepSDiv(*this); }
     virtual uint32_t opcode() const { return SpvOpSDiv; }
     virtual std::string name() const { return "OpSDiv"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnSDiv>(); }
 };
 
 // OpFDiv instruction (code 136).
@@ -371,6 +393,7 @@ struct InsnFDiv : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepFDiv(*this); }
     virtual uint32_t opcode() const { return SpvOpFDiv; }
     virtual std::string name() const { return "OpFDiv"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnFDiv>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -388,6 +411,7 @@ struct InsnFMod : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepFMod(*this); }
     virtual uint32_t opcode() const { return SpvOpFMod; }
     virtual std::string name() const { return "OpFMod"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnFMod>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -405,6 +429,7 @@ struct InsnVectorTimesScalar : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepVectorTimesScalar(*this); }
     virtual uint32_t opcode() const { return SpvOpVectorTimesScalar; }
     virtual std::string name() const { return "OpVectorTimesScalar"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnVectorTimesScalar>(); }
 };
 
 // OpVectorTimesMatrix instruction (code 144).
@@ -421,6 +446,7 @@ struct InsnVectorTimesMatrix : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepVectorTimesMatrix(*this); }
     virtual uint32_t opcode() const { return SpvOpVectorTimesMatrix; }
     virtual std::string name() const { return "OpVectorTimesMatrix"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnVectorTimesMatrix>(); }
 };
 
 // OpMatrixTimesVector instruction (code 145).
@@ -437,6 +463,7 @@ struct InsnMatrixTimesVector : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepMatrixTimesVector(*this); }
     virtual uint32_t opcode() const { return SpvOpMatrixTimesVector; }
     virtual std::string name() const { return "OpMatrixTimesVector"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnMatrixTimesVector>(); }
 };
 
 // OpMatrixTimesMatrix instruction (code 146).
@@ -453,6 +480,7 @@ struct InsnMatrixTimesMatrix : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepMatrixTimesMatrix(*this); }
     virtual uint32_t opcode() const { return SpvOpMatrixTimesMatrix; }
     virtual std::string name() const { return "OpMatrixTimesMatrix"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnMatrixTimesMatrix>(); }
 };
 
 // OpDot instruction (code 148).
@@ -469,6 +497,7 @@ struct InsnDot : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepDot(*this); }
     virtual uint32_t opcode() const { return SpvOpDot; }
     virtual std::string name() const { return "OpDot"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnDot>(); }
 };
 
 // OpAny instruction (code 154).
@@ -483,6 +512,7 @@ struct InsnAny : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepAny(*this); }
     virtual uint32_t opcode() const { return SpvOpAny; }
     virtual std::string name() const { return "OpAny"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnAny>(); }
 };
 
 // OpAll instruction (code 155).
@@ -497,6 +527,7 @@ struct InsnAll : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepAll(*this); }
     virtual uint32_t opcode() const { return SpvOpAll; }
     virtual std::string name() const { return "OpAll"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnAll>(); }
 };
 
 // OpLogicalOr instruction (code 166).
@@ -513,6 +544,7 @@ struct InsnLogicalOr : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepLogicalOr(*this); }
     virtual uint32_t opcode() const { return SpvOpLogicalOr; }
     virtual std::string name() const { return "OpLogicalOr"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnLogicalOr>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -530,6 +562,7 @@ struct InsnLogicalAnd : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepLogicalAnd(*this); }
     virtual uint32_t opcode() const { return SpvOpLogicalAnd; }
     virtual std::string name() const { return "OpLogicalAnd"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnLogicalAnd>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -545,6 +578,7 @@ struct InsnLogicalNot : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepLogicalNot(*this); }
     virtual uint32_t opcode() const { return SpvOpLogicalNot; }
     virtual std::string name() const { return "OpLogicalNot"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnLogicalNot>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -564,6 +598,7 @@ struct InsnSelect : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepSelect(*this); }
     virtual uint32_t opcode() const { return SpvOpSelect; }
     virtual std::string name() const { return "OpSelect"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnSelect>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -581,6 +616,7 @@ struct InsnIEqual : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepIEqual(*this); }
     virtual uint32_t opcode() const { return SpvOpIEqual; }
     virtual std::string name() const { return "OpIEqual"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnIEqual>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -598,6 +634,7 @@ struct InsnINotEqual : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepINotEqual(*this); }
     virtual uint32_t opcode() const { return SpvOpINotEqual; }
     virtual std::string name() const { return "OpINotEqual"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnINotEqual>(); }
 };
 
 // OpSLessThan instruction (code 177).
@@ -614,6 +651,7 @@ struct InsnSLessThan : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepSLessThan(*this); }
     virtual uint32_t opcode() const { return SpvOpSLessThan; }
     virtual std::string name() const { return "OpSLessThan"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnSLessThan>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -631,6 +669,7 @@ struct InsnSLessThanEqual : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepSLessThanEqual(*this); }
     virtual uint32_t opcode() const { return SpvOpSLessThanEqual; }
     virtual std::string name() const { return "OpSLessThanEqual"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnSLessThanEqual>(); }
 };
 
 // OpFOrdEqual instruction (code 180).
@@ -647,6 +686,7 @@ struct InsnFOrdEqual : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepFOrdEqual(*this); }
     virtual uint32_t opcode() const { return SpvOpFOrdEqual; }
     virtual std::string name() const { return "OpFOrdEqual"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnFOrdEqual>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -664,6 +704,7 @@ struct InsnFOrdLessThan : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepFOrdLessThan(*this); }
     virtual uint32_t opcode() const { return SpvOpFOrdLessThan; }
     virtual std::string name() const { return "OpFOrdLessThan"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnFOrdLessThan>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -681,6 +722,7 @@ struct InsnFOrdGreaterThan : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepFOrdGreaterThan(*this); }
     virtual uint32_t opcode() const { return SpvOpFOrdGreaterThan; }
     virtual std::string name() const { return "OpFOrdGreaterThan"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnFOrdGreaterThan>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -698,6 +740,7 @@ struct InsnFOrdLessThanEqual : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepFOrdLessThanEqual(*this); }
     virtual uint32_t opcode() const { return SpvOpFOrdLessThanEqual; }
     virtual std::string name() const { return "OpFOrdLessThanEqual"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnFOrdLessThanEqual>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -715,6 +758,7 @@ struct InsnFOrdGreaterThanEqual : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepFOrdGreaterThanEqual(*this); }
     virtual uint32_t opcode() const { return SpvOpFOrdGreaterThanEqual; }
     virtual std::string name() const { return "OpFOrdGreaterThanEqual"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnFOrdGreaterThanEqual>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -734,6 +778,7 @@ struct InsnPhi : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepPhi(*this); }
     virtual uint32_t opcode() const { return SpvOpPhi; }
     virtual std::string name() const { return "OpPhi"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnPhi>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -746,6 +791,7 @@ struct InsnBranch : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepBranch(*this); }
     virtual uint32_t opcode() const { return SpvOpBranch; }
     virtual std::string name() const { return "OpBranch"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnBranch>(); }
     virtual void emit(Compiler *compiler);
     virtual bool isBranch() const { return true; }
     virtual bool isTermination() const { return true; }
@@ -765,6 +811,7 @@ struct InsnBranchConditional : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepBranchConditional(*this); }
     virtual uint32_t opcode() const { return SpvOpBranchConditional; }
     virtual std::string name() const { return "OpBranchConditional"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnBranchConditional>(); }
     virtual void emit(Compiler *compiler);
     virtual bool isBranch() const { return true; }
     virtual bool isTermination() const { return true; }
@@ -777,6 +824,7 @@ struct InsnKill : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepKill(*this); }
     virtual uint32_t opcode() const { return SpvOpKill; }
     virtual std::string name() const { return "OpKill"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnKill>(); }
     virtual bool isTermination() const { return true; }
 };
 
@@ -787,6 +835,7 @@ struct InsnReturn : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepReturn(*this); }
     virtual uint32_t opcode() const { return SpvOpReturn; }
     virtual std::string name() const { return "OpReturn"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnReturn>(); }
     virtual void emit(Compiler *compiler);
     virtual bool isBranch() const { return true; }
     virtual bool isTermination() const { return true; }
@@ -801,6 +850,7 @@ struct InsnReturnValue : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepReturnValue(*this); }
     virtual uint32_t opcode() const { return SpvOpReturnValue; }
     virtual std::string name() const { return "OpReturnValue"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnReturnValue>(); }
     virtual void emit(Compiler *compiler);
     virtual bool isBranch() const { return true; }
     virtual bool isTermination() const { return true; }
@@ -818,6 +868,7 @@ struct InsnGLSLstd450FAbs : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450FAbs(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450FAbs; }
     virtual std::string name() const { return "GLSLstd450FAbs"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450FAbs>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -833,6 +884,7 @@ struct InsnGLSLstd450FSign : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450FSign(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450FSign; }
     virtual std::string name() const { return "GLSLstd450FSign"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450FSign>(); }
 };
 
 // GLSLstd450Floor instruction (code 8).
@@ -847,6 +899,7 @@ struct InsnGLSLstd450Floor : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450Floor(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450Floor; }
     virtual std::string name() const { return "GLSLstd450Floor"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450Floor>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -862,6 +915,7 @@ struct InsnGLSLstd450Fract : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450Fract(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450Fract; }
     virtual std::string name() const { return "GLSLstd450Fract"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450Fract>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -877,6 +931,7 @@ struct InsnGLSLstd450Radians : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450Radians(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450Radians; }
     virtual std::string name() const { return "GLSLstd450Radians"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450Radians>(); }
 };
 
 // GLSLstd450Sin instruction (code 13).
@@ -891,6 +946,7 @@ struct InsnGLSLstd450Sin : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450Sin(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450Sin; }
     virtual std::string name() const { return "GLSLstd450Sin"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450Sin>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -906,6 +962,7 @@ struct InsnGLSLstd450Cos : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450Cos(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450Cos; }
     virtual std::string name() const { return "GLSLstd450Cos"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450Cos>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -921,6 +978,7 @@ struct InsnGLSLstd450Atan : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450Atan(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450Atan; }
     virtual std::string name() const { return "GLSLstd450Atan"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450Atan>(); }
 };
 
 // GLSLstd450Atan2 instruction (code 25).
@@ -937,6 +995,7 @@ struct InsnGLSLstd450Atan2 : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450Atan2(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450Atan2; }
     virtual std::string name() const { return "GLSLstd450Atan2"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450Atan2>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -954,6 +1013,7 @@ struct InsnGLSLstd450Pow : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450Pow(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450Pow; }
     virtual std::string name() const { return "GLSLstd450Pow"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450Pow>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -969,6 +1029,7 @@ struct InsnGLSLstd450Exp : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450Exp(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450Exp; }
     virtual std::string name() const { return "GLSLstd450Exp"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450Exp>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -984,6 +1045,7 @@ struct InsnGLSLstd450Log : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450Log(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450Log; }
     virtual std::string name() const { return "GLSLstd450Log"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450Log>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -999,6 +1061,7 @@ struct InsnGLSLstd450Exp2 : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450Exp2(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450Exp2; }
     virtual std::string name() const { return "GLSLstd450Exp2"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450Exp2>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -1014,6 +1077,7 @@ struct InsnGLSLstd450Log2 : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450Log2(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450Log2; }
     virtual std::string name() const { return "GLSLstd450Log2"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450Log2>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -1029,6 +1093,7 @@ struct InsnGLSLstd450Sqrt : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450Sqrt(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450Sqrt; }
     virtual std::string name() const { return "GLSLstd450Sqrt"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450Sqrt>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -1046,6 +1111,7 @@ struct InsnGLSLstd450FMin : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450FMin(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450FMin; }
     virtual std::string name() const { return "GLSLstd450FMin"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450FMin>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -1063,6 +1129,7 @@ struct InsnGLSLstd450FMax : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450FMax(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450FMax; }
     virtual std::string name() const { return "GLSLstd450FMax"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450FMax>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -1082,6 +1149,7 @@ struct InsnGLSLstd450FClamp : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450FClamp(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450FClamp; }
     virtual std::string name() const { return "GLSLstd450FClamp"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450FClamp>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -1101,6 +1169,7 @@ struct InsnGLSLstd450FMix : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450FMix(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450FMix; }
     virtual std::string name() const { return "GLSLstd450FMix"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450FMix>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -1118,6 +1187,7 @@ struct InsnGLSLstd450Step : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450Step(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450Step; }
     virtual std::string name() const { return "GLSLstd450Step"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450Step>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -1137,6 +1207,7 @@ struct InsnGLSLstd450SmoothStep : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450SmoothStep(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450SmoothStep; }
     virtual std::string name() const { return "GLSLstd450SmoothStep"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450SmoothStep>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -1152,6 +1223,7 @@ struct InsnGLSLstd450Length : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450Length(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450Length; }
     virtual std::string name() const { return "GLSLstd450Length"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450Length>(); }
 };
 
 // GLSLstd450Distance instruction (code 67).
@@ -1168,6 +1240,7 @@ struct InsnGLSLstd450Distance : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450Distance(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450Distance; }
     virtual std::string name() const { return "GLSLstd450Distance"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450Distance>(); }
 };
 
 // GLSLstd450Cross instruction (code 68).
@@ -1184,6 +1257,7 @@ struct InsnGLSLstd450Cross : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450Cross(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450Cross; }
     virtual std::string name() const { return "GLSLstd450Cross"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450Cross>(); }
 };
 
 // GLSLstd450Normalize instruction (code 69).
@@ -1198,6 +1272,7 @@ struct InsnGLSLstd450Normalize : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450Normalize(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450Normalize; }
     virtual std::string name() const { return "GLSLstd450Normalize"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450Normalize>(); }
 };
 
 // GLSLstd450Reflect instruction (code 71).
@@ -1214,6 +1289,7 @@ struct InsnGLSLstd450Reflect : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450Reflect(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450Reflect; }
     virtual std::string name() const { return "GLSLstd450Reflect"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450Reflect>(); }
 };
 
 // GLSLstd450Refract instruction (code 72).
@@ -1232,6 +1308,7 @@ struct InsnGLSLstd450Refract : public Instruction {
     virtual void step(Interpreter *interpreter) { interpreter->stepGLSLstd450Refract(*this); }
     virtual uint32_t opcode() const { return 0x10000 | GLSLstd450Refract; }
     virtual std::string name() const { return "GLSLstd450Refract"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<InsnGLSLstd450Refract>(); }
 };
 
 
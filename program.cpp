@@ -1,8 +1,12 @@
 #include <iomanip>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
 
 #include "program.h"
 #include "risc-v.h"
 #include "function.h"
+#include "timing.h"
 
 std::map<uint32_t, std::string> OpcodeToString = {
 #include "opcode_to_string.h"
@@ -18,7 +22,15 @@ Program::Program(bool throwOnUnimplemented_, bool verbose_) :
     throwOnUnimplemented(throwOnUnimplemented_),
     hasUnimplemented(false),
     verbose(verbose_),
-    mainFunctionId(NO_FUNCTION)
+    mainFunctionId(NO_FUNCTION),
+    uniformPrologueFunctionId(NO_FUNCTION),
+    skippedComponentCount(0),
+    sourceHash(14695981039346656037ull),
+    maxBlockCount(0),
+    scheduleForLatency(false),
+    cycleTable(defaultCycleTable()),
+    unscheduledCycles(0),
+    scheduledCycles(0)
 {
     memorySize = 0;
     auto anotherRegion = [this](size_t size){MemoryRegion r(memorySize, size); memorySize += size; return r;};
@@ -187,15 +199,8 @@ void Program::prepareForCompile() {
     replacePhi();
 
     // Compute successor and predecessor blocks.
-    for (auto& [functionId, function] : functions) {
-        for (auto& [_, block] : function->blocks) {
-            Instruction *instruction = block->instructions.tail.get();
-            assert(instruction->isTermination());
-            block->succ = instruction->targetLabelIds;
-            for (uint32_t blockId : block->succ) {
-                function->blocks[blockId]->pred.insert(block->blockId);
-            }
-        }
+    for (auto& [_, function] : functions) {
+        function->computeSuccPred();
     }
 
     // Break loops by renaming variables in phi instructions.
@@ -209,14 +214,1139 @@ void Program::prepareForCompile() {
     }
 
     // Convert vector instructions to scalar instructions.
+    computeDemandedComponents();
     expandVectors();
 
+    // Replace calls to small builtins with inline code.
+    expandBuiltins();
+
+    // Move per-frame computations out of the per-pixel code.
+    hoistUniformExpressions();
+    createUniformPrologueFunction();
+
+    // Hide floating point latency.
+    scheduleInstructions();
+
     // Compute liveness and spill variables.
     for (auto &[_, function] : functions) {
         function->ensureMaxRegisters();
     }
 }
 
+// Functions with at most this many instructions are inlined at every call.
+static const size_t MAX_INLINE_SIZE = 50;
+
+// Larger limit for calls from blocks that the profile says are hot.
+static const size_t MAX_HOT_INLINE_SIZE = 200;
+
+// Blocks that ran at least this fraction of the most frequent block's count
+// are hot.
+static const uint64_t HOT_BLOCK_FRACTION = 10;
+
+// Prefix of the labels that profileLabel() and profileShaderLabel() make.
+static const std::string PROFILE_LABEL_PREFIX = "profile.";
+
+std::string Program::profileLabel(const Block *block) {
+    return PROFILE_LABEL_PREFIX + block->profileKey;
+}
+
+std::string Program::profileShaderLabel() const {
+    std::ostringstream ss;
+    ss << PROFILE_LABEL_PREFIX << "shader_" << std::hex << sourceHash;
+    return ss.str();
+}
+
+void Program::loadBlockProfile(const std::string &pathname) {
+    std::ifstream file(pathname);
+    if (!file.good()) {
+        std::cerr << "Error: Can't open block profile \"" << pathname << "\".\n";
+        exit(EXIT_FAILURE);
+    }
+
+    // Block keys start with the SPIR-V block they came from, so counts from
+    // another shader would land on unrelated blocks.
+    std::string shaderLabel = profileShaderLabel();
+    bool sameShader = false;
+
+    std::string label;
+    uint64_t count;
+    while (file >> label >> count) {
+        if (label == shaderLabel) {
+            sameShader = true;
+        } else if (label.compare(0, PROFILE_LABEL_PREFIX.size(), PROFILE_LABEL_PREFIX) == 0) {
+            blockCounts[label.substr(PROFILE_LABEL_PREFIX.size())] = count;
+            maxBlockCount = std::max(maxBlockCount, count);
+        }
+    }
+
+    if (!sameShader) {
+        std::cerr << "Error: Block profile \"" << pathname
+            << "\" is from a different shader or different SPIR-V options.\n";
+        exit(EXIT_FAILURE);
+    }
+
+    std::cout << "Read counts for " << blockCounts.size() << " blocks from \""
+        << pathname << "\".\n";
+}
+
+uint64_t Program::blockCount(const Block *block) const {
+    auto itr = blockCounts.find(block->profileKey);
+    return itr == blockCounts.end() ? 0 : itr->second;
+}
+
+bool Program::isColdBlock(const Block *block) const {
+    auto itr = blockCounts.find(block->profileKey);
+    return itr != blockCounts.end() && itr->second == 0;
+}
+
+bool Program::isHotBlock(const Block *block) const {
+    auto itr = blockCounts.find(block->profileKey);
+    return itr != blockCounts.end() && itr->second > 0 &&
+        itr->second*HOT_BLOCK_FRACTION >= maxBlockCount;
+}
+
+// Number of instructions in the function, not counting its parameters.
+static size_t functionSize(const Function *function) {
+    size_t size = 0;
+
+    for (auto &[_, block] : function->blocks) {
+        for (auto inst = block->instructions.head; inst; inst = inst->next) {
+            if (inst->opcode() != SpvOpFunctionParameter) {
+                size++;
+            }
+        }
+    }
+
+    return size;
+}
+
+// Whether the function calls any other function.
+static bool hasCalls(const Function *function) {
+    for (auto &[_, block] : function->blocks) {
+        for (auto inst = block->instructions.head; inst; inst = inst->next) {
+            if (inst->opcode() == SpvOpFunctionCall) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// Copy the instruction, renaming the IDs (results, arguments, and labels)
+// that are in the map.
+static std::shared_ptr<Instruction> cloneInstruction(const Instruction *instruction,
+        const std::map<uint32_t, uint32_t> &idMap) {
+
+    auto mapId = [&idMap](uint32_t id) {
+        auto itr = idMap.find(id);
+        return itr == idMap.end() ? id : itr->second;
+    };
+
+    std::shared_ptr<Instruction> newInst = instruction->clone();
+
+    newInst->resIdSet.clear();
+    for (auto &id : newInst->resIdList) {
+        id = mapId(id);
+        newInst->resIdSet.insert(id);
+    }
+    newInst->argIdSet.clear();
+    for (auto &id : newInst->argIdList) {
+        id = mapId(id);
+        newInst->argIdSet.insert(id);
+    }
+    std::set<uint32_t> targetLabelIds;
+    for (uint32_t id : newInst->targetLabelIds) {
+        targetLabelIds.insert(mapId(id));
+    }
+    newInst->targetLabelIds = targetLabelIds;
+
+    // Labels that aren't in the generic lists.
+    switch (newInst->opcode()) {
+        case SpvOpBranch: {
+            InsnBranch *branch = dynamic_cast<InsnBranch *>(newInst.get());
+            branch->targetLabelId = mapId(branch->targetLabelId);
+            break;
+        }
+
+        case SpvOpBranchConditional: {
+            InsnBranchConditional *branch =
+                dynamic_cast<InsnBranchConditional *>(newInst.get());
+            branch->trueLabelId = mapId(branch->trueLabelId);
+            branch->falseLabelId = mapId(branch->falseLabelId);
+            break;
+        }
+
+        case SpvOpPhi: {
+            InsnPhi *phi = dynamic_cast<InsnPhi *>(newInst.get());
+            for (auto &id : phi->labelId) {
+                id = mapId(id);
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    return newInst;
+}
+
+void Program::inlineFunctions() {
+    // Number of calls to each function ID.
+    std::map<uint32_t, int> callCount;
+    auto countCalls = [this, &callCount]() {
+        callCount.clear();
+        for (auto &[_, function] : functions) {
+            for (auto &[_, block] : function->blocks) {
+                for (auto inst = block->instructions.head; inst; inst = inst->next) {
+                    if (inst->opcode() == SpvOpFunctionCall) {
+                        callCount[dynamic_cast<InsnFunctionCall *>(inst.get())->functionId]++;
+                    }
+                }
+            }
+        }
+    };
+
+    // Function name to number of calls inlined and size of function.
+    std::map<std::string, std::pair<int, size_t>> report;
+
+    // Inline one call at a time, since it splits blocks. Only inline functions
+    // that don't call anything themselves, so that we inline from the leaves
+    // up and see the real size of what we're inlining.
+    bool changed;
+    do {
+        changed = false;
+        countCalls();
+
+        for (auto &[_, caller] : functions) {
+            for (auto &[_, block] : caller->blocks) {
+                for (auto inst = block->instructions.head; inst && !changed; inst = inst->next) {
+                    if (inst->opcode() != SpvOpFunctionCall) {
+                        continue;
+                    }
+
+                    uint32_t calleeId = dynamic_cast<InsnFunctionCall *>(inst.get())->functionId;
+                    const Function *callee = functions.at(calleeId).get();
+                    size_t size = functionSize(callee);
+                    if (!hasCalls(callee) &&
+                            (size <= MAX_INLINE_SIZE || callCount.at(calleeId) == 1 ||
+                             (size <= MAX_HOT_INLINE_SIZE && isHotBlock(block.get())))) {
+
+                        auto &entry = report[callee->name];
+                        entry.first++;
+                        entry.second = size;
+
+                        inlineCall(caller.get(), inst);
+                        changed = true;
+                    }
+                }
+                if (changed) {
+                    break;
+                }
+            }
+            if (changed) {
+                break;
+            }
+        }
+    } while (changed);
+
+    // Remove functions that are no longer called.
+    countCalls();
+    for (auto itr = functions.begin(); itr != functions.end(); ) {
+        if (itr->first != mainFunctionId && callCount.find(itr->first) == callCount.end()) {
+            itr = functions.erase(itr);
+        } else {
+            ++itr;
+        }
+    }
+
+    for (auto &[name, entry] : report) {
+        std::cout << "Inlined " << entry.first << " call" << (entry.first == 1 ? "" : "s")
+            << " to " << name << " (" << entry.second << " instructions).\n";
+    }
+}
+
+void Program::inlineCall(Function *caller, std::shared_ptr<Instruction> call) {
+    InsnFunctionCall *insn = dynamic_cast<InsnFunctionCall *>(call.get());
+    const Function *callee = functions.at(insn->functionId).get();
+    Block *block = call->list->block;
+
+    // Move the instructions after the call to a new block.
+    uint32_t afterBlockId = nextReg++;
+    auto afterBlock = std::make_shared<Block>(afterBlockId, caller);
+    caller->blocks[afterBlockId] = afterBlock;
+
+    // Calls are never copied before they're inlined, so their result IDs
+    // come from the SPIR-V and name the call site from one compile to the next.
+    std::string callKey = std::to_string(insn->resultId());
+    afterBlock->profileKey = block->profileKey + "_a" + callKey;
+    while (call->next) {
+        afterBlock->instructions.push_back(call->next);
+    }
+
+    // Phis in the successors now come from the new block.
+    for (uint32_t targetId : afterBlock->instructions.tail->targetLabelIds) {
+        for (auto inst = caller->blocks.at(targetId)->instructions.head;
+                inst && inst->opcode() == SpvOpPhi; inst = inst->next) {
+
+            InsnPhi *phi = dynamic_cast<InsnPhi *>(inst.get());
+            std::replace(phi->labelId.begin(), phi->labelId.end(), block->blockId, afterBlockId);
+        }
+    }
+
+    // Make new IDs for the callee's blocks and results. Parameters become
+    // the call's arguments.
+    std::map<uint32_t, uint32_t> idMap;
+    size_t parameterIndex = 0;
+    for (auto &[blockId, calleeBlock] : callee->blocks) {
+        idMap[blockId] = nextReg++;
+
+        for (auto inst = calleeBlock->instructions.head; inst; inst = inst->next) {
+            if (inst->opcode() == SpvOpFunctionParameter) {
+                idMap[inst->resIdList[0]] = insn->operandId(parameterIndex++);
+            } else {
+                for (uint32_t resId : inst->resIdList) {
+                    uint32_t newId = nextReg++;
+                    auto itr = resultTypes.find(resId);
+                    if (itr != resultTypes.end()) {
+                        resultTypes[newId] = itr->second;
+                    }
+                    idMap[resId] = newId;
+                }
+            }
+        }
+    }
+    auto mapId = [&idMap](uint32_t id) {
+        auto itr = idMap.find(id);
+        return itr == idMap.end() ? id : itr->second;
+    };
+
+    // Copy the callee's blocks, turning returns into branches to the new block.
+    std::vector<uint32_t> returnIds;
+    std::vector<uint32_t> returnBlockIds;
+    for (auto &[blockId, calleeBlock] : callee->blocks) {
+        uint32_t newBlockId = idMap.at(blockId);
+        auto newBlock = std::make_shared<Block>(newBlockId, caller);
+        newBlock->profileKey = calleeBlock->profileKey + "_i" + callKey;
+        caller->blocks[newBlockId] = newBlock;
+
+        for (auto inst = calleeBlock->instructions.head; inst; inst = inst->next) {
+            uint32_t opcode = inst->opcode();
+
+            if (opcode == SpvOpFunctionParameter) {
+                // Replaced by the arguments.
+                continue;
+            }
+
+            if (opcode == SpvOpReturn || opcode == SpvOpReturnValue) {
+                if (opcode == SpvOpReturnValue) {
+                    returnIds.push_back(mapId(inst->argIdList[0]));
+                    returnBlockIds.push_back(newBlockId);
+                }
+                newBlock->instructions.push_back(std::make_shared<InsnBranch>(
+                            inst->lineInfo, afterBlockId));
+                continue;
+            }
+
+            newBlock->instructions.push_back(cloneInstruction(inst.get(), idMap));
+        }
+    }
+
+    // The call's result comes from whichever return we took.
+    if (!returnIds.empty()) {
+        afterBlock->instructions.insert(std::make_shared<InsnPhi>(call->lineInfo,
+                    insn->type, insn->resultId(), returnIds, returnBlockIds),
+                afterBlock->instructions.head);
+    }
+
+    // Replace the call with a jump to the copy of the callee.
+    LineInfo lineInfo = call->lineInfo;
+    block->instructions.erase(call);
+    block->instructions.push_back(std::make_shared<InsnBranch>(lineInfo,
+                idMap.at(callee->startBlockId)));
+}
+
+// Whether the instruction has no side effects, can't trap, and computes
+// its results only from its operands.
+static bool isPureOpcode(uint32_t opcode) {
+    switch (opcode) {
+        case SpvOpLoad:
+        case SpvOpAccessChain:
+        case SpvOpVectorShuffle:
+        case SpvOpCompositeConstruct:
+        case SpvOpCompositeExtract:
+        case SpvOpCompositeInsert:
+        case SpvOpCopyObject:
+        case SpvOpConvertFToS:
+        case SpvOpConvertSToF:
+        case SpvOpFNegate:
+        case SpvOpIAdd:
+        case SpvOpFAdd:
+        case SpvOpISub:
+        case SpvOpFSub:
+        case SpvOpFMul:
+        case SpvOpFDiv:
+        case SpvOpFMod:
+        case SpvOpVectorTimesScalar:
+        case SpvOpVectorTimesMatrix:
+        case SpvOpMatrixTimesVector:
+        case SpvOpMatrixTimesMatrix:
+        case SpvOpDot:
+        case SpvOpAny:
+        case SpvOpAll:
+        case SpvOpLogicalOr:
+        case SpvOpLogicalAnd:
+        case SpvOpLogicalNot:
+        case SpvOpSelect:
+        case SpvOpIEqual:
+        case SpvOpINotEqual:
+        case SpvOpSLessThan:
+        case SpvOpSLessThanEqual:
+        case SpvOpFOrdEqual:
+        case SpvOpFOrdLessThan:
+        case SpvOpFOrdGreaterThan:
+        case SpvOpFOrdLessThanEqual:
+        case SpvOpFOrdGreaterThanEqual:
+        case 0x10000 | GLSLstd450FAbs:
+        case 0x10000 | GLSLstd450FSign:
+        case 0x10000 | GLSLstd450Floor:
+        case 0x10000 | GLSLstd450Fract:
+        case 0x10000 | GLSLstd450Radians:
+        case 0x10000 | GLSLstd450Sin:
+        case 0x10000 | GLSLstd450Cos:
+        case 0x10000 | GLSLstd450Atan:
+        case 0x10000 | GLSLstd450Atan2:
+        case 0x10000 | GLSLstd450Pow:
+        case 0x10000 | GLSLstd450Exp:
+        case 0x10000 | GLSLstd450Log:
+        case 0x10000 | GLSLstd450Exp2:
+        case 0x10000 | GLSLstd450Log2:
+        case 0x10000 | GLSLstd450Sqrt:
+        case 0x10000 | GLSLstd450FMin:
+        case 0x10000 | GLSLstd450FMax:
+        case 0x10000 | GLSLstd450FClamp:
+        case 0x10000 | GLSLstd450FMix:
+        case 0x10000 | GLSLstd450Step:
+        case 0x10000 | GLSLstd450SmoothStep:
+        case 0x10000 | GLSLstd450Length:
+        case 0x10000 | GLSLstd450Distance:
+        case 0x10000 | GLSLstd450Cross:
+        case 0x10000 | GLSLstd450Normalize:
+        case 0x10000 | GLSLstd450Reflect:
+        case 0x10000 | GLSLstd450Refract:
+        case RiscVOpAddi:
+        case RiscVOpLoad:
+        case RiscVOpCross:
+        case RiscVOpLength:
+        case RiscVOpReflect:
+        case RiscVOpNormalize:
+        case RiscVOpDot:
+        case RiscVOpAll:
+        case RiscVOpAny:
+        case RiscVOpDistance:
+        case RiscVOpFmadd:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+void Program::hoistUniformExpressions() {
+    uniformPrologue.clear();
+    uniformResultIds.clear();
+
+    // Registers whose value is the same for every pixel of a frame. Start with
+    // constants and pointers to uniform variables.
+    std::set<uint32_t> uniformIds;
+    for (auto &[id, _] : constants) {
+        uniformIds.insert(id);
+    }
+    for (auto &[id, var] : variables) {
+        if (var.storageClass == SpvStorageClassUniform ||
+                var.storageClass == SpvStorageClassUniformConstant) {
+
+            uniformIds.insert(id);
+        }
+    }
+
+    // Results of hoisted instructions.
+    std::set<uint32_t> hoistedIds;
+
+    // An instruction is only hoisted once all its operands are uniform, so
+    // appending to the prologue keeps it in dependency order. Keep going
+    // until nothing more can be hoisted.
+    bool changed;
+    do {
+        changed = false;
+
+        for (auto &[_, function] : functions) {
+            for (auto &[_, block] : function->blocks) {
+                std::shared_ptr<Instruction> nextInst;
+                for (auto inst = block->instructions.head; inst; inst = nextInst) {
+                    nextInst = inst->next;
+
+                    if (!isPureOpcode(inst->opcode()) || inst->resIdList.empty()) {
+                        continue;
+                    }
+
+                    bool allUniform = true;
+                    for (uint32_t argId : inst->argIdSet) {
+                        if (uniformIds.find(argId) == uniformIds.end()) {
+                            allUniform = false;
+                            break;
+                        }
+                    }
+
+                    if (allUniform) {
+                        uniformIds.insert(inst->resIdSet.begin(), inst->resIdSet.end());
+                        hoistedIds.insert(inst->resIdSet.begin(), inst->resIdSet.end());
+                        block->instructions.erase(inst);
+                        uniformPrologue.push_back(inst);
+                        changed = true;
+                    }
+                }
+            }
+        }
+    } while (changed);
+
+    // Find the hoisted results that the remaining code still needs.
+    for (auto &[_, function] : functions) {
+        for (auto &[_, block] : function->blocks) {
+            for (auto inst = block->instructions.head; inst; inst = inst->next) {
+                for (uint32_t argId : inst->argIdSet) {
+                    if (hoistedIds.find(argId) != hoistedIds.end()) {
+                        uniformResultIds.insert(argId);
+                    }
+                }
+            }
+        }
+    }
+
+    if (verbose) {
+        std::cout << "----------------------- Uniform prologue\n";
+        for (auto &inst : uniformPrologue) {
+            inst->dump(std::cout);
+        }
+        std::cout << "Hoisted " << uniformPrologue.size() << " instructions, "
+            << uniformResultIds.size() << " results used per pixel.\n";
+        std::cout << "-----------------------\n";
+    }
+}
+
+void Program::createUniformPrologueFunction() {
+    uniformPrologueFunctionId = NO_FUNCTION;
+    if (uniformPrologue.empty()) {
+        return;
+    }
+
+    LineInfo lineInfo;
+
+    // Make a single-block function out of the prologue.
+    uint32_t functionId = nextReg++;
+    auto function = std::make_shared<Function>(functionId, ".uniformPrologue",
+            0, SpvFunctionControlMaskNone, 0, this);
+    uint32_t blockId = nextReg++;
+    auto block = std::make_shared<Block>(blockId, function.get());
+    block->profileKey = "prologue";
+    function->blocks[blockId] = block;
+    function->startBlockId = blockId;
+
+    for (auto &inst : uniformPrologue) {
+        block->instructions.push_back(inst);
+    }
+
+    // Store each result that the per-pixel code needs into its own variable.
+    std::map<uint32_t, uint32_t> resultVariables;
+    for (uint32_t regId : uniformResultIds) {
+        uint32_t varId = nextReg++;
+        variables[varId] = {typeIdOf(regId), SpvStorageClassPrivate, NO_INITIALIZER, 0xFFFFFFFF};
+        resultVariables[regId] = varId;
+
+        block->instructions.push_back(std::make_shared<RiscVStore>(lineInfo,
+                    varId, regId, NO_MEMORY_ACCESS_SEMANTIC, 0));
+    }
+    block->instructions.push_back(std::make_shared<InsnReturn>(lineInfo));
+
+    // In each function, load the results it uses into new registers at the
+    // top of the function. Registers are assigned program-wide, so we can't
+    // re-use the prologue's IDs.
+    for (auto &[_, otherFunction] : functions) {
+        std::map<uint32_t, uint32_t> localIds;
+
+        for (auto &[_, otherBlock] : otherFunction->blocks) {
+            for (auto inst = otherBlock->instructions.head; inst; inst = inst->next) {
+                // Copy, the instruction's set changes as we rename.
+                std::set<uint32_t> argIds = inst->argIdSet;
+                for (uint32_t argId : argIds) {
+                    if (resultVariables.find(argId) == resultVariables.end()) {
+                        continue;
+                    }
+
+                    auto itr = localIds.find(argId);
+                    if (itr == localIds.end()) {
+                        uint32_t newId = nextReg++;
+                        resultTypes[newId] = typeIdOf(argId);
+                        itr = localIds.insert({argId, newId}).first;
+                    }
+
+                    if (inst->opcode() == RiscVOpPhi) {
+                        RiscVPhi *phi = dynamic_cast<RiscVPhi *>(inst.get());
+                        for (auto &operandIds : phi->operandIds) {
+                            std::replace(operandIds.begin(), operandIds.end(),
+                                    argId, itr->second);
+                        }
+                        phi->recomputeArgs();
+                    } else {
+                        inst->changeArg(argId, itr->second);
+                    }
+                }
+            }
+        }
+
+        InstructionList &startList = otherFunction->blocks.at(otherFunction->startBlockId)->instructions;
+        for (auto &[regId, newId] : localIds) {
+            startList.insert(std::make_shared<RiscVLoad>(lineInfo, typeIdOf(regId), newId,
+                        resultVariables.at(regId), NO_MEMORY_ACCESS_SEMANTIC, 0), startList.head);
+        }
+    }
+
+    function->computeDomTree(verbose);
+    functions[functionId] = function;
+    uniformPrologueFunctionId = functionId;
+}
+
+// Loops are only unrolled if the result has at most this many instructions.
+static const size_t MAX_UNROLLED_SIZE = 500;
+
+// Larger limit for loops whose header the profile says is hot.
+static const size_t MAX_HOT_UNROLLED_SIZE = 1000;
+
+// Largest factor for partially-unrolled loops.
+static const size_t MAX_UNROLL_FACTOR = 8;
+
+// Loops that run more than this many times aren't unrolled.
+static const uint32_t MAX_TRIP_COUNT = 1024;
+
+// Evaluate the integer comparison on the two values. Returns false if we
+// don't know the opcode.
+static bool evaluateComparison(uint32_t opcode, uint32_t a, uint32_t b, bool &result) {
+    switch (opcode) {
+        case SpvOpIEqual: result = a == b; break;
+        case SpvOpINotEqual: result = a != b; break;
+        case SpvOpSLessThan: result = int32_t(a) < int32_t(b); break;
+        case SpvOpSLessThanEqual: result = int32_t(a) <= int32_t(b); break;
+        case SpvOpSGreaterThan: result = int32_t(a) > int32_t(b); break;
+        case SpvOpSGreaterThanEqual: result = int32_t(a) >= int32_t(b); break;
+        case SpvOpULessThan: result = a < b; break;
+        case SpvOpULessThanEqual: result = a <= b; break;
+        case SpvOpUGreaterThan: result = a > b; break;
+        case SpvOpUGreaterThanEqual: result = a >= b; break;
+        default: return false;
+    }
+
+    return true;
+}
+
+void Program::unrollLoops() {
+    for (auto &[_, function] : functions) {
+        // The dominance computation needs every block to be reachable.
+        std::set<uint32_t> reachable;
+        std::vector<uint32_t> worklist = {function->startBlockId};
+        while (!worklist.empty()) {
+            uint32_t blockId = worklist.back();
+            worklist.pop_back();
+            if (reachable.insert(blockId).second) {
+                for (uint32_t succId : function->blocks.at(blockId)->instructions.tail->targetLabelIds) {
+                    worklist.push_back(succId);
+                }
+            }
+        }
+        if (reachable.size() != function->blocks.size()) {
+            continue;
+        }
+
+        // Headers of loops that we've already tried.
+        std::set<uint32_t> visited;
+
+        bool changed;
+        do {
+            changed = false;
+            function->computeSuccPred();
+            function->computeDomTree(false);
+
+            // Back edges go from a block to one that dominates it.
+            std::vector<std::pair<uint32_t, uint32_t>> backEdges; // Latch and header.
+            std::set<uint32_t> headerIds;
+            for (auto &[blockId, block] : function->blocks) {
+                for (uint32_t succId : block->succ) {
+                    if (block->isDominatedBy(succId)) {
+                        backEdges.push_back(std::make_pair(blockId, succId));
+                        headerIds.insert(succId);
+                    }
+                }
+            }
+
+            for (auto [latchId, headerId] : backEdges) {
+                if (visited.find(headerId) != visited.end()) {
+                    continue;
+                }
+
+                // The loop is the header and every block that reaches the
+                // latch without going through the header.
+                std::set<uint32_t> loopBlockIds = {headerId};
+                std::vector<uint32_t> worklist = {latchId};
+                while (!worklist.empty()) {
+                    uint32_t blockId = worklist.back();
+                    worklist.pop_back();
+                    if (loopBlockIds.insert(blockId).second) {
+                        Block *block = function->blocks.at(blockId).get();
+                        worklist.insert(worklist.end(), block->pred.begin(), block->pred.end());
+                    }
+                }
+
+                // Do inner loops first. We'll come back to this one.
+                bool innermost = true;
+                for (uint32_t otherHeaderId : headerIds) {
+                    if (otherHeaderId != headerId &&
+                            loopBlockIds.find(otherHeaderId) != loopBlockIds.end()) {
+
+                        innermost = false;
+                        break;
+                    }
+                }
+                if (!innermost) {
+                    continue;
+                }
+
+                visited.insert(headerId);
+
+                // Don't grow code that never runs.
+                if (isColdBlock(function->blocks.at(headerId).get())) {
+                    continue;
+                }
+
+                uint32_t remainingHeaderId;
+                if (unrollLoop(function.get(), headerId, latchId, loopBlockIds, remainingHeaderId)) {
+                    visited.insert(remainingHeaderId);
+                    changed = true;
+                    break;
+                }
+            }
+        } while (changed);
+    }
+}
+
+bool Program::unrollLoop(Function *function, uint32_t headerId, uint32_t latchId,
+        const std::set<uint32_t> &loopBlockIds, uint32_t &remainingHeaderId) {
+
+    Block *header = function->blocks.at(headerId).get();
+    Block *latch = function->blocks.at(latchId).get();
+    auto inLoop = [&loopBlockIds](uint32_t blockId) {
+        return loopBlockIds.find(blockId) != loopBlockIds.end();
+    };
+    auto asConstant = [this](uint32_t id, uint32_t &value) {
+        auto itr = constants.find(id);
+        if (itr == constants.end() || types.at(itr->second.type)->op() != SpvOpTypeInt) {
+            return false;
+        }
+        value = *reinterpret_cast<uint32_t *>(itr->second.data);
+        return true;
+    };
+
+    // The header must be entered from one block outside the loop and the
+    // latch.
+    if (header->pred.size() != 2 || latch->instructions.tail->opcode() != SpvOpBranch) {
+        return false;
+    }
+    uint32_t preheaderId = *header->pred.begin() == latchId
+        ? *header->pred.rbegin() : *header->pred.begin();
+    Instruction *preheaderBranch = function->blocks.at(preheaderId)->instructions.tail.get();
+    if (inLoop(preheaderId) ||
+            (preheaderBranch->opcode() != SpvOpBranch &&
+             preheaderBranch->opcode() != SpvOpBranchConditional)) {
+
+        return false;
+    }
+
+    // Find the only exit from the loop, and the instructions that define
+    // each result in the loop.
+    uint32_t exitingId = NO_BLOCK_ID;
+    uint32_t exitId = NO_BLOCK_ID;
+    std::map<uint32_t, Instruction *> definitions;
+    size_t loopSize = 0;
+    for (uint32_t blockId : loopBlockIds) {
+        Block *block = function->blocks.at(blockId).get();
+
+        // Returns and kills.
+        if (block->succ.empty()) {
+            return false;
+        }
+
+        for (uint32_t succId : block->succ) {
+            if (!inLoop(succId)) {
+                if (exitingId != NO_BLOCK_ID) {
+                    return false;
+                }
+                exitingId = blockId;
+                exitId = succId;
+            }
+        }
+
+        for (auto inst = block->instructions.head; inst; inst = inst->next) {
+            loopSize++;
+            for (uint32_t resId : inst->resIdList) {
+                definitions[resId] = inst.get();
+            }
+        }
+    }
+
+    // The exit test must be done on every iteration.
+    if (exitingId == NO_BLOCK_ID || !latch->isDominatedBy(exitingId)) {
+        return false;
+    }
+    Instruction *exitInst = function->blocks.at(exitingId)->instructions.tail.get();
+    if (exitInst->opcode() != SpvOpBranchConditional) {
+        return false;
+    }
+    InsnBranchConditional *exitBranch = dynamic_cast<InsnBranchConditional *>(exitInst);
+    bool stayIfTrue = inLoop(exitBranch->trueLabelId);
+    uint32_t stayId = stayIfTrue ? exitBranch->trueLabelId : exitBranch->falseLabelId;
+
+    // The condition compares a constant to a value in the loop.
+    auto compareItr = definitions.find(exitBranch->conditionId());
+    if (compareItr == definitions.end() || compareItr->second->argIdList.size() != 2) {
+        return false;
+    }
+    Instruction *compare = compareItr->second;
+    uint32_t bound;
+    uint32_t valueId;
+    bool boundFirst;
+    if (asConstant(compare->argIdList[1], bound)) {
+        valueId = compare->argIdList[0];
+        boundFirst = false;
+    } else if (asConstant(compare->argIdList[0], bound)) {
+        valueId = compare->argIdList[1];
+        boundFirst = true;
+    } else {
+        return false;
+    }
+
+    // Whether the ID is the phi's result plus a constant, returned in delta.
+    auto isOffset = [&definitions, &asConstant](uint32_t id, uint32_t phiId, uint32_t &delta) {
+        auto itr = definitions.find(id);
+        if (itr == definitions.end()) {
+            return false;
+        }
+        const Instruction *inst = itr->second;
+        switch (inst->opcode()) {
+            case SpvOpIAdd:
+                return (inst->argIdList[0] == phiId && asConstant(inst->argIdList[1], delta)) ||
+                    (inst->argIdList[1] == phiId && asConstant(inst->argIdList[0], delta));
+
+            case SpvOpISub:
+                if (inst->argIdList[0] == phiId && asConstant(inst->argIdList[1], delta)) {
+                    delta = -delta;
+                    return true;
+                }
+                return false;
+
+            default:
+                return false;
+        }
+    };
+
+    // Find the induction variable: a phi in the header that starts at a
+    // constant and goes up by a constant each time around the loop. The
+    // compared value is that phi plus a constant offset.
+    bool foundInduction = false;
+    uint32_t start = 0;
+    uint32_t step = 0;
+    uint32_t offset = 0;
+    for (auto inst = header->instructions.head;
+            inst && inst->opcode() == SpvOpPhi && !foundInduction; inst = inst->next) {
+
+        InsnPhi *phi = dynamic_cast<InsnPhi *>(inst.get());
+        uint32_t phiId = phi->resultId();
+        offset = 0;
+        if (valueId != phiId && !isOffset(valueId, phiId, offset)) {
+            continue;
+        }
+
+        bool foundStart = false;
+        bool foundStep = false;
+        for (size_t i = 0; i < phi->labelId.size(); i++) {
+            if (phi->labelId[i] == preheaderId) {
+                foundStart = asConstant(phi->operandId(i), start);
+            } else {
+                foundStep = isOffset(phi->operandId(i), phiId, step) && step != 0;
+            }
+        }
+        foundInduction = foundStart && foundStep;
+    }
+    if (!foundInduction) {
+        return false;
+    }
+
+    // Run the loop test until it exits. The trip count is the number of
+    // times we go around the loop.
+    uint32_t tripCount = 0;
+    while (true) {
+        if (tripCount > MAX_TRIP_COUNT) {
+            return false;
+        }
+
+        uint32_t value = start + tripCount*step + offset;
+        bool result;
+        if (!evaluateComparison(compare->opcode(),
+                    boundFirst ? bound : value, boundFirst ? value : bound, result)) {
+
+            return false;
+        }
+        if (result != stayIfTrue) {
+            break;
+        }
+        tripCount++;
+    }
+
+    // Unroll completely if it's small enough. Otherwise make several copies
+    // of the body per trip around the loop.
+    size_t maxSize = isHotBlock(function->blocks.at(headerId).get()) ?
+        MAX_HOT_UNROLLED_SIZE : MAX_UNROLLED_SIZE;
+    bool full = (tripCount + 1)*loopSize <= maxSize;
+    size_t factor;
+    if (full) {
+        factor = tripCount + 1;
+    } else {
+        factor = std::min(std::min(maxSize/loopSize, MAX_UNROLL_FACTOR), size_t(tripCount));
+        if (factor < 2) {
+            return false;
+        }
+    }
+
+    // The copy that does the last exit test, and so where we leave the loop.
+    size_t exitCopy = tripCount % factor;
+
+    auto mapId = [](const std::map<uint32_t, uint32_t> &idMap, uint32_t id) {
+        auto itr = idMap.find(id);
+        return itr == idMap.end() ? id : itr->second;
+    };
+
+    // Make new IDs for each copy's blocks and results. Copies that have only
+    // one predecessor don't need the header phis, they use the value that
+    // the phi would have picked.
+    std::vector<std::map<uint32_t, uint32_t>> idMaps(factor);
+    for (size_t copy = 0; copy < factor; copy++) {
+        auto &idMap = idMaps[copy];
+
+        for (uint32_t blockId : loopBlockIds) {
+            idMap[blockId] = nextReg++;
+
+            Block *block = function->blocks.at(blockId).get();
+            for (auto inst = block->instructions.head; inst; inst = inst->next) {
+                if (blockId == headerId && inst->opcode() == SpvOpPhi && (full || copy > 0)) {
+                    InsnPhi *phi = dynamic_cast<InsnPhi *>(inst.get());
+                    for (size_t i = 0; i < phi->labelId.size(); i++) {
+                        if (copy == 0 && phi->labelId[i] == preheaderId) {
+                            idMap[phi->resultId()] = phi->operandId(i);
+                        } else if (copy > 0 && phi->labelId[i] == latchId) {
+                            idMap[phi->resultId()] = mapId(idMaps[copy - 1], phi->operandId(i));
+                        }
+                    }
+                } else {
+                    for (uint32_t resId : inst->resIdList) {
+                        uint32_t newId = nextReg++;
+                        auto itr = resultTypes.find(resId);
+                        if (itr != resultTypes.end()) {
+                            resultTypes[newId] = itr->second;
+                        }
+                        idMap[resId] = newId;
+                    }
+                }
+            }
+        }
+    }
+
+    // Make the copies. Only one copy keeps the exit test, and only if we
+    // might go around again.
+    std::vector<std::shared_ptr<Block>> newBlocks;
+    for (size_t copy = 0; copy < factor; copy++) {
+        auto &idMap = idMaps[copy];
+
+        for (uint32_t blockId : loopBlockIds) {
+            Block *block = function->blocks.at(blockId).get();
+            auto newBlock = std::make_shared<Block>(idMap.at(blockId), function);
+            newBlock->profileKey = block->profileKey + "_u" + std::to_string(factor) +
+                "_" + std::to_string(copy);
+            newBlocks.push_back(newBlock);
+
+            for (auto inst = block->instructions.head; inst; inst = inst->next) {
+                if (blockId == headerId && inst->opcode() == SpvOpPhi && (full || copy > 0)) {
+                    continue;
+                }
+
+                if (inst.get() == exitInst && (copy != exitCopy || full)) {
+                    newBlock->instructions.push_back(std::make_shared<InsnBranch>(inst->lineInfo,
+                                copy == exitCopy ? exitId : idMap.at(stayId)));
+                    continue;
+                }
+
+                if (inst == latch->instructions.tail) {
+                    newBlock->instructions.push_back(std::make_shared<InsnBranch>(inst->lineInfo,
+                                idMaps[(copy + 1) % factor].at(headerId)));
+                    continue;
+                }
+
+                std::shared_ptr<Instruction> newInst = cloneInstruction(inst.get(), idMap);
+
+                // The first copy of a partially-unrolled loop is entered
+                // from the last copy.
+                if (blockId == headerId && inst->opcode() == SpvOpPhi) {
+                    const InsnPhi *phi = dynamic_cast<const InsnPhi *>(inst.get());
+                    InsnPhi *newPhi = dynamic_cast<InsnPhi *>(newInst.get());
+                    auto &lastIdMap = idMaps[factor - 1];
+                    for (size_t i = 0; i < phi->labelId.size(); i++) {
+                        if (phi->labelId[i] == latchId) {
+                            newPhi->labelId[i] = lastIdMap.at(latchId);
+                            newPhi->argIdList[i] = mapId(lastIdMap, phi->operandId(i));
+                        }
+                    }
+                    newPhi->argIdSet = std::set<uint32_t>(newPhi->argIdList.begin(),
+                            newPhi->argIdList.end());
+                }
+
+                newBlock->instructions.push_back(newInst);
+            }
+        }
+    }
+
+    // Enter the first copy.
+    uint32_t newHeaderId = idMaps[0].at(headerId);
+    if (preheaderBranch->opcode() == SpvOpBranch) {
+        dynamic_cast<InsnBranch *>(preheaderBranch)->targetLabelId = newHeaderId;
+    } else {
+        InsnBranchConditional *branch = dynamic_cast<InsnBranchConditional *>(preheaderBranch);
+        if (branch->trueLabelId == headerId) {
+            branch->trueLabelId = newHeaderId;
+        }
+        if (branch->falseLabelId == headerId) {
+            branch->falseLabelId = newHeaderId;
+        }
+    }
+    preheaderBranch->targetLabelIds.erase(headerId);
+    preheaderBranch->targetLabelIds.insert(newHeaderId);
+
+    // Code after the loop uses the values from the copy that exits.
+    auto &exitIdMap = idMaps[exitCopy];
+    for (auto &[blockId, block] : function->blocks) {
+        if (inLoop(blockId)) {
+            continue;
+        }
+
+        for (auto inst = block->instructions.head; inst; inst = inst->next) {
+            for (auto &id : inst->argIdList) {
+                id = mapId(exitIdMap, id);
+            }
+            inst->argIdSet = std::set<uint32_t>(inst->argIdList.begin(), inst->argIdList.end());
+
+            if (inst->opcode() == SpvOpPhi) {
+                InsnPhi *phi = dynamic_cast<InsnPhi *>(inst.get());
+                std::replace(phi->labelId.begin(), phi->labelId.end(),
+                        exitingId, exitIdMap.at(exitingId));
+            }
+        }
+    }
+
+    // Replace the loop with the copies.
+    for (uint32_t blockId : loopBlockIds) {
+        function->blocks.erase(blockId);
+    }
+    for (auto &block : newBlocks) {
+        function->blocks[block->blockId] = block;
+    }
+
+    // The back edge of the last copy of a fully-unrolled loop is never
+    // taken, so some of its blocks can't be reached.
+    if (full) {
+        std::set<uint32_t> reachable;
+        std::vector<uint32_t> worklist = {function->startBlockId};
+        while (!worklist.empty()) {
+            uint32_t blockId = worklist.back();
+            worklist.pop_back();
+            if (reachable.insert(blockId).second) {
+                for (uint32_t succId : function->blocks.at(blockId)->instructions.tail->targetLabelIds) {
+                    worklist.push_back(succId);
+                }
+            }
+        }
+
+        for (auto itr = function->blocks.begin(); itr != function->blocks.end(); ) {
+            if (reachable.find(itr->first) == reachable.end()) {
+                itr = function->blocks.erase(itr);
+            } else {
+                ++itr;
+            }
+        }
+
+        // Drop phi operands from blocks that are gone.
+        for (auto &[_, block] : function->blocks) {
+            for (auto inst = block->instructions.head;
+                    inst && inst->opcode() == SpvOpPhi; inst = inst->next) {
+
+                InsnPhi *phi = dynamic_cast<InsnPhi *>(inst.get());
+                for (size_t i = phi->labelId.size(); i-- > 0; ) {
+                    if (reachable.find(phi->labelId[i]) == reachable.end()) {
+                        phi->labelId.erase(phi->labelId.begin() + i);
+                        phi->argIdList.erase(phi->argIdList.begin() + i);
+                    }
+                }
+                phi->argIdSet = std::set<uint32_t>(phi->argIdList.begin(), phi->argIdList.end());
+            }
+        }
+    }
+
+    // Remove the loop control that's no longer used.
+    bool removed;
+    do {
+        removed = false;
+
+        std::set<uint32_t> usedIds;
+        for (auto &[_, block] : function->blocks) {
+            for (auto inst = block->instructions.head; inst; inst = inst->next) {
+                usedIds.insert(inst->argIdSet.begin(), inst->argIdSet.end());
+            }
+        }
+
+        for (auto &block : newBlocks) {
+            std::shared_ptr<Instruction> nextInst;
+            for (auto inst = block->instructions.head; inst; inst = nextInst) {
+                nextInst = inst->next;
+
+                if (isPureOpcode(inst->opcode()) && !inst->resIdList.empty() &&
+                        std::none_of(inst->resIdList.begin(), inst->resIdList.end(),
+                            [&usedIds](uint32_t id) { return usedIds.find(id) != usedIds.end(); })) {
+
+                    block->instructions.erase(inst);
+                    removed = true;
+                }
+            }
+        }
+    } while (removed);
+
+    std::cout << (full ? "Fully unrolled" : "Unrolled") << " loop " << headerId
+        << " in " << function->name << " (" << tripCount << " iterations, "
+        << loopSize << " instructions";
+    if (!full) {
+        std::cout << ", factor " << factor;
+    }
+    std::cout << ").\n";
+
+    remainingHeaderId = full ? NO_BLOCK_ID : newHeaderId;
+
+    return true;
+}
+
 void Program::replacePhi() {
     for (auto &[_, function] : functions) {
         replacePhiInFunction(function.get());
@@ -298,6 +1428,159 @@ void Program::replacePhiInBlock(Block *block) {
     newList.swap(block->instructions);
 }
 
+// Whether component i of the instruction's result only depends on component
+// i of its vector operands. These are the instructions that expandVectors()
+// expands with expandVectorsUniOp(), expandVectorsBinOp(), and
+// expandVectorsTerOp(), plus VectorTimesScalar.
+static bool isComponentWiseOpcode(uint32_t opcode) {
+    switch (opcode) {
+        case SpvOpCopyObject:
+        case SpvOpFOrdEqual:
+        case SpvOpFOrdLessThan:
+        case SpvOpFOrdGreaterThan:
+        case SpvOpFOrdGreaterThanEqual:
+        case SpvOpIEqual:
+        case SpvOpSLessThan:
+        case SpvOpIAdd:
+        case SpvOpFAdd:
+        case SpvOpFSub:
+        case SpvOpFMul:
+        case SpvOpFDiv:
+        case SpvOpFMod:
+        case SpvOpFNegate:
+        case SpvOpConvertSToF:
+        case SpvOpConvertFToS:
+        case SpvOpLogicalNot:
+        case SpvOpLogicalAnd:
+        case SpvOpLogicalOr:
+        case SpvOpSelect:
+        case SpvOpVectorTimesScalar:
+        case 0x10000 | GLSLstd450Sqrt:
+        case 0x10000 | GLSLstd450Sin:
+        case 0x10000 | GLSLstd450Cos:
+        case 0x10000 | GLSLstd450Atan2:
+        case 0x10000 | GLSLstd450FAbs:
+        case 0x10000 | GLSLstd450Exp2:
+        case 0x10000 | GLSLstd450Fract:
+        case 0x10000 | GLSLstd450Floor:
+        case 0x10000 | GLSLstd450FClamp:
+        case 0x10000 | GLSLstd450SmoothStep:
+        case 0x10000 | GLSLstd450FMix:
+        case 0x10000 | GLSLstd450FMin:
+        case 0x10000 | GLSLstd450FMax:
+        case 0x10000 | GLSLstd450Step:
+        case 0x10000 | GLSLstd450Pow:
+        case 0x10000 | GLSLstd450Exp:
+        case 0x10000 | GLSLstd450Log:
+        case 0x10000 | GLSLstd450Log2:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+void Program::computeDemandedComponents() {
+    const uint32_t ALL_COMPONENTS = 0xFFFFFFFF;
+
+    // Nothing is known to be used yet. Only vector results are tracked;
+    // scalars, matrices, and constants are always whole.
+    demandedComponents.clear();
+    for (auto &[_, function] : functions) {
+        for (auto &[_, block] : function->blocks) {
+            for (auto inst = block->instructions.head; inst; inst = inst->next) {
+                for (uint32_t resId : inst->resIdList) {
+                    if (getTypeAsVector(typeIdOf(resId)) != nullptr) {
+                        demandedComponents[resId] = 0;
+                    }
+                }
+            }
+        }
+    }
+
+    auto demandedOf = [this, ALL_COMPONENTS](uint32_t regId) {
+        auto itr = demandedComponents.find(regId);
+        return itr == demandedComponents.end() ? ALL_COMPONENTS : itr->second;
+    };
+
+    // Add to the components used of the register. Returns whether that changed.
+    auto demand = [this](uint32_t regId, uint32_t mask) {
+        auto itr = demandedComponents.find(regId);
+        if (itr == demandedComponents.end() || (itr->second | mask) == itr->second) {
+            return false;
+        }
+        itr->second |= mask;
+        return true;
+    };
+
+    // Work backward from uses to definitions. Phis make cycles, so go
+    // around until nothing changes.
+    bool changed;
+    do {
+        changed = false;
+        for (auto &[_, function] : functions) {
+            for (auto &[_, block] : function->blocks) {
+                for (auto inst = block->instructions.head; inst; inst = inst->next) {
+                    Instruction *instruction = inst.get();
+                    uint32_t opcode = instruction->opcode();
+
+                    if (isComponentWiseOpcode(opcode)) {
+                        uint32_t mask = demandedOf(instruction->resIdList[0]);
+                        for (uint32_t argId : instruction->argIdList) {
+                            changed = demand(argId, mask) || changed;
+                        }
+                    } else if (opcode == SpvOpCompositeExtract &&
+                            dynamic_cast<InsnCompositeExtract *>(instruction)->indexesId.size() == 1) {
+
+                        InsnCompositeExtract *insn = dynamic_cast<InsnCompositeExtract *>(instruction);
+                        changed = demand(insn->compositeId(), 1 << insn->indexesId[0]) || changed;
+                    } else if (opcode == SpvOpCompositeInsert &&
+                            getTypeAsVector(typeIdOf(instruction->resIdList[0])) != nullptr) {
+
+                        // The inserted component comes from the (scalar) object.
+                        InsnCompositeInsert *insn = dynamic_cast<InsnCompositeInsert *>(instruction);
+                        changed = demand(insn->objectId(), ALL_COMPONENTS) || changed;
+                        uint32_t mask = demandedOf(insn->resultId()) & ~(1 << insn->indexesId[0]);
+                        changed = demand(insn->compositeId(), mask) || changed;
+                    } else if (opcode == SpvOpVectorShuffle) {
+                        InsnVectorShuffle *insn = dynamic_cast<InsnVectorShuffle *>(instruction);
+                        uint32_t n1 = getTypeAsVector(typeIdOf(insn->vector1Id()))->count;
+                        uint32_t mask = demandedOf(insn->resultId());
+                        for (size_t i = 0; i < insn->componentsId.size(); i++) {
+                            uint32_t component = insn->componentsId[i];
+                            if ((mask & (1 << i)) == 0) {
+                                // Not used.
+                            } else if (component < n1) {
+                                changed = demand(insn->vector1Id(), 1 << component) || changed;
+                            } else {
+                                changed = demand(insn->vector2Id(), 1 << (component - n1)) || changed;
+                            }
+                        }
+                    } else if (opcode == RiscVOpPhi) {
+                        RiscVPhi *phi = dynamic_cast<RiscVPhi *>(instruction);
+                        for (size_t resIndex = 0; resIndex < phi->resultIds.size(); resIndex++) {
+                            uint32_t mask = demandedOf(phi->resultIds[resIndex]);
+                            for (uint32_t operandId : phi->operandIds[resIndex]) {
+                                changed = demand(operandId, mask) || changed;
+                            }
+                        }
+                    } else {
+                        // Anything else might use every component.
+                        for (uint32_t argId : instruction->argIdList) {
+                            changed = demand(argId, ALL_COMPONENTS) || changed;
+                        }
+                    }
+                }
+            }
+        }
+    } while (changed);
+}
+
+bool Program::isComponentDemanded(uint32_t regId, int i) const {
+    auto itr = demandedComponents.find(regId);
+    return itr == demandedComponents.end() || (itr->second & (1 << i)) != 0;
+}
+
 void Program::expandVectors() {
     for (auto &[_, function] : functions) {
         expandVectorsInFunction(function.get());
@@ -362,6 +1645,10 @@ void Program::expandVectorsInBlock(Block *block) {
                         resultTypes.at(insn->resultId()));
                 if (typeVector != nullptr) {
                     for (size_t i = 0; i < typeVector->count; i++) {
+                        if (!isComponentDemanded(insn->resultId(), i)) {
+                            skippedComponentCount++;
+                            continue;
+                        }
                         auto [subtype, offset] = getConstituentInfo(insn->type, i);
                         newList.push_back(std::make_shared<RiscVLoad>(insn->lineInfo,
                                     subtype,
@@ -602,6 +1889,10 @@ void Program::expandVectorsInBlock(Block *block) {
 
                 // Break into individual floating point multiplies.
                 for (uint32_t i = 0; i < typeVector->count; i++) {
+                    if (!isComponentDemanded(insn->resultId(), i)) {
+                        skippedComponentCount++;
+                        continue;
+                    }
                     newList.push_back(std::make_shared<InsnFMul>(insn->lineInfo,
                                 typeVector->type,
                                 scalarize(insn->resultId(), i, typeVector->type),
@@ -801,6 +2092,10 @@ void Program::expandVectorsInBlock(Block *block) {
 
                     // Expand vectors.
                     for (int elIndex = 0; elIndex < vectorCount(typeVector); elIndex++) {
+                        if (!isComponentDemanded(oldPhi->resultIds[resIndex], elIndex)) {
+                            skippedComponentCount++;
+                            continue;
+                        }
                         uint32_t regId = scalarize(oldPhi->resultIds[resIndex],
                                 elIndex, typeVector);
                         newPhi->resultIds.push_back(regId);
@@ -1056,3 +2351,602 @@ void Program::expandVectorsInBlock(Block *block) {
     newList.swap(block->instructions);
 }
 
+// Number of instructions that inlining builtins may add to a function,
+// beyond the call sequences that they replace.
+static const int BUILTIN_INLINE_BUDGET = 300;
+
+// Number of instructions for a multiply-add.
+static int multiplyAddSize() {
+    return RISCV_HAVE_FMADD ? 1 : 2;
+}
+
+// Number of instructions for a dot product of n-element vectors.
+static int dotSize(int n) {
+    return 1 + (n - 1)*multiplyAddSize();
+}
+
+// Number of scalar instructions that the builtin expands to, or 0 if
+// it's not a builtin that we expand.
+static int builtinInlineSize(const Instruction *inst) {
+    int n = inst->argIdList.size();
+
+    switch (inst->opcode()) {
+        case RiscVOpDot:
+            return dotSize(n/2);
+
+        case RiscVOpLength:
+            return dotSize(n) + 1;
+
+        case RiscVOpDistance:
+            return n/2 + dotSize(n/2) + 1;
+
+        case RiscVOpNormalize:
+            return dotSize(n) + 2 + n;
+
+        case RiscVOpReflect:
+            return dotSize(n/2) + 1 + 2*(n/2);
+
+        case 0x10000 | GLSLstd450FClamp:
+            return 2;
+
+        case 0x10000 | GLSLstd450FMix:
+            return 2 + multiplyAddSize();
+
+        case 0x10000 | GLSLstd450SmoothStep:
+            return 9;
+
+        default:
+            return 0;
+    }
+}
+
+// Approximate number of instructions in the call sequence for the builtin:
+// a move for each parameter and result, and the jal.
+static int builtinCallSize(const Instruction *inst) {
+    return inst->argIdList.size() + inst->resIdList.size() + 1;
+}
+
+uint32_t Program::floatConstant(uint32_t type, float value) {
+    // Reuse an existing constant if there's one with the same bits.
+    for (auto &[id, reg] : constants) {
+        if (reg.type == type && reg.initialized && reg.size == sizeof(float) &&
+                memcmp(reg.data, &value, sizeof(float)) == 0) {
+
+            return id;
+        }
+    }
+
+    uint32_t id = nextReg++;
+    Register &reg = allocConstantObject(id, type);
+    memcpy(reg.data, &value, sizeof(float));
+
+    return id;
+}
+
+void Program::expandBuiltins() {
+    // Map from builtin name to number of inlined calls and instructions.
+    std::map<std::string, std::pair<int,int>> report;
+
+    for (auto &[_, function] : functions) {
+        // Find all builtins in the function.
+        std::vector<std::shared_ptr<Instruction>> builtins;
+        for (auto &[_, block] : function->blocks) {
+            for (auto inst = block->instructions.head; inst; inst = inst->next) {
+                if (builtinInlineSize(inst.get()) > 0) {
+                    builtins.push_back(inst);
+                }
+            }
+        }
+
+        // Inline the ones that grow the code the least first. Those that
+        // are no bigger than their call sequence are free.
+        // With a profile, spend the budget on the hottest sites first.
+        std::stable_sort(builtins.begin(), builtins.end(),
+                [this](const std::shared_ptr<Instruction> &a, const std::shared_ptr<Instruction> &b) {
+                    uint64_t countA = blockCount(a->list->block);
+                    uint64_t countB = blockCount(b->list->block);
+                    if (countA != countB) {
+                        return countA > countB;
+                    }
+                    return builtinInlineSize(a.get()) - builtinCallSize(a.get()) <
+                        builtinInlineSize(b.get()) - builtinCallSize(b.get());
+                });
+
+        int budget = BUILTIN_INLINE_BUDGET;
+        int skipped = 0;
+        for (auto &inst : builtins) {
+            int size = builtinInlineSize(inst.get());
+            int growth = std::max(size - builtinCallSize(inst.get()), 0);
+            if (growth > budget || (growth > 0 && isColdBlock(inst->list->block))) {
+                skipped++;
+                continue;
+            }
+            budget -= growth;
+
+            auto &entry = report[inst->name()];
+            entry.first++;
+            entry.second += size;
+
+            expandBuiltin(inst);
+        }
+
+        if (skipped > 0) {
+            std::cout << "Left " << skipped << " builtin call" << (skipped == 1 ? "" : "s")
+                << " in " << function->name << " to stay within the code size budget"
+                << (blockCounts.empty() ? "" : " or because they never ran") << ".\n";
+        }
+    }
+
+    for (auto &[name, entry] : report) {
+        std::cout << "Inlined " << entry.first << " call" << (entry.first == 1 ? "" : "s")
+            << " to " << name << " (" << entry.second << " instructions).\n";
+    }
+}
+
+void Program::expandBuiltin(std::shared_ptr<Instruction> inst) {
+    InstructionList *list = inst->list;
+    const LineInfo &lineInfo = inst->lineInfo;
+    const std::vector<uint32_t> &args = inst->argIdList;
+    const std::vector<uint32_t> &results = inst->resIdList;
+
+    // All of these work on a single scalar float type.
+    uint32_t type = typeIdOf(results[0]);
+    assert(isTypeFloat(type));
+
+    // Add the instruction in front of the builtin.
+    auto add = [list, inst](std::shared_ptr<Instruction> newInst) {
+        list->insert(newInst, inst);
+    };
+
+    // Make a new register for an intermediate result.
+    auto temp = [this, type]() {
+        uint32_t id = nextReg++;
+        resultTypes[id] = type;
+        return id;
+    };
+
+    // a*b + c into resultId, fused if the core can do it.
+    auto multiplyAdd = [&](uint32_t a, uint32_t b, uint32_t c, uint32_t resultId) {
+        if (RISCV_HAVE_FMADD) {
+            add(std::make_shared<RiscVFmadd>(lineInfo, type, resultId, a, b, c));
+        } else {
+            uint32_t product = temp();
+            add(std::make_shared<InsnFMul>(lineInfo, type, product, a, b));
+            add(std::make_shared<InsnFAdd>(lineInfo, type, resultId, product, c));
+        }
+    };
+
+    // Dot product of the n-element vectors a and b, into resultId.
+    auto dot = [&](const uint32_t *a, const uint32_t *b, size_t n, uint32_t resultId) {
+        uint32_t sum = n == 1 ? resultId : temp();
+        add(std::make_shared<InsnFMul>(lineInfo, type, sum, a[0], b[0]));
+        for (size_t i = 1; i < n; i++) {
+            uint32_t next = i == n - 1 ? resultId : temp();
+            multiplyAdd(a[i], b[i], sum, next);
+            sum = next;
+        }
+    };
+
+    switch (inst->opcode()) {
+        case RiscVOpDot: {
+            size_t n = args.size()/2;
+            dot(&args[0], &args[n], n, results[0]);
+            break;
+        }
+
+        case RiscVOpLength: {
+            size_t n = args.size();
+            uint32_t squared = temp();
+            dot(&args[0], &args[0], n, squared);
+            add(std::make_shared<InsnGLSLstd450Sqrt>(lineInfo, type, results[0], squared));
+            break;
+        }
+
+        case RiscVOpDistance: {
+            size_t n = args.size()/2;
+            std::vector<uint32_t> diff;
+            for (size_t i = 0; i < n; i++) {
+                diff.push_back(temp());
+                add(std::make_shared<InsnFSub>(lineInfo, type, diff[i], args[i], args[n + i]));
+            }
+            uint32_t squared = temp();
+            dot(&diff[0], &diff[0], n, squared);
+            add(std::make_shared<InsnGLSLstd450Sqrt>(lineInfo, type, results[0], squared));
+            break;
+        }
+
+        case RiscVOpNormalize: {
+            // Multiply by the reciprocal like the library does.
+            size_t n = args.size();
+            uint32_t squared = temp();
+            dot(&args[0], &args[0], n, squared);
+            uint32_t length = temp();
+            add(std::make_shared<InsnGLSLstd450Sqrt>(lineInfo, type, length, squared));
+            uint32_t reciprocal = temp();
+            add(std::make_shared<InsnFDiv>(lineInfo, type, reciprocal,
+                        floatConstant(type, 1.0f), length));
+            for (size_t i = 0; i < n; i++) {
+                add(std::make_shared<InsnFMul>(lineInfo, type, results[i], args[i], reciprocal));
+            }
+            break;
+        }
+
+        case RiscVOpReflect: {
+            // i - 2*dot(n, i)*n
+            size_t n = results.size();
+            uint32_t product = temp();
+            dot(&args[0], &args[n], n, product);
+            uint32_t product2 = temp();
+            add(std::make_shared<InsnFAdd>(lineInfo, type, product2, product, product));
+            for (size_t i = 0; i < n; i++) {
+                uint32_t scaled = temp();
+                add(std::make_shared<InsnFMul>(lineInfo, type, scaled, product2, args[n + i]));
+                add(std::make_shared<InsnFSub>(lineInfo, type, results[i], args[i], scaled));
+            }
+            break;
+        }
+
+        case 0x10000 | GLSLstd450FClamp: {
+            // min(max(x, minVal), maxVal)
+            uint32_t low = temp();
+            add(std::make_shared<InsnGLSLstd450FMax>(lineInfo, type, low, args[0], args[1]));
+            add(std::make_shared<InsnGLSLstd450FMin>(lineInfo, type, results[0], low, args[2]));
+            break;
+        }
+
+        case 0x10000 | GLSLstd450FMix: {
+            // x*(1 - a) + y*a
+            uint32_t oneMinusA = temp();
+            add(std::make_shared<InsnFSub>(lineInfo, type, oneMinusA,
+                        floatConstant(type, 1.0f), args[2]));
+            uint32_t ya = temp();
+            add(std::make_shared<InsnFMul>(lineInfo, type, ya, args[1], args[2]));
+            multiplyAdd(args[0], oneMinusA, ya, results[0]);
+            break;
+        }
+
+        case 0x10000 | GLSLstd450SmoothStep: {
+            // t = clamp((x - edge0)/(edge1 - edge0), 0, 1); t*t*(3 - 2*t)
+            // The result is undefined when edge0 >= edge1, so unlike the
+            // library we don't check for equal edges.
+            uint32_t range = temp();
+            add(std::make_shared<InsnFSub>(lineInfo, type, range, args[1], args[0]));
+            uint32_t offset = temp();
+            add(std::make_shared<InsnFSub>(lineInfo, type, offset, args[2], args[0]));
+            uint32_t unclamped = temp();
+            add(std::make_shared<InsnFDiv>(lineInfo, type, unclamped, offset, range));
+            uint32_t low = temp();
+            add(std::make_shared<InsnGLSLstd450FMax>(lineInfo, type, low, unclamped,
+                        floatConstant(type, 0.0f)));
+            uint32_t t = temp();
+            add(std::make_shared<InsnGLSLstd450FMin>(lineInfo, type, t, low,
+                        floatConstant(type, 1.0f)));
+            uint32_t t2 = temp();
+            add(std::make_shared<InsnFAdd>(lineInfo, type, t2, t, t));
+            uint32_t spline = temp();
+            add(std::make_shared<InsnFSub>(lineInfo, type, spline,
+                        floatConstant(type, 3.0f), t2));
+            uint32_t partial = temp();
+            add(std::make_shared<InsnFMul>(lineInfo, type, partial, spline, t));
+            add(std::make_shared<InsnFMul>(lineInfo, type, results[0], partial, t));
+            break;
+        }
+
+        default:
+            assert(false);
+            break;
+    }
+
+    list->erase(inst);
+}
+
+// Mnemonic of the instruction, for looking up its cycles in the cycle
+// table, or nullptr if it runs in the base instruction cycles.
+static const char *scheduleMnemonic(uint32_t opcode) {
+    switch (opcode) {
+        case SpvOpFMul:
+            return "fmul.s";
+
+        case SpvOpFAdd:
+            return "fadd.s";
+
+        case SpvOpFSub:
+            return "fsub.s";
+
+        case RiscVOpFmadd:
+            return "fmadd.s";
+
+        case SpvOpFDiv:
+            return "fdiv.s";
+
+        case 0x10000 | GLSLstd450Sqrt:
+            return "fsqrt.s";
+
+        case SpvOpConvertFToS:
+            return "fcvt.w.s";
+
+        case SpvOpConvertSToF:
+            return "fcvt.s.w";
+
+        case SpvOpFOrdEqual:
+            return "feq.s";
+
+        case SpvOpFOrdLessThan:
+        case SpvOpFOrdGreaterThan:
+            return "flt.s";
+
+        case SpvOpFOrdLessThanEqual:
+        case SpvOpFOrdGreaterThanEqual:
+            return "fle.s";
+
+        case 0x10000 | GLSLstd450FMin:
+            return "fmin.s";
+
+        case 0x10000 | GLSLstd450FMax:
+            return "fmax.s";
+
+        case SpvOpLoad:
+        case RiscVOpLoad:
+        case RiscVOpLoadConst:
+            return "lw";
+
+        default:
+            return nullptr;
+    }
+}
+
+int Program::instructionLatency(const Instruction *inst) const {
+    // We don't know which routine a call is until it's emitted, so
+    // assume the default.
+    int cycles = BASE_INSTRUCTION_CYCLES;
+    if (isLibraryCall(inst->opcode())) {
+        cycles = DEFAULT_LIBRARY_ROUTINE_CYCLES;
+    } else {
+        const char *mnemonic = scheduleMnemonic(inst->opcode());
+        if (mnemonic != nullptr) {
+            cycles = lookupCycles(cycleTable, mnemonic);
+        }
+    }
+
+    // A plain instruction's result can be used by the next one, and the
+    // rest wait for their extra cycles.
+    return std::max(1, 1 + cycles - BASE_INSTRUCTION_CYCLES);
+}
+
+// Instruction in the dependence graph of a block being scheduled.
+struct ScheduleNode {
+    std::shared_ptr<Instruction> inst;
+    int latency;
+
+    // Nodes that must be issued after this one, with the number of cycles
+    // that they must wait after this one is issued.
+    std::vector<std::pair<size_t,int>> succ;
+
+    // Number of unscheduled nodes that must be issued before this one.
+    int predCount = 0;
+
+    // Longest latency path from this node to the end of the block.
+    int height = 0;
+
+    // Earliest cycle at which this node's operands are ready.
+    int earliest = 0;
+};
+
+void Program::scheduleInstructions() {
+    unscheduledCycles = 0;
+    scheduledCycles = 0;
+
+    for (auto &[_, function] : functions) {
+        // Number of instructions that use each register.
+        std::map<uint32_t,int> useCount;
+        for (auto &[_, block] : function->blocks) {
+            for (auto inst = block->instructions.head; inst; inst = inst->next) {
+                for (uint32_t argId : inst->argIdList) {
+                    useCount[argId]++;
+                }
+            }
+        }
+
+        for (auto &[_, block] : function->blocks) {
+            scheduleBlock(block.get(), useCount, unscheduledCycles, scheduledCycles);
+        }
+    }
+}
+
+void Program::scheduleBlock(Block *block, std::map<uint32_t,int> &useCount,
+        int &cyclesBefore, int &cyclesAfter) {
+
+    // Build the nodes in the original order.
+    std::vector<ScheduleNode> nodes;
+    for (auto inst = block->instructions.head; inst; inst = inst->next) {
+        ScheduleNode node;
+        node.inst = inst;
+        node.latency = scheduleForLatency ? instructionLatency(inst.get()) : 1;
+        nodes.push_back(node);
+    }
+
+    auto addEdge = [&nodes](size_t from, size_t to, int latency) {
+        nodes[from].succ.push_back({to, latency});
+        nodes[to].predCount++;
+    };
+
+    // Build the dependences. Results come from the most recent definition;
+    // stores stay in order with loads and other stores; and anything that
+    // we don't know is free of side effects stays where it is relative to
+    // everything else.
+    std::map<uint32_t,size_t> definedBy;
+    std::vector<size_t> loads;
+    int lastStore = -1;
+    int lastBarrier = -1;
+    std::vector<size_t> sinceBarrier;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        Instruction *inst = nodes[i].inst.get();
+        uint32_t opcode = inst->opcode();
+        bool isLoad = opcode == SpvOpLoad || opcode == RiscVOpLoad;
+        bool isStore = opcode == SpvOpStore || opcode == RiscVOpStore;
+        bool isBarrier = !isLoad && !isStore && opcode != RiscVOpLoadConst &&
+            !isPureOpcode(opcode) && !isLibraryCall(opcode);
+
+        std::set<size_t> preds;
+        for (uint32_t argId : inst->argIdSet) {
+            auto itr = definedBy.find(argId);
+            if (itr != definedBy.end()) {
+                addEdge(itr->second, i, nodes[itr->second].latency);
+                preds.insert(itr->second);
+            }
+        }
+
+        // Ordering edges only need the other node to have been issued.
+        auto addOrder = [&](size_t from) {
+            if (preds.insert(from).second) {
+                addEdge(from, i, 1);
+            }
+        };
+
+        if (isBarrier) {
+            for (size_t j : sinceBarrier) {
+                addOrder(j);
+            }
+            if (lastBarrier != -1) {
+                addOrder(lastBarrier);
+            }
+            lastBarrier = i;
+            sinceBarrier.clear();
+        } else {
+            if (lastBarrier != -1) {
+                addOrder(lastBarrier);
+            }
+            if (isLoad || isStore) {
+                if (lastStore != -1) {
+                    addOrder(lastStore);
+                }
+            }
+            if (isStore) {
+                for (size_t j : loads) {
+                    addOrder(j);
+                }
+                loads.clear();
+                lastStore = i;
+            }
+            if (isLoad) {
+                loads.push_back(i);
+            }
+            sinceBarrier.push_back(i);
+        }
+
+        for (uint32_t resId : inst->resIdSet) {
+            definedBy[resId] = i;
+        }
+    }
+
+    // Estimate the cycles of the original order on a core that issues one
+    // instruction per cycle and waits for operands.
+    {
+        std::vector<int> ready(nodes.size(), 0);
+        int cycle = 0;
+        int end = 0;
+        for (size_t i = 0; i < nodes.size(); i++) {
+            int start = std::max(cycle, ready[i]);
+            for (auto [j, latency] : nodes[i].succ) {
+                ready[j] = std::max(ready[j], start + latency);
+            }
+            cycle = start + 1;
+            end = std::max(end, start + nodes[i].latency);
+        }
+        cyclesBefore += end;
+    }
+
+    // Heights, from the bottom up. Edges always go forward.
+    for (size_t i = nodes.size(); i-- > 0; ) {
+        int height = 0;
+        for (auto [j, latency] : nodes[i].succ) {
+            height = std::max(height, nodes[j].height);
+        }
+        nodes[i].height = nodes[i].latency + height;
+    }
+
+    // How much issuing this node reduces the number of live registers.
+    auto pressureDrop = [&nodes, &useCount](size_t i) {
+        const Instruction *inst = nodes[i].inst.get();
+        int drop = 0;
+        for (uint32_t argId : inst->argIdSet) {
+            if (useCount[argId] == 1) {
+                drop++;
+            }
+        }
+        for (uint32_t resId : inst->resIdSet) {
+            if (useCount[resId] > 0) {
+                drop--;
+            }
+        }
+        return drop;
+    };
+
+    // Whether node a should be issued before node b.
+    auto better = [&](size_t a, size_t b) {
+        int dropA = pressureDrop(a);
+        int dropB = pressureDrop(b);
+        if (scheduleForLatency || dropA == dropB) {
+            if (nodes[a].height != nodes[b].height) {
+                return nodes[a].height > nodes[b].height;
+            }
+        }
+        if (dropA != dropB) {
+            return dropA > dropB;
+        }
+        return a < b;
+    };
+
+    // List scheduling: at each cycle issue the best node whose operands
+    // are ready, or if none are, wait for the one that's ready first.
+    std::vector<size_t> candidates;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].predCount == 0) {
+            candidates.push_back(i);
+        }
+    }
+    InstructionList newList(block);
+    int cycle = 0;
+    int end = 0;
+    while (!candidates.empty()) {
+        int best = -1;
+        for (size_t k = 0; k < candidates.size(); k++) {
+            size_t i = candidates[k];
+            if (nodes[i].earliest <= cycle && (best == -1 || better(i, candidates[best]))) {
+                best = k;
+            }
+        }
+        if (best == -1) {
+            for (size_t k = 0; k < candidates.size(); k++) {
+                size_t i = candidates[k];
+                size_t b = best == -1 ? 0 : candidates[best];
+                if (best == -1 || nodes[i].earliest < nodes[b].earliest ||
+                        (nodes[i].earliest == nodes[b].earliest && better(i, b))) {
+
+                    best = k;
+                }
+            }
+            cycle = nodes[candidates[best]].earliest;
+        }
+
+        size_t i = candidates[best];
+        candidates.erase(candidates.begin() + best);
+
+        for (uint32_t argId : nodes[i].inst->argIdSet) {
+            useCount[argId]--;
+        }
+        for (auto [j, latency] : nodes[i].succ) {
+            nodes[j].earliest = std::max(nodes[j].earliest, cycle + latency);
+            if (--nodes[j].predCount == 0) {
+                candidates.push_back(j);
+            }
+        }
+        newList.push_back(nodes[i].inst);
+
+        end = std::max(end, cycle + nodes[i].latency);
+        cycle++;
+    }
+    cyclesAfter += end;
+
+    newList.swap(block->instructions);
+}
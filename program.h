@@ -106,6 +106,8 @@ struct Program
     std::map<uint32_t, std::shared_ptr<Type>> types;
     std::map<uint32_t, size_t> typeSizes; // XXX put into Type
     std::map<uint32_t, Variable> variables;
+    // Variables that Function::spillRegister() made to hold spilled registers.
+    std::set<uint32_t> spillVariables;
     // Map from function ID to Function object.
     std::map<uint32_t, std::shared_ptr<Function>> functions;
     // Map from virtual register ID to its type. Only used for results of instructions.
@@ -131,6 +133,49 @@ struct Program
 
     std::map<uint32_t, MemoryRegion> memoryRegions;
 
+    // Instructions that depend only on uniforms and constants, moved out of
+    // the per-pixel code by hoistUniformExpressions(). They're in dependency
+    // order and are evaluated once per frame.
+    std::vector<std::shared_ptr<Instruction>> uniformPrologue;
+
+    // Results of the uniform prologue that are used by per-pixel code.
+    std::set<uint32_t> uniformResultIds;
+
+    // ID of the compiled uniform prologue function, or NO_FUNCTION if there
+    // isn't one.
+    uint32_t uniformPrologueFunctionId;
+
+    // Bit mask of the used components of each vector register, from
+    // computeDemandedComponents().
+    std::map<uint32_t, uint32_t> demandedComponents;
+
+    // Number of vector components that expandVectors() didn't compute.
+    int skippedComponentCount;
+
+    // Hash of the SPIR-V that we parsed.
+    uint64_t sourceHash;
+
+    // Number of times each block ran, by the block's profileKey, from a
+    // profile of an earlier compile of the same shader. Empty if there's no
+    // profile.
+    std::map<std::string, uint64_t> blockCounts;
+
+    // Largest count in blockCounts.
+    uint64_t maxBlockCount;
+
+    // Whether scheduleInstructions() hides floating point latency. Otherwise
+    // it only reduces register pressure, which is what helps a core that
+    // waits for each instruction to finish before starting the next.
+    bool scheduleForLatency;
+
+    // Estimated cycles of each mnemonic, see timing.h. The scheduler takes
+    // its latencies from this.
+    std::map<std::string, int> cycleTable;
+
+    // Estimated cycles of all blocks before and after scheduleInstructions().
+    int unscheduledCycles;
+    int scheduledCycles;
+
     // Returns the type as the specific subtype. Does not check to see
     // whether the object is of the specific subtype.
     template <class T>
@@ -294,12 +339,102 @@ struct Program
     // typeVector's subtype.
     uint32_t scalarize(uint32_t vreg, int i, const TypeVector *typeVector);
 
+    // Text label that names the block in a block profile.
+    static std::string profileLabel(const Block *block);
+
+    // Text label that names the shader in a block profile.
+    std::string profileShaderLabel() const;
+
+    // Read the block profile written by "emu --block-profile". Only the
+    // labels from profileLabel() are used. Fails the program if the profile
+    // is from another shader.
+    void loadBlockProfile(const std::string &pathname);
+
+    // Number of times the block ran in the profile, or zero if it's not in
+    // the profile.
+    uint64_t blockCount(const Block *block) const;
+
+    // Whether the profile says the block never ran.
+    bool isColdBlock(const Block *block) const;
+
+    // Whether the profile says the block ran at least a tenth as often as
+    // the most frequent block.
+    bool isHotBlock(const Block *block) const;
+
+    // Inline calls to small functions, and to functions only called once.
+    // With a profile, larger functions are inlined into hot blocks.
+    // Prints a report of what was inlined.
+    void inlineFunctions();
+
+    // Replace the call instruction with a copy of the body of the function
+    // it calls. The code after the call is moved to a new block.
+    void inlineCall(Function *caller, std::shared_ptr<Instruction> call);
+
+    // Unroll innermost loops that run a constant number of times. Small
+    // loops are unrolled completely, larger ones by a factor that keeps
+    // the code size bounded. With a profile, loops that never ran are left
+    // alone and hot ones get a larger size bound. Prints a report of what
+    // was unrolled.
+    void unrollLoops();
+
+    // Try to unroll the loop made of the specified blocks, whose back edge
+    // goes from the latch to the header. Returns whether it was unrolled.
+    // If the loop was only partially unrolled, remainingHeaderId is set to
+    // the header of the loop that's left, otherwise to NO_BLOCK_ID.
+    bool unrollLoop(Function *function, uint32_t headerId, uint32_t latchId,
+            const std::set<uint32_t> &loopBlockIds, uint32_t &remainingHeaderId);
+
+    // Expand small builtins (dot, length, clamp, etc.) into scalar
+    // instructions instead of library calls, as long as the code growth
+    // stays within a per-function budget. Prints a report of what was
+    // expanded. Must be called after expandVectors().
+    void expandBuiltins();
+
+    // Replace the builtin instruction with its scalar expansion.
+    void expandBuiltin(std::shared_ptr<Instruction> inst);
+
+    // Return the ID of a constant with this float value, making one if
+    // necessary.
+    uint32_t floatConstant(uint32_t type, float value);
+
+    // Reorder the instructions of each block to reduce register pressure or,
+    // with scheduleForLatency, to hide the latency of the shader core's
+    // floating point unit. Sets unscheduledCycles and scheduledCycles.
+    void scheduleInstructions();
+
+    // Number of cycles before the results of the instruction can be used,
+    // from cycleTable.
+    int instructionLatency(const Instruction *inst) const;
+
+    // List-schedule the block. The useCount map has the number of unscheduled
+    // uses of each register and is updated. The block's estimated cycles
+    // before and after are added to cyclesBefore and cyclesAfter.
+    void scheduleBlock(Block *block, std::map<uint32_t,int> &useCount,
+            int &cyclesBefore, int &cyclesAfter);
+
+    // Move instructions whose results only depend on uniforms and constants
+    // out of the functions' blocks and into uniformPrologue.
+    void hoistUniformExpressions();
+
+    // Put the uniform prologue into its own function for the compiler. Its
+    // results are passed to the per-pixel functions through variables.
+    void createUniformPrologueFunction();
+
     // Replace the SPIR-V Phi instructions with ours.
     void replacePhi();
     void replacePhiInFunction(Function *function);
     void replacePhiInBlock(Block *block);
 
-    // Transform vector instructions to scalar instructions.
+    // Find which components of each vector register are used, so that
+    // expandVectors() only computes those.
+    void computeDemandedComponents();
+
+    // Whether component i of the register is used. Registers that
+    // computeDemandedComponents() didn't see are assumed to be all used.
+    bool isComponentDemanded(uint32_t regId, int i) const;
+
+    // Transform vector instructions to scalar instructions, skipping
+    // components that are never used. Prints how many were skipped.
     void expandVectors();
     void expandVectorsInFunction(Function *function);
     void expandVectorsInBlockTree(Block *block);
@@ -315,6 +450,10 @@ struct Program
         const TypeVector *typeVector = getTypeAsVector(typeIdOf(insn->resultId()));
         if (typeVector != nullptr) {
             for (uint32_t i = 0; i < typeVector->count; i++) {
+                if (!isComponentDemanded(insn->resultId(), i)) {
+                    skippedComponentCount++;
+                    continue;
+                }
                 auto [subtype, offset] = getConstituentInfo(insn->type, i);
                 newList.push_back(std::make_shared<T>(insn->lineInfo,
                             subtype,
@@ -337,6 +476,10 @@ struct Program
             uint32_t arg1Subtype = typeVector1->type;
 
             for (uint32_t i = 0; i < typeVector->count; i++) {
+                if (!isComponentDemanded(insn->resultId(), i)) {
+                    skippedComponentCount++;
+                    continue;
+                }
                 auto [subtype, offset] = getConstituentInfo(insn->type, i);
                 newList.push_back(std::make_shared<T>(insn->lineInfo,
                             subtype,
@@ -355,6 +498,10 @@ struct Program
         const TypeVector *typeVector = getTypeAsVector(typeIdOf(insn->resultId()));
         if (typeVector != nullptr) {
             for (uint32_t i = 0; i < typeVector->count; i++) {
+                if (!isComponentDemanded(insn->resultId(), i)) {
+                    skippedComponentCount++;
+                    continue;
+                }
                 auto [subtype, offset] = getConstituentInfo(insn->type, i);
                 newList.push_back(std::make_shared<T>(insn->lineInfo,
                             subtype,
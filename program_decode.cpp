@@ -6,6 +6,12 @@ spv_result_t Program::handleInstruction(void* user_data, const spv_parsed_instru
 {
     auto pgm = static_cast<Program*>(user_data);
 
+    // FNV-1a of the words, so that a block profile can be checked against
+    // the shader that it came from.
+    for (uint16_t i = 0; i < insn->num_words; i++) {
+        pgm->sourceHash = (pgm->sourceHash ^ insn->words[i])*1099511628211ull;
+    }
+
     auto opds = insn->operands;
 
     int which = 0;
@@ -547,6 +553,7 @@ spv_result_t Program::handleInstruction(void* user_data, const spv_parsed_instru
 
             // Make new block for this label.
             std::shared_ptr<Block> block = std::make_shared<Block>(id, pgm->currentFunction.get());
+            block->profileKey = "b" + std::to_string(id);
             pgm->currentFunction->blocks[id] = block;
 
             // The first label we run into after a function definition is its start block.
@@ -4,6 +4,7 @@
 // Instructions that map to the RISC-V ISA.
 
 #include "basic_types.h"
+#include "GLSL.std.450.h"
 
 enum {
     RiscVOpAddi = 16384, // XXX not sure what's a safe number to start with.
@@ -20,6 +21,7 @@ enum {
     RiscVOpAny,
     RiscVOpDistance,
     RiscVOpPhi,
+    RiscVOpFmadd,
 };
 
 // "addi" instruction.
@@ -35,6 +37,7 @@ struct RiscVAddi : public Instruction {
     virtual void step(Interpreter *interpreter) { assert(false); }
     virtual uint32_t opcode() const { return RiscVOpAddi; }
     virtual std::string name() const { return "addi"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<RiscVAddi>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -52,6 +55,7 @@ struct RiscVLoad : public Instruction {
     virtual void step(Interpreter *interpreter) { assert(false); }
     virtual uint32_t opcode() const { return RiscVOpLoad; }
     virtual std::string name() const { return "load"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<RiscVLoad>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -67,6 +71,7 @@ struct RiscVLoadConst : public Instruction {
     virtual void step(Interpreter *interpreter) { assert(false); }
     virtual uint32_t opcode() const { return RiscVOpLoadConst; }
     virtual std::string name() const { return "loadconst"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<RiscVLoadConst>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -83,6 +88,7 @@ struct RiscVStore : public Instruction {
     virtual void step(Interpreter *interpreter) { assert(false); }
     virtual uint32_t opcode() const { return RiscVOpStore; }
     virtual std::string name() const { return "store"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<RiscVStore>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -121,6 +127,7 @@ struct RiscVCross : public Instruction {
     virtual void step(Interpreter *interpreter) { assert(false); }
     virtual uint32_t opcode() const { return RiscVOpCross; }
     virtual std::string name() const { return "cross"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<RiscVCross>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -137,6 +144,7 @@ struct RiscVLength : public Instruction {
     virtual void step(Interpreter *interpreter) { assert(false); }
     virtual uint32_t opcode() const { return RiscVOpLength; }
     virtual std::string name() const { return "length"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<RiscVLength>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -154,6 +162,7 @@ struct RiscVReflect : public Instruction {
     virtual void step(Interpreter *interpreter) { assert(false); }
     virtual uint32_t opcode() const { return RiscVOpReflect; }
     virtual std::string name() const { return "reflect"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<RiscVReflect>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -171,6 +180,7 @@ struct RiscVNormalize : public Instruction {
     virtual void step(Interpreter *interpreter) { assert(false); }
     virtual uint32_t opcode() const { return RiscVOpNormalize; }
     virtual std::string name() const { return "normalize"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<RiscVNormalize>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -190,6 +200,7 @@ struct RiscVDot : public Instruction {
     virtual void step(Interpreter *interpreter) { assert(false); }
     virtual uint32_t opcode() const { return RiscVOpDot; }
     virtual std::string name() const { return "dot"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<RiscVDot>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -206,6 +217,7 @@ struct RiscVAll : public Instruction {
     virtual void step(Interpreter *interpreter) { assert(false); }
     virtual uint32_t opcode() const { return RiscVOpAll; }
     virtual std::string name() const { return "all"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<RiscVAll>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -222,6 +234,7 @@ struct RiscVAny : public Instruction {
     virtual void step(Interpreter *interpreter) { assert(false); }
     virtual uint32_t opcode() const { return RiscVOpAny; }
     virtual std::string name() const { return "any"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<RiscVAny>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -241,6 +254,33 @@ struct RiscVDistance : public Instruction {
     virtual void step(Interpreter *interpreter) { assert(false); }
     virtual uint32_t opcode() const { return RiscVOpDistance; }
     virtual std::string name() const { return "distance"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<RiscVDistance>(); }
+    virtual void emit(Compiler *compiler);
+};
+
+// Whether the target core implements fmadd.s. The emulator does, but the
+// ShaderCore RTL only decodes it, so by default we don't generate it.
+#ifndef RISCV_HAVE_FMADD
+#define RISCV_HAVE_FMADD 0
+#endif
+
+// Fused multiply-add instruction: rs1*rs2 + rs3, with a single rounding.
+struct RiscVFmadd : public Instruction {
+    RiscVFmadd(const LineInfo& lineInfo, uint32_t type, uint32_t resultId, uint32_t rs1, uint32_t rs2, uint32_t rs3) : Instruction(lineInfo), type(type) {
+        addResult(resultId);
+        addParameter(rs1);
+        addParameter(rs2);
+        addParameter(rs3);
+    }
+    uint32_t type; // result type
+    uint32_t resultId() const { return resIdList[0]; } // SSA register for result value
+    uint32_t rs1() const { return argIdList[0]; } // multiplicand
+    uint32_t rs2() const { return argIdList[1]; } // multiplier
+    uint32_t rs3() const { return argIdList[2]; } // addend
+    virtual void step(Interpreter *interpreter) { assert(false); }
+    virtual uint32_t opcode() const { return RiscVOpFmadd; }
+    virtual std::string name() const { return "fmadd"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<RiscVFmadd>(); }
     virtual void emit(Compiler *compiler);
 };
 
@@ -256,6 +296,7 @@ struct RiscVPhi : public Instruction {
     virtual void step(Interpreter *interpreter) { assert(false); }
     virtual uint32_t opcode() const { return RiscVOpPhi; }
     virtual std::string name() const { return "phi"; }
+    virtual std::shared_ptr<Instruction> clone() const { return cloneAs<RiscVPhi>(); }
     virtual void emit(Compiler *compiler);
 
     // Return the label index for the specified source block ID, or -1 if not found.
@@ -282,6 +323,40 @@ struct RiscVPhi : public Instruction {
     }
 };
 
+// Whether the instruction with this opcode is compiled to a call to a
+// library routine, which clobbers the argument registers.
+inline bool isLibraryCall(uint32_t opcode) {
+    switch (opcode) {
+        case SpvOpFMod:
+        case 0x10000 | GLSLstd450Sin:
+        case 0x10000 | GLSLstd450Cos:
+        case 0x10000 | GLSLstd450Atan2:
+        case 0x10000 | GLSLstd450Exp:
+        case 0x10000 | GLSLstd450Exp2:
+        case 0x10000 | GLSLstd450Fract:
+        case 0x10000 | GLSLstd450Floor:
+        case 0x10000 | GLSLstd450Step:
+        case 0x10000 | GLSLstd450Pow:
+        case 0x10000 | GLSLstd450Log:
+        case 0x10000 | GLSLstd450Log2:
+        case 0x10000 | GLSLstd450FClamp:
+        case 0x10000 | GLSLstd450FMix:
+        case 0x10000 | GLSLstd450SmoothStep:
+        case RiscVOpCross:
+        case RiscVOpLength:
+        case RiscVOpReflect:
+        case RiscVOpNormalize:
+        case RiscVOpDot:
+        case RiscVOpAll:
+        case RiscVOpAny:
+        case RiscVOpDistance:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
 // The following constant loaded into SP depends on the RAM
 // allocated per-core in hardware.
 const uint32_t RiscVInitialStackPointer = 0x10000;
@@ -36,6 +36,7 @@
 #include "shadertoy.h"
 #include "timer.h"
 #include "compiler.h"
+#include "heatmap.h"
 
 #define DEFAULT_WIDTH (640/2)
 #define DEFAULT_HEIGHT (360/2)
@@ -47,6 +48,10 @@
 
 static const char *DEFAULT_ASSEMBLY_PATHNAME = "out.s";
 
+// Shader core clock and number of cores for the compile report's frame rate.
+static const double DEFAULT_CLOCK_MHZ = 50;
+static const int DEFAULT_CORE_COUNT = 1;
+
 // -----------------------------------------------------------------------------------
 
 void RiscVPhi::emit(Compiler *compiler)
@@ -87,18 +92,11 @@ void RiscVLoad::emit(Compiler *compiler)
 
 void RiscVLoadConst::emit(Compiler *compiler)
 {
-    std::ostringstream ss;
     std::ostringstream ssc;
-
-    if (compiler->isRegFloat(resultId())) {
-        ss << "flw ";
-    } else {
-        ss << "lw ";
-    }
-    ss << compiler->reg(resultId()) << ", " << ".C" << constId << "(x0)";
     ssc << "r" << resultId() << " = constant r" << constId;
 
-    compiler->emit(ss.str(), ssc.str());
+    compiler->emitLoadConstant(compiler->physicalRegisterFor(resultId(), true), constId,
+            compiler->findScratchRegister(this), ssc.str());
 }
 
 void RiscVStore::emit(Compiler *compiler)
@@ -126,31 +124,21 @@ void RiscVStore::emit(Compiler *compiler)
     compiler->emit(ss1.str(), ss2.str());
 }
 
-void RiscVCross::emit(Compiler *compiler)
+void RiscVFmadd::emit(Compiler *compiler)
 {
-    compiler->emit("addi sp, sp, -28", "Make room on stack");
-    compiler->emit("sw ra, 24(sp)", "Save return address");
-
-    for (int i = argIdList.size() - 1; i >= 0; i--) {
-        std::ostringstream ss;
-        ss << "fsw " << compiler->reg(argIdList[i]) << ", " << (i*4) << "(sp)";
-        std::ostringstream ssc;
-        ssc << "Push parameter r" << argIdList[i];
-        compiler->emit(ss.str(), ssc.str());
-    }
-
-    compiler->emit("jal ra, .cross", "Call routine");
-
-    for (size_t i = 0; i < resIdList.size(); i++) {
-        std::ostringstream ss;
-        ss << "flw " << compiler->reg(resIdList[i]) << ", " << (i*4) << "(sp)";
-        std::ostringstream ssc;
-        ssc << "Pop result r" << resIdList[i];
-        compiler->emit(ss.str(), ssc.str());
-    }
+    std::ostringstream ss1;
+    ss1 << "fmadd.s " << compiler->reg(resultId())
+        << ", " << compiler->reg(rs1())
+        << ", " << compiler->reg(rs2())
+        << ", " << compiler->reg(rs3());
+    std::ostringstream ss2;
+    ss2 << "r" << resultId() << " = r" << rs1() << "*r" << rs2() << " + r" << rs3();
+    compiler->emit(ss1.str(), ss2.str());
+}
 
-    compiler->emit("lw ra, 12(sp)", "Restore return address");
-    compiler->emit("addi sp, sp, 16", "Restore stack");
+void RiscVCross::emit(Compiler *compiler)
+{
+    compiler->emitCall(".cross", resIdList, argIdList);
 }
 
 void RiscVLength::emit(Compiler *compiler)
@@ -269,12 +257,16 @@ void InsnFNegate::emit(Compiler *compiler)
 
 void InsnIAdd::emit(Compiler *compiler)
 {
+    // Use addi if either side is a constant that fits in its 12 bits.
+    auto isImmediate = [compiler](uint32_t id, uint32_t &value) {
+        return compiler->asIntegerConstant(id, value) &&
+            int32_t(value) >= -2048 && int32_t(value) <= 2047;
+    };
+
     uint32_t intValue;
-    if (compiler->asIntegerConstant(operand1Id(), intValue)) {
-        // XXX Verify that immediate fits in 12 bits.
+    if (isImmediate(operand1Id(), intValue)) {
         compiler->emitBinaryImmOp("addi", resultId(), operand2Id(), intValue);
-    } else if (compiler->asIntegerConstant(operand2Id(), intValue)) {
-        // XXX Verify that immediate fits in 12 bits.
+    } else if (isImmediate(operand2Id(), intValue)) {
         compiler->emitBinaryImmOp("addi", resultId(), operand1Id(), intValue);
     } else {
         compiler->emitBinaryOp("add", resultId(), operand1Id(), operand2Id());
@@ -394,14 +386,12 @@ void InsnBranch::emit(Compiler *compiler)
     // See if we need to emit any copies for Phis at our target.
     compiler->emitPhiCopy(this, targetLabelId);
 
-    std::ostringstream ss;
-    ss << "jal x0, block" << targetLabelId;
-    compiler->emit(ss.str(), "");
+    compiler->emitJump(targetLabelId);
 }
 
 void InsnReturn::emit(Compiler *compiler)
 {
-    compiler->emit("jalr x0, ra, 0", "");
+    compiler->emitReturn();
 }
 
 void InsnReturnValue::emit(Compiler *compiler)
@@ -411,7 +401,7 @@ void InsnReturnValue::emit(Compiler *compiler)
     std::ostringstream ss2;
     ss2 << "return " << valueId();
     compiler->emit(ss1.str(), ss2.str());
-    compiler->emit("jalr x0, ra, 0", "");
+    compiler->emitReturn();
 }
 
 void InsnPhi::emit(Compiler *compiler)
@@ -456,25 +446,47 @@ void InsnFOrdGreaterThan::emit(Compiler *compiler)
 
 void InsnBranchConditional::emit(Compiler *compiler)
 {
-    std::string localLabel = compiler->makeLocalLabel();
+    // Both ways go to the same place, so it's just a jump.
+    if (trueLabelId == falseLabelId) {
+        compiler->emitPhiCopy(this, trueLabelId);
+        compiler->emitJump(trueLabelId);
+        return;
+    }
+
+    // Handle the path to the next block last so that it can fall through.
+    bool trueIsLast = compiler->fallThroughBlockId == trueLabelId;
+    uint32_t firstLabelId = trueIsLast ? falseLabelId : trueLabelId;
+    uint32_t lastLabelId = trueIsLast ? trueLabelId : falseLabelId;
 
-    std::ostringstream ss1;
-    ss1 << "beq " << compiler->reg(conditionId())
-        << ", x0, " << localLabel;
     std::ostringstream ssid;
     ssid << "r" << conditionId();
-    compiler->emit(ss1.str(), ssid.str());
-    // True path.
-    compiler->emitPhiCopy(this, trueLabelId);
-    std::ostringstream ss2;
-    ss2 << "jal x0, block" << trueLabelId;
-    compiler->emit(ss2.str(), "");
-    // False path.
-    compiler->emitLabel(localLabel);
-    compiler->emitPhiCopy(this, falseLabelId);
-    std::ostringstream ss3;
-    ss3 << "jal x0, block" << falseLabelId;
-    compiler->emit(ss3.str(), "");
+
+    if (!compiler->needsPhiCopy(this, firstLabelId) &&
+            compiler->isBranchInRange(blockId(), firstLabelId)) {
+
+        // Branch straight to the first path's block.
+        compiler->emitPhiCopy(this, firstLabelId);
+        std::ostringstream ss1;
+        ss1 << (trueIsLast ? "beq " : "bne ") << compiler->reg(conditionId())
+            << ", x0, block" << firstLabelId;
+        compiler->emit(ss1.str(), ssid.str());
+        compiler->removedJumpCount++;
+    } else {
+        // Skip over the first path's copies and jump.
+        std::string localLabel = compiler->makeLocalLabel();
+        std::ostringstream ss1;
+        ss1 << (trueIsLast ? "bne " : "beq ") << compiler->reg(conditionId())
+            << ", x0, " << localLabel;
+        compiler->emit(ss1.str(), ssid.str());
+        compiler->emitPhiCopy(this, firstLabelId);
+        std::ostringstream ss2;
+        ss2 << "jal x0, block" << firstLabelId;
+        compiler->emit(ss2.str(), "");
+        compiler->emitLabel(localLabel);
+    }
+
+    compiler->emitPhiCopy(this, lastLabelId);
+    compiler->emitJump(lastLabelId);
 }
 
 void InsnAccessChain::emit(Compiler *compiler)
@@ -560,6 +572,7 @@ void InsnCopyObject::emit(Compiler *compiler)
     const CompilerRegister *r2 = compiler->asRegister(operandId());
     assert(r1 != nullptr);
     assert(r2 != nullptr);
+    compiler->recordCopy(r1->phy, r2->phy);
 
     std::ostringstream ss1;
     if (r1->phy != r2->phy) {
@@ -736,9 +749,22 @@ void usage(const char* progname)
     printf("\t-n        Compile and load shader, but do not shade an image\n");
     printf("\t-S        show the disassembly of the SPIR-V code\n");
     printf("\t-c        compile to our own ISA\n");
+    printf("\t--no-inline  don't inline small shader functions\n");
+    printf("\t--no-unroll  don't unroll loops with constant trip counts\n");
     printf("\t--json    input file is a ShaderToy JSON file\n");
     printf("\t--term    draw output image on terminal (in addition to file)\n");
-    printf("\t-o out.s  output assembly pathname [%s]\n", DEFAULT_ASSEMBLY_PATHNAME);
+    printf("\t--heatmap also write the instructions run for each pixel to heatNNNN.ppm\n");
+    printf("\t          and each row's total to heatNNNN.txt\n");
+    printf("\t-o out.s  output assembly pathname, or object file if it ends in .o [%s]\n",
+            DEFAULT_ASSEMBLY_PATHNAME);
+    printf("\t-l out.s  also write assembly listing when writing an object file\n");
+    printf("\t-p prof   guide optimization with block counts from \"emu --block-profile\"\n");
+    printf("\t-r        print a report of the compiled code and its estimated speed\n");
+    printf("\t--cycles FILE  read \"mnemonic cycles\" lines for the report and scheduler\n");
+    printf("\t--clock MHZ    core clock for the report [%g]\n", DEFAULT_CLOCK_MHZ);
+    printf("\t--cores N      number of cores for the report [%d]\n", DEFAULT_CORE_COUNT);
+    printf("\t--schedule-latency  schedule to hide floating point latency instead of\n");
+    printf("\t               to reduce register pressure\n");
 }
 
 const std::string shaderPreambleFilename = "preamble.frag";
@@ -747,10 +773,9 @@ const std::string shaderEpilogueFilename = "epilogue.frag";
 // Number of rows still left to shade (for progress report).
 static std::atomic_int rowsLeft;
 
-// Render rows starting at "startRow" every "skip".
-void render(ShaderToyRenderPass* pass, int startRow, int skip, int frameNumber, float when)
+// Set the ShaderToy uniforms for this frame.
+void setUniforms(Interpreter &interpreter, ShaderToyRenderPass* pass, int frameNumber, float when)
 {
-    Interpreter interpreter(&pass->pgm);
     ImagePtr output = pass->outputs[0].sampledImage.image;
 
     interpreter.set("iResolution", v3float {static_cast<float>(output->width), static_cast<float>(output->height), 1.0f});
@@ -771,6 +796,20 @@ void render(ShaderToyRenderPass* pass, int startRow, int skip, int frameNumber,
         float h = static_cast<float>(image->height);
         interpreter.set("iChannelResolution[" + std::to_string(input.channelNumber) + "]", v3float{w, h, 0});
     }
+}
+
+// Render rows starting at "startRow" every "skip". The "uniforms" interpreter
+// has already run the pass's uniform prologue for this frame. If
+// "instructionCounts" isn't null, the number of instructions each pixel took
+// is put there, in the order of the image file.
+void render(ShaderToyRenderPass* pass, const Interpreter* uniforms, int startRow, int skip, int frameNumber, float when,
+        std::vector<uint64_t>* instructionCounts)
+{
+    Interpreter interpreter(&pass->pgm);
+    ImagePtr output = pass->outputs[0].sampledImage.image;
+
+    setUniforms(interpreter, pass, frameNumber, when);
+    interpreter.copyUniformResults(*uniforms);
 
     // This loop acts like a rasterizer fixed function block.  Maybe it should
     // set inputs and read outputs also.
@@ -778,8 +817,13 @@ void render(ShaderToyRenderPass* pass, int startRow, int skip, int frameNumber,
         for(uint32_t x = 0; x < output->width; x++) {
             v4float color;
             output->get(x, output->height - 1 - y, color);
+            uint64_t before = interpreter.instructionCount;
             eval(interpreter, x + 0.5f, y + 0.5f, color);
             output->set(x, output->height - 1 - y, color);
+            if(instructionCounts != nullptr) {
+                (*instructionCounts)[(output->height - 1 - y)*output->width + x] =
+                    interpreter.instructionCount - before;
+            }
         }
 
         rowsLeft--;
@@ -970,6 +1014,7 @@ std::string base64Encode(const std::string &in) {
     return out;
 }
 
+#ifndef SHADE_NO_MAIN
 int main(int argc, char **argv)
 {
     bool debug = false;
@@ -979,10 +1024,20 @@ int main(int argc, char **argv)
     bool inputIsJSON = false;
     bool imageToTerminal = false;
     bool compile = false;
+    bool heatmap = false;
+    bool inlineFunctions = true;
+    bool unrollLoops = true;
     int threadCount = std::thread::hardware_concurrency();
     int frameStart = 0, frameEnd = 0;
     CommandLineParameters params;
     std::string outputAssemblyPathname = DEFAULT_ASSEMBLY_PATHNAME;
+    std::string listingPathname;
+    std::string blockProfilePathname;
+    bool printReport = false;
+    std::string cycleTablePathname;
+    bool scheduleForLatency = false;
+    double clockMhz = DEFAULT_CLOCK_MHZ;
+    int coreCount = DEFAULT_CORE_COUNT;
 
     params.outputWidth = DEFAULT_WIDTH;
     params.outputHeight = DEFAULT_HEIGHT;
@@ -1010,6 +1065,21 @@ int main(int argc, char **argv)
             imageToTerminal = true;
             argv++; argc--;
 
+        } else if(strcmp(argv[0], "--heatmap") == 0) {
+
+            heatmap = true;
+            argv++; argc--;
+
+        } else if(strcmp(argv[0], "--no-inline") == 0) {
+
+            inlineFunctions = false;
+            argv++; argc--;
+
+        } else if(strcmp(argv[0], "--no-unroll") == 0) {
+
+            unrollLoops = false;
+            argv++; argc--;
+
         } else if(strcmp(argv[0], "-S") == 0) {
 
             disassemble = true;
@@ -1053,6 +1123,24 @@ int main(int argc, char **argv)
             outputAssemblyPathname = argv[1];
             argv += 2; argc -= 2;
 
+        } else if(strcmp(argv[0], "-l") == 0) {
+
+            if(argc < 2) {
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            listingPathname = argv[1];
+            argv += 2; argc -= 2;
+
+        } else if(strcmp(argv[0], "-p") == 0) {
+
+            if(argc < 2) {
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            blockProfilePathname = argv[1];
+            argv += 2; argc -= 2;
+
         } else if(strcmp(argv[0], "-v") == 0) {
 
             params.beVerbose = true;
@@ -1078,6 +1166,43 @@ int main(int argc, char **argv)
             compile = true;
             argv++; argc--;
 
+        } else if(strcmp(argv[0], "-r") == 0) {
+
+            printReport = true;
+            argv++; argc--;
+
+        } else if(strcmp(argv[0], "--cycles") == 0) {
+
+            if(argc < 2) {
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            cycleTablePathname = argv[1];
+            argv += 2; argc -= 2;
+
+        } else if(strcmp(argv[0], "--schedule-latency") == 0) {
+
+            scheduleForLatency = true;
+            argv++; argc--;
+
+        } else if(strcmp(argv[0], "--clock") == 0) {
+
+            if(argc < 2) {
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            clockMhz = atof(argv[1]);
+            argv += 2; argc -= 2;
+
+        } else if(strcmp(argv[0], "--cores") == 0) {
+
+            if(argc < 2) {
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            coreCount = atoi(argv[1]);
+            argv += 2; argc -= 2;
+
         } else if(strcmp(argv[0], "-h") == 0) {
 
             usage(progname);
@@ -1146,10 +1271,30 @@ int main(int argc, char **argv)
             exit(EXIT_FAILURE);
         }
 
+        if (!blockProfilePathname.empty()) {
+            pass->pgm.loadBlockProfile(blockProfilePathname);
+        }
+
+        // Get rid of call and loop overhead.
+        if (inlineFunctions) {
+            pass->pgm.inlineFunctions();
+        }
+        if (unrollLoops) {
+            pass->pgm.unrollLoops();
+        }
+
         if (compile) {
+            if (!cycleTablePathname.empty()) {
+                loadCycleTable(cycleTablePathname, pass->pgm.cycleTable);
+            }
+            pass->pgm.scheduleForLatency = scheduleForLatency;
             pass->pgm.prepareForCompile();
-            Compiler compiler(&pass->pgm, outputAssemblyPathname);
+            Compiler compiler(&pass->pgm, outputAssemblyPathname, listingPathname);
             compiler.compile();
+            if (printReport) {
+                compiler.printReport(clockMhz, coreCount,
+                        params.outputWidth, params.outputHeight);
+            }
             exit(EXIT_SUCCESS);
         }
 
@@ -1157,6 +1302,9 @@ int main(int argc, char **argv)
             exit(EXIT_SUCCESS);
         }
 
+        // Compute per-frame expressions once instead of for every pixel.
+        pass->pgm.hoistUniformExpressions();
+
         for(size_t i = 0; i < pass->inputs.size(); i++) {
             auto& toyImage = pass->inputs[i];
             pass->pgm.sampledImages[i] = toyImage.sampledImage;
@@ -1166,6 +1314,9 @@ int main(int argc, char **argv)
     std::cout << "Using " << threadCount << " threads.\n";
 
     for(int frameNumber = frameStart; frameNumber <= frameEnd; frameNumber++) {
+        // Heatmap of the last pass, the one that makes the image.
+        std::vector<uint64_t> instructionCounts;
+
         for(auto& pass: renderPasses) {
 
             Timer timer;
@@ -1176,11 +1327,24 @@ int main(int argc, char **argv)
             // Workers decrement rowsLeft at the end of each row.
             rowsLeft = image->height;
 
+            // Evaluate the expressions that only depend on uniforms once
+            // for all threads.
+            Interpreter uniforms(&pass->pgm);
+            setUniforms(uniforms, pass.get(), frameNumber, frameNumber / 60.0);
+            uniforms.runUniformPrologue();
+
             std::vector<std::thread *> thread;
 
+            std::vector<uint64_t>* passInstructionCounts = nullptr;
+            if(heatmap && pass == renderPasses.back()) {
+                instructionCounts.resize(image->width*image->height);
+                passInstructionCounts = &instructionCounts;
+            }
+
             // Generate the rows on multiple threads.
             for (int t = 0; t < threadCount; t++) {
-                thread.push_back(new std::thread(render, pass.get(), t, threadCount, frameNumber, frameNumber / 60.0));
+                thread.push_back(new std::thread(render, pass.get(), &uniforms, t, threadCount, frameNumber, frameNumber / 60.0,
+                            passInstructionCounts));
                 // std::this_thread::sleep_for(std::chrono::milliseconds(100)); XXX delete
             }
 
@@ -1219,6 +1383,13 @@ int main(int argc, char **argv)
         image->writePpm(imageFile);
         imageFile.close();
 
+        if (heatmap) {
+            std::ostringstream ss;
+            ss << "heat" << std::setfill('0') << std::setw(4) << frameNumber;
+            writeHeatmap(instructionCounts, image->width, image->height, "instructions",
+                    ss.str() + ".ppm", ss.str() + ".txt");
+        }
+
         if (imageToTerminal) {
             // https://www.iterm2.com/documentation-images.html
             std::ostringstream ss;
@@ -1232,3 +1403,4 @@ int main(int argc, char **argv)
 
     exit(EXIT_SUCCESS);
 }
+#endif // SHADE_NO_MAIN
@@ -0,0 +1,120 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+
+// Latencies of the shader core's floating point units, in cycles. These
+// mirror the FP_*_LATENCY localparams in gpu/shadercore/ShaderCore.v and
+// are selected by the same ALTERA_* defines.
+#ifdef ALTERA_FP_MULTIPLY
+static const int FP_MULTIPLY_LATENCY = 11;
+#else
+static const int FP_MULTIPLY_LATENCY = 4;
+#endif
+#ifdef ALTERA_FP_DIVIDE
+static const int FP_DIVIDE_LATENCY = 14;
+#else
+static const int FP_DIVIDE_LATENCY = 4;
+#endif
+#ifdef ALTERA_FP_ADD_SUB
+static const int FP_ADD_SUB_LATENCY = 14;
+#else
+static const int FP_ADD_SUB_LATENCY = 4;
+#endif
+#ifdef ALTERA_INT_TO_FLOAT
+static const int FP_INT_TO_FLOAT_LATENCY = 6;
+#else
+static const int FP_INT_TO_FLOAT_LATENCY = 4;
+#endif
+static const int FP_FLOAT_TO_INT_LATENCY = 6;
+static const int FP_SQRT_LATENCY = 28;
+
+// The core runs one instruction at a time through STATE_FETCH,
+// STATE_FETCH2, STATE_DECODE, STATE_EXECUTE, and STATE_RETIRE.
+static const int BASE_INSTRUCTION_CYCLES = 5;
+
+// Loads add STATE_LOAD and STATE_LOAD2, and stores to the internal data
+// RAM add STATE_STORE.
+static const int LOAD_EXTRA_CYCLES = 2;
+static const int STORE_EXTRA_CYCLES = 1;
+
+// Stores with the high address bit set go to SDRAM instead, through
+// STATE_STORE_REQUEST until the memory arbiter lets the core have the
+// controller and STATE_STORE_STALL until the controller takes the write.
+// Each is at least a cycle; other cores' writes make it longer.
+static const int SDRAM_STORE_EXTRA_CYCLES = 2;
+
+// Cycles for a library routine that isn't in the cycle table. It's a rough
+// guess; measure the real routines with emu and put them in the table.
+static const int DEFAULT_LIBRARY_ROUTINE_CYCLES = 200;
+
+// Estimated cycles the shader core takes to run each instruction, keyed by
+// mnemonic. Floating point instructions wait in STATE_FP_WAIT for the
+// latency of their unit. Mnemonics not in the table take
+// BASE_INSTRUCTION_CYCLES. The table can also have the names of library
+// routines, for the cycles of one call not counting the jal, and "sdram"
+// for the cycles a store to SDRAM takes over one to data RAM.
+inline std::map<std::string, int> defaultCycleTable() {
+    std::map<std::string, int> table;
+
+    for (const char *mnemonic : {"lw", "lh", "lhu", "lb", "lbu", "flw"}) {
+        table[mnemonic] = BASE_INSTRUCTION_CYCLES + LOAD_EXTRA_CYCLES;
+    }
+    for (const char *mnemonic : {"sw", "sh", "sb", "fsw"}) {
+        table[mnemonic] = BASE_INSTRUCTION_CYCLES + STORE_EXTRA_CYCLES;
+    }
+    table["sdram"] = SDRAM_STORE_EXTRA_CYCLES;
+
+    table["fadd.s"] = BASE_INSTRUCTION_CYCLES + FP_ADD_SUB_LATENCY;
+    table["fsub.s"] = BASE_INSTRUCTION_CYCLES + FP_ADD_SUB_LATENCY;
+    table["fmul.s"] = BASE_INSTRUCTION_CYCLES + FP_MULTIPLY_LATENCY;
+    table["fdiv.s"] = BASE_INSTRUCTION_CYCLES + FP_DIVIDE_LATENCY;
+    table["fsqrt.s"] = BASE_INSTRUCTION_CYCLES + FP_SQRT_LATENCY;
+    table["fmadd.s"] = BASE_INSTRUCTION_CYCLES + FP_MULTIPLY_LATENCY + FP_ADD_SUB_LATENCY;
+    table["fcvt.s.w"] = BASE_INSTRUCTION_CYCLES + FP_INT_TO_FLOAT_LATENCY;
+    table["fcvt.s.wu"] = BASE_INSTRUCTION_CYCLES + FP_INT_TO_FLOAT_LATENCY;
+
+    // The core uses the float-to-int latency for compares and min/max.
+    for (const char *mnemonic : {"fcvt.w.s", "fcvt.wu.s", "feq.s", "flt.s", "fle.s",
+            "fmin.s", "fmax.s"}) {
+
+        table[mnemonic] = BASE_INSTRUCTION_CYCLES + FP_FLOAT_TO_INT_LATENCY;
+    }
+
+    return table;
+}
+
+// Replace entries of the table with "name cycles" lines from the file.
+// Fails the program if the file can't be read.
+inline void loadCycleTable(const std::string &pathname, std::map<std::string, int> &table) {
+    std::ifstream file(pathname);
+    if (!file.good()) {
+        std::cerr << "Error: Can't open cycle table \"" << pathname << "\".\n";
+        exit(EXIT_FAILURE);
+    }
+
+    std::string name;
+    int cycles;
+    while (file >> name >> cycles) {
+        table[name] = cycles;
+    }
+    if (!file.eof()) {
+        std::cerr << "Error: Can't parse cycle table \"" << pathname << "\".\n";
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Cycles for the mnemonic or library routine in the table, or the default
+// if it's not there.
+inline int lookupCycles(const std::map<std::string, int> &table, const std::string &name,
+        int defaultCycles = BASE_INSTRUCTION_CYCLES) {
+
+    auto itr = table.find(name);
+    return itr == table.end() ? defaultCycles : itr->second;
+}
+
+#endif // TIMING_H
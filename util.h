@@ -5,6 +5,13 @@
 #include <iomanip>
 #include <iostream>
 
+// RISC-V floating point rounding modes (the "rm" field).
+const int RM_RNE = 0b000;
+const int RM_RTZ = 0b001;
+const int RM_RDN = 0b010;
+const int RM_RUP = 0b011;
+const int RM_TONEAREST_MAX = 0b100;
+
 template<typename T>
 std::string to_hex(T i) {
     std::stringstream stream;